@@ -9,6 +9,8 @@
 
 #include "ShaderProgram.h"
 #include "Camera.h"
+#include "PickingService.h"
+#include "BVH.h"
 
 class MainWindow
 {
@@ -23,6 +25,7 @@ public:
 	void FramebufferSizeCallback(int width, int height);
 	void MouseButtonCallback(int button, int action, int mods);
 	void CursorPositionCallback(double xpos, double ypos);
+	void KeyCallback(int key, int action);
 
 private:
 	// Initialize GLFW callbacks
@@ -37,8 +40,14 @@ private:
 	// Rendering interface ImGUI
 	void RenderImgui();
 	
-	// Perform selection on the object
+	// Model matrix of a spiral
+	glm::mat4 SpiralMatrix(int i) const;
+	// Perform selection on the object (GPU: the result arrives in a later frame)
 	void PerformSelection(int x, int y);
+	// Perform selection with a ray cast on the CPU (immediate)
+	void PerformRayCast(int x, int y);
+	// Segment drawn from the camera to the selected point
+	void UpdateRay(const glm::vec3& origin, const glm::vec3& point);
 
 private:
 	// settings
@@ -71,6 +80,13 @@ private:
 		GLint uColor;
 		GLint uMatrix;
 	} m_pickingShaderLocations;
+	// IDs of the spirals (picking framebuffer)
+	std::unique_ptr<ShaderProgram> m_idShader = nullptr;
+	struct {
+		GLint uProjMatrix;
+		GLint uId;
+		GLint uMatrix;
+	} m_idShaderLocations;
 
 	// Shader constant location 
 	const GLint SHADER_POSTION_LOCATION = 0;
@@ -78,6 +94,15 @@ private:
 	const GLint SHADER_COLOR_LOCATION = 2;
 
 	// Picking parameters
+	// - ID framebuffer and asynchronous readbacks
+	PickingService m_picking;
+	// - ray casts: BVH of the spiral, instanced for each spiral
+	BVH m_spiralBVH;
+	TopLevelBVH m_scene;
 	int m_selectedSpiral = -1;
 	glm::vec3 m_point = glm::vec3(0.0);
+
+	// Animation (space key): rotation of each spiral around its axis
+	bool m_animate = false;
+	float m_spinAngle = 0.0f;
 };
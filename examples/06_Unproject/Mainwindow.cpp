@@ -4,10 +4,11 @@
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 
-#include <map>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/matrix_inverse.hpp>
 
+#include <chrono>
+
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 #ifndef M_PI
 #define M_PI (3.14159)
@@ -97,6 +98,10 @@ void MainWindow::InitializeCallback() {
 		MainWindow* w = reinterpret_cast<MainWindow*>(glfwGetWindowUserPointer(window));
 		w->CursorPositionCallback(xpos, ypos);
 		});
+	glfwSetKeyCallback(m_window, [](GLFWwindow* window, int key, int, int action, int) {
+		MainWindow* w = reinterpret_cast<MainWindow*>(glfwGetWindowUserPointer(window));
+		w->KeyCallback(key, action);
+		});
 
 }
 
@@ -144,6 +149,30 @@ int MainWindow::InitializeGL()
 		return 3;
 	}
 
+	// ID shader (same vertex shader, writes the ID of the spiral)
+	bool idSuccess = true;
+	m_idShader = std::make_unique<ShaderProgram>();
+	idSuccess &= m_idShader->addShaderFromSource(GL_VERTEX_SHADER, directory + "constantColor.vert");
+	idSuccess &= m_idShader->addShaderFromSource(GL_FRAGMENT_SHADER, directory + "pickingId.frag");
+	idSuccess &= m_idShader->link();
+	if (!idSuccess) {
+		std::cerr << "Error when loading ID shader\n";
+		return 4;
+	}
+	m_idShaderLocations.uProjMatrix = m_idShader->uniformLocation("uProjMatrix");
+	m_idShaderLocations.uId = m_idShader->uniformLocation("uId");
+	m_idShaderLocations.uMatrix = m_idShader->uniformLocation("uMatrix");
+	if (m_idShaderLocations.uProjMatrix < 0 || m_idShaderLocations.uId < 0 || m_idShaderLocations.uMatrix < 0) {
+		std::cerr << "Unable to find shader location for uProjMatrix, uId or uMatrix" << std::endl;
+		return 3;
+	}
+
+	// Offscreen framebuffer of the IDs (same size as the window)
+	if (!m_picking.create(m_windowWidth, m_windowHeight)) {
+		std::cerr << "Error during picking framebuffer creation\n";
+		return 5;
+	}
+
 	// Create our VertexArrays Objects and VertexBuffer Objects
 	glGenVertexArrays(NumVAOs, m_VAOs);
 	glGenBuffers(NumBuffers, m_buffers);
@@ -185,14 +214,7 @@ void MainWindow::RenderScene()
 	for (int i = 0; i < NbSpirals; ++i)
 	{
 
-		glm::mat4 currentTransformation = m_camera.viewMatrix();
-		currentTransformation = glm::translate(currentTransformation,
-			// Translation vector
-			// based on spherical coordinates
-			glm::vec3(cos(2.0f * i * float(M_PI) / static_cast<float>(NbSpirals)), 
-					  sin(2.0f * i * float(M_PI) / static_cast<float>(NbSpirals)), 
-				  	  0.0)
-		);
+		glm::mat4 currentTransformation = m_camera.viewMatrix() * SpiralMatrix(i);
 
 		// Draw selected spiral differently
 		bool isSelected = (m_selectedSpiral == i);
@@ -244,6 +266,19 @@ int MainWindow::RenderLoop()
 			glfwSetWindowShouldClose(m_window, true);
 		m_camera.keybordEvents(m_window, delta_time);
 
+		// Spin the spirals: only the matrices of the instances change,
+		// the tree of the ray casts is refit
+		if (m_animate) {
+			m_spinAngle += delta_time;
+			for (int i = 0; i < NbSpirals; ++i) {
+				m_scene.setTransform(uint32_t(i), SpiralMatrix(i));
+			}
+			m_scene.update();
+		}
+
+		// Selections read back by the GPU since the last frame
+		m_picking.poll();
+
 		RenderScene();
 
 		// Show rendering and get events
@@ -252,6 +287,7 @@ int MainWindow::RenderLoop()
 	}
 
 	// Cleanup
+	m_picking.destroy();
 	glfwDestroyWindow(m_window);
 	glfwTerminate();
 
@@ -314,6 +350,17 @@ int MainWindow::InitGeometrySpiral()
 		Normals[i * 2 + 1][2] = up;
 	}
 
+	// Same triangles on the CPU for the ray casts: the BVH of the spiral
+	// is built once (object space), each spiral is an instance of it
+	m_spiralBVH.clear();
+	m_spiralBVH.addTriangleStrip(&Vertices[0][0], 3, NbVerticesSpiral, glm::mat4(1.0f), 0);
+	m_spiralBVH.build();
+	m_scene.clear();
+	for (int i = 0; i < NbSpirals; ++i) {
+		m_scene.addInstance(m_spiralBVH, SpiralMatrix(i), uint32_t(i));
+	}
+	m_scene.build();
+
 	// Transfer our vertices to the graphic card memory (in our VBO)
 	GLsizeiptr DataSize = sizeof(Vertices) + sizeof(Colors) + sizeof(SelectedColors) + sizeof(Normals);
 	GLsizeiptr OffsetVertices = 0;
@@ -366,123 +413,124 @@ int MainWindow::InitGeometrySpiral()
 
 void MainWindow::PerformSelection(int x, int y)
 {
-	// Map (dictionnary) used to store the correspondences between colors and spiral number.
-	// This to found easily the object associated to a given color
-	struct compUVec4 {
-		bool operator()(const glm::uvec4& a, const glm::uvec4& b) const {
-			auto ia = (a.a << 24) + (a.r << 16) + (a.g << 8) + a.b;
-			auto ib = (b.a << 24) + (b.r << 16) + (b.g << 8) + b.b;
-			return ia < ib;
-		}
-	};
-	std::map<glm::uvec4, uint32_t, compUVec4> myMap;
-	// Identificator ID used as a color for rendering and as a key for the map.
 	std::cout << "Viewer::performSelection(" << x << ", " << y << ")" << std::endl;
 
-	// Selection is performed by drawing the spirals with a color that matches their ID
-	// Note: Because we are drawing outside the draw() function, the back buffer is not
-	//       swapped after this function is called.
+	// Selection is performed by drawing the spirals with their ID (uint)
+	// in the picking framebuffer: the back buffer is not touched.
+	m_picking.begin();
 
-	// Clear back buffer. Since we set a differet clear color, we save the
-	// previous value and restore it after the backbuffer has been cleared.
-	{
-		float clearColor[4];
-		glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
-		glClearColor(1, 1, 1, 1);	// This value should not match any existing index
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
-	}
-	
 	// Bind our vertex/fragment shaders
-	m_pickingShader->bind();
+	m_idShader->bind();
 
 	// Draw the spirals
 	// Note that we use dedicated VAO in this case
 	glBindVertexArray(m_VAOs[VAO_SpiralPicking]);
-	m_pickingShader->setMat4(m_pickingShaderLocations.uProjMatrix, m_camera.projectionMatrix());
+	m_idShader->setMat4(m_idShaderLocations.uProjMatrix, m_camera.projectionMatrix());
 	for (uint32_t id = 0; id < NbSpirals; ++id)
 	{
-		// Save transformations
-		glm::mat4 currentTransformation(m_camera.viewMatrix());
-
-		// Translate spiral
-		currentTransformation = glm::translate(currentTransformation,
-			glm::vec3(cos(2.0f * id * float(M_PI) / static_cast<float>(NbSpirals)),sin(2.0f * id * float(M_PI) / static_cast<float>(NbSpirals)),0.0));
-
-		// For convenience, convert the ID to a color object.
-		auto GetRGBA = [](uint32_t v) -> glm::uvec4 {
-			unsigned int blue = v & 255;
-			unsigned int green = (v >> 8) & 255;
-			unsigned int red = (v >> 16) & 255;
-			unsigned int alpha = (v >> 24) & 255;
+		// Same transformations as the rendering
+		glm::mat4 currentTransformation = m_camera.viewMatrix() * SpiralMatrix(int(id));
 
-			return glm::uvec4(red, green, blue, alpha);
-		};
-		glm::uvec4 color = GetRGBA(id);
-		myMap.insert({color, id}); 
-
-
-		// Set the color value for the shader.
-		// Need to send color where each channel is between [0, 1]
-		glm::vec4 color_float = glm::vec4(color.r / 255.0, color.g / 255.0, color.b / 255.0, color.a / 255.0) ;
-		m_pickingShader->setVec4(m_pickingShaderLocations.uColor, color_float);
+		// The ID is written as is (no conversion to a color)
+		glProgramUniform1ui(m_idShader->programId(), m_idShaderLocations.uId, id);
 
 		// Draw the spiral
-		m_pickingShader->setMat4(m_pickingShaderLocations.uMatrix, currentTransformation);
+		m_idShader->setMat4(m_idShaderLocations.uMatrix, currentTransformation);
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, NbVerticesSpiral);
 	}
 
-	// Wait until all drawing commands are done
-	glFinish();
-
-	// Read the pixel under the cursor
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	unsigned char pixelData[4];
-	glReadPixels(x, m_windowHeight - 1 - y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixelData);
-
-	std::cout << "Selected pixelData: " << int(pixelData[0]) << ", "
-		<< int(pixelData[1]) << ", "
-		<< int(pixelData[2]) << ", "
-		<< int(pixelData[3]) << std::endl;
-
-	// For convenience, construct a color object matching what was read in the frame buffer.
-	glm::uvec4 pickedColor(pixelData[0], pixelData[1], pixelData[2], pixelData[3]);
-	// Get the value matching the key.
-	auto iteratorToPair = myMap.find(pickedColor);
-	m_selectedSpiral = (iteratorToPair != myMap.end()) ? iteratorToPair->second : -1;
-	std::cout << "m_selectedSpiral: " << m_selectedSpiral << std::endl;
-
-
-	///////////////// UNPROJECT
-	// Read depth information
-	float depth = 0;
-	glReadPixels(x, m_windowHeight - 1 - y, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &depth);
-	std::cout << "Depth: " << depth << "\n";
-	if (depth < 1) {
-		// Compute intersection point
-		glm::vec3 win = glm::vec3(x, m_windowHeight - 1 - y, depth); 
-		glm::vec4 viewport(0, 0, m_windowWidth, m_windowHeight);
-		m_point = glm::unProject(win, m_camera.viewMatrix(), m_camera.projectionMatrix(), viewport);
-		std::cout << "p: " << m_point.x << " " << m_point.y << " " << m_point.z << "\n";
+	// Read the ID and the depth under the cursor without waiting for the
+	// GPU: the callback is called by m_picking.poll() once the copy is done.
+	// The camera may have moved meanwhile: unproject with the matrices of
+	// the picking pass
+	const glm::mat4 view = m_camera.viewMatrix();
+	const glm::mat4 projection = m_camera.projectionMatrix();
+	const glm::vec4 viewport(0, 0, m_windowWidth, m_windowHeight);
+	const glm::vec3 orig = m_camera.position();
+	const bool queued = m_picking.request(x, m_windowHeight - 1 - y, [this, view, projection, viewport, orig](const PickingService::Result& result) {
+		m_selectedSpiral = (result.id != PickingService::NoObject) ? int(result.id) : -1;
+		std::cout << "m_selectedSpiral: " << m_selectedSpiral << ", triangle " << result.primitive << " (" << result.frames << " frame(s) later)" << std::endl;
+
+		///////////////// UNPROJECT
+		std::cout << "Depth: " << result.depth << "\n";
+		if (result.depth < 1) {
+			// Compute intersection point
+			glm::vec3 win = glm::vec3(result.x, result.y, result.depth);
+			m_point = glm::unProject(win, view, projection, viewport);
+			std::cout << "p: " << m_point.x << " " << m_point.y << " " << m_point.z << "\n";
+			UpdateRay(orig, m_point);
+		}
+	});
+	if (!queued) {
+		std::cout << "Selection ignored (outside the window or too many selections in flight)" << std::endl;
+	}
 
-		glm::vec3 orig = m_camera.position();
-		GLfloat vertices[2][3] = {
-			 {orig.x,orig.y,orig.z}, 
-			 {GLfloat(m_point.x),   GLfloat(m_point.y),   GLfloat(m_point.z)},
-		};
+	// Back to the window
+	m_picking.end();
+}
 
-		// Update our VBO
-		glBindBuffer(GL_ARRAY_BUFFER, m_buffers[VBO_Ray]);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+glm::mat4 MainWindow::SpiralMatrix(int i) const
+{
+	// Translation vector based on spherical coordinates, then the spin
+	const glm::mat4 translation = glm::translate(glm::mat4(1.0f),
+		glm::vec3(cos(2.0f * i * float(M_PI) / static_cast<float>(NbSpirals)),
+				  sin(2.0f * i * float(M_PI) / static_cast<float>(NbSpirals)),
+				  0.0));
+	return glm::rotate(translation, m_spinAngle, glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
+void MainWindow::PerformRayCast(int x, int y)
+{
+	std::cout << "Viewer::performRayCast(" << x << ", " << y << ")" << std::endl;
+
+	// Ray from the camera through the center of the pixel: no rendering,
+	// no readback, the BVH answers right away
+	BVH::Ray ray;
+	ray.origin = m_camera.position();
+	ray.direction = m_camera.rayDirection(glm::vec2(x + 0.5f, y + 0.5f), m_windowWidth, m_windowHeight);
+	BVH::Hit hit;
+	const auto start = std::chrono::high_resolution_clock::now();
+	const bool found = m_scene.intersect(ray, hit);
+	const double microseconds = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+
+	m_selectedSpiral = found ? int(hit.instance) : -1;
+	std::cout << "m_selectedSpiral: " << m_selectedSpiral;
+	if (found) {
+		std::cout << ", triangle " << hit.primitive;
+	}
+	std::cout << " (" << microseconds << " us, " << m_scene.numInstances() << " instances of " << m_spiralBVH.numTriangles() << " triangles)" << std::endl;
+	if (found) {
+		m_point = ray.origin + hit.t * ray.direction;
+		std::cout << "p: " << m_point.x << " " << m_point.y << " " << m_point.z << "\n";
+		UpdateRay(ray.origin, m_point);
 	}
 }
 
+void MainWindow::UpdateRay(const glm::vec3& origin, const glm::vec3& point)
+{
+	GLfloat vertices[2][3] = {
+		 {origin.x, origin.y, origin.z},
+		 {point.x,  point.y,  point.z},
+	};
+
+	// Update our VBO
+	glBindBuffer(GL_ARRAY_BUFFER, m_buffers[VBO_Ray]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+}
 
 void MainWindow::FramebufferSizeCallback(int width, int height) {
 	m_windowWidth = width;
 	m_windowHeight = height;
 	glViewport(0, 0, width, height);
 	m_camera.viewportEvents(width, height);
+	m_picking.resize(width, height);
+}
+
+void MainWindow::KeyCallback(int key, int action) {
+	// Space: start/stop spinning the spirals
+	if (key == GLFW_KEY_SPACE && action == GLFW_PRESS) {
+		m_animate = !m_animate;
+	}
 }
 
 void MainWindow::CursorPositionCallback(double xpos, double ypos) {
@@ -496,13 +544,18 @@ void MainWindow::MouseButtonCallback(int button, int action, int mods)
 	std::cout << " - Left? " << (button == GLFW_MOUSE_BUTTON_LEFT ? "true" : "false") << "\n";
 	std::cout << " - Pressed? " << (action == GLFW_PRESS ? "true" : "false") << "\n";
 	std::cout << " - Shift? " << (mods == GLFW_MOD_SHIFT ? "true" : "false") << "\n";
-	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && mods == GLFW_MOD_SHIFT)
+	// Shift + click: ray cast on the CPU
+	// Ctrl + click: ID and depth read back from the GPU, then unproject
+	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && (mods == GLFW_MOD_SHIFT || mods == GLFW_MOD_CONTROL))
 	{
 		double xpos, ypos;
 		//getting cursor position
 		glfwGetCursorPos(m_window, &xpos, &ypos);
 		std::cout << "Cursor Position at (" << xpos << " : " << ypos << ")" << std::endl;
 
-		PerformSelection((int)xpos, (int)ypos);
+		if (mods == GLFW_MOD_SHIFT)
+			PerformRayCast((int)xpos, (int)ypos);
+		else
+			PerformSelection((int)xpos, (int)ypos);
 	}
 }
\ No newline at end of file
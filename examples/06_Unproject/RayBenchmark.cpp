@@ -0,0 +1,216 @@
+// Benchmark of the batched ray queries of the BVH (no window or OpenGL needed)
+// For each mesh, rays/second of each kernel (single rays, packets of 4
+// and 8) with:
+// - coherent rays: primary rays of a pinhole camera looking at the mesh
+// - incoherent rays: ambient occlusion rays, from the points hit by the
+//   primary rays in random directions (short, occlusion only) and random
+//   rays crossing the bounding box (closest hit)
+// The hits of the packets are compared with the ones of the single rays.
+//
+// Usage: 06_Unproject_benchmark [mesh.obj ...]
+// (soccerball.obj and susane.obj of the examples by default)
+
+#include "BVH.h"
+#include "JobSystem.h"
+#include "OBJLoader.h"
+#include "Random.h"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+	const int ImageSize = 512;        // Primary rays: ImageSize x ImageSize
+	const int AmbientSamples = 4;     // Occlusion rays per point hit
+
+	// Rays/second of f() (best of a few runs)
+	template<typename F>
+	double raysPerSecond(std::size_t count, F f)
+	{
+		f(); // Warm up
+		double best = 1e30;
+		for (int r = 0; r < 5; ++r) {
+			const auto start = std::chrono::high_resolution_clock::now();
+			f();
+			const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+			best = std::min(best, elapsed.count());
+		}
+		return double(count) / best;
+	}
+
+	glm::vec3 randomDirection(PCG32& rng)
+	{
+		// Uniform on the sphere
+		const float z = rng.nextFloat(-1.0f, 1.0f);
+		const float phi = rng.nextFloat(0.0f, 6.2831853f);
+		const float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+		return glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+	}
+
+	// Camera in front of the mesh, the image covers its bounding sphere
+	std::vector<BVH::Ray> primaryRays(const BVH& bvh)
+	{
+		const glm::vec3 center = 0.5f * (bvh.boundsMin() + bvh.boundsMax());
+		const float radius = 0.5f * glm::length(bvh.boundsMax() - bvh.boundsMin());
+		const glm::vec3 eye = center + glm::vec3(0.3f, 0.4f, 2.5f) * radius;
+		const glm::vec3 forward = glm::normalize(center - eye);
+		const glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+		const glm::vec3 up = glm::cross(right, forward);
+		const float halfSize = radius / glm::length(center - eye);
+
+		std::vector<BVH::Ray> rays(ImageSize * ImageSize);
+		for (int y = 0; y < ImageSize; ++y) {
+			for (int x = 0; x < ImageSize; ++x) {
+				const float sx = (2.0f * (x + 0.5f) / ImageSize - 1.0f) * halfSize;
+				const float sy = (2.0f * (y + 0.5f) / ImageSize - 1.0f) * halfSize;
+				BVH::Ray& ray = rays[y * ImageSize + x];
+				ray.origin = eye;
+				ray.direction = glm::normalize(forward + sx * right + sy * up);
+			}
+		}
+		return rays;
+	}
+
+	// Short rays in random directions from the points hit
+	std::vector<BVH::Ray> ambientRays(const BVH& bvh, const std::vector<BVH::Ray>& primary, const std::vector<BVH::Hit>& hits)
+	{
+		const float length = 0.2f * glm::length(bvh.boundsMax() - bvh.boundsMin());
+		PCG32 rng(7);
+		std::vector<BVH::Ray> rays;
+		for (std::size_t i = 0; i < primary.size(); ++i) {
+			if (!hits[i].valid()) {
+				continue;
+			}
+			// Slightly before the surface (no self intersection)
+			const glm::vec3 p = primary[i].origin + (hits[i].t * 0.999f) * primary[i].direction;
+			for (int s = 0; s < AmbientSamples; ++s) {
+				BVH::Ray ray;
+				ray.origin = p;
+				ray.direction = randomDirection(rng);
+				if (glm::dot(ray.direction, primary[i].direction) > 0.0f) {
+					ray.direction = -ray.direction; // Hemisphere of the viewer
+				}
+				ray.tMax = length;
+				rays.push_back(ray);
+			}
+		}
+		return rays;
+	}
+
+	// Rays between two random points of the (enlarged) bounding box
+	std::vector<BVH::Ray> randomRays(const BVH& bvh, std::size_t count)
+	{
+		const glm::vec3 center = 0.5f * (bvh.boundsMin() + bvh.boundsMax());
+		const glm::vec3 extent = 0.6f * (bvh.boundsMax() - bvh.boundsMin());
+		PCG32 rng(3);
+		auto point = [&]() {
+			return center + extent * glm::vec3(rng.nextFloat(-1.0f, 1.0f), rng.nextFloat(-1.0f, 1.0f), rng.nextFloat(-1.0f, 1.0f));
+		};
+		std::vector<BVH::Ray> rays(count);
+		for (BVH::Ray& ray : rays) {
+			ray.origin = point();
+			ray.direction = point() - ray.origin;
+		}
+		return rays;
+	}
+
+	bool sameHit(const BVH::Hit& a, const BVH::Hit& b)
+	{
+		return a.valid() == b.valid() && a.t == b.t && a.object == b.object && a.primitive == b.primitive;
+	}
+
+	void benchmarkIntersect(const BVH& bvh, const char* name, const std::vector<BVH::Ray>& rays)
+	{
+		std::cout << std::setw(22) << name << std::setw(10) << rays.size();
+		std::vector<BVH::Hit> reference(rays.size());
+		bvh.intersect(rays.data(), reference.data(), rays.size(), BVH::Kernel::Single);
+		std::vector<BVH::Hit> hits(rays.size());
+		int mismatches = 0;
+		for (auto kernel : { BVH::Kernel::Single, BVH::Kernel::SSE, BVH::Kernel::AVX2 }) {
+			if (!BVH::isAvailable(kernel)) continue;
+			std::cout << std::setw(10) << raysPerSecond(rays.size(), [&]() {
+				bvh.intersect(rays.data(), hits.data(), rays.size(), kernel);
+			}) * 1e-6;
+			for (std::size_t i = 0; i < rays.size(); ++i) {
+				mismatches += !sameHit(hits[i], reference[i]);
+			}
+		}
+		std::cout << std::setw(12) << mismatches << std::endl;
+	}
+
+	void benchmarkOccluded(const BVH& bvh, const char* name, const std::vector<BVH::Ray>& rays)
+	{
+		std::cout << std::setw(22) << name << std::setw(10) << rays.size();
+		std::unique_ptr<bool[]> reference(new bool[rays.size()]);
+		bvh.occluded(rays.data(), reference.get(), rays.size(), BVH::Kernel::Single);
+		std::unique_ptr<bool[]> occluded(new bool[rays.size()]);
+		int mismatches = 0;
+		for (auto kernel : { BVH::Kernel::Single, BVH::Kernel::SSE, BVH::Kernel::AVX2 }) {
+			if (!BVH::isAvailable(kernel)) continue;
+			std::cout << std::setw(10) << raysPerSecond(rays.size(), [&]() {
+				bvh.occluded(rays.data(), occluded.get(), rays.size(), kernel);
+			}) * 1e-6;
+			for (std::size_t i = 0; i < rays.size(); ++i) {
+				mismatches += occluded[i] != reference[i];
+			}
+		}
+		std::cout << std::setw(12) << mismatches << std::endl;
+	}
+
+	void benchmarkMesh(const std::string& path)
+	{
+		OBJLoader::Loader loader(path);
+		if (!loader.isLoaded()) {
+			std::cerr << "Can't load " << path << std::endl;
+			return;
+		}
+		BVH bvh;
+		for (const OBJLoader::Mesh& mesh : loader.getMeshes()) {
+			bvh.addMesh(mesh, glm::mat4(1.0f), 0);
+		}
+		bvh.build();
+		std::cout << "\n" << path << ": " << bvh.numTriangles() << " triangles, " << bvh.numNodes() << " nodes, depth " << bvh.depth() << "\n";
+
+		std::cout << std::setw(22) << "Rays/second (millions)" << std::setw(10) << "rays";
+		for (auto kernel : { BVH::Kernel::Single, BVH::Kernel::SSE, BVH::Kernel::AVX2 }) {
+			if (BVH::isAvailable(kernel)) {
+				std::cout << std::setw(10) << BVH::kernelName(kernel);
+			}
+		}
+		std::cout << std::setw(12) << "mismatches" << "\n";
+
+		const std::vector<BVH::Ray> primary = primaryRays(bvh);
+		std::vector<BVH::Hit> hits(primary.size());
+		bvh.intersect(primary.data(), hits.data(), primary.size());
+		const std::vector<BVH::Ray> ambient = ambientRays(bvh, primary, hits);
+		const std::vector<BVH::Ray> random = randomRays(bvh, primary.size());
+
+		benchmarkIntersect(bvh, "coherent (camera)", primary);
+		benchmarkOccluded(bvh, "coherent (occlusion)", primary);
+		benchmarkIntersect(bvh, "incoherent (random)", random);
+		benchmarkOccluded(bvh, "incoherent (AO)", ambient);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<std::string> paths;
+	for (int i = 1; i < argc; ++i) {
+		paths.push_back(argv[i]);
+	}
+	if (paths.empty()) {
+		paths.push_back(EXAMPLES_DIR "lab_03_ObjLoader/assets/soccerball.obj");
+		paths.push_back(EXAMPLES_DIR "05_GeometryShader/susane.obj");
+	}
+
+	std::cout << JobSystem::instance().numThreads() << " threads" << std::endl;
+	std::cout << std::fixed << std::setprecision(2);
+	for (const std::string& path : paths) {
+		benchmarkMesh(path);
+	}
+	return 0;
+}
@@ -0,0 +1,12 @@
+#version 400 core
+
+// ID of the object (GL_RG32UI attachment of the PickingService)
+uniform uint uId;
+
+// (object ID, triangle of the draw)
+layout(location = 0) out uvec2 oId;
+
+void main()
+{
+  oId = uvec2(uId, uint(gl_PrimitiveID));
+}
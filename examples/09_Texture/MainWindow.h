@@ -10,6 +10,7 @@
 #include <memory>
 
 #include "ShaderProgram.h"
+#include "TextureCache.h"
 
 class MainWindow
 {
@@ -36,11 +37,8 @@ private:
 	// Update camera position (eye)
 	void updateCameraEye();
 
-	// Load texture
-	bool loadTexture(const std::string& path, unsigned int& textureID,
-		GLint uvMode, // UV/ST warp mode
-		GLint minMode,  // Minfication
-		GLint magMode); // Magnification
+	// Acquire the textures of a material (and release the current ones)
+	void setMaterial(int material);
 
 private:
 	// settings
@@ -62,9 +60,15 @@ private:
 	GLuint m_VAOs[NumVAOs];
 	GLuint m_buffers[NumBuffers];
 
-	// Textures
-	unsigned int m_textureDiffuseID = -1;
-	unsigned int m_textureARMID = -1;
+	// Textures (shared: acquired from m_textures)
+	enum Materials { WoodFloorDeck, SlabTiles, NumMaterials };
+	TextureCache m_textures;
+	int m_material = WoodFloorDeck;
+	unsigned int m_textureDiffuseID = 0;
+	unsigned int m_textureARMID = 0;
+	// Filters and wrap mode (m_mode) of both textures: set on the sampler,
+	// not on the shared textures
+	GLuint m_sampler = 0;
 	int m_mode = 0;
 	bool m_activateARM = true;
 
@@ -1,8 +1,5 @@
 #include "MainWindow.h"
 
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
-
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
@@ -19,6 +16,7 @@ const GLuint NumVertices = 4;
 const GLuint NumColors = 4;
 const GLuint NumNormals = 4;
 const GLuint NumUvs = 4;
+const GLint WrapModes[] = { GL_REPEAT, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_BORDER }; // Modes of the combo
 
 MainWindow::MainWindow() :
 	m_at(glm::vec3(0, 0,0)),
@@ -125,29 +123,15 @@ int MainWindow::InitializeGL()
 	glBufferSubData(GL_ARRAY_BUFFER, sizeof(vertices), sizeof(uvs), uvs);
 	glBufferSubData(GL_ARRAY_BUFFER, sizeof(vertices) + sizeof(uvs), sizeof(normals), normals);
 
-	// Load texture
-	std::string assets_dir = ASSETS_DIR;
-	std::string image_diffuse_path = assets_dir + "wood_floor_deck_diff_1k.jpg";
-	std::string image_arm_path = assets_dir + "wood_floor_deck_arm_1k.jpg"; // Ambiant + Roughness + Metallic
-	// Autre texture:
-	// image_diffuse_path = assets_dir + "slab_tiles_diff_1k.jpg";
-	// image_arm_path = assets_dir + "slab_tiles_arm_1k.jpg";
+	// Textures (shared, loaded in background: placeholders until uploaded)
+	setMaterial(m_material);
 
-	if (!loadTexture(image_diffuse_path, m_textureDiffuseID, GL_REPEAT, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR)) {
-		std::cerr << "Unable to load texture: " << image_diffuse_path << std::endl;
-		return 4;
-	}
-	else {
-		std::cout << "Load texture -- OpenGL ID: " << m_textureDiffuseID << "\n";
-	}
-
-	if (!loadTexture(image_arm_path, m_textureARMID, GL_REPEAT, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR)) {
-		std::cerr << "Unable to load texture: " << image_arm_path << std::endl;
-		return 4;
-	}
-	else {
-		std::cout << "Load texture -- OpenGL ID: " << m_textureARMID << "\n";
-	}
+	// Sampler of both textures (the wrap mode of the combo)
+	glCreateSamplers(1, &m_sampler);
+	glSamplerParameteri(m_sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glSamplerParameteri(m_sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glSamplerParameteri(m_sampler, GL_TEXTURE_WRAP_S, WrapModes[m_mode]);
+	glSamplerParameteri(m_sampler, GL_TEXTURE_WRAP_T, WrapModes[m_mode]);
 
 	// build and compile our shader program
 	const std::string directory = SHADERS_DIR;
@@ -219,26 +203,16 @@ void MainWindow::RenderImgui()
 			"CLAMP_EDGE",
 			"CLAMP_BORDER",
 		};
-		bool changed = ImGui::Combo("Mode", &m_mode, items, IM_ARRAYSIZE(items));
-		if (changed && m_mode == 0) {
-			glTextureParameteri(m_textureDiffuseID, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTextureParameteri(m_textureDiffuseID, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			glTextureParameteri(m_textureARMID, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTextureParameteri(m_textureARMID, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		if (ImGui::Combo("Mode", &m_mode, items, IM_ARRAYSIZE(items))) {
+			glSamplerParameteri(m_sampler, GL_TEXTURE_WRAP_S, WrapModes[m_mode]);
+			glSamplerParameteri(m_sampler, GL_TEXTURE_WRAP_T, WrapModes[m_mode]);
 		}
-		else if (changed && m_mode == 1) {
-			glTextureParameteri(m_textureDiffuseID,GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTextureParameteri(m_textureDiffuseID,GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-			glTextureParameteri(m_textureARMID,GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTextureParameteri(m_textureARMID,GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		}
-		else if (changed && m_mode == 2) {
-			glTextureParameteri(m_textureDiffuseID,GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-			glTextureParameteri(m_textureDiffuseID,GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-			glTextureParameteri(m_textureARMID,GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-			glTextureParameteri(m_textureARMID,GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-
+		const char* materials[NumMaterials] = { "Wood floor deck", "Slab tiles" };
+		if (ImGui::Combo("Material", &m_material, materials, IM_ARRAYSIZE(materials))) {
+			setMaterial(m_material);
 		}
+		const TextureCache::Stats& stats = m_textures.stats();
+		ImGui::Text("Images decoded: %u, textures reused: %u, from cached pixels: %u", stats.decodes, stats.textureHits, stats.pixelHits);
 		ImGui::Checkbox("Activate (ARM)", &m_activateARM);
 
 		bool updateCamera = ImGui::SliderFloat("Left Right Slider", &m_longitude, -180.0f, 180.0f);
@@ -266,6 +240,8 @@ void MainWindow::RenderScene()
 	// Note that binding point are configured inside the shader
 	glBindTextureUnit(0, m_textureDiffuseID);
 	glBindTextureUnit(1, m_textureARMID);
+	glBindSampler(0, m_sampler);
+	glBindSampler(1, m_sampler);
 	
 	// Camera specification (for the shader)
 	glm::mat4 lookAt = glm::lookAt(m_eye, m_at, m_up);
@@ -287,6 +263,9 @@ int MainWindow::RenderLoop()
 		if (glfwGetKey(m_window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 			glfwSetWindowShouldClose(m_window, true);
 
+		// Upload the textures decoded since the last frame
+		m_textures.update();
+
 		RenderScene();
 		RenderImgui();
 
@@ -300,6 +279,8 @@ int MainWindow::RenderLoop()
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
 
+	m_textures.destroy();
+	glDeleteSamplers(1, &m_sampler);
 	glfwDestroyWindow(m_window);
 	glfwTerminate();
 
@@ -315,41 +296,37 @@ void MainWindow::updateCameraEye()
 	m_eye = longitude * latitude * glm::vec4(m_eye,1);
 }
 
-bool MainWindow::loadTexture(const std::string& path, unsigned int& textureID, GLint uvMode, GLint minMode, GLint magMode)
+void MainWindow::setMaterial(int material)
 {
-	// OpenGL 4.6 -- need to specify the texture type
-	glCreateTextures(GL_TEXTURE_2D, 1, &textureID);
-
-	// Ask the library to flip the image horizontally
-	// This is necessary as TexImage2D assume "The first element corresponds to the lower left corner of the texture image"
-	// whereas stb_image load the image such "the first pixel pointed to is top-left-most in the image"
-	stbi_set_flip_vertically_on_load(true);
-
-	int width, height, nrComponents;
-	unsigned char* data = stbi_load(path.c_str(), &width, &height, &nrComponents, STBI_rgb_alpha);
-	if (data)
-	{
-		glTextureStorage2D(textureID, 1, GL_RGBA8, width, height);
-		glTextureSubImage2D(textureID, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, data);
-		if (minMode == GL_LINEAR_MIPMAP_LINEAR) {
-			glGenerateTextureMipmap(textureID);
+	// The textures of a material chosen again are still there (m_textures
+	// keeps the released ones within a budget), or uploaded from the
+	// decoded pixels it keeps (the files are not read nor decoded again)
+	const char* names[NumMaterials] = { "wood_floor_deck", "slab_tiles" };
+	const std::string prefix = std::string(ASSETS_DIR) + names[material];
+
+	// The callbacks give the textures with the image (immutable storage:
+	// not the placeholders returned), right away if already loaded.
+	// The callbacks of a previous material still loading are ignored
+	const GLuint previousDiffuse = m_textureDiffuseID;
+	const GLuint previousARM = m_textureARMID;
+	const int request = ++m_materialRequest;
+
+	TextureSettings settings; // Mipmaps
+	settings.immutable = true; // glTextureStorage2D
+	m_textureDiffuseID = m_textures.acquire(prefix + "_diff_1k.jpg", settings, [this, request](GLuint texture, bool) {
+		if (request == m_materialRequest) {
+			m_textureDiffuseID = texture;
 		}
-
-		glTextureParameteri(textureID, GL_TEXTURE_WRAP_S, uvMode);
-		glTextureParameteri(textureID, GL_TEXTURE_WRAP_T, uvMode);
-		glTextureParameteri(textureID, GL_TEXTURE_MIN_FILTER, minMode);
-		glTextureParameteri(textureID, GL_TEXTURE_MAG_FILTER, magMode);
-
-		stbi_image_free(data);
-
-		std::cout << "Texture loaded at path: " << path << std::endl;
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
-		return false;
+	});
+	settings.placeholder = glm::u8vec4(255, 128, 0, 255); // No occlusion, not metallic
+	m_textureARMID = m_textures.acquire(prefix + "_arm_1k.jpg", settings, [this, request](GLuint texture, bool) { // Ambiant + Roughness + Metallic
+		if (request == m_materialRequest) {
+			m_textureARMID = texture;
+		}
+	});
+	if (previousDiffuse != 0) {
+		m_textures.release(previousDiffuse);
+		m_textures.release(previousARM);
 	}
-
-	return true;
-}
\ No newline at end of file
+	std::cout << "Load texture -- OpenGL ID: " << m_textureDiffuseID << ", " << m_textureARMID << "\n";
+}
@@ -10,6 +10,7 @@
 #include <memory>
 
 #include "ShaderProgram.h"
+#include "TextureCache.h"
 
 class MainWindow
 {
@@ -36,11 +37,11 @@ private:
 	// Update camera position (eye)
 	void updateCameraEye();
 
-	// Load texture
-	bool loadTexture(const std::string& path, unsigned int& textureID,
-		GLint uvMode, // UV/ST warp mode
-		GLint minMode,  // Minfication
-		GLint magMode); // Magnification
+	// Acquire the textures of a material (and release the current ones)
+	void setMaterial(int material);
+	// Resident handles of the textures (placeholders until loaded) with the
+	// sampler of the wrap mode; the previous ones made non-resident
+	void updateHandles();
 
 private:
 	// settings
@@ -62,12 +63,25 @@ private:
 	GLuint m_VAOs[NumVAOs];
 	GLuint m_buffers[NumBuffers];
 
-	// Textures
-	unsigned int m_textureDiffuseID = -1;
+	// Textures (shared: acquired from m_textures). The handles are the ones
+	// of the placeholders until the textures are loaded
+	enum Materials { WoodFloorDeck, SlabTiles, NumMaterials };
+	TextureCache m_textures;
+	int m_material = WoodFloorDeck;
+	int m_materialRequest = 0; // Last setMaterial (ignore the callbacks of the previous ones)
+	unsigned int m_textureDiffuseID = 0;
+	unsigned int m_placeholderDiffuseID = 0;
+	bool m_diffuseLoaded = false;
 	GLuint64 m_handleDiffuse = 0;
-	unsigned int m_textureARMID = -1;
+	unsigned int m_textureARMID = 0;
+	unsigned int m_placeholderARMID = 0;
+	bool m_armLoaded = false;
 	GLuint64 m_handleARM = 0;
-	int m_mode = 0;
+	// Filters and wrap mode (m_mode) of the handles: set on samplers, not on
+	// the shared textures. One sampler per mode (frozen once it has a handle)
+	enum WrapModes { Repeat, ClampEdge, ClampBorder, NumWrapModes };
+	GLuint m_samplers[NumWrapModes];
+	int m_mode = Repeat;
 	bool m_activateARM = true;
 
 	// GLFW Window
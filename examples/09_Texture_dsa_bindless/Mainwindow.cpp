@@ -1,8 +1,5 @@
 #include "MainWindow.h"
 
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
-
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
@@ -20,6 +17,18 @@ const GLuint NumColors = 4;
 const GLuint NumNormals = 4;
 const GLuint NumUvs = 4;
 
+namespace {
+	// Handle of a texture and a sampler, made resident if it is not yet
+	GLuint64 residentHandle(GLuint texture, GLuint sampler)
+	{
+		const GLuint64 handle = glGetTextureSamplerHandleARB(texture, sampler);
+		if (!glIsTextureHandleResidentARB(handle)) {
+			glMakeTextureHandleResidentARB(handle);
+		}
+		return handle;
+	}
+}
+
 MainWindow::MainWindow() :
 	m_at(glm::vec3(0, 0,0)),
 	m_up(glm::vec3(0, 1, 0))
@@ -125,33 +134,24 @@ int MainWindow::InitializeGL()
 	glBufferSubData(GL_ARRAY_BUFFER, sizeof(vertices), sizeof(uvs), uvs);
 	glBufferSubData(GL_ARRAY_BUFFER, sizeof(vertices) + sizeof(uvs), sizeof(normals), normals);
 
-	// Load texture
-	std::string assets_dir = ASSETS_DIR;
-	std::string image_diffuse_path = assets_dir + "wood_floor_deck_diff_1k.jpg";
-	std::string image_arm_path = assets_dir + "wood_floor_deck_arm_1k.jpg"; // Ambiant + Roughness + Metallic
-	// Autre texture:
-	// image_diffuse_path = assets_dir + "slab_tiles_diff_1k.jpg";
-	// image_arm_path = assets_dir + "slab_tiles_arm_1k.jpg";
-
-	if (!loadTexture(image_diffuse_path, m_textureDiffuseID, GL_REPEAT, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR)) {
-		std::cerr << "Unable to load texture: " << image_diffuse_path << std::endl;
-		return 4;
+	// Textures (shared, loaded in background). The storage of a texture cannot
+	// change once it has a handle: the handles of placeholder textures are
+	// used until the images are uploaded (RenderLoop)
+	TextureSettings settings;
+	settings.immutable = true;
+	m_placeholderDiffuseID = TextureLoader::createPlaceholder(settings.placeholder, settings);
+	m_placeholderARMID = TextureLoader::createPlaceholder(glm::u8vec4(255, 128, 0, 255), settings); // No occlusion, not metallic
+
+	// Samplers of the wrap modes of the combo (a handle per texture and sampler)
+	const GLint wrapModes[NumWrapModes] = { GL_REPEAT, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_BORDER };
+	glCreateSamplers(NumWrapModes, m_samplers);
+	for (int mode = 0; mode < NumWrapModes; ++mode) {
+		glSamplerParameteri(m_samplers[mode], GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glSamplerParameteri(m_samplers[mode], GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glSamplerParameteri(m_samplers[mode], GL_TEXTURE_WRAP_S, wrapModes[mode]);
+		glSamplerParameteri(m_samplers[mode], GL_TEXTURE_WRAP_T, wrapModes[mode]);
 	}
-	else {
-		std::cout << "Load texture -- OpenGL ID: " << m_textureDiffuseID << "\n";
-	}
-	m_handleDiffuse = glGetTextureHandleARB(m_textureDiffuseID);
-	glMakeTextureHandleResidentARB(m_handleDiffuse);
-
-	if (!loadTexture(image_arm_path, m_textureARMID, GL_REPEAT, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR)) {
-		std::cerr << "Unable to load texture: " << image_arm_path << std::endl;
-		return 4;
-	}
-	else {
-		std::cout << "Load texture -- OpenGL ID: " << m_textureARMID << "\n";
-	}
-	m_handleARM = glGetTextureHandleARB(m_textureARMID);
-	glMakeTextureHandleResidentARB(m_handleARM);
+	setMaterial(m_material);
 
 	// build and compile our shader program
 	const std::string directory = SHADERS_DIR;
@@ -223,26 +223,15 @@ void MainWindow::RenderImgui()
 			"CLAMP_EDGE",
 			"CLAMP_BORDER",
 		};
-		bool changed = ImGui::Combo("Mode", &m_mode, items, IM_ARRAYSIZE(items));
-		if (changed && m_mode == 0) {
-			glTextureParameteri(m_textureDiffuseID, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTextureParameteri(m_textureDiffuseID, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			glTextureParameteri(m_textureARMID, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTextureParameteri(m_textureARMID, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		}
-		else if (changed && m_mode == 1) {
-			glTextureParameteri(m_textureDiffuseID,GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTextureParameteri(m_textureDiffuseID,GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-			glTextureParameteri(m_textureARMID,GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTextureParameteri(m_textureARMID,GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		if (ImGui::Combo("Mode", &m_mode, items, IM_ARRAYSIZE(items))) {
+			updateHandles();
 		}
-		else if (changed && m_mode == 2) {
-			glTextureParameteri(m_textureDiffuseID,GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-			glTextureParameteri(m_textureDiffuseID,GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-			glTextureParameteri(m_textureARMID,GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-			glTextureParameteri(m_textureARMID,GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-
+		const char* materials[NumMaterials] = { "Wood floor deck", "Slab tiles" };
+		if (ImGui::Combo("Material", &m_material, materials, IM_ARRAYSIZE(materials))) {
+			setMaterial(m_material);
 		}
+		const TextureCache::Stats& stats = m_textures.stats();
+		ImGui::Text("Images decoded: %u, textures reused: %u, from cached pixels: %u", stats.decodes, stats.textureHits, stats.pixelHits);
 		ImGui::Checkbox("Activate (ARM)", &m_activateARM);
 
 		bool updateCamera = ImGui::SliderFloat("Left Right Slider", &m_longitude, -180.0f, 180.0f);
@@ -291,6 +280,9 @@ int MainWindow::RenderLoop()
 		if (glfwGetKey(m_window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 			glfwSetWindowShouldClose(m_window, true);
 
+		// Upload the textures decoded since the last frame (new handles)
+		m_textures.update();
+
 		RenderScene();
 		RenderImgui();
 
@@ -304,6 +296,8 @@ int MainWindow::RenderLoop()
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
 
+	m_textures.destroy();
+	glDeleteSamplers(NumWrapModes, m_samplers);
 	glfwDestroyWindow(m_window);
 	glfwTerminate();
 
@@ -319,41 +313,61 @@ void MainWindow::updateCameraEye()
 	m_eye = longitude * latitude * glm::vec4(m_eye,1);
 }
 
-bool MainWindow::loadTexture(const std::string& path, unsigned int& textureID, GLint uvMode, GLint minMode, GLint magMode)
+void MainWindow::setMaterial(int material)
 {
-	// OpenGL 4.6 -- need to specify the texture type
-	glCreateTextures(GL_TEXTURE_2D, 1, &textureID);
-
-	// Ask the library to flip the image horizontally
-	// This is necessary as TexImage2D assume "The first element corresponds to the lower left corner of the texture image"
-	// whereas stb_image load the image such "the first pixel pointed to is top-left-most in the image"
-	stbi_set_flip_vertically_on_load(true);
-
-	int width, height, nrComponents;
-	unsigned char* data = stbi_load(path.c_str(), &width, &height, &nrComponents, STBI_rgb_alpha);
-	if (data)
-	{
-		glTextureStorage2D(textureID, 1, GL_RGBA8, width, height);
-		glTextureSubImage2D(textureID, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, data);
-		if (minMode == GL_LINEAR_MIPMAP_LINEAR) {
-			glGenerateTextureMipmap(textureID);
+	// The textures of a material chosen again are still there (m_textures
+	// keeps the released ones within a budget), or uploaded from the
+	// decoded pixels it keeps (the files are not read nor decoded again)
+	const char* names[NumMaterials] = { "wood_floor_deck", "slab_tiles" };
+	const std::string prefix = std::string(ASSETS_DIR) + names[material];
+
+	// Placeholders until the callbacks of this material (the callbacks of a
+	// previous material still loading are ignored). The textures already
+	// loaded call them right away. Immutable storage: the callbacks give
+	// new textures, not the ones returned by acquire
+	const GLuint previousDiffuseID = m_textureDiffuseID;
+	const GLuint previousARMID = m_textureARMID;
+	m_diffuseLoaded = false;
+	m_armLoaded = false;
+	const int request = ++m_materialRequest;
+
+	TextureSettings settings; // Mipmaps
+	settings.immutable = true; // glTextureStorage2D
+	m_textureDiffuseID = m_textures.acquire(prefix + "_diff_1k.jpg", settings, [this, request](GLuint texture, bool loaded) {
+		if (request == m_materialRequest) {
+			m_textureDiffuseID = texture;
+			m_diffuseLoaded = loaded;
+			updateHandles();
 		}
-
-		glTextureParameteri(textureID, GL_TEXTURE_WRAP_S, uvMode);
-		glTextureParameteri(textureID, GL_TEXTURE_WRAP_T, uvMode);
-		glTextureParameteri(textureID, GL_TEXTURE_MIN_FILTER, minMode);
-		glTextureParameteri(textureID, GL_TEXTURE_MAG_FILTER, magMode);
-
-		stbi_image_free(data);
-
-		std::cout << "Texture loaded at path: " << path << std::endl;
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
-		return false;
+	});
+	settings.placeholder = glm::u8vec4(255, 128, 0, 255); // No occlusion, not metallic
+	m_textureARMID = m_textures.acquire(prefix + "_arm_1k.jpg", settings, [this, request](GLuint texture, bool loaded) { // Ambiant + Roughness + Metallic
+		if (request == m_materialRequest) {
+			m_textureARMID = texture;
+			m_armLoaded = loaded;
+			updateHandles();
+		}
+	});
+
+	// The previous textures may be deleted after their last reference:
+	// their handles are made non-resident before
+	updateHandles();
+	if (previousDiffuseID != 0) {
+		m_textures.release(previousDiffuseID);
+		m_textures.release(previousARMID);
 	}
+	std::cout << "Load texture -- OpenGL ID: " << m_textureDiffuseID << ", " << m_textureARMID << "\n";
+}
 
-	return true;
-}
\ No newline at end of file
+void MainWindow::updateHandles()
+{
+	const GLuint64 previous[] = { m_handleDiffuse, m_handleARM };
+	const GLuint sampler = m_samplers[m_mode];
+	m_handleDiffuse = residentHandle(m_diffuseLoaded ? m_textureDiffuseID : m_placeholderDiffuseID, sampler);
+	m_handleARM = residentHandle(m_armLoaded ? m_textureARMID : m_placeholderARMID, sampler);
+	for (GLuint64 handle : previous) {
+		if (handle != 0 && handle != m_handleDiffuse && handle != m_handleARM) {
+			glMakeTextureHandleNonResidentARB(handle);
+		}
+	}
+}
@@ -9,6 +9,7 @@
 #include <tuple>
 
 #include "ShaderProgram.h"
+#include "TextureLoader.h"
 
 typedef std::tuple<glm::vec3, glm::vec3, glm::vec3> vec3x3;
 typedef std::tuple<glm::vec2, glm::vec2, glm::vec2> vec2x3;
@@ -37,11 +38,6 @@ private:
 
 	void updateCameraEye();
 
-	bool loadTexture(const std::string& path, unsigned int& textureID,
-		GLint uvMode, // UV/ST warp mode
-		GLint minMode,  // Minfication
-		GLint magMode); // Magnification
-	
 	glm::vec3 computeTangentFace(vec3x3 pos, vec2x3 uvs) const;
 
 private:
@@ -61,6 +57,7 @@ private:
 	glm::vec3 m_eye, m_at, m_up;
 	glm::mat4 m_proj;
 
+	TextureLoader m_textureLoader;
 	unsigned int m_diffTexID = -1 ;
 	unsigned int m_normalTexID = -1;
 	unsigned int m_ARMTexID = -1;
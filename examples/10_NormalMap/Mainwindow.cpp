@@ -1,8 +1,5 @@
 #include "MainWindow.h"
 
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
-
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
@@ -222,18 +219,14 @@ int MainWindow::InitializeGL()
     std::string dispPath = assets_dir + "concrete_debris_disp_1k.jpg";
 
 
-    if (!loadTexture(diffPath, m_diffTexID, GL_CLAMP_TO_BORDER, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR)) {
-        std::cerr << "Unable to load texture: " << diffPath << std::endl;
-        return 4;
-    }
-    if (!loadTexture(normalPath, m_normalTexID, GL_CLAMP_TO_BORDER, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR)) {
-        std::cerr << "Unable to load texture: " << normalPath << std::endl;
-        return 4;
-    }
-    if (!loadTexture(ARMPath, m_ARMTexID, GL_CLAMP_TO_BORDER, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR)) {
-        std::cerr << "Unable to load texture: " << ARMPath << std::endl;
-        return 4;
-    }
+    // Decoded in background: placeholders until the images are uploaded (RenderLoop)
+    TextureLoader::Settings settings;
+    settings.wrap = GL_CLAMP_TO_BORDER;
+    m_diffTexID = m_textureLoader.load(diffPath, settings);
+    settings.placeholder = glm::u8vec4(128, 128, 255, 255); // Flat normal (0, 0, 1)
+    m_normalTexID = m_textureLoader.load(normalPath, settings);
+    settings.placeholder = glm::u8vec4(255, 128, 0, 255); // No occlusion, not metallic
+    m_ARMTexID = m_textureLoader.load(ARMPath, settings);
     
     // Configure the texture uniform in advances
     {
@@ -350,6 +343,9 @@ int MainWindow::RenderLoop()
         if (glfwGetKey(m_window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
             glfwSetWindowShouldClose(m_window, true);
 
+        // Upload the textures decoded since the last frame
+        m_textureLoader.update();
+
         RenderScene();
         RenderImgui();
 
@@ -363,6 +359,7 @@ int MainWindow::RenderLoop()
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
 
+    m_textureLoader.release();
     glfwDestroyWindow(m_window);
     glfwTerminate();
 
@@ -377,41 +374,3 @@ void MainWindow::updateCameraEye()
     longitude = glm::rotate(longitude, glm::radians(m_longitude), glm::vec3(0, 1, 0));
     m_eye = longitude * latitude * glm::vec4(m_eye,1);
 }
-
-bool MainWindow::loadTexture(const std::string& path, unsigned int& textureID, GLint uvMode, GLint minMode, GLint magMode)
-{
-    glGenTextures(1, &textureID);
-
-    // Ask the library to flip the image horizontally
-    // This is necessary as TexImage2D assume "The first element corresponds to the lower left corner of the texture image"
-    // whereas stb_image load the image such "the first pixel pointed to is top-left-most in the image"
-    stbi_set_flip_vertically_on_load(true);
-
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(path.c_str(), &width, &height, &nrComponents, STBI_rgb_alpha);
-    if (data)
-    {
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        if (minMode == GL_LINEAR_MIPMAP_LINEAR) {
-            glGenerateMipmap(GL_TEXTURE_2D);
-        }
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, uvMode);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, uvMode);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minMode);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magMode);
-
-        stbi_image_free(data);
-
-        std::cout << "Texture loaded at path: " << path << std::endl;
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-        return false;
-    }
-
-    return true;
-}
\ No newline at end of file
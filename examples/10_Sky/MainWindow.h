@@ -9,6 +9,7 @@
 
 #include "ShaderProgram.h"
 #include "Camera.h"
+#include "TextureLoader.h"
 
 class MainWindow
 {
@@ -33,12 +34,6 @@ private:
 	// Rendering interface ImGUI
 	void RenderImgui();
 
-	bool loadTexture(const std::string& path, 
-		unsigned int& textureID, 
-		GLint uvMode, // UV/ST warp mode
-		GLint minMode,  // Minfication
-		GLint magMode); // Magnification
-
 	void initGeometrySphere();
 
 private:
@@ -84,6 +79,7 @@ private:
 	GLuint m_buffers[NumBuffers];
 
 	// Textures
+	TextureLoader m_textureLoader;
 	unsigned int TextureId = -1 ;
 
 	// GLFW Window
@@ -3,9 +3,6 @@
 #include <vector>
 #include <iostream>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
-
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
@@ -156,10 +153,12 @@ int MainWindow::InitializeGL()
     std::cout << "Load textures ... \n";
     std::string assets_dir = ASSETS_DIR;
     std::string SkydomePath = assets_dir + "skydome2.png";
-    if (!loadTexture(&SkydomePath[0], TextureId, GL_MIRRORED_REPEAT, GL_LINEAR, GL_LINEAR)) {
-        std::cerr << "Error when loading image skydome2.png\n";
-        return 5;
-    }
+    // Decoded in background: sky blue until the image is uploaded (RenderLoop)
+    TextureLoader::Settings settings;
+    settings.wrap = GL_MIRRORED_REPEAT;
+    settings.minFilter = GL_LINEAR;
+    settings.placeholder = glm::u8vec4(135, 170, 215, 255);
+    TextureId = m_textureLoader.load(SkydomePath, settings);
 
     // Set texture unit (all 0)
     m_skydomeShader->setInt(m_uSky.texSkydome, 0);
@@ -250,6 +249,9 @@ int MainWindow::RenderLoop()
             m_camera.keybordEvents(m_window, delta_time);
         }
 
+        // Upload the textures decoded since the last frame
+        m_textureLoader.update();
+
         RenderScene();
         RenderImgui();
 
@@ -263,50 +265,13 @@ int MainWindow::RenderLoop()
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
 
+    m_textureLoader.release();
     glfwDestroyWindow(m_window);
     glfwTerminate();
 
     return 0;
 }
 
-bool MainWindow::loadTexture(const std::string& path, unsigned int& textureID, GLint uvMode, GLint minMode, GLint magMode)
-{
-    glGenTextures(1, &textureID);
-
-    // Ask the library to flip the image horizontally
-    // This is necessary as TexImage2D assume "The first element corresponds to the lower left corner of the texture image"
-    // whereas stb_image load the image such "the first pixel pointed to is top-left-most in the image"
-    stbi_set_flip_vertically_on_load(true);
-
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(path.c_str(), &width, &height, &nrComponents, STBI_rgb_alpha);
-    if (data)
-    {
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        if (minMode == GL_LINEAR_MIPMAP_LINEAR) {
-            glGenerateMipmap(GL_TEXTURE_2D);
-        }
-        
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, uvMode);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, uvMode);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minMode);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magMode);
-
-        stbi_image_free(data);
-
-        std::cout << "Texture loaded at path: " << path << std::endl;
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-        return false;
-    }
-
-    return true;
-}
-
 void MainWindow::initGeometrySphere()
 {
     // Generate a sphere between [-0.5, 0.5]x[-0.5, 0.5]x[-0.5, 0.5]
@@ -0,0 +1,137 @@
+#include "HiZBuffer.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+	const GLuint ReduceGroupSize = 8; // local_size_x/y of hiz_reduce.comp
+	const GLuint CullGroupSize = 64;  // local_size_x of cull.comp
+
+	GLuint numGroups(GLuint count, GLuint groupSize)
+	{
+		return (count + groupSize - 1) / groupSize;
+	}
+
+	bool loadProgram(std::unique_ptr<ShaderProgram>& program, const std::string& path)
+	{
+		bool success = true;
+		program = std::make_unique<ShaderProgram>();
+		success &= program->addShaderFromSource(GL_COMPUTE_SHADER, path);
+		success &= program->link();
+		if (!success) {
+			std::cerr << "Error when loading Hi-Z shader: " << path << "\n";
+		}
+		return success;
+	}
+}
+
+HiZBuffer::~HiZBuffer()
+{
+	release();
+}
+
+bool HiZBuffer::initialize(const std::string& directory)
+{
+	if (!loadProgram(m_reduceShader, directory + "hiz_reduce.comp") || !loadProgram(m_cullShader, directory + "cull.comp")) {
+		return false;
+	}
+	m_reduceUniforms.sourceLevel = m_reduceShader->uniformLocation("sourceLevel");
+	m_reduceUniforms.fromDepth = m_reduceShader->uniformLocation("fromDepth");
+	m_cullUniforms.viewProj = m_cullShader->uniformLocation("viewProj");
+	m_cullUniforms.hiZViewProj = m_cullShader->uniformLocation("hiZViewProj");
+	m_cullUniforms.count = m_cullShader->uniformLocation("count");
+	m_cullUniforms.occlusion = m_cullShader->uniformLocation("occlusion");
+	m_cullUniforms.reprojected = m_cullShader->uniformLocation("reprojected");
+	m_cullUniforms.depthSize = m_cullShader->uniformLocation("depthSize");
+	if (m_reduceUniforms.sourceLevel < 0 || m_reduceUniforms.fromDepth < 0 || m_cullUniforms.viewProj < 0 ||
+		m_cullUniforms.hiZViewProj < 0 || m_cullUniforms.count < 0 || m_cullUniforms.occlusion < 0 ||
+		m_cullUniforms.reprojected < 0 || m_cullUniforms.depthSize < 0) {
+		std::cerr << "Unable to find the uniforms of the Hi-Z shaders\n";
+		return false;
+	}
+	return true;
+}
+
+void HiZBuffer::create(int width, int height)
+{
+	release();
+	m_width = width;
+	m_height = height;
+
+	// Level 0: half the depth buffer, down to 1x1
+	const int width0 = std::max(1, width / 2);
+	const int height0 = std::max(1, height / 2);
+	m_levels = 1;
+	while ((std::max(width0, height0) >> m_levels) > 0) {
+		m_levels++;
+	}
+	glGenTextures(1, &m_texture);
+	glBindTexture(GL_TEXTURE_2D, m_texture);
+	glTexStorage2D(GL_TEXTURE_2D, m_levels, GL_RG32F, width0, height0);
+	// Only read with texelFetch
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void HiZBuffer::release()
+{
+	if (m_texture != 0) {
+		glDeleteTextures(1, &m_texture);
+		m_texture = 0;
+	}
+	m_levels = 0;
+}
+
+void HiZBuffer::build(GLuint depthTexture)
+{
+	// The depth written by the previous draws must be visible
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	m_reduceShader->bind();
+	glActiveTexture(GL_TEXTURE0);
+	for (int level = 0; level < m_levels; ++level)
+	{
+		// Level 0 from the depth texture, then each level from the previous one
+		glBindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : m_texture);
+		m_reduceShader->setInt(m_reduceUniforms.sourceLevel, level == 0 ? 0 : level - 1);
+		m_reduceShader->setBool(m_reduceUniforms.fromDepth, level == 0);
+		glBindImageTexture(0, m_texture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32F);
+		const GLuint width = GLuint(std::max(1, (m_width / 2) >> level));
+		const GLuint height = GLuint(std::max(1, (m_height / 2) >> level));
+		glDispatchCompute(numGroups(width, ReduceGroupSize), numGroups(height, ReduceGroupSize), 1);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void HiZBuffer::cull(GLuint boundsBuffer, GLuint count, GLuint visibleBuffer, GLuint commandBuffer, GLuint indexCount,
+	const glm::mat4& viewProj, const glm::mat4* hiZViewProj)
+{
+	// Nothing visible yet: the shader counts the instances
+	const DrawCommand command = { indexCount, 0, 0, 0, 0 };
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(command), &command);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BoundsBinding, boundsBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VisibleBinding, visibleBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CommandBinding, commandBuffer);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, m_texture);
+
+	m_cullShader->bind();
+	m_cullShader->setMat4(m_cullUniforms.viewProj, viewProj);
+	m_cullShader->setMat4(m_cullUniforms.hiZViewProj, hiZViewProj ? *hiZViewProj : viewProj);
+	glProgramUniform1ui(m_cullShader->programId(), m_cullUniforms.count, count);
+	m_cullShader->setBool(m_cullUniforms.occlusion, hiZViewProj != nullptr && m_texture != 0);
+	// Another camera: the parts of the boxes out of its screen are unknown
+	m_cullShader->setBool(m_cullUniforms.reprojected, hiZViewProj != nullptr && *hiZViewProj != viewProj);
+	m_cullShader->setVec2(m_cullUniforms.depthSize, glm::vec2(m_width, m_height));
+	glDispatchCompute(numGroups(count, CullGroupSize), 1, 1);
+
+	// The list is read by the vertex shader, the count by the draw command
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
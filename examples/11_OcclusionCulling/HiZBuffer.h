@@ -0,0 +1,100 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <memory>
+#include <string>
+
+#include "ShaderProgram.h"
+
+// Hierarchical Z-buffer (Hi-Z) and occlusion culling on the GPU
+//
+// build(): from a depth texture, a pyramid of min/max depths (GL_RG32F,
+// one mip level per dispatch of hiz_reduce.comp). Level 0 is half the
+// size of the depth buffer, each texel of a level holds the min and max
+// of the 2x2 (3 on the last row/column of an odd size) texels below.
+//
+// cull(): one thread per object (cull.comp). The box of the object is
+// - tested against the frustum of the camera
+// - projected with the camera of the depth buffer: the level where its
+//   rectangle covers at most 2x2 texels gives the farthest depth of the
+//   occluders in front of it. It is hidden if its nearest point is
+//   farther than that.
+// The visible objects are appended to a list and counted in the
+// instanceCount of an indirect draw command: the draw is submitted
+// without reading anything back.
+//
+// The depth can come from a pre-pass of the occluders (same camera) or
+// from the previous frame (reprojected: the boxes are projected with the
+// previous camera, an object uncovered by the motion of the camera then
+// appears one frame late).
+class HiZBuffer
+{
+public:
+	// Layout of glDrawElementsIndirect
+	struct DrawCommand {
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	// SSBO bindings used by cull() (see cull.comp)
+	static const GLuint BoundsBinding = 0;  // vec4 min, vec4 max per object (world space)
+	static const GLuint VisibleBinding = 1; // uint per visible object
+	static const GLuint CommandBinding = 2; // DrawCommand
+
+	HiZBuffer() = default;
+	~HiZBuffer();
+	HiZBuffer(const HiZBuffer&) = delete;
+	HiZBuffer& operator=(const HiZBuffer&) = delete;
+
+	// ------------------------------------------------------------------------
+	// load the compute shaders (directory with the .comp files)
+	// return true if sucessfull
+	bool initialize(const std::string& directory);
+
+	// ------------------------------------------------------------------------
+	// allocate the pyramid for a depth buffer of width x height
+	void create(int width, int height);
+	void release();
+
+	// ------------------------------------------------------------------------
+	// build the pyramid from a depth texture (same size as create)
+	void build(GLuint depthTexture);
+
+	// ------------------------------------------------------------------------
+	// cull "count" objects: the visible ones are written in visibleBuffer
+	// and counted in the instanceCount of commandBuffer (reset to 0 here,
+	// "indexCount" indices per instance).
+	// viewProj: frustum of the camera. hiZViewProj: camera of the depth
+	// buffer of the last build (nullptr: frustum culling only)
+	void cull(GLuint boundsBuffer, GLuint count, GLuint visibleBuffer, GLuint commandBuffer, GLuint indexCount,
+		const glm::mat4& viewProj, const glm::mat4* hiZViewProj);
+
+	GLuint texture() const { return m_texture; }
+	int numLevels() const { return m_levels; }
+
+private:
+	std::unique_ptr<ShaderProgram> m_reduceShader;
+	struct {
+		GLint sourceLevel = -1;
+		GLint fromDepth = -1;
+	} m_reduceUniforms;
+	std::unique_ptr<ShaderProgram> m_cullShader;
+	struct {
+		GLint viewProj = -1;
+		GLint hiZViewProj = -1;
+		GLint count = -1;
+		GLint occlusion = -1;
+		GLint reprojected = -1;
+		GLint depthSize = -1;
+	} m_cullUniforms;
+
+	GLuint m_texture = 0;
+	int m_width = 0;  // Size of the depth buffer
+	int m_height = 0;
+	int m_levels = 0;
+};
@@ -0,0 +1,539 @@
+#include "MainWindow.h"
+
+#include "imgui.h"
+#include "imgui_impl_glfw.h"
+#include "imgui_impl_opengl3.h"
+
+#include "JobSystem.h"
+#include "Random.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+	const float Spacing = 5.0f;     // Distance between the centers of the buildings (streets on the multiples)
+	const float EyeHeight = 1.7f;   // Street level
+}
+
+MainWindow::MainWindow():
+	m_camera(m_windowWidth, m_windowHeight,
+		glm::vec3(0.0, EyeHeight, 0.5f * MainWindow::GridSize * Spacing),
+		glm::vec3(0.0, EyeHeight, 0.0))
+{
+}
+
+int MainWindow::Initialisation()
+{
+	// OpenGL version (usefull for imGUI and other libraries)
+	const char* glsl_version = "#version 430 core";
+
+	// glfw: initialize and configure
+	// ------------------------------
+	glfwInit();
+
+	// Request OpenGL 4.3 (compute shaders, SSBO, indirect draws)
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+#ifdef __APPLE__
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+
+	// glfw window creation
+	// --------------------
+	m_window = glfwCreateWindow(m_windowWidth, m_windowHeight, "Occlusion culling", NULL, NULL);
+	if (m_window == NULL)
+	{
+		std::cerr << "Failed to create GLFW window" << std::endl;
+		glfwTerminate();
+		return 1;
+	}
+
+	glfwMakeContextCurrent(m_window);
+	InitializeCallback();
+
+	// glad: load all OpenGL function pointers
+	// ---------------------------------------
+	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+	{
+		std::cerr << "Failed to initialize GLAD" << std::endl;
+		return 2;
+	}
+
+	// imGui: create interface
+	// ---------------------------------------
+	// Setup Dear ImGui context
+	ImGui::CreateContext();
+	ImGuiIO& io = ImGui::GetIO(); (void)io;
+	io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;// Enable Keyboard Controls
+
+	// Setup Dear ImGui style
+	ImGui::StyleColorsDark();
+
+	// Setup Platform/Renderer backends
+	ImGui_ImplGlfw_InitForOpenGL(m_window, true);
+	ImGui_ImplOpenGL3_Init(glsl_version);
+
+	// Other openGL initialization
+	// -----------------------------
+	return InitializeGL();
+}
+
+void MainWindow::InitializeCallback() {
+	glfwSetWindowUserPointer(m_window, reinterpret_cast<void*>(this));
+	glfwSetFramebufferSizeCallback(m_window, [](GLFWwindow* window, int width, int height) {
+		MainWindow* w = reinterpret_cast<MainWindow*>(glfwGetWindowUserPointer(window));
+		w->FramebufferSizeCallback(width, height);
+		});
+	glfwSetCursorPosCallback(m_window, [](GLFWwindow* window, double xpos, double ypos) {
+		MainWindow* w = reinterpret_cast<MainWindow*>(glfwGetWindowUserPointer(window));
+		w->CursorPositionCallback(xpos, ypos);
+		});
+}
+
+int MainWindow::InitializeGL()
+{
+	// Load and create shaders
+	const std::string directory = SHADERS_DIR;
+	bool mainShaderSuccess = true;
+	m_cityShader = std::make_unique<ShaderProgram>();
+	mainShaderSuccess &= m_cityShader->addShaderFromSource(GL_VERTEX_SHADER, directory + "city.vert");
+	mainShaderSuccess &= m_cityShader->addShaderFromSource(GL_FRAGMENT_SHADER, directory + "city.frag");
+	mainShaderSuccess &= m_cityShader->link();
+	if (!mainShaderSuccess) {
+		std::cerr << "Error when loading main shader\n";
+		return 4;
+	}
+	m_cityUniforms.viewProj = m_cityShader->uniformLocation("viewProj");
+	if (m_cityUniforms.viewProj == -1) {
+		std::cerr << "Error when loading main shader uniforms\n";
+		return 5;
+	}
+	if (!m_hiZ.initialize(directory)) {
+		return 6;
+	}
+
+	glGenQueries(NumQueries, m_primitiveQueries);
+	glGenQueries(NumQueries, m_timeQueries);
+
+	createCube();
+	createCity();
+	m_softwareOcclusion.resize(m_softwareWidth, m_softwareHeight);
+
+	// The city is seen from the street: far buildings are small
+	m_camera.setFar(2.0f * GridSize * Spacing);
+
+	// Setup projection matrix and framebuffer (a bit hacky)
+	FramebufferSizeCallback(m_windowWidth, m_windowHeight);
+
+	return 0;
+}
+
+void MainWindow::createCube()
+{
+	// One face per axis and side, normal along the axis (counter
+	// clockwise seen from outside)
+	std::vector<glm::vec3> vertices; // Position, normal
+	std::vector<GLuint> indices;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const int u = (axis + 1) % 3;
+		const int v = (axis + 2) % 3;
+		for (int side = 0; side < 2; ++side)
+		{
+			glm::vec3 normal(0.0f);
+			normal[axis] = side ? 1.0f : -1.0f;
+			const GLuint first = GLuint(vertices.size() / 2);
+			const glm::vec2 corners[4] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+			for (const glm::vec2& corner : corners) {
+				glm::vec3 position(0.0f);
+				position[axis] = float(side);
+				position[u] = corner.x;
+				position[v] = corner.y;
+				vertices.push_back(position);
+				vertices.push_back(normal);
+			}
+			const GLuint front[6] = { 0, 1, 2, 0, 2, 3 };
+			const GLuint back[6] = { 0, 2, 1, 0, 3, 2 };
+			for (GLuint i : side ? front : back) {
+				indices.push_back(first + i);
+			}
+		}
+	}
+	m_cubeIndices = GLuint(indices.size());
+
+	glGenVertexArrays(1, &m_cubeVAO);
+	glGenBuffers(2, m_cubeBuffers);
+	glBindVertexArray(m_cubeVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, m_cubeBuffers[0]);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (void*)0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (void*)sizeof(glm::vec3));
+	glEnableVertexAttribArray(1);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_cubeBuffers[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+	glBindVertexArray(0);
+}
+
+void MainWindow::createCity()
+{
+	// Ground, then a building per cell of the grid (a few towers)
+	PCG32 rng(11);
+	const float half = 0.5f * GridSize * Spacing;
+	m_boxes.clear();
+	m_boxes.push_back({ glm::vec4(-half, -0.1f, -half, 0.0f), glm::vec4(half, 0.0f, half, 0.0f) });
+	for (int z = 0; z < GridSize; ++z) {
+		for (int x = 0; x < GridSize; ++x) {
+			const glm::vec2 center((x + 0.5f) * Spacing - half, (z + 0.5f) * Spacing - half);
+			const glm::vec2 footprint(rng.nextFloat(2.0f, 4.0f), rng.nextFloat(2.0f, 4.0f));
+			const float height = rng.nextFloat() < 0.1f ? rng.nextFloat(20.0f, 40.0f) : rng.nextFloat(3.0f, 12.0f);
+			m_boxes.push_back({
+				glm::vec4(center.x - 0.5f * footprint.x, 0.0f, center.y - 0.5f * footprint.y, 0.0f),
+				glm::vec4(center.x + 0.5f * footprint.x, height, center.y + 0.5f * footprint.y, 0.0f) });
+		}
+	}
+	const GLuint count = GLuint(m_boxes.size());
+
+	// Without culling (and until the first culling): every object
+	std::vector<GLuint> all(count);
+	for (GLuint i = 0; i < count; ++i) {
+		all[i] = i;
+	}
+	const HiZBuffer::DrawCommand command = { m_cubeIndices, count, 0, 0, 0 };
+
+	glGenBuffers(1, &m_boundsBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_boundsBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, m_boxes.size() * sizeof(SoftwareOcclusion::Box), m_boxes.data(), GL_STATIC_DRAW);
+	glGenBuffers(1, &m_allBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_allBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, all.size() * sizeof(GLuint), all.data(), GL_STATIC_DRAW);
+	glGenBuffers(1, &m_visibleBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_visibleBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, all.size() * sizeof(GLuint), all.data(), GL_DYNAMIC_DRAW);
+	glGenBuffers(1, &m_occluderBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_occluderBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, all.size() * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+	glGenBuffers(1, &m_commandBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_commandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(command), &command, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void MainWindow::createFramebuffer(int width, int height)
+{
+	releaseFramebuffer();
+	m_width = width;
+	m_height = height;
+
+	glGenTextures(1, &m_colorTexture);
+	glBindTexture(GL_TEXTURE_2D, m_colorTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+	// Depth texture: read by the Hi-Z reduction (texelFetch)
+	glGenTextures(1, &m_depthTexture);
+	glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &m_fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_colorTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depthTexture, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "Error: the framebuffer is not complete\n";
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// The pyramid of the previous size is useless
+	m_hiZ.create(width, height);
+	m_hiZValid = false;
+}
+
+void MainWindow::releaseFramebuffer()
+{
+	if (m_fbo != 0) {
+		glDeleteFramebuffers(1, &m_fbo);
+		glDeleteTextures(1, &m_colorTexture);
+		glDeleteTextures(1, &m_depthTexture);
+		m_fbo = m_colorTexture = m_depthTexture = 0;
+	}
+}
+
+void MainWindow::RenderImgui()
+{
+	// Start the Dear ImGui frame
+	ImGui_ImplOpenGL3_NewFrame();
+	ImGui_ImplGlfw_NewFrame();
+	ImGui::NewFrame();
+
+	//imgui
+	{
+		ImGui::Begin("Occlusion culling");
+		ImGui::Text("Application average %.3f ms/frame (%.1f FPS)",
+		1000.0/double(ImGui::GetIO().Framerate), double(ImGui::GetIO().Framerate));
+		ImGui::Text("GPU (culling and draw): %.3f ms", m_gpuTime);
+		ImGui::Combo("Culling", &m_cullingMode, "None\0Frustum\0Hi-Z (occluder pre-pass)\0Hi-Z (previous frame)\0Software (CPU)\0");
+		ImGui::Checkbox("Freeze culling", &m_freezeCulling);
+		ImGui::Text("Drawn: %u / %zu objects (%llu triangles)",
+			GLuint(m_drawnTriangles / (m_cubeIndices / 3)), m_boxes.size(), (unsigned long long)m_drawnTriangles);
+		if (m_cullingMode == HiZOccluders || m_cullingMode == Software) {
+			ImGui::InputInt("Occluders", &m_numOccluders);
+			m_numOccluders = std::max(0, std::min(m_numOccluders, int(m_boxes.size()) - 1));
+		}
+		if (m_cullingMode == HiZOccluders || m_cullingMode == HiZPreviousFrame) {
+			ImGui::Text("Hi-Z: %d levels", m_hiZ.numLevels());
+		}
+		if (m_cullingMode == Software) {
+			ImGui::Text("Depth buffer %dx%d (%u threads)", m_softwareWidth, m_softwareHeight, JobSystem::instance().numThreads());
+			ImGui::Text("Rasterize: %.3f ms, test: %.3f ms", m_rasterizeTime, m_testTime);
+		}
+		ImGui::End();
+	}
+
+	ImGui::Render();
+	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+}
+
+void MainWindow::SelectOccluders()
+{
+	// Distance from the camera to the buildings in front of it (the
+	// ground hides nothing from the street)
+	const glm::vec3 eye = m_camera.position();
+	const glm::mat4 view = m_camera.viewMatrix();
+	const glm::vec3 forward = -glm::vec3(view[0][2], view[1][2], view[2][2]);
+	m_occluderDistances.clear();
+	for (GLuint i = 1; i < GLuint(m_boxes.size()); ++i)
+	{
+		const glm::vec3 boxMin(m_boxes[i].min);
+		const glm::vec3 boxMax(m_boxes[i].max);
+		const glm::vec3 toBox = glm::max(glm::max(boxMin - eye, eye - boxMax), glm::vec3(0.0f));
+		const glm::vec3 center = 0.5f * (boxMin + boxMax);
+		if (glm::dot(center - eye, forward) < -0.5f * glm::length(boxMax - boxMin)) {
+			continue; // Behind the camera
+		}
+		m_occluderDistances.push_back({ glm::dot(toBox, toBox), i });
+	}
+	const std::size_t count = std::min(std::size_t(m_numOccluders), m_occluderDistances.size());
+	std::nth_element(m_occluderDistances.begin(), m_occluderDistances.begin() + count, m_occluderDistances.end());
+	m_occluders.clear();
+	for (std::size_t i = 0; i < count; ++i) {
+		m_occluders.push_back(m_occluderDistances[i].second);
+	}
+}
+
+void MainWindow::CullObjects(const glm::mat4& viewProj)
+{
+	const GLuint count = GLuint(m_boxes.size());
+	switch (m_cullingMode)
+	{
+	case NoCulling:
+		break; // m_allBuffer is drawn
+	case FrustumOnly:
+		m_hiZ.cull(m_boundsBuffer, count, m_visibleBuffer, m_commandBuffer, m_cubeIndices, viewProj, nullptr);
+		break;
+	case HiZOccluders:
+		// Depth of the occluders, then pyramid and culling with the same camera
+		SelectOccluders();
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_occluderBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, m_occluders.size() * sizeof(GLuint), m_occluders.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		DrawOccluders(viewProj);
+		m_hiZ.build(m_depthTexture);
+		m_hiZViewProj = viewProj;
+		m_hiZValid = true;
+		m_hiZ.cull(m_boundsBuffer, count, m_visibleBuffer, m_commandBuffer, m_cubeIndices, viewProj, &m_hiZViewProj);
+		break;
+	case HiZPreviousFrame:
+		// Pyramid of the last frame (built after its draw, see RenderScene)
+		m_hiZ.cull(m_boundsBuffer, count, m_visibleBuffer, m_commandBuffer, m_cubeIndices, viewProj,
+			m_hiZValid ? &m_hiZViewProj : nullptr);
+		break;
+	case Software:
+	{
+		const auto start = std::chrono::high_resolution_clock::now();
+		SelectOccluders();
+		m_softwareOcclusion.begin(viewProj);
+		for (GLuint occluder : m_occluders) {
+			m_softwareOcclusion.rasterizeBox(glm::vec3(m_boxes[occluder].min), glm::vec3(m_boxes[occluder].max));
+		}
+		const auto rasterized = std::chrono::high_resolution_clock::now();
+		m_softwareOcclusion.cull(m_boxes.data(), m_boxes.size(), m_softwareVisible);
+		const auto end = std::chrono::high_resolution_clock::now();
+		m_rasterizeTime = std::chrono::duration<float, std::milli>(rasterized - start).count();
+		m_testTime = std::chrono::duration<float, std::milli>(end - rasterized).count();
+
+		// Same buffers as the GPU culling
+		const HiZBuffer::DrawCommand command = { m_cubeIndices, GLuint(m_softwareVisible.size()), 0, 0, 0 };
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_visibleBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, m_softwareVisible.size() * sizeof(uint32_t), m_softwareVisible.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_commandBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(command), &command);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		break;
+	}
+	}
+}
+
+void MainWindow::DrawOccluders(const glm::mat4& viewProj)
+{
+	// Depth only (the occluders are drawn again with the visible objects)
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	m_cityShader->bind();
+	m_cityShader->setMat4(m_cityUniforms.viewProj, viewProj);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, HiZBuffer::BoundsBinding, m_boundsBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, HiZBuffer::VisibleBinding, m_occluderBuffer);
+	glBindVertexArray(m_cubeVAO);
+	glDrawElementsInstanced(GL_TRIANGLES, m_cubeIndices, GL_UNSIGNED_INT, nullptr, GLsizei(m_occluders.size()));
+	glBindVertexArray(0);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void MainWindow::DrawCity(const glm::mat4& viewProj)
+{
+	m_cityShader->bind();
+	m_cityShader->setMat4(m_cityUniforms.viewProj, viewProj);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, HiZBuffer::BoundsBinding, m_boundsBuffer);
+	glBindVertexArray(m_cubeVAO);
+	if (m_cullingMode == NoCulling)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, HiZBuffer::VisibleBinding, m_allBuffer);
+		glDrawElementsInstanced(GL_TRIANGLES, m_cubeIndices, GL_UNSIGNED_INT, nullptr, GLsizei(m_boxes.size()));
+	}
+	else
+	{
+		// Number of instances written by the culling (no read back)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, HiZBuffer::VisibleBinding, m_visibleBuffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+		glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+	glBindVertexArray(0);
+}
+
+void MainWindow::RenderScene()
+{
+	const glm::mat4 viewProj = m_camera.projectionMatrix() * m_camera.viewMatrix();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+	glViewport(0, 0, m_width, m_height);
+	glEnable(GL_DEPTH_TEST);
+	// The occluders of the pre-pass are drawn again at the same depth
+	glDepthFunc(GL_LEQUAL);
+	glClearColor(0.55f, 0.7f, 0.85f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	glBeginQuery(GL_TIME_ELAPSED, m_timeQueries[m_query]);
+	if (!m_freezeCulling) {
+		CullObjects(viewProj);
+	}
+	glBeginQuery(GL_PRIMITIVES_GENERATED, m_primitiveQueries[m_query]);
+	DrawCity(viewProj);
+	glEndQuery(GL_PRIMITIVES_GENERATED);
+	if (m_cullingMode == HiZPreviousFrame && !m_freezeCulling) {
+		// For the culling of the next frame
+		m_hiZ.build(m_depthTexture);
+		m_hiZViewProj = viewProj;
+		m_hiZValid = true;
+	}
+	glEndQuery(GL_TIME_ELAPSED);
+	m_query = (m_query + 1) % NumQueries;
+	m_frames++;
+	readQueries();
+
+	// Copy to the window
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDisable(GL_DEPTH_TEST);
+}
+
+void MainWindow::readQueries()
+{
+	// Oldest queries (NumQueries - 1 frames ago), never wait for them
+	if (m_frames < NumQueries) {
+		return;
+	}
+	GLint available = 0;
+	glGetQueryObjectiv(m_timeQueries[m_query], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (available) {
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(m_timeQueries[m_query], GL_QUERY_RESULT, &elapsed);
+		m_gpuTime = float(elapsed) * 1e-6f;
+	}
+	glGetQueryObjectiv(m_primitiveQueries[m_query], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (available) {
+		glGetQueryObjectui64v(m_primitiveQueries[m_query], GL_QUERY_RESULT, &m_drawnTriangles);
+	}
+}
+
+int MainWindow::RenderLoop()
+{
+	float time = float(glfwGetTime());
+	while (!glfwWindowShouldClose(m_window))
+	{
+		// Compute delta time between two frames
+		float new_time = float(glfwGetTime());
+		const float delta_time = new_time - time;
+		time = new_time;
+
+		// Check inputs: Does ESC was pressed?
+		if (glfwGetKey(m_window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+			glfwSetWindowShouldClose(m_window, true);
+		if (!m_imGuiActive) {
+			m_camera.keybordEvents(m_window, delta_time);
+		}
+
+		RenderScene();
+		RenderImgui();
+
+		// Show rendering and get events
+		glfwSwapBuffers(m_window);
+		glfwPollEvents();
+		m_imGuiActive = ImGui::IsAnyItemActive();
+	}
+
+	cleanup();
+	return 0;
+}
+
+void MainWindow::cleanup()
+{
+	// Cleanup
+	ImGui_ImplOpenGL3_Shutdown();
+	ImGui_ImplGlfw_Shutdown();
+	ImGui::DestroyContext();
+
+	// Cleanup (OpenGL objects need the context)
+	releaseFramebuffer();
+	m_hiZ.release();
+	const GLuint buffers[] = { m_boundsBuffer, m_allBuffer, m_visibleBuffer, m_commandBuffer, m_occluderBuffer };
+	glDeleteBuffers(5, buffers);
+	glDeleteBuffers(2, m_cubeBuffers);
+	glDeleteVertexArrays(1, &m_cubeVAO);
+	glDeleteQueries(NumQueries, m_primitiveQueries);
+	glDeleteQueries(NumQueries, m_timeQueries);
+	glfwDestroyWindow(m_window);
+	glfwTerminate();
+}
+
+void MainWindow::FramebufferSizeCallback(int width, int height)
+{
+	// make sure the viewport matches the new window dimensions; note that width and
+	// height will be significantly larger than specified on retina displays.
+	glViewport(0, 0, width, height);
+	m_camera.viewportEvents(width, height);
+	if (width > 0 && height > 0) {
+		createFramebuffer(width, height); // Minimized: keep the old one
+	}
+}
+
+void MainWindow::CursorPositionCallback(double xpos, double ypos) {
+	if (!m_imGuiActive) {
+		int state = glfwGetMouseButton(m_window, GLFW_MOUSE_BUTTON_LEFT);
+		m_camera.mouseEvents(glm::vec2(xpos, ypos), state == GLFW_PRESS);
+	}
+}
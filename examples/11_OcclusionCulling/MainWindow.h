@@ -0,0 +1,117 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "ShaderProgram.h"
+#include "Camera.h"
+#include "HiZBuffer.h"
+#include "SoftwareOcclusion.h"
+
+class MainWindow
+{
+public:
+	MainWindow();
+
+	// Main functions (initialization, run)
+	int Initialisation();
+	int RenderLoop();
+
+	// Callback to intersept GLFW calls
+	void FramebufferSizeCallback(int width, int height);
+	void CursorPositionCallback(double xpos, double ypos);
+
+private:
+	// Initialize GLFW callbacks
+	void InitializeCallback();
+	// Intiialize OpenGL objects (shaders, ...)
+	int InitializeGL();
+	void createCity();
+	void createCube();
+	void createFramebuffer(int width, int height);
+	void releaseFramebuffer();
+
+	// Rendering scene (OpenGL)
+	void RenderScene();
+	void RenderImgui();
+	// Objects to draw this frame (visible list and draw command)
+	void CullObjects(const glm::mat4& viewProj);
+	// Nearest buildings in front of the camera (m_occluders)
+	void SelectOccluders();
+	// Instances of the list bound to VisibleBinding (depth only for the occluders)
+	void DrawOccluders(const glm::mat4& viewProj);
+	void DrawCity(const glm::mat4& viewProj);
+	void readQueries();
+	void cleanup();
+
+private:
+	// settings (before the camera: used by its constructor)
+	const unsigned int m_windowWidth = 1280;
+	const unsigned int m_windowHeight = 720;
+	GLFWwindow* m_window = nullptr;
+
+	// Camera
+	Camera m_camera;
+	bool m_imGuiActive = false;
+
+	// City: a grid of buildings on a ground (object 0), one box per object
+	static const int GridSize = 64;
+	std::vector<SoftwareOcclusion::Box> m_boxes;
+	GLuint m_boundsBuffer = 0;   // Boxes (SSBO, HiZBuffer::BoundsBinding)
+	GLuint m_allBuffer = 0;      // 0 .. n - 1 (no culling)
+	GLuint m_visibleBuffer = 0;  // Visible objects (written by the culling)
+	GLuint m_commandBuffer = 0;  // HiZBuffer::DrawCommand (instanceCount: visible objects)
+	GLuint m_occluderBuffer = 0; // Occluders of the frame
+
+	// Unit cube (positions in [0, 1], normals), drawn once per object
+	GLuint m_cubeVAO = 0;
+	GLuint m_cubeBuffers[2] = { 0, 0 }; // Vertices, indices
+	GLuint m_cubeIndices = 0;
+
+	// The scene is drawn in a framebuffer: the depth texture is the input
+	// of the Hi-Z pyramid, the color is copied to the window
+	GLuint m_fbo = 0;
+	GLuint m_colorTexture = 0;
+	GLuint m_depthTexture = 0;
+	int m_width = 0;
+	int m_height = 0;
+
+	// Culling
+	enum CullingMode { NoCulling, FrustumOnly, HiZOccluders, HiZPreviousFrame, Software, NumCullingModes };
+	int m_cullingMode = HiZOccluders;
+	bool m_freezeCulling = false; // Keep the last visible list (move to see what is culled)
+	HiZBuffer m_hiZ;
+	bool m_hiZValid = false;      // The pyramid holds a depth buffer of m_hiZViewProj
+	glm::mat4 m_hiZViewProj = glm::mat4(1.0f);
+	// Occluders: the m_numOccluders nearest buildings, drawn in the depth
+	// pre-pass (HiZOccluders) or rasterized on the CPU (Software)
+	int m_numOccluders = 128;
+	std::vector<GLuint> m_occluders;
+	std::vector<std::pair<float, GLuint>> m_occluderDistances;
+	SoftwareOcclusion m_softwareOcclusion;
+	int m_softwareWidth = 320;
+	int m_softwareHeight = 180;
+	std::vector<uint32_t> m_softwareVisible;
+	float m_rasterizeTime = 0.0f; // CPU times of the software culling (ms)
+	float m_testTime = 0.0f;
+
+	// Triangles drawn and GPU time of the frame (a few frames late)
+	static const int NumQueries = 3;
+	GLuint m_primitiveQueries[NumQueries];
+	GLuint m_timeQueries[NumQueries];
+	int m_query = 0;
+	int m_frames = 0; // The queries are read once they have all been used
+	GLuint64 m_drawnTriangles = 0;
+	float m_gpuTime = 0.0f;
+
+	// Shader (boxes of the visible list)
+	std::unique_ptr<ShaderProgram> m_cityShader;
+	struct {
+		GLint viewProj = -1;
+	} m_cityUniforms;
+};
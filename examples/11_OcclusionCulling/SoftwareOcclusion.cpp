@@ -0,0 +1,267 @@
+#include "SoftwareOcclusion.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define OCCLUSION_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+	const float MinW = 1e-6f;            // Vertices closer to the camera plane are skipped
+	const std::size_t CullGrain = 256;   // Boxes per job
+
+	// Corner i of a box (bit 0: x, bit 1: y, bit 2: z)
+	glm::vec3 corner(const glm::vec3& boxMin, const glm::vec3& boxMax, int i)
+	{
+		return glm::vec3((i & 1) ? boxMax.x : boxMin.x, (i & 2) ? boxMax.y : boxMin.y, (i & 4) ? boxMax.z : boxMin.z);
+	}
+
+	// Faces of a box (quads, corners as above): drawn whole, a diagonal
+	// would leave pixels partly covered by both triangles
+	const int BoxFaces[6][4] = {
+		{ 0, 2, 3, 1 }, // z min
+		{ 4, 5, 7, 6 }, // z max
+		{ 0, 1, 5, 4 }, // y min
+		{ 2, 6, 7, 3 }, // y max
+		{ 0, 4, 6, 2 }, // x min
+		{ 1, 3, 7, 5 }, // x max
+	};
+}
+
+void SoftwareOcclusion::resize(int width, int height)
+{
+	m_width = width;
+	m_height = height;
+	m_stride = (width + 3) & ~3;
+	m_depth.assign(std::size_t(m_stride) * height, 1.0f);
+}
+
+void SoftwareOcclusion::begin(const glm::mat4& viewProj)
+{
+	m_viewProj = viewProj;
+	std::fill(m_depth.begin(), m_depth.end(), 1.0f);
+}
+
+bool SoftwareOcclusion::toScreen(const glm::vec3& p, glm::vec3& screen) const
+{
+	const glm::vec4 clip = m_viewProj * glm::vec4(p, 1.0f);
+	if (clip.w <= MinW) {
+		return false;
+	}
+	const glm::vec3 ndc = glm::vec3(clip) / clip.w;
+	screen = glm::vec3((ndc.x * 0.5f + 0.5f) * m_width, (ndc.y * 0.5f + 0.5f) * m_height, ndc.z * 0.5f + 0.5f);
+	return true;
+}
+
+void SoftwareOcclusion::rasterizeBox(const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+	glm::vec3 screen[8];
+	bool valid[8];
+	for (int i = 0; i < 8; ++i) {
+		valid[i] = toScreen(corner(boxMin, boxMax, i), screen[i]);
+	}
+	for (const int* f : BoxFaces) {
+		if (valid[f[0]] && valid[f[1]] && valid[f[2]] && valid[f[3]]) {
+			const glm::vec3 face[4] = { screen[f[0]], screen[f[1]], screen[f[2]], screen[f[3]] };
+			rasterizeScreen(face, 4);
+		}
+	}
+}
+
+void SoftwareOcclusion::rasterizeTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+	glm::vec3 screen[3];
+	if (toScreen(a, screen[0]) && toScreen(b, screen[1]) && toScreen(c, screen[2])) {
+		rasterizeScreen(screen, 3);
+	}
+}
+
+void SoftwareOcclusion::rasterizeScreen(const glm::vec3* vertices, int count)
+{
+	// Counter clockwise: the edge functions are positive inside
+	float area = 0.0f;
+	for (int i = 0; i < count; ++i) {
+		const glm::vec3& p = vertices[i];
+		const glm::vec3& q = vertices[(i + 1) % count];
+		area += p.x * q.y - q.x * p.y;
+	}
+	if (area == 0.0f) {
+		return;
+	}
+	glm::vec3 v[4];
+	for (int i = 0; i < count; ++i) {
+		v[i] = area > 0.0f ? vertices[i] : vertices[count - 1 - i];
+	}
+
+	// Depth plane z(x, y) = z0 + dzdx x + dzdy y (the polygon is planar)
+	const glm::vec3 ab = v[1] - v[0];
+	const glm::vec3 ac = v[2] - v[0];
+	const float det = ab.x * ac.y - ab.y * ac.x;
+	if (det == 0.0f) {
+		return;
+	}
+	const float dzdx = (ab.z * ac.y - ac.z * ab.y) / det;
+	const float dzdy = (ac.z * ab.x - ab.z * ac.x) / det;
+	// Farthest depth of the polygon over the pixel (not at its center)
+	const float z0 = v[0].z - dzdx * v[0].x - dzdy * v[0].y + 0.5f * (std::abs(dzdx) + std::abs(dzdy));
+
+	// Edge functions E(x, y) = A x + B y + C of the edges v[i] v[i + 1],
+	// moved inside by half a pixel: E >= 0 at the center of a pixel when
+	// the whole pixel is inside (a triangle has a 4th edge always true)
+	float A[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	float B[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	float C[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < count; ++i) {
+		const glm::vec3& p = v[i];
+		const glm::vec3& q = v[(i + 1) % count];
+		A[i] = p.y - q.y;
+		B[i] = q.x - p.x;
+		C[i] = p.x * q.y - p.y * q.x - 0.5f * (std::abs(A[i]) + std::abs(B[i]));
+	}
+
+	// Pixels that may be inside
+	float xMin = v[0].x, xMax = v[0].x, yMin = v[0].y, yMax = v[0].y;
+	for (int i = 1; i < count; ++i) {
+		xMin = std::min(xMin, v[i].x);
+		xMax = std::max(xMax, v[i].x);
+		yMin = std::min(yMin, v[i].y);
+		yMax = std::max(yMax, v[i].y);
+	}
+	const int x0 = std::max(0, int(std::floor(xMin)));
+	const int x1 = std::min(m_width - 1, int(std::floor(xMax)));
+	const int y0 = std::max(0, int(std::floor(yMin)));
+	const int y1 = std::min(m_height - 1, int(std::floor(yMax)));
+	if (x0 > x1 || y0 > y1) {
+		return;
+	}
+
+	// Groups of 4 pixels (the padding of the rows can be written)
+	const int first = x0 & ~3;
+	for (int y = y0; y <= y1; ++y)
+	{
+		const float py = y + 0.5f;
+		float* row = &m_depth[std::size_t(y) * m_stride];
+#ifdef OCCLUSION_X86
+		const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+		const __m128 zero = _mm_setzero_ps();
+		for (int x = first; x <= x1; x += 4)
+		{
+			const __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), offsets);
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int i = 0; i < 4; ++i) {
+				const __m128 e = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A[i]), px), _mm_set1_ps(B[i] * py + C[i]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(e, zero));
+			}
+			if (_mm_movemask_ps(inside) == 0) {
+				continue;
+			}
+			const __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(dzdx), px), _mm_set1_ps(dzdy * py + z0));
+			const __m128 depth = _mm_loadu_ps(row + x);
+			// Nearest depth inside the polygon (SSE2 has no blend: and/andnot/or)
+			const __m128 nearest = _mm_min_ps(depth, z);
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, depth)));
+		}
+#else
+		for (int x = x0; x <= x1; ++x)
+		{
+			const float px = x + 0.5f;
+			bool inside = true;
+			for (int i = 0; i < count; ++i) {
+				inside = inside && A[i] * px + B[i] * py + C[i] >= 0.0f;
+			}
+			if (inside) {
+				row[x] = std::min(row[x], dzdx * px + dzdy * py + z0);
+			}
+		}
+#endif
+	}
+}
+
+bool SoftwareOcclusion::isVisible(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+{
+	// Frustum: outside if all the corners are on the outer side of a plane
+	glm::vec4 clip[8];
+	glm::bvec3 allBelow(true), allAbove(true);
+	bool behind = false;
+	for (int i = 0; i < 8; ++i) {
+		clip[i] = m_viewProj * glm::vec4(corner(boxMin, boxMax, i), 1.0f);
+		const glm::vec3 c(clip[i]);
+		allBelow = glm::bvec3(allBelow.x && c.x < -clip[i].w, allBelow.y && c.y < -clip[i].w, allBelow.z && c.z < -clip[i].w);
+		allAbove = glm::bvec3(allAbove.x && c.x > clip[i].w, allAbove.y && c.y > clip[i].w, allAbove.z && c.z > clip[i].w);
+		behind |= clip[i].w <= MinW;
+	}
+	if (glm::any(allBelow) || glm::any(allAbove)) {
+		return false;
+	}
+	if (behind) {
+		return true; // Crosses the plane of the camera
+	}
+
+	// Rectangle and nearest depth of the box
+	glm::vec2 rectMin(std::numeric_limits<float>::max());
+	glm::vec2 rectMax(-std::numeric_limits<float>::max());
+	float nearest = 1.0f;
+	for (int i = 0; i < 8; ++i) {
+		const glm::vec3 ndc = glm::vec3(clip[i]) / clip[i].w;
+		rectMin = glm::min(rectMin, glm::vec2(ndc));
+		rectMax = glm::max(rectMax, glm::vec2(ndc));
+		nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+	}
+	if (nearest <= 0.0f) {
+		return true;
+	}
+	const int x0 = std::max(0, int(std::floor((rectMin.x * 0.5f + 0.5f) * m_width)));
+	const int x1 = std::min(m_width - 1, int(std::floor((rectMax.x * 0.5f + 0.5f) * m_width)));
+	const int y0 = std::max(0, int(std::floor((rectMin.y * 0.5f + 0.5f) * m_height)));
+	const int y1 = std::min(m_height - 1, int(std::floor((rectMax.y * 0.5f + 0.5f) * m_height)));
+
+	// Visible if the occluders are farther somewhere in the rectangle
+	const int first = x0 & ~3;
+	for (int y = y0; y <= y1; ++y)
+	{
+		const float* row = &m_depth[std::size_t(y) * m_stride];
+#ifdef OCCLUSION_X86
+		const __m128 z = _mm_set1_ps(nearest);
+		const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+		const __m128i firstColumn = _mm_set1_epi32(x0 - 1);
+		const __m128i lastColumn = _mm_set1_epi32(x1 + 1);
+		for (int x = first; x <= x1; x += 4)
+		{
+			// Columns of the group in [x0, x1]
+			const __m128i columns = _mm_add_epi32(_mm_set1_epi32(x), lanes);
+			const __m128i inRange = _mm_and_si128(_mm_cmpgt_epi32(columns, firstColumn), _mm_cmplt_epi32(columns, lastColumn));
+			const __m128 farther = _mm_and_ps(_mm_cmpgt_ps(_mm_loadu_ps(row + x), z), _mm_castsi128_ps(inRange));
+			if (_mm_movemask_ps(farther) != 0) {
+				return true;
+			}
+		}
+#else
+		for (int x = x0; x <= x1; ++x) {
+			if (row[x] > nearest) {
+				return true;
+			}
+		}
+#endif
+	}
+	return false;
+}
+
+void SoftwareOcclusion::cull(const Box* boxes, std::size_t count, std::vector<uint32_t>& visible) const
+{
+	std::vector<uint8_t> flags(count);
+	JobSystem::instance().parallelFor(0, count, CullGrain, [&](std::size_t begin, std::size_t end) {
+		for (std::size_t i = begin; i < end; ++i) {
+			flags[i] = isVisible(glm::vec3(boxes[i].min), glm::vec3(boxes[i].max)) ? 1 : 0;
+		}
+	});
+	visible.clear();
+	for (std::size_t i = 0; i < count; ++i) {
+		if (flags[i]) {
+			visible.push_back(uint32_t(i));
+		}
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Occlusion culling on the CPU (fallback of HiZBuffer, no OpenGL)
+//
+// A few large objects close to the camera (occluders) are rasterized in
+// a small depth buffer (e.g. 320x180), then the box of each object is
+// tested against it: it is visible if the buffer is farther than its
+// nearest point somewhere in its rectangle.
+// - rasterization: edge functions and depth evaluated for 4 pixels at
+//   once (SSE, scalar fallback), nearest depth kept
+// - test: 4 pixels compared at once, stops at the first visible pixel;
+//   the boxes are tested in parallel (JobSystem)
+// The culling is conservative (never hides a visible object): an occluder
+// only writes the pixels it covers entirely (edges moved inside by half a
+// pixel), with its farthest depth over the pixel. The faces crossing the
+// near plane are skipped (no clipping) and the pixels along the edges of
+// the faces stay empty: both only hide fewer objects.
+//
+// Usage (each frame):
+// occlusion.begin(viewProj);
+// occlusion.rasterizeBox(occluderMin, occluderMax); // For each occluder
+// occlusion.cull(boxes, numBoxes, visible);
+class SoftwareOcclusion
+{
+public:
+	struct Box {
+		glm::vec4 min; // World space (w unused), as the SSBO of the GPU culling
+		glm::vec4 max;
+	};
+
+	SoftwareOcclusion() = default;
+
+	// ------------------------------------------------------------------------
+	// size of the depth buffer (pixels)
+	void resize(int width, int height);
+
+	// ------------------------------------------------------------------------
+	// clear the depth buffer, camera of the frame (world to clip space)
+	void begin(const glm::mat4& viewProj);
+	// draw the faces of a box (occluder) in the depth buffer
+	void rasterizeBox(const glm::vec3& boxMin, const glm::vec3& boxMax);
+	// draw a triangle (world space, any winding)
+	void rasterizeTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+
+	// ------------------------------------------------------------------------
+	// true if the box is in the frustum and not hidden by the occluders
+	bool isVisible(const glm::vec3& boxMin, const glm::vec3& boxMax) const;
+	// indices of the visible boxes (in parallel)
+	void cull(const Box* boxes, std::size_t count, std::vector<uint32_t>& visible) const;
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+	// Depth of the pixels ([0, 1] as the OpenGL depth buffer, 1: empty),
+	// rows of stride() floats
+	const float* depth() const { return m_depth.data(); }
+	int stride() const { return m_stride; }
+
+private:
+	// Vertex in the depth buffer (pixels, depth), false if w <= 0
+	bool toScreen(const glm::vec3& p, glm::vec3& screen) const;
+	// convex polygon of 3 or 4 vertices in the depth buffer (vertices from
+	// toScreen, planar, any winding)
+	void rasterizeScreen(const glm::vec3* vertices, int count);
+
+private:
+	int m_width = 0;
+	int m_height = 0;
+	int m_stride = 0; // Width rounded to 4 pixels
+	std::vector<float> m_depth;
+	glm::mat4 m_viewProj = glm::mat4(1.0f);
+};
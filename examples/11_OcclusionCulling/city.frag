@@ -0,0 +1,23 @@
+#version 430 core
+
+in vec3 fNormal;
+flat in uint fObject;
+
+out vec4 oColor;
+
+// Color of an object (the ground, object 0, is grey)
+vec3 objectColor(uint object) {
+    if (object == 0u) {
+        return vec3(0.35);
+    }
+    uint h = object * 747796405u + 2891336453u;
+    h = ((h >> ((h >> 28u) + 4u)) ^ h) * 277803737u;
+    h = (h >> 22u) ^ h;
+    return vec3(0.45) + 0.4 * vec3(h & 255u, (h >> 8u) & 255u, (h >> 16u) & 255u) / 255.0;
+}
+
+void main() {
+    const vec3 lightDirection = normalize(vec3(0.4, 1.0, 0.3));
+    float diffuse = max(0.0, dot(normalize(fNormal), lightDirection));
+    oColor = vec4(objectColor(fObject) * (0.3 + 0.7 * diffuse), 1.0);
+}
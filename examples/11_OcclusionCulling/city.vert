@@ -0,0 +1,33 @@
+#version 430 core
+
+// Unit cube instanced on the boxes of the city: the instance reads its
+// object in the list of the visible objects (written by the culling)
+
+layout(location = 0) in vec3 vPosition; // [0, 1]
+layout(location = 1) in vec3 vNormal;
+
+struct Bounds {
+    vec4 boxMin; // World space (w unused)
+    vec4 boxMax;
+};
+
+layout(binding = 0, std430) readonly buffer ssbo1 {
+    Bounds bounds[];
+};
+
+layout(binding = 1, std430) readonly buffer ssbo2 {
+    uint visible[];
+};
+
+uniform mat4 viewProj;
+
+out vec3 fNormal;
+flat out uint fObject;
+
+void main() {
+    uint object = visible[gl_InstanceID];
+    vec3 position = mix(bounds[object].boxMin.xyz, bounds[object].boxMax.xyz, vPosition);
+    gl_Position = viewProj * vec4(position, 1.0);
+    fNormal = vNormal;
+    fObject = object;
+}
@@ -6,8 +6,15 @@
 
 #include <iostream>
 #include <memory>
+#include <vector>
 
 #include "ShaderProgram.h"
+#include "ShadowPass.h"
+#include "ShadowCascades.h"
+#include "ShadowFilter.h"
+#include "ShadowCache.h"
+#include "PointShadow.h"
+#include "FrameTimer.h"
 
 class MainWindow
 {
@@ -26,6 +33,10 @@ private:
 	void InitializeCallback();
 	// Intiialize OpenGL objects (shaders, ...)
 	int InitializeGL();
+	// (Re)load the main shader (variant of the shadow filter)
+	int LoadMainShader();
+	// Load the shaders of the point light shadow (both layer modes)
+	int LoadCubeShadowShaders();
 
 	// Rendering scene (OpenGL)
 	void RenderScene();
@@ -37,8 +48,28 @@ private:
 	int InitGeometryFloor();
 	int InitPlane2D();
 
+	// Scene objects
+	enum Shape { CubeShape, FloorShape };
+	enum CasterSet { AllCasters, StaticCasters, DynamicCasters };
+	struct SceneObject {
+		Shape shape;
+		glm::mat4 model;
+		glm::vec4 color;
+		bool dynamic;
+	};
+	void BuildScene();
+	void DrawShape(Shape shape, int instances = 1);
+	void ObjectBounds(const SceneObject& object, glm::vec3& objectMin, glm::vec3& objectMax) const;
+	// Fill m_casters with the bounds of the objects (index = object)
+	void GatherCasters();
+
 	// Shadow map
-	void ShadowRender();
+	void ShadowRender(const glm::mat4& view);
+	void DrawCasters(const glm::mat4& lightViewProjMatrix, const std::vector<int>& visible, CasterSet casters);
+	// Point light: the 6 faces of the cube map in one pass
+	void PointShadowRender();
+	// (Re)allocate the shadow maps for the number of cascades
+	bool CreateShadowMaps();
 	
 	// Animation light position
 	void UpdateLightPosition(float delta_time);
@@ -51,17 +82,33 @@ private:
 	// Camera settings 
 	glm::vec3 m_eye, m_at, m_up;
 	glm::mat4 m_proj;
+	const float m_cameraNear = 0.01f;
+	const float m_cameraFar = 100.0f;
+	// Default framebuffer (size tracked by FramebufferSizeCallback)
+	ShadowPass::Target m_screen;
 
 	// Main shader
 	std::unique_ptr<ShaderProgram> m_mainShader = nullptr;
 	struct {
 		GLint MVMatrix = -1;
 		GLint ProjMatrix = -1;
-		GLint MLPMatrix = -1;
+		GLint ModelMatrix = -1;
 		GLint normalMatrix = -1;
 		GLint uColor = -1;
 		GLint texShadowMap = -1;
+		GLint cascadeMatrices = -1;
+		GLint cascadeSplits = -1;
+		GLint cascadeCount = -1;
+		GLint showCascades = -1;
+		GLint lightType = -1;
+		GLint lightDirectionCameraSpace = -1;
 		GLint lightPositionCameraSpace = -1;
+		GLint lightPositionWorld = -1;
+		GLint texShadowCube = -1;
+		GLint pointNear = -1;
+		GLint pointFar = -1;
+		GLint pointBiasScale = -1;
+		GLint filterRadius = -1;
 		GLint biasType = -1;
 		GLint biasValue = -1; 
 		GLint biasValueMin = -1;
@@ -73,14 +120,29 @@ private:
 		GLint MLP = -1;
 	} m_shadowMapUniforms;
 
+	// Point light shadow shaders: gl_Layer written by the vertex shader
+	// (GL_ARB_shader_viewport_layer_array) or by the geometry shader
+	enum CubeLayerMode { VertexLayer, GeometryLayer, NumCubeLayerModes };
+	std::unique_ptr<ShaderProgram> m_cubeShadowShaders[NumCubeLayerModes];
+	struct {
+		GLint ModelMatrix = -1;
+		GLint faceMatrices = -1;
+		GLint faces = -1;    // VertexLayer
+		GLint faceMask = -1; // GeometryLayer
+	} m_cubeShadowUniforms[NumCubeLayerModes];
+	bool m_vertexLayerSupported = false;
+	int m_cubeLayerMode = GeometryLayer;
+
 	// Debug shader
 	std::unique_ptr<ShaderProgram> m_debugShader = nullptr;
 	struct {
 		GLint tex = -1;
 		GLint scale = -1;
+		GLint layer = -1;
 	} m_debugUniforms;
 	bool m_debug = false;
 	float m_debugScale = 1.0f;
+	int m_debugLayer = 0;
 
 	// Light position
 	// - For animation
@@ -88,19 +150,51 @@ private:
 	double m_lightRadius;
 	double m_lightAngle;
 	double m_lightHeight;
-	// - Light position 3d
+	// - Light position 3d (directional light: the light comes from
+	//   this position towards the origin)
 	glm::vec3 m_lightPosition;
-	// - Matrix to project to the shadow map
-	glm::mat4 m_lightViewProjMatrix;
-	float m_lightNear = 0.1f;
-	float m_lightFar = 10.0f;
+	// - Directional light (cascades) or point light (cube map)
+	enum LightType { DirectionalLight, PointLight };
+	int m_lightType = DirectionalLight;
+	// - The point light turns between the cube and the pillars
+	const double m_pointLightRadius = 1.8;
+	const double m_pointLightHeight = 2.0;
+
+	// Cascaded shadow maps
+	ShadowCascades m_cascades;
+	ShadowCascades::Settings m_cascadeSettings;
+	bool m_showCascades = false;
+	// Bounds of the objects for the culling of the shadow pass
+	ShadowCasters m_casters;
+	int m_castersDrawn = 0; // Draws of the shadow pass this frame
 
 	// Shadow map information
+	// (memory budget: the cascades share SHADOW_SIZE_X * SHADOW_SIZE_Y texels)
 	const int SHADOW_SIZE_X = 2048;
 	const int SHADOW_SIZE_Y = 2048;
+	int m_cascadeSize = 0; // Resolution of a cascade
 	int m_biasType = 0;
-	float m_biasValue = 0.0005f;
+	float m_biasValue = 0.002f; // Linear depth of the orthographic cascades
 	float m_biasValueMin = 0.00005f;
+	ShadowPass m_shadowPass;
+	// Shadows of the static objects (copied in m_shadowPass each frame)
+	ShadowCache m_shadowCache;
+	bool m_useShadowCache = true;
+	int m_cachedCascades = 0; // Cascades reused from the cache this frame
+	// Point light shadow (depth cube map)
+	const int POINT_SHADOW_SIZE = 1024;
+	const float m_pointNear = 0.05f;
+	float m_pointBiasScale = 5.0f; // Bias relative to the distance: biasValue * scale
+	PointShadow m_pointShadow;
+	int m_pointFaces = 0; // Faces drawn this frame (sum over the casters)
+	// Filtering of the lookups (sampler objects and shader variant)
+	ShadowFilter m_shadowFilter;
+	ShadowFilter::Settings m_filterSettings;
+	// Call glFinish after the shadow pass (old behavior, to compare the timings)
+	bool m_synchronize = false;
+
+	// CPU and GPU time of the passes
+	FrameTimer m_frameTimer;
 
 
 	// Face cube
@@ -109,9 +203,6 @@ private:
 	static const int NumVerticesCube = 4 * NumFacesCube;
 	static const int NumVerticesFloor = 4;
 
-	unsigned int DepthMapFBO = 0;
-	unsigned int TextureId = 0;
-
 	enum VAO_IDs { CubeVAO, FloorVAO, Plane2DVAO, NumVAOs };
 	enum VBO_IDs { CubeVBO, CubeEBO, FloorVBO, Plane2DVBO, NumVBOs };
 
@@ -121,6 +212,12 @@ private:
 	glm::vec4 m_color;
 	glm::vec3 m_cubePosition = glm::vec3(0.0, 1.0, 0.0);
 
+	// Scene: the floor and the pillars are static, the red cube is dynamic
+	std::vector<SceneObject> m_objects;
+	std::size_t m_cubeObject = 0;      // Index of the red cube
+	bool m_pillars = true;             // Static pillars around the cube
+	unsigned int m_staticVersion = 0; // Incremented when the static set changes
+
 	// GLFW Window
 	GLFWwindow* m_window = nullptr;
 };
@@ -7,6 +7,10 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/matrix_inverse.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 #ifndef M_PI
 #define M_PI (3.14159)
@@ -25,7 +29,11 @@ MainWindow::MainWindow() :
 }
 
 void MainWindow::FramebufferSizeCallback(int width, int height) {
-	m_proj = glm::perspective(45.0f, float(width) / height, 0.01f, 100.0f);
+	// Minimized window: keep the previous size
+	if (width == 0 || height == 0) return;
+	m_screen.width = width;
+	m_screen.height = height;
+	m_proj = glm::perspective(45.0f, float(width) / height, m_cameraNear, m_cameraFar);
 }
 
 int MainWindow::Initialisation()
@@ -106,32 +114,10 @@ int MainWindow::InitializeGL()
 	// build and compile our shader program
 	const std::string directory = SHADERS_DIR;
 
-	m_mainShader = std::make_unique<ShaderProgram>();
-	bool mainShaderSuccess = true;
-	mainShaderSuccess &= m_mainShader->addShaderFromSource(GL_VERTEX_SHADER, directory + "triangles.vert");
-	mainShaderSuccess &= m_mainShader->addShaderFromSource(GL_FRAGMENT_SHADER, directory + "triangles.frag");
-	mainShaderSuccess &= m_mainShader->link();
-	if (!mainShaderSuccess) {
-		std::cerr << "Error when loading main shader\n";
-		return 4;
-	}
-	// Load uniform
-	m_mainUniforms.MVMatrix = m_mainShader->uniformLocation("MVMatrix");
-	m_mainUniforms.ProjMatrix = m_mainShader->uniformLocation("ProjMatrix");
-	m_mainUniforms.MLPMatrix = m_mainShader->uniformLocation("MLPMatrix");
-	m_mainUniforms.normalMatrix = m_mainShader->uniformLocation("normalMatrix");
-	m_mainUniforms.uColor = m_mainShader->uniformLocation("uColor");
-	m_mainUniforms.texShadowMap = m_mainShader->uniformLocation("texShadowMap");
-	m_mainUniforms.lightPositionCameraSpace = m_mainShader->uniformLocation("lightPositionCameraSpace");
-	m_mainUniforms.biasType = m_mainShader->uniformLocation("biasType");
-	m_mainUniforms.biasValue = m_mainShader->uniformLocation("biasValue");
-	m_mainUniforms.biasValueMin = m_mainShader->uniformLocation("biasValueMin");
-	if(m_mainUniforms.MVMatrix == -1 || m_mainUniforms.ProjMatrix == -1 || m_mainUniforms.MLPMatrix == -1 || m_mainUniforms.normalMatrix == -1 || m_mainUniforms.uColor == -1 || m_mainUniforms.texShadowMap == -1 || m_mainUniforms.lightPositionCameraSpace == -1 || m_mainUniforms.biasType == -1 || m_mainUniforms.biasValue == -1 || m_mainUniforms.biasValueMin == -1) {
-		std::cerr << "Error when loading main shader uniforms\n";
-		return 5;
+	int mainShaderReturn = LoadMainShader();
+	if (mainShaderReturn != 0) {
+		return mainShaderReturn;
 	}
-	
-	m_mainShader->setInt(m_mainUniforms.texShadowMap, 0); // Setup shadow map Tex unit
 
 	m_shadowMapShader = std::make_unique<ShaderProgram>();
 	bool shadowMapShaderSuccess = true;
@@ -148,6 +134,11 @@ int MainWindow::InitializeGL()
 		return 5;
 	}
 
+	int cubeShadowReturn = LoadCubeShadowShaders();
+	if (cubeShadowReturn != 0) {
+		return cubeShadowReturn;
+	}
+
 	m_debugShader = std::make_unique<ShaderProgram>();
 	bool debugShaderSuccess = true;
 	debugShaderSuccess &= m_debugShader->addShaderFromSource(GL_VERTEX_SHADER, directory + "debug.vert");
@@ -159,7 +150,8 @@ int MainWindow::InitializeGL()
 	}
 	m_debugUniforms.tex = m_debugShader->uniformLocation("tex");
 	m_debugUniforms.scale = m_debugShader->uniformLocation("scale");
-	if (m_debugUniforms.tex == -1 || m_debugUniforms.scale == -1) {
+	m_debugUniforms.layer = m_debugShader->uniformLocation("layer");
+	if (m_debugUniforms.tex == -1 || m_debugUniforms.scale == -1 || m_debugUniforms.layer == -1) {
 		std::cerr << "Error when loading debug shader uniforms\n";
 		return 5;
 	}
@@ -198,27 +190,8 @@ int MainWindow::InitializeGL()
 	}
 
 	////////////////////////////////
-	// Create a framebuffer object
-	glGenFramebuffers(1, &DepthMapFBO);
-
-	// 1) create depth texture
-	glGenTextures(1, &TextureId);
-	glBindTexture(GL_TEXTURE_2D, TextureId);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_SIZE_X, SHADOW_SIZE_Y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-	// 2) attach depth texture as FBO's depth buffer
-	glBindFramebuffer(GL_FRAMEBUFFER, DepthMapFBO);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, TextureId, 0);
-	glDrawBuffer(GL_NONE);
-	glReadBuffer(GL_NONE);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-	// Always check that our framebuffer is ok
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	// Create the shadow maps (one per cascade) and their framebuffer objects
+	if (!CreateShadowMaps())
 	{
 		std::cout << "Framebuffer is not ok" << std::endl;
 		return 6; // Error
@@ -227,11 +200,25 @@ int MainWindow::InitializeGL()
 	{
 		std::cout << "framebuffer is ok" << std::endl;
 	}
+	if (!m_pointShadow.create(POINT_SHADOW_SIZE))
+	{
+		std::cout << "Cube map framebuffer is not ok" << std::endl;
+		return 6;
+	}
+	// Filter across the faces of the cube map
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+	m_shadowFilter.create();
+	m_frameTimer.create();
+	glClearColor(0, 0, 0, 1);
 
 	// Tell the main shader that we will 
-	// use the texShadowMap at texture unit 0
+	// use the texShadowMap at texture unit 0 (texShadowCube at unit 1)
 	glUseProgram(m_mainShader->programId());
 	m_mainShader->setInt(m_mainUniforms.texShadowMap, 0);
+	m_mainShader->setInt(m_mainUniforms.texShadowCube, 1);
+
+	BuildScene();
 
 	// Initialize camera... etc
 	FramebufferSizeCallback(SCR_WIDTH, SCR_HEIGHT);
@@ -239,30 +226,152 @@ int MainWindow::InitializeGL()
 	return 0;
 }
 
+int MainWindow::LoadMainShader()
+{
+	// The filter of the shadow map is a variant of the fragment shader
+	const std::string directory = SHADERS_DIR;
+	const std::string defines = ShadowFilter::defines(m_filterSettings);
+
+	auto shader = std::make_unique<ShaderProgram>();
+	bool mainShaderSuccess = true;
+	mainShaderSuccess &= shader->addShaderFromSource(GL_VERTEX_SHADER, directory + "triangles.vert");
+	mainShaderSuccess &= shader->addShaderFromSource(GL_FRAGMENT_SHADER, directory + "triangles.frag", defines);
+	mainShaderSuccess &= shader->link();
+	if (!mainShaderSuccess) {
+		std::cerr << "Error when loading main shader\n";
+		return 4;
+	}
+	// Keep the previous variant until this one is complete
+	m_mainShader = std::move(shader);
+
+	// Load uniform
+	m_mainUniforms.MVMatrix = m_mainShader->uniformLocation("MVMatrix");
+	m_mainUniforms.ProjMatrix = m_mainShader->uniformLocation("ProjMatrix");
+	m_mainUniforms.ModelMatrix = m_mainShader->uniformLocation("ModelMatrix");
+	m_mainUniforms.normalMatrix = m_mainShader->uniformLocation("normalMatrix");
+	m_mainUniforms.uColor = m_mainShader->uniformLocation("uColor");
+	m_mainUniforms.texShadowMap = m_mainShader->uniformLocation("texShadowMap");
+	m_mainUniforms.cascadeMatrices = m_mainShader->uniformLocation("cascadeMatrices");
+	m_mainUniforms.cascadeSplits = m_mainShader->uniformLocation("cascadeSplits");
+	m_mainUniforms.cascadeCount = m_mainShader->uniformLocation("cascadeCount");
+	m_mainUniforms.showCascades = m_mainShader->uniformLocation("showCascades");
+	m_mainUniforms.lightType = m_mainShader->uniformLocation("lightType");
+	m_mainUniforms.lightDirectionCameraSpace = m_mainShader->uniformLocation("lightDirectionCameraSpace");
+	m_mainUniforms.lightPositionCameraSpace = m_mainShader->uniformLocation("lightPositionCameraSpace");
+	m_mainUniforms.lightPositionWorld = m_mainShader->uniformLocation("lightPositionWorld");
+	m_mainUniforms.texShadowCube = m_mainShader->uniformLocation("texShadowCube");
+	m_mainUniforms.pointNear = m_mainShader->uniformLocation("pointNear");
+	m_mainUniforms.pointFar = m_mainShader->uniformLocation("pointFar");
+	m_mainUniforms.pointBiasScale = m_mainShader->uniformLocation("pointBiasScale");
+	m_mainUniforms.filterRadius = m_mainShader->uniformLocation("filterRadius"); // -1 with the single tap filters
+	m_mainUniforms.biasType = m_mainShader->uniformLocation("biasType");
+	m_mainUniforms.biasValue = m_mainShader->uniformLocation("biasValue");
+	m_mainUniforms.biasValueMin = m_mainShader->uniformLocation("biasValueMin");
+	if(m_mainUniforms.MVMatrix == -1 || m_mainUniforms.ProjMatrix == -1 || m_mainUniforms.ModelMatrix == -1 || m_mainUniforms.normalMatrix == -1 || m_mainUniforms.uColor == -1 || m_mainUniforms.texShadowMap == -1 || m_mainUniforms.lightDirectionCameraSpace == -1 || m_mainUniforms.biasType == -1 || m_mainUniforms.biasValue == -1 || m_mainUniforms.biasValueMin == -1) {
+		std::cerr << "Error when loading main shader uniforms\n";
+		return 5;
+	}
+	if (m_mainUniforms.cascadeMatrices == -1 || m_mainUniforms.cascadeSplits == -1 || m_mainUniforms.cascadeCount == -1 || m_mainUniforms.showCascades == -1) {
+		std::cerr << "Error when loading main shader cascade uniforms\n";
+		return 5;
+	}
+	if (m_mainUniforms.lightType == -1 || m_mainUniforms.lightPositionCameraSpace == -1 || m_mainUniforms.lightPositionWorld == -1 || m_mainUniforms.texShadowCube == -1 || m_mainUniforms.pointNear == -1 || m_mainUniforms.pointFar == -1 || m_mainUniforms.pointBiasScale == -1) {
+		std::cerr << "Error when loading main shader point light uniforms\n";
+		return 5;
+	}
+	
+	m_mainShader->setInt(m_mainUniforms.texShadowMap, 0); // Setup shadow map Tex unit
+	m_mainShader->setInt(m_mainUniforms.texShadowCube, 1);
+	return 0;
+}
+
+int MainWindow::LoadCubeShadowShaders()
+{
+	// The geometry shader is the fallback when the vertex shader cannot write gl_Layer
+	const std::string directory = SHADERS_DIR;
+	m_vertexLayerSupported = PointShadow::hasVertexShaderLayer();
+	m_cubeLayerMode = m_vertexLayerSupported ? VertexLayer : GeometryLayer;
+
+	for (int mode = 0; mode < NumCubeLayerModes; ++mode)
+	{
+		if (mode == VertexLayer && !m_vertexLayerSupported) {
+			continue;
+		}
+		auto shader = std::make_unique<ShaderProgram>();
+		bool success = true;
+		if (mode == VertexLayer) {
+			success &= shader->addShaderFromSource(GL_VERTEX_SHADER, directory + "shadow_cube.vert", "#define VERTEX_LAYER\n");
+		}
+		else {
+			success &= shader->addShaderFromSource(GL_VERTEX_SHADER, directory + "shadow_cube.vert");
+			success &= shader->addShaderFromSource(GL_GEOMETRY_SHADER, directory + "shadow_cube.geom");
+		}
+		success &= shader->addShaderFromSource(GL_FRAGMENT_SHADER, directory + "shadow.frag");
+		success &= shader->link();
+		if (!success) {
+			std::cerr << "Error when loading point shadow shader\n";
+			return 4;
+		}
+		m_cubeShadowUniforms[mode].ModelMatrix = shader->uniformLocation("ModelMatrix");
+		m_cubeShadowUniforms[mode].faceMatrices = shader->uniformLocation("faceMatrices");
+		m_cubeShadowUniforms[mode].faces = shader->uniformLocation("faces");
+		m_cubeShadowUniforms[mode].faceMask = shader->uniformLocation("faceMask");
+		const GLint selection = mode == VertexLayer ? m_cubeShadowUniforms[mode].faces : m_cubeShadowUniforms[mode].faceMask;
+		if (m_cubeShadowUniforms[mode].ModelMatrix == -1 || m_cubeShadowUniforms[mode].faceMatrices == -1 || selection == -1) {
+			std::cerr << "Error when loading point shadow shader uniforms\n";
+			return 5;
+		}
+		m_cubeShadowShaders[mode] = std::move(shader);
+	}
+	return 0;
+}
+
 void MainWindow::RenderScene()
 {
 	// Compute camera
 	glm::mat4 lookAt = glm::lookAt(m_eye, m_at, m_up);
 
+	// The red cube can be moved at any time (dynamic object)
+	m_objects[m_cubeObject].model = glm::translate(glm::mat4(1.0f), m_cubePosition);
+	GatherCasters();
+
 	/////////////// 
 	//  Shadow pass
 	///////////////
-	ShadowRender();
+	m_frameTimer.mark("Shadow pass");
+	if (m_lightType == PointLight) {
+		PointShadowRender();
+	}
+	else {
+		ShadowRender(lookAt);
+	}
 
 	////////////////////
 	// Normal rendering pass
 	////////////////////
 	
 	// Clear buffers.
+	m_frameTimer.mark("Main pass");
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glUseProgram(m_mainShader->programId());
 
 	// Matrices and lighting informations
 	m_mainShader->setMat4(m_mainUniforms.MVMatrix, lookAt);
 	m_mainShader->setMat4(m_mainUniforms.ProjMatrix, m_proj);
+	m_mainShader->setInt(m_mainUniforms.lightType, m_lightType);
+	m_mainShader->setVec3(m_mainUniforms.lightDirectionCameraSpace, lookAt * glm::vec4(m_lightPosition, 0.0));
 	m_mainShader->setVec3(m_mainUniforms.lightPositionCameraSpace, lookAt * glm::vec4(m_lightPosition, 1.0));
-	// Shadow map
-	m_mainShader->setMat4(m_mainUniforms.MLPMatrix, m_lightViewProjMatrix);
+	m_mainShader->setVec3(m_mainUniforms.lightPositionWorld, m_lightPosition);
+	// Shadow map (point light)
+	m_mainShader->setFloat(m_mainUniforms.pointNear, m_pointShadow.near());
+	m_mainShader->setFloat(m_mainUniforms.pointFar, m_pointShadow.far());
+	m_mainShader->setFloat(m_mainUniforms.pointBiasScale, m_pointBiasScale);
+	// Shadow map (cascades)
+	glProgramUniformMatrix4fv(m_mainShader->programId(), m_mainUniforms.cascadeMatrices, m_cascades.count(), GL_FALSE, &m_cascades.viewProjs()[0][0][0]);
+	glProgramUniform1fv(m_mainShader->programId(), m_mainUniforms.cascadeSplits, m_cascades.count(), m_cascades.splits());
+	m_mainShader->setInt(m_mainUniforms.cascadeCount, m_cascades.count());
+	m_mainShader->setBool(m_mainUniforms.showCascades, m_showCascades);
+	m_mainShader->setFloat(m_mainUniforms.filterRadius, m_filterSettings.radius);
 	// Bias configuration
 	m_mainShader->setInt(m_mainUniforms.biasType, m_biasType);
 	m_mainShader->setFloat(m_mainUniforms.biasValue, m_biasValue);
@@ -271,43 +380,40 @@ void MainWindow::RenderScene()
 
 	// Activate texture containing the shadow map
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, TextureId);
-
-	// Draw WHITE floor
-	glm::mat4 modelMatrix = glm::mat4(1.0);
-	glm::mat4 modelViewMatrix = lookAt * modelMatrix;
-	glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat4(modelViewMatrix));
-	m_mainShader->setVec4(m_mainUniforms.uColor, glm::vec4(1.0, 1.0, 1.0, 1.0));
-	m_mainShader->setMat4(m_mainUniforms.MVMatrix, modelViewMatrix);
-	m_mainShader->setMat3(m_mainUniforms.normalMatrix, normalMatrix);
-	m_mainShader->setMat4(m_mainUniforms.MLPMatrix, m_lightViewProjMatrix * modelMatrix);
-	glBindVertexArray(m_VAOs[FloorVAO]);
-	glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-	glDrawArrays(GL_TRIANGLE_FAN, 0, NumVerticesFloor);
-
-	// Draw RED cube
-	modelMatrix = glm::translate(modelMatrix, m_cubePosition);   // translate up by 1.0
-	modelViewMatrix = lookAt * modelMatrix;
-	normalMatrix = glm::inverseTranspose(glm::mat4(modelViewMatrix));
-	m_mainShader->setVec4(m_mainUniforms.uColor, glm::vec4(1.0, 0.0, 0.0, 1.0));
-	m_mainShader->setMat4(m_mainUniforms.MVMatrix, modelViewMatrix);
-	m_mainShader->setMat3(m_mainUniforms.normalMatrix, normalMatrix);
-	m_mainShader->setMat4(m_mainUniforms.MLPMatrix, m_lightViewProjMatrix * modelMatrix);
-
-	glBindVertexArray(m_VAOs[CubeVAO]);
-	glDrawElements(GL_TRIANGLES, 3 * NumTriCube, GL_UNSIGNED_INT, 0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_shadowPass.texture());
+	m_shadowFilter.bind(0, m_filterSettings.mode);
+	// (the cube map is always looked up with the 2x2 PCF sampler)
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, m_pointShadow.texture());
+	m_shadowFilter.bind(1, ShadowFilter::Hardware);
+
+	// Draw the objects (WHITE floor, GREY pillars, RED cube)
+	for (const SceneObject& object : m_objects)
+	{
+		const glm::mat4 modelViewMatrix = lookAt * object.model;
+		const glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(modelViewMatrix));
+		m_mainShader->setVec4(m_mainUniforms.uColor, object.color);
+		m_mainShader->setMat4(m_mainUniforms.MVMatrix, modelViewMatrix);
+		m_mainShader->setMat3(m_mainUniforms.normalMatrix, normalMatrix);
+		m_mainShader->setMat4(m_mainUniforms.ModelMatrix, object.model);
+		DrawShape(object.shape);
+	}
 
 	if (m_debug) {
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		glUseProgram(m_debugShader->programId());
 		m_debugShader->setFloat(m_debugUniforms.scale, m_debugScale);
+		m_debugShader->setInt(m_debugUniforms.layer, std::min(m_debugLayer, m_cascades.count() - 1));
 		
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, TextureId);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, m_shadowPass.texture());
+		m_shadowFilter.bindDepth(0);
 
 		glBindVertexArray(m_VAOs[Plane2DVAO]);
 		glDrawArrays(GL_TRIANGLES, 0, 3);
 	}
+	ShadowFilter::unbind(0);
+	ShadowFilter::unbind(1);
 }
 
 void MainWindow::RenderImgui()
@@ -323,18 +429,59 @@ void MainWindow::RenderImgui()
 		
 		ImGui::Checkbox("Debug", &m_debug);
 		ImGui::InputFloat("debugScale", &m_debugScale);
+		ImGui::SliderInt("debugCascade", &m_debugLayer, 0, ShadowCascades::MaxCascades - 1);
 
 		ImGui::Separator();
 		ImGui::Text("Camera");
 		ImGui::Checkbox("Animate", &m_lightAnimation);
 		ImGui::InputFloat3("Position Light", &m_lightPosition[0]);
-		ImGui::InputFloat("Near", &m_lightNear);
-		ImGui::InputFloat("Far", &m_lightFar);
+		const char* lightTypes[] = { "Directional (cascades)", "Point (cube map)" };
+		ImGui::Combo("Light", &m_lightType, lightTypes, IM_ARRAYSIZE(lightTypes));
+
+		if (m_lightType == PointLight) {
+			ImGui::Separator();
+			ImGui::Text("Point light");
+			if (m_vertexLayerSupported) {
+				const char* layerModes[] = { "Vertex shader (instanced)", "Geometry shader" };
+				ImGui::Combo("gl_Layer from", &m_cubeLayerMode, layerModes, IM_ARRAYSIZE(layerModes));
+			}
+			else {
+				ImGui::Text("gl_Layer from the geometry shader");
+			}
+			ImGui::Text("Resolution: %d x %d (x 6)", m_pointShadow.size(), m_pointShadow.size());
+			ImGui::Text("Near / far: %.2f / %.2f", m_pointShadow.near(), m_pointShadow.far());
+			ImGui::SliderFloat("Bias scale", &m_pointBiasScale, 1.0f, 20.0f);
+			ImGui::Text("Faces drawn: %d / %d", m_pointFaces, int(m_objects.size()) * PointShadow::NumFaces);
+		}
+
+		ImGui::Separator();
+		ImGui::Text("Cascades");
+		if (ImGui::SliderInt("Count", &m_cascadeSettings.count, 1, ShadowCascades::MaxCascades)) {
+			CreateShadowMaps();
+		}
+		ImGui::Text("Resolution: %d x %d (x %d)", m_cascadeSize, m_cascadeSize, m_shadowPass.layers());
+		ImGui::SliderFloat("Lambda", &m_cascadeSettings.lambda, 0.0f, 1.0f);
+		ImGui::InputFloat("Max distance", &m_cascadeSettings.maxDistance);
+		const char* fitModes[] = { "Stable (snapped)", "Tight" };
+		int fit = m_cascadeSettings.fit;
+		if (ImGui::Combo("Fit", &fit, fitModes, IM_ARRAYSIZE(fitModes))) {
+			m_cascadeSettings.fit = ShadowCascades::FitMode(fit);
+		}
+		ImGui::Checkbox("Show cascades", &m_showCascades);
+		ImGui::Checkbox("Cull casters", &m_cascadeSettings.cullCasters);
+		ImGui::Checkbox("Cache static shadows", &m_useShadowCache);
+		ImGui::Text("Cascades from the cache: %d / %d", m_useShadowCache ? m_cachedCascades : 0, m_cascades.count());
+		if (m_lightType == DirectionalLight) {
+			ImGui::Text("Casters drawn: %d / %d", m_castersDrawn, int(m_objects.size()) * m_cascades.count());
+		}
 
 
 		ImGui::Separator();
 		ImGui::Text("Cube");
 		ImGui::InputFloat3("Position Cube", &m_cubePosition[0]);
+		if (ImGui::Checkbox("Static pillars", &m_pillars)) {
+			BuildScene();
+		}
 
 		ImGui::Separator();
 		ImGui::Text("Bias configuration: ");
@@ -343,10 +490,41 @@ void MainWindow::RenderImgui()
 		ImGui::InputFloat("Value", &m_biasValue, 0.01f, 1.0f, "%.6f");
 		ImGui::InputFloat("Value Min", &m_biasValueMin, 0.01f, 1.0f, "%.6f");
 
+		ImGui::Separator();
+		ImGui::Text("Filtering: ");
+		int mode = m_filterSettings.mode;
+		const char* modes[ShadowFilter::NumModes];
+		for (int i = 0; i < ShadowFilter::NumModes; ++i) {
+			modes[i] = ShadowFilter::name(ShadowFilter::Mode(i));
+		}
+		bool reload = false;
+		if (ImGui::Combo("Filter", &mode, modes, ShadowFilter::NumModes)) {
+			m_filterSettings.mode = ShadowFilter::Mode(mode);
+			reload = true;
+		}
+		if (m_filterSettings.mode == ShadowFilter::Poisson || m_filterSettings.mode == ShadowFilter::RotatedDisk) {
+			const char* kernels[ShadowFilter::NumKernelSizes] = { "4 taps", "8 taps", "16 taps", "32 taps" };
+			reload |= ImGui::Combo("Kernel", &m_filterSettings.kernel, kernels, ShadowFilter::NumKernelSizes);
+			ImGui::SliderFloat("Radius (texels)", &m_filterSettings.radius, 0.5f, 8.0f);
+		}
+		if (reload && LoadMainShader() != 0) {
+			std::cerr << "Shader variant not available: " << ShadowFilter::defines(m_filterSettings);
+		}
+
+		ImGui::Separator();
+		ImGui::Text("Timings (ms)");
+		ImGui::Checkbox("glFinish after the shadow pass", &m_synchronize);
+		ImGui::Text("Frame (CPU): %.3f", m_frameTimer.frameTime());
+		ImGui::Text("Frame (GPU): %.3f", m_frameTimer.gpuFrameTime());
+		for (const FrameTimer::Timing& timing : m_frameTimer.timings()) {
+			ImGui::Text("%-12s CPU %.3f GPU %.3f", timing.name.c_str(), timing.cpu, timing.gpu);
+		}
+
 		ImGui::End();
 	}
 
 	ImGui::Render();
+	m_frameTimer.mark("ImGui");
 	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
@@ -366,13 +544,20 @@ int MainWindow::RenderLoop()
 		if (glfwGetKey(m_window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 			glfwSetWindowShouldClose(m_window, true);
 
+		m_frameTimer.beginFrame();
 		RenderScene();
 		RenderImgui();
+		m_frameTimer.endFrame();
 
 		glfwSwapBuffers(m_window);
 		glfwPollEvents();
 	}
 
+	m_shadowPass.release();
+	m_shadowCache.release();
+	m_pointShadow.release();
+	m_shadowFilter.release();
+	m_frameTimer.release();
 	glfwDestroyWindow(m_window);
 	glfwTerminate();
 
@@ -536,62 +721,216 @@ int MainWindow::InitGeometryFloor()
 	return 0;
 }
 
-void MainWindow::ShadowRender()
+bool MainWindow::CreateShadowMaps()
 {
-	// Save viewport information
-	GLint viewport[4];
-	glGetIntegerv(GL_VIEWPORT, viewport);
+	// Same memory for any number of cascades: each one gets
+	// SHADOW_SIZE_X * SHADOW_SIZE_Y / count texels (multiple of 64)
+	m_cascadeSettings.count = std::min(std::max(m_cascadeSettings.count, 1), int(ShadowCascades::MaxCascades));
+	const float side = std::sqrt(float(SHADOW_SIZE_X) * float(SHADOW_SIZE_Y) / float(m_cascadeSettings.count));
+	m_cascadeSize = std::max(64, int(side / 64.0f) * 64);
+	bool success = m_shadowPass.create(m_cascadeSize, m_cascadeSize, m_cascadeSettings.count);
+	success &= m_shadowCache.create(m_cascadeSize, m_cascadeSize, m_cascadeSettings.count);
+	return success;
+}
 
-	// Render the scene from the light's point of view.
-	// Create a viewport that matches the size of the shadow map FBO.
-	glViewport(0, 0, SHADOW_SIZE_X, SHADOW_SIZE_Y);
+void MainWindow::ShadowRender(const glm::mat4& view)
+{
+	// Fit the cascades to the camera frustum and cull the casters
+	// against the light volume of each one (casters outside the frustum
+	// still cast shadows inside it)
+	m_cascades.update(m_cascadeSettings, view, m_proj, m_cameraNear, m_cameraFar,
+		m_lightPosition, m_casters, m_cascadeSize);
 
-	// Setup the offscreen frame buffer we'll use to store the depth image.
-	glBindFramebuffer(GL_FRAMEBUFFER, DepthMapFBO);
-	glClear(GL_DEPTH_BUFFER_BIT);
+	// Bind the shadow shader program.
+	glUseProgram(m_shadowMapShader->programId());
 
-	// Compute the light projection matrix.
-	GLfloat LightFOV = 90.0f;
-	glm::mat4 LightProjMatrix = glm::perspective(LightFOV, 1.0f, m_lightNear, m_lightFar);
+	// Render the scene from the light's point of view, once per cascade
+	// (the pass binds the framebuffer of the layer with the size of the shadow map).
+	m_cachedCascades = 0;
+	m_castersDrawn = 0;
+	for (int cascade = 0; cascade < m_cascades.count(); ++cascade)
+	{
+		const glm::mat4& lightViewProjMatrix = m_cascades.viewProj(cascade);
+		const std::vector<int>& visible = m_cascades.casters(cascade);
+		if (!m_useShadowCache) {
+			m_shadowPass.begin(cascade);
+			DrawCasters(lightViewProjMatrix, visible, AllCasters);
+			continue;
+		}
+
+		// Static casters: drawn again only if the cascade moved or the
+		// static set changed, then copied
+		const unsigned int lightVersion = m_cascades.version(cascade);
+		if (m_shadowCache.needsUpdate(cascade, lightVersion, m_staticVersion)) {
+			m_shadowCache.begin(cascade);
+			DrawCasters(lightViewProjMatrix, visible, StaticCasters);
+			m_shadowCache.validate(cascade, lightVersion, m_staticVersion);
+		}
+		else {
+			m_cachedCascades++;
+		}
+		m_shadowCache.copyTo(m_shadowPass, cascade);
+
+		// Dynamic casters on top of the copy
+		m_shadowPass.begin(cascade, false);
+		DrawCasters(lightViewProjMatrix, visible, DynamicCasters);
+	}
 
-	// Compute the light view matrix.
-	glm::vec3 At(0.0, 0.0, 0.0);    // Center of the scene
-	glm::vec3 Up(0.0, 1.0, 0.0);    // Up direction.
-	glm::vec3 LightPos(m_lightPosition.x, m_lightPosition.y, m_lightPosition.z);
-	glm::mat4 LightViewMatrix = glm::lookAt(LightPos, At, Up);
-	m_lightViewProjMatrix = LightProjMatrix * LightViewMatrix;
+	// No need to wait for the GPU: the main pass samples the shadow map
+	// after these draws in the same command stream
+	if (m_synchronize) {
+		glFinish();
+	}
 
-	// Bind the shadow shader program.
-	glUseProgram(m_shadowMapShader->programId());
+	// Back to the window (with the viewport tracked by FramebufferSizeCallback)
+	m_shadowPass.end(m_screen);
+}
 
-	// Draw the floor
-	glm::mat4 ModelMatrix = glm::mat4(1.0f);
+void MainWindow::PointShadowRender()
+{
+	// Depth range of the casters: the depth of a face is the major axis
+	// of the light to point vector, between distance / sqrt(3) and distance
+	float nearest, farthest;
+	m_casters.distanceRange(m_lightPosition, nearest, farthest);
+	const float near = std::max(m_pointNear, 0.99f * nearest / std::sqrt(3.0f));
+	m_pointShadow.update(m_lightPosition, near, std::max(1.01f * farthest, 2.0f * near));
+
+	const int mode = m_vertexLayerSupported ? m_cubeLayerMode : GeometryLayer;
+	const ShaderProgram& shader = *m_cubeShadowShaders[mode];
+	const auto& uniforms = m_cubeShadowUniforms[mode];
+	glUseProgram(shader.programId());
+	glProgramUniformMatrix4fv(shader.programId(), uniforms.faceMatrices, PointShadow::NumFaces, GL_FALSE, &m_pointShadow.faceViewProjs()[0][0][0]);
+
+	// The 6 faces in one pass: each caster is sent only to the faces
+	// whose frustum it touches
+	m_pointShadow.begin();
+	m_pointFaces = 0;
+	m_castersDrawn = 0;
+	for (const SceneObject& object : m_objects)
+	{
+		glm::vec3 objectMin, objectMax;
+		ObjectBounds(object, objectMin, objectMax);
+		const unsigned int mask = m_pointShadow.faceMask(objectMin, objectMax);
+		if (mask == 0) {
+			continue;
+		}
+		shader.setMat4(uniforms.ModelMatrix, object.model);
+		if (mode == VertexLayer) {
+			// One instance per face (gl_Layer = faces[gl_InstanceID])
+			GLint faces[PointShadow::NumFaces];
+			int count = 0;
+			for (int face = 0; face < PointShadow::NumFaces; ++face) {
+				if (mask & (1u << face)) {
+					faces[count++] = face;
+				}
+			}
+			glProgramUniform1iv(shader.programId(), uniforms.faces, count, faces);
+			DrawShape(object.shape, count);
+			m_pointFaces += count;
+			m_castersDrawn++;
+		}
+		else {
+			// The geometry shader skips the other faces
+			shader.setInt(uniforms.faceMask, int(mask));
+			DrawShape(object.shape);
+			m_castersDrawn++;
+			for (int face = 0; face < PointShadow::NumFaces; ++face) {
+				m_pointFaces += (mask >> face) & 1;
+			}
+		}
+	}
 
-	m_shadowMapShader->setMat4(m_shadowMapUniforms.MLP, m_lightViewProjMatrix * ModelMatrix);
-	glBindVertexArray(m_VAOs[FloorVAO]);
-	glDrawArrays(GL_TRIANGLE_FAN, 0, NumVerticesFloor);
+	if (m_synchronize) {
+		glFinish();
+	}
+	m_pointShadow.end(m_screen);
+}
 
-	// Draw the cube
-	ModelMatrix = glm::translate(ModelMatrix, m_cubePosition);
-	m_shadowMapShader->setMat4(m_shadowMapUniforms.MLP, m_lightViewProjMatrix * ModelMatrix);
-	glBindVertexArray(m_VAOs[CubeVAO]);
-	glDrawElements(GL_TRIANGLES, 3 * NumTriCube, GL_UNSIGNED_INT, nullptr);
+void MainWindow::DrawCasters(const glm::mat4& lightViewProjMatrix, const std::vector<int>& visible, CasterSet casters)
+{
+	for (int index : visible)
+	{
+		const SceneObject& object = m_objects[index];
+		if ((casters == StaticCasters && object.dynamic) || (casters == DynamicCasters && !object.dynamic)) {
+			continue;
+		}
+		m_shadowMapShader->setMat4(m_shadowMapUniforms.MLP, lightViewProjMatrix * object.model);
+		DrawShape(object.shape);
+		m_castersDrawn++;
+	}
+}
 
-	//Finish drawing and release the framebuffer.
-	glFinish();
+void MainWindow::BuildScene()
+{
+	m_objects.clear();
+
+	// WHITE floor
+	m_objects.push_back({ FloorShape, glm::mat4(1.0f), glm::vec4(1.0, 1.0, 1.0, 1.0), false });
+
+	// GREY pillars around the center
+	if (m_pillars) {
+		const int NumPillars = 6;
+		for (int i = 0; i < NumPillars; ++i) {
+			const float angle = float(2.0 * M_PI * (i + 0.5) / NumPillars);
+			glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f * std::cos(angle), 0.75f, 3.0f * std::sin(angle)));
+			model = glm::scale(model, glm::vec3(0.5f, 1.5f, 0.5f));
+			m_objects.push_back({ CubeShape, model, glm::vec4(0.7, 0.7, 0.7, 1.0), false });
+		}
+	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	// RED cube (moved from the interface)
+	m_cubeObject = m_objects.size();
+	m_objects.push_back({ CubeShape, glm::translate(glm::mat4(1.0f), m_cubePosition), glm::vec4(1.0, 0.0, 0.0, 1.0), true });
 
-	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
-	glClearColor(0, 0, 0, 1);
+	// The cached shadows of the static objects are no longer valid
+	m_staticVersion++;
+}
+
+void MainWindow::DrawShape(Shape shape, int instances)
+{
+	if (shape == FloorShape) {
+		glBindVertexArray(m_VAOs[FloorVAO]);
+		glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, NumVerticesFloor, instances);
+	}
+	else {
+		glBindVertexArray(m_VAOs[CubeVAO]);
+		glDrawElementsInstanced(GL_TRIANGLES, 3 * NumTriCube, GL_UNSIGNED_INT, nullptr, instances);
+	}
+}
+
+void MainWindow::ObjectBounds(const SceneObject& object, glm::vec3& objectMin, glm::vec3& objectMax) const
+{
+	// Corners of the shape transformed by the model
+	const glm::vec3 shapeMin = object.shape == FloorShape ? glm::vec3(-4, 0, -4) : glm::vec3(-0.5f);
+	const glm::vec3 shapeMax = object.shape == FloorShape ? glm::vec3(4, 0, 4) : glm::vec3(0.5f);
+	objectMin = glm::vec3(std::numeric_limits<float>::max());
+	objectMax = glm::vec3(-std::numeric_limits<float>::max());
+	for (int i = 0; i < 8; ++i) {
+		const glm::vec3 corner((i & 1) ? shapeMax.x : shapeMin.x, (i & 2) ? shapeMax.y : shapeMin.y, (i & 4) ? shapeMax.z : shapeMin.z);
+		const glm::vec3 p = glm::vec3(object.model * glm::vec4(corner, 1.0f));
+		objectMin = glm::min(objectMin, p);
+		objectMax = glm::max(objectMax, p);
+	}
+}
+
+void MainWindow::GatherCasters()
+{
+	m_casters.clear();
+	for (const SceneObject& object : m_objects)
+	{
+		glm::vec3 objectMin, objectMax;
+		ObjectBounds(object, objectMin, objectMax);
+		m_casters.add(objectMin, objectMax);
+	}
 }
 
 void MainWindow::UpdateLightPosition(float delta_time)
 {
 	if (m_lightAnimation) {
 		m_lightAngle += delta_time;
-		m_lightPosition.x = float(m_lightRadius * cos(m_lightAngle));
-		m_lightPosition.z = float(-m_lightRadius * sin(m_lightAngle));
-		m_lightPosition.y = float(m_lightHeight);
+		const double radius = m_lightType == PointLight ? m_pointLightRadius : m_lightRadius;
+		m_lightPosition.x = float(radius * cos(m_lightAngle));
+		m_lightPosition.z = float(-radius * sin(m_lightAngle));
+		m_lightPosition.y = float(m_lightType == PointLight ? m_pointLightHeight : m_lightHeight);
 	}
 }
\ No newline at end of file
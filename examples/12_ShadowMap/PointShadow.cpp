@@ -0,0 +1,132 @@
+#include "PointShadow.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <cstring>
+
+namespace {
+	// Orientation of the faces (GL_TEXTURE_CUBE_MAP_POSITIVE_X + i)
+	const glm::vec3 FaceDirections[PointShadow::NumFaces] = {
+		{ 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }
+	};
+	const glm::vec3 FaceUps[PointShadow::NumFaces] = {
+		{ 0, -1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, -1, 0 }, { 0, -1, 0 }
+	};
+}
+
+PointShadow::~PointShadow()
+{
+	release();
+}
+
+bool PointShadow::create(int size)
+{
+	release();
+	m_size = size;
+
+	// 1) create depth cube map
+	// (the main pass samples it with the comparison sampler of ShadowFilter)
+	glGenTextures(1, &m_texture);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, m_texture);
+	for (int face = 0; face < NumFaces; ++face) {
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+	}
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+	// 2) attach the whole cube map (layered framebuffer: gl_Layer selects the face)
+	glGenFramebuffers(1, &m_framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_texture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return complete;
+}
+
+void PointShadow::release()
+{
+	if (m_framebuffer != 0) {
+		glDeleteFramebuffers(1, &m_framebuffer);
+		m_framebuffer = 0;
+	}
+	if (m_texture != 0) {
+		glDeleteTextures(1, &m_texture);
+		m_texture = 0;
+	}
+}
+
+bool PointShadow::hasVertexShaderLayer()
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; ++i) {
+		const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+		if (name != nullptr && std::strcmp(name, "GL_ARB_shader_viewport_layer_array") == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void PointShadow::update(const glm::vec3& lightPosition, float near, float far)
+{
+	m_lightPosition = lightPosition;
+	m_near = near;
+	m_far = far;
+	const glm::mat4 proj = glm::perspective(glm::radians(90.0f), 1.0f, near, far);
+	for (int face = 0; face < NumFaces; ++face) {
+		m_faceViewProj[face] = proj * glm::lookAt(lightPosition, lightPosition + FaceDirections[face], FaceUps[face]);
+	}
+}
+
+unsigned int PointShadow::faceMask(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+{
+	// Box relative to the light
+	const glm::vec3 center = 0.5f * (boxMin + boxMax) - m_lightPosition;
+	const glm::vec3 extent = 0.5f * (boxMax - boxMin);
+
+	// Farther than the far plane in every direction
+	const glm::vec3 closest = glm::max(glm::abs(center) - extent, glm::vec3(0.0f));
+	if (glm::dot(closest, closest) > m_far * m_far) {
+		return 0;
+	}
+
+	// The frustum of a face (axis d) is 4 planes through the light:
+	// d.p >= |u.p| and d.p >= |v.p| (u, v: the other axes). The box is
+	// outside if its farthest point along a plane normal is behind it
+	auto inFront = [&](const glm::vec3& normal) {
+		return glm::dot(normal, center) + glm::dot(glm::abs(normal), extent) >= 0.0f;
+	};
+	unsigned int mask = 0;
+	for (int face = 0; face < NumFaces; ++face)
+	{
+		const glm::vec3& d = FaceDirections[face];
+		glm::vec3 u(0.0f), v(0.0f);
+		u[(face / 2 + 1) % 3] = 1.0f;
+		v[(face / 2 + 2) % 3] = 1.0f;
+		if (inFront(d - u) && inFront(d + u) && inFront(d - v) && inFront(d + v)
+			&& glm::dot(d, center) + glm::dot(glm::abs(d), extent) >= m_near) {
+			mask |= 1u << face;
+		}
+	}
+	return mask;
+}
+
+void PointShadow::begin() const
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+	glViewport(0, 0, m_size, m_size);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void PointShadow::end(const ShadowPass::Target& next) const
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, next.framebuffer);
+	glViewport(0, 0, next.width, next.height);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "ShadowPass.h"
+
+// Omnidirectional shadows of a point light (depth cube map)
+//
+// The six faces are rendered in a single pass: the framebuffer has the
+// whole cube map attached (layered) and each primitive is sent to its
+// face with gl_Layer:
+// - from the vertex shader (GL_ARB_shader_viewport_layer_array): an
+//   object is drawn instanced, one instance per face it can touch
+// - from a geometry shader with 6 invocations otherwise (fallback)
+// faceMask() culls an object (AABB) against the frustum of each face,
+// so most objects are sent to one or two faces only.
+//
+// The faces use the usual perspective depth, so the main pass can use
+// a samplerCubeShadow: the depth reference is computed from the major
+// axis of the light to fragment vector (see triangles.frag).
+class PointShadow
+{
+public:
+	static const int NumFaces = 6;
+
+	PointShadow() = default;
+	~PointShadow();
+	PointShadow(const PointShadow&) = delete;
+	PointShadow& operator=(const PointShadow&) = delete;
+
+	// ------------------------------------------------------------------------
+	// allocate the depth cube map (size x size per face) and the layered
+	// framebuffer. return true if the framebuffer is complete
+	bool create(int size);
+	void release();
+
+	// true if gl_Layer can be written from the vertex shader
+	static bool hasVertexShaderLayer();
+
+	// ------------------------------------------------------------------------
+	// compute the matrices of the faces (90 degrees perspectives)
+	void update(const glm::vec3& lightPosition, float near, float far);
+	// bit i set if the box (world space) intersects the frustum of face i
+	unsigned int faceMask(const glm::vec3& boxMin, const glm::vec3& boxMax) const;
+
+	// ------------------------------------------------------------------------
+	// bind the layered framebuffer, set the viewport and clear the faces
+	void begin() const;
+	void end(const ShadowPass::Target& next) const;
+
+	GLuint texture() const { return m_texture; }
+	int size() const { return m_size; }
+	const glm::mat4* faceViewProjs() const { return m_faceViewProj; }
+	const glm::vec3& lightPosition() const { return m_lightPosition; }
+	float near() const { return m_near; }
+	float far() const { return m_far; }
+
+private:
+	GLuint m_framebuffer = 0;
+	GLuint m_texture = 0;
+	int m_size = 0;
+
+	glm::vec3 m_lightPosition = glm::vec3(0.0f);
+	float m_near = 0.05f;
+	float m_far = 20.0f;
+	glm::mat4 m_faceViewProj[NumFaces];
+};
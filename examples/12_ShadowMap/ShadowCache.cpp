@@ -0,0 +1,33 @@
+#include "ShadowCache.h"
+
+bool ShadowCache::create(int width, int height, int layers)
+{
+	m_keys.assign(layers, Key());
+	return m_pass.create(width, height, layers);
+}
+
+void ShadowCache::release()
+{
+	m_pass.release();
+	m_keys.clear();
+}
+
+bool ShadowCache::needsUpdate(int layer, unsigned int lightVersion, unsigned int staticVersion) const
+{
+	const Key& key = m_keys[layer];
+	return !key.valid || key.light != lightVersion || key.statics != staticVersion;
+}
+
+void ShadowCache::validate(int layer, unsigned int lightVersion, unsigned int staticVersion)
+{
+	m_keys[layer].light = lightVersion;
+	m_keys[layer].statics = staticVersion;
+	m_keys[layer].valid = true;
+}
+
+void ShadowCache::copyTo(const ShadowPass& shadowMap, int layer) const
+{
+	glCopyImageSubData(m_pass.texture(), GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer,
+		shadowMap.texture(), GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer,
+		m_pass.width(), m_pass.height(), 1);
+}
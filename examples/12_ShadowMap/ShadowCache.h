@@ -0,0 +1,52 @@
+#pragma once
+
+#include "ShadowPass.h"
+
+#include <vector>
+
+// Cache of the shadows of the static casters
+//
+// The static casters are rendered once in a second depth texture array
+// (one layer per shadow map). Each frame the cached layer is copied in
+// the working shadow map (glCopyImageSubData, no draw) and only the
+// dynamic casters are drawn on top of it.
+//
+// A layer stays valid while its key is unchanged: the version of the
+// light transform of the layer (e.g. ShadowCascades::version) and the
+// version of the static set (incremented by the scene when a static
+// object is added, removed or moved).
+class ShadowCache
+{
+public:
+	ShadowCache() = default;
+
+	// ------------------------------------------------------------------------
+	// allocate the cache (same size as the shadow maps), all layers invalid
+	// (called again when the resolution or the number of layers changes)
+	bool create(int width, int height, int layers);
+	void release();
+
+	// ------------------------------------------------------------------------
+	// true if the static casters of the layer must be drawn again
+	bool needsUpdate(int layer, unsigned int lightVersion, unsigned int staticVersion) const;
+	// bind the framebuffer of a cached layer (cleared) to draw the static casters
+	void begin(int layer) const { m_pass.begin(layer); }
+	// mark the layer as up to date for this key
+	void validate(int layer, unsigned int lightVersion, unsigned int staticVersion);
+
+	// ------------------------------------------------------------------------
+	// copy the cached layer in the same layer of the shadow map
+	void copyTo(const ShadowPass& shadowMap, int layer) const;
+
+	int layers() const { return m_pass.layers(); }
+
+private:
+	struct Key {
+		unsigned int light = 0;
+		unsigned int statics = 0;
+		bool valid = false;
+	};
+
+	ShadowPass m_pass;
+	std::vector<Key> m_keys;
+};
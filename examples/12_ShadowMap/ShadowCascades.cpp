@@ -0,0 +1,114 @@
+#include "ShadowCascades.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+void ShadowCascades::update(const Settings& settings, const glm::mat4& view, const glm::mat4& proj, float near, float far,
+	const glm::vec3& lightDirection, ShadowCasters& casters, int resolution)
+{
+	m_count = std::min(std::max(settings.count, 1), int(MaxCascades));
+	const float shadowFar = std::min(far, settings.maxDistance);
+
+	// Edges of the camera frustum in view space (symmetric perspective):
+	// the corners at the view depth d are d * edge. Inverting proj * view
+	// instead loses too much precision with a far/near ratio of 10^4
+	// (the size of the stable cascades would change with the camera pose)
+	const glm::vec2 tanHalfFov(1.0f / proj[0][0], 1.0f / proj[1][1]);
+	glm::vec3 edges[4];
+	for (int i = 0; i < 4; ++i) {
+		const float x = (i & 1) ? 1.0f : -1.0f;
+		const float y = (i & 2) ? 1.0f : -1.0f;
+		edges[i] = glm::vec3(x * tanHalfFov.x, y * tanHalfFov.y, -1.0f);
+	}
+	const glm::mat4 invView = glm::inverse(view);
+
+	// Light orientation (a directional light has no position: the
+	// cascades are placed in this frame)
+	const glm::vec3 direction = glm::normalize(lightDirection);
+	const glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+	const glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), -direction, up);
+
+	// Bounds of the casters in the light space (the light looks down -z)
+	casters.transform(lightView);
+
+	float previous = near;
+	for (int c = 0; c < m_count; ++c)
+	{
+		// Practical split scheme
+		const float p = float(c + 1) / float(m_count);
+		const float logSplit = near * std::pow(shadowFar / near, p);
+		const float uniformSplit = near + (shadowFar - near) * p;
+		const float split = settings.lambda * logSplit + (1.0f - settings.lambda) * uniformSplit;
+		m_splits[c] = split;
+
+		// Corners of the sub-frustum (view space, then world space)
+		glm::vec3 viewCorners[8], corners[8];
+		for (int i = 0; i < 4; ++i) {
+			viewCorners[i] = previous * edges[i];
+			viewCorners[i + 4] = split * edges[i];
+		}
+		for (int i = 0; i < 8; ++i) {
+			corners[i] = glm::vec3(invView * glm::vec4(viewCorners[i], 1.0f));
+		}
+		previous = split;
+
+		// Bounds in light space
+		glm::vec3 lo(std::numeric_limits<float>::max());
+		glm::vec3 hi(-std::numeric_limits<float>::max());
+		for (const glm::vec3& corner : corners) {
+			const glm::vec3 q = glm::vec3(lightView * glm::vec4(corner, 1.0f));
+			lo = glm::min(lo, q);
+			hi = glm::max(hi, q);
+		}
+
+		if (settings.fit == Stable)
+		{
+			// Largest distance between two corners: bounds the extent of the
+			// sub-frustum in any orientation. Computed in view space, so it
+			// only depends on the projection and the splits
+			float size = 0.0f;
+			for (int a = 0; a < 8; ++a) {
+				for (int b = a + 1; b < 8; ++b) {
+					size = std::max(size, glm::distance(viewCorners[a], viewCorners[b]));
+				}
+			}
+
+			// Move by whole texels only
+			const float texel = size / float(resolution);
+			const glm::vec2 center = 0.5f * (glm::vec2(lo) + glm::vec2(hi));
+			lo.x = std::floor((center.x - 0.5f * size) / texel) * texel;
+			lo.y = std::floor((center.y - 0.5f * size) / texel) * texel;
+			hi.x = lo.x + size;
+			hi.y = lo.y + size;
+		}
+
+		// Casters touching the footprint of the cascade, up to the light.
+		// Without culling: all the casters, in the infinite volume
+		m_casters[c].clear();
+		const float infinity = std::numeric_limits<float>::max();
+		const glm::vec3 volumeMin = settings.cullCasters ? lo : glm::vec3(-infinity);
+		const glm::vec3 volumeMax = settings.cullCasters ? hi : glm::vec3(infinity);
+		float zMin = lo.z, zMax = hi.z;
+		if (casters.cull(volumeMin, volumeMax, m_casters[c], zMin, zMax) > 0)
+		{
+			// Near plane on the closest caster, far plane on the farthest one
+			// if no receiver lies beyond it (rounded to whole units, so moving
+			// objects do not change the matrix at every frame)
+			if (settings.cullCasters) {
+				hi.z = std::ceil(zMax);
+				lo.z = std::max(lo.z, std::floor(zMin));
+			}
+			else {
+				hi.z = std::max(hi.z, std::ceil(zMax));
+			}
+		}
+		const glm::mat4 viewProj = glm::ortho(lo.x, hi.x, lo.y, hi.y, -hi.z, -lo.z) * lightView;
+		if (viewProj != m_viewProj[c]) {
+			m_viewProj[c] = viewProj;
+			m_versions[c]++;
+		}
+	}
+}
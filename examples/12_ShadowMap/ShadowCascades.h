@@ -0,0 +1,71 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "ShadowCasters.h"
+
+// Cascaded shadow maps for a directional light
+//
+// The camera frustum (up to maxDistance) is split in count sub-frusta
+// with the practical split scheme: a blend (lambda) between the
+// logarithmic split, which gives the same texel density relative to the
+// view depth, and the uniform split. Each cascade is an orthographic
+// projection fitted to its sub-frustum in light space:
+// - Stable: the square size is the largest distance between two corners
+//   of the sub-frustum (invariant to the camera rotation) and its origin
+//   is snapped to the texels of the shadow map, so the shadows do not
+//   shimmer when the camera moves.
+// - Tight: bounding box of the sub-frustum, more texels per unit but the
+//   size changes with the camera orientation (shimmering).
+// The casters are culled against the light volume of each cascade (its
+// x, y footprint and everything in front of the far plane): the casters
+// outside the sub-frustum but between it and the light still cast
+// shadows. The near plane is moved to the closest kept caster and the
+// far plane to the farthest one if it is before the sub-frustum end, so
+// the depth range only covers what can be shadowed.
+class ShadowCascades
+{
+public:
+	static const int MaxCascades = 4;
+	enum FitMode { Stable, Tight };
+
+	struct Settings {
+		int count = 4;
+		float lambda = 0.5f;       // 0: uniform splits, 1: logarithmic splits
+		float maxDistance = 20.0f; // View depth covered by the cascades
+		FitMode fit = Stable;
+		bool cullCasters = true;   // false: all casters in all cascades
+	};
+
+	// ------------------------------------------------------------------------
+	// compute the splits and the light matrices of the cascades
+	// view, proj: camera (symmetric perspective), near/far: camera planes
+	// lightDirection: direction towards the light (world space)
+	// casters: bounds of the shadow casters (moved in the light space)
+	// resolution: size of a cascade in texels (for the snapping)
+	void update(const Settings& settings, const glm::mat4& view, const glm::mat4& proj, float near, float far,
+		const glm::vec3& lightDirection, ShadowCasters& casters, int resolution);
+
+	int count() const { return m_count; }
+	// World to light clip space of the cascade i
+	const glm::mat4& viewProj(int i) const { return m_viewProj[i]; }
+	const glm::mat4* viewProjs() const { return m_viewProj; }
+	// Far view depth of the cascade i (distance along the view axis)
+	float split(int i) const { return m_splits[i]; }
+	const float* splits() const { return m_splits; }
+	// Index of the casters to draw in the cascade i
+	const std::vector<int>& casters(int i) const { return m_casters[i]; }
+	// Incremented when the matrix of the cascade i changes (with the
+	// stable fit: the light or the settings changed, or the camera moved
+	// by at least one texel)
+	unsigned int version(int i) const { return m_versions[i]; }
+
+private:
+	int m_count = 0;
+	glm::mat4 m_viewProj[MaxCascades];
+	float m_splits[MaxCascades] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	unsigned int m_versions[MaxCascades] = { 0, 0, 0, 0 };
+	std::vector<int> m_casters[MaxCascades];
+};
@@ -0,0 +1,154 @@
+#include "ShadowCasters.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CASTERS_X86 1
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+void ShadowCasters::clear()
+{
+	m_count = 0;
+	for (std::vector<float>& stream : m_world) {
+		stream.clear();
+	}
+}
+
+void ShadowCasters::add(const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+	// Pad with NaN bounds: every comparison fails, never visible
+	if (m_count % Lanes == 0) {
+		for (std::vector<float>& stream : m_world) {
+			stream.resize(m_count + Lanes, std::numeric_limits<float>::quiet_NaN());
+		}
+	}
+	for (int axis = 0; axis < 3; ++axis) {
+		m_world[MinX + axis][m_count] = boxMin[axis];
+		m_world[MaxX + axis][m_count] = boxMax[axis];
+	}
+	m_count++;
+}
+
+void ShadowCasters::transform(const glm::mat4& lightView)
+{
+	const std::size_t padded = m_world[MinX].size();
+	for (std::vector<float>& stream : m_light) {
+		stream.resize(padded);
+	}
+
+	// Center and extent: the transformed box of the extent e is |M| e.
+	// Plain loops over the streams (vectorized by the compiler)
+	for (int row = 0; row < 3; ++row)
+	{
+		const float m0 = lightView[0][row], m1 = lightView[1][row], m2 = lightView[2][row], t = lightView[3][row];
+		const float a0 = std::abs(m0), a1 = std::abs(m1), a2 = std::abs(m2);
+		const float* minX = m_world[MinX].data();
+		const float* minY = m_world[MinY].data();
+		const float* minZ = m_world[MinZ].data();
+		const float* maxX = m_world[MaxX].data();
+		const float* maxY = m_world[MaxY].data();
+		const float* maxZ = m_world[MaxZ].data();
+		float* outMin = m_light[MinX + row].data();
+		float* outMax = m_light[MaxX + row].data();
+		for (std::size_t i = 0; i < padded; ++i) {
+			const float cx = 0.5f * (minX[i] + maxX[i]), ex = 0.5f * (maxX[i] - minX[i]);
+			const float cy = 0.5f * (minY[i] + maxY[i]), ey = 0.5f * (maxY[i] - minY[i]);
+			const float cz = 0.5f * (minZ[i] + maxZ[i]), ez = 0.5f * (maxZ[i] - minZ[i]);
+			const float center = m0 * cx + m1 * cy + m2 * cz + t;
+			const float extent = a0 * ex + a1 * ey + a2 * ez;
+			outMin[i] = center - extent;
+			outMax[i] = center + extent;
+		}
+	}
+}
+
+int ShadowCasters::cull(const glm::vec3& volumeMin, const glm::vec3& volumeMax, std::vector<int>& visible, float& zMin, float& zMax) const
+{
+	const float* s[NumStreams];
+	for (int k = 0; k < NumStreams; ++k) {
+		s[k] = m_light[k].data();
+	}
+	const int padded = int(m_light[MinX].size());
+	const std::size_t first = visible.size();
+	float lo = std::numeric_limits<float>::max();
+	float hi = -std::numeric_limits<float>::max();
+
+#ifdef CASTERS_X86
+	// 4 boxes per test, one bit per visible box
+	const __m128 vMinX = _mm_set1_ps(volumeMin.x), vMaxX = _mm_set1_ps(volumeMax.x);
+	const __m128 vMinY = _mm_set1_ps(volumeMin.y), vMaxY = _mm_set1_ps(volumeMax.y);
+	const __m128 vFar = _mm_set1_ps(volumeMin.z);
+	__m128 rangeMin = _mm_set1_ps(lo), rangeMax = _mm_set1_ps(hi);
+	for (int i = 0; i < padded; i += Lanes)
+	{
+		const __m128 minZ = _mm_loadu_ps(s[MinZ] + i);
+		const __m128 maxZ = _mm_loadu_ps(s[MaxZ] + i);
+		__m128 inside = _mm_and_ps(_mm_cmpge_ps(_mm_loadu_ps(s[MaxX] + i), vMinX), _mm_cmple_ps(_mm_loadu_ps(s[MinX] + i), vMaxX));
+		inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(_mm_loadu_ps(s[MaxY] + i), vMinY), _mm_cmple_ps(_mm_loadu_ps(s[MinY] + i), vMaxY)));
+		inside = _mm_and_ps(inside, _mm_cmpge_ps(maxZ, vFar));
+		int mask = _mm_movemask_ps(inside);
+		if (mask == 0) {
+			continue;
+		}
+		// Depth range of the visible lanes only
+		rangeMin = _mm_min_ps(rangeMin, _mm_or_ps(_mm_and_ps(inside, minZ), _mm_andnot_ps(inside, rangeMin)));
+		rangeMax = _mm_max_ps(rangeMax, _mm_or_ps(_mm_and_ps(inside, maxZ), _mm_andnot_ps(inside, rangeMax)));
+		while (mask != 0) {
+			const int lane = mask & 1 ? 0 : mask & 2 ? 1 : mask & 4 ? 2 : 3;
+			visible.push_back(i + lane);
+			mask &= mask - 1;
+		}
+	}
+	float mins[Lanes], maxs[Lanes];
+	_mm_storeu_ps(mins, rangeMin);
+	_mm_storeu_ps(maxs, rangeMax);
+	for (int lane = 0; lane < Lanes; ++lane) {
+		lo = std::min(lo, mins[lane]);
+		hi = std::max(hi, maxs[lane]);
+	}
+#else
+	for (int i = 0; i < padded; ++i)
+	{
+		if (s[MaxX][i] >= volumeMin.x && s[MinX][i] <= volumeMax.x
+			&& s[MaxY][i] >= volumeMin.y && s[MinY][i] <= volumeMax.y
+			&& s[MaxZ][i] >= volumeMin.z) {
+			visible.push_back(i);
+			lo = std::min(lo, s[MinZ][i]);
+			hi = std::max(hi, s[MaxZ][i]);
+		}
+	}
+#endif
+
+	const int count = int(visible.size() - first);
+	if (count > 0) {
+		zMin = lo;
+		zMax = hi;
+	}
+	return count;
+}
+
+void ShadowCasters::distanceRange(const glm::vec3& point, float& nearest, float& farthest) const
+{
+	float nearest2 = std::numeric_limits<float>::max();
+	float farthest2 = 0.0f;
+	for (int i = 0; i < m_count; ++i)
+	{
+		float inside2 = 0.0f, outside2 = 0.0f;
+		for (int axis = 0; axis < 3; ++axis) {
+			const float lo = m_world[MinX + axis][i] - point[axis];
+			const float hi = m_world[MaxX + axis][i] - point[axis];
+			// Closest point of the box (0 inside the slab) and farthest corner
+			const float closest = lo > 0.0f ? lo : (hi < 0.0f ? hi : 0.0f);
+			const float far = std::max(std::abs(lo), std::abs(hi));
+			inside2 += closest * closest;
+			outside2 += far * far;
+		}
+		nearest2 = std::min(nearest2, inside2);
+		farthest2 = std::max(farthest2, outside2);
+	}
+	nearest = m_count > 0 ? std::sqrt(nearest2) : 0.0f;
+	farthest = std::sqrt(farthest2);
+}
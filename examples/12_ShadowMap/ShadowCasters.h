@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Bounds of the shadow casters, for the culling of the shadow pass
+//
+// The world space boxes (AABB) are stored as a Structure of Arrays and
+// tested 4 at a time (SSE, scalar fallback on other architectures):
+// - transform() moves all the boxes in the light space once per frame
+//   (center transformed, extent by the absolute matrix)
+// - cull() keeps the boxes overlapping the light volume of a shadow map
+//   in x and y and in front of its far plane: the casters between the
+//   volume and the light still cast shadows inside it. The depth range
+//   of the kept boxes tightens the near and far planes of the map.
+//
+// The index of a caster is its order of add().
+class ShadowCasters
+{
+public:
+	// Number of boxes tested together (the arrays are padded)
+	static const int Lanes = 4;
+
+	// ------------------------------------------------------------------------
+	void clear();
+	void add(const glm::vec3& boxMin, const glm::vec3& boxMax);
+	int size() const { return m_count; }
+
+	// ------------------------------------------------------------------------
+	// compute the bounds of the boxes in the light space (lightView: world
+	// to light, the light looks down -z)
+	void transform(const glm::mat4& lightView);
+	// append the index of the boxes (light space, after transform) touching
+	// the volume [volumeMin.xy, volumeMax.xy] x [volumeMin.z, +inf) to
+	// visible. zMin/zMax: depth range of these boxes (unchanged if none).
+	// return the number of boxes appended
+	int cull(const glm::vec3& volumeMin, const glm::vec3& volumeMax, std::vector<int>& visible, float& zMin, float& zMax) const;
+
+	// ------------------------------------------------------------------------
+	// distance between a point and the closest / farthest box (world space)
+	void distanceRange(const glm::vec3& point, float& nearest, float& farthest) const;
+
+private:
+	enum Stream { MinX, MinY, MinZ, MaxX, MaxY, MaxZ, NumStreams };
+
+	int m_count = 0;
+	std::vector<float> m_world[NumStreams]; // World space bounds
+	std::vector<float> m_light[NumStreams]; // Light space bounds (transform)
+};
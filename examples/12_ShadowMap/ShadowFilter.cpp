@@ -0,0 +1,93 @@
+#include "ShadowFilter.h"
+
+#include <algorithm>
+
+namespace {
+	void setupSampler(GLuint sampler, GLint filter, bool compare)
+	{
+		const GLfloat border[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, filter);
+		glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, filter);
+		glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		glSamplerParameterfv(sampler, GL_TEXTURE_BORDER_COLOR, border);
+		if (compare) {
+			// Lit if the (biased) depth of the fragment <= depth of the shadow map
+			glSamplerParameteri(sampler, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+			glSamplerParameteri(sampler, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		}
+		else {
+			glSamplerParameteri(sampler, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+		}
+	}
+}
+
+ShadowFilter::~ShadowFilter()
+{
+	release();
+}
+
+void ShadowFilter::create()
+{
+	release();
+	glGenSamplers(1, &m_comparePoint);
+	glGenSamplers(1, &m_compareLinear);
+	glGenSamplers(1, &m_depth);
+	setupSampler(m_comparePoint, GL_NEAREST, true);
+	setupSampler(m_compareLinear, GL_LINEAR, true);
+	setupSampler(m_depth, GL_NEAREST, false);
+}
+
+void ShadowFilter::release()
+{
+	if (m_comparePoint != 0) {
+		glDeleteSamplers(1, &m_comparePoint);
+		glDeleteSamplers(1, &m_compareLinear);
+		glDeleteSamplers(1, &m_depth);
+		m_comparePoint = m_compareLinear = m_depth = 0;
+	}
+}
+
+std::string ShadowFilter::defines(const Settings& settings)
+{
+	return "#define SHADOW_FILTER " + std::to_string(int(settings.mode)) + "\n"
+		+ "#define SHADOW_TAPS " + std::to_string(taps(settings)) + "\n";
+}
+
+int ShadowFilter::kernelSize(int kernel)
+{
+	const int sizes[NumKernelSizes] = { 4, 8, 16, 32 };
+	return sizes[std::min(std::max(kernel, 0), NumKernelSizes - 1)];
+}
+
+int ShadowFilter::taps(const Settings& settings)
+{
+	return (settings.mode == Poisson || settings.mode == RotatedDisk) ? kernelSize(settings.kernel) : 1;
+}
+
+const char* ShadowFilter::name(Mode mode)
+{
+	switch (mode)
+	{
+	case Nearest: return "Nearest";
+	case Hardware: return "Hardware 2x2 PCF";
+	case Poisson: return "Poisson disk PCF";
+	case RotatedDisk: return "Rotated disk PCF";
+	default: return "";
+	}
+}
+
+void ShadowFilter::bind(GLuint unit, Mode mode) const
+{
+	glBindSampler(unit, mode == Nearest ? m_comparePoint : m_compareLinear);
+}
+
+void ShadowFilter::bindDepth(GLuint unit) const
+{
+	glBindSampler(unit, m_depth);
+}
+
+void ShadowFilter::unbind(GLuint unit)
+{
+	glBindSampler(unit, 0);
+}
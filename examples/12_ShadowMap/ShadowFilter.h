@@ -0,0 +1,64 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <string>
+
+// Filtering of the shadow map lookups
+//
+// The depth comparison is done by the texture unit: the sampler has
+// GL_TEXTURE_COMPARE_MODE set, so a texture() on a sampler2DArrayShadow
+// returns the lit fraction. With GL_LINEAR the hardware compares the 4
+// nearest texels and filters the results (2x2 PCF for the cost of one
+// lookup). The wrap mode is CLAMP_TO_BORDER with a border depth of 1.0:
+// everything outside the shadow map is lit.
+//
+// The mode and the number of taps are compile-time variants of
+// triangles.frag (SHADOW_FILTER and SHADOW_TAPS, see defines()):
+// - Nearest: 1 tap, no filtering (hard shadows, same as a manual compare)
+// - Hardware: 1 tap, 2x2 PCF
+// - Poisson: SHADOW_TAPS hardware PCF taps on a Poisson disk (radius in texels)
+// - RotatedDisk: same disk rotated per pixel (noise instead of banding)
+class ShadowFilter
+{
+public:
+	enum Mode { Nearest, Hardware, Poisson, RotatedDisk, NumModes };
+	static const int NumKernelSizes = 4;
+	static const int MaxTaps = 32;
+
+	struct Settings {
+		Mode mode = Hardware;
+		int kernel = 2;        // Index in kernelSize() (16 taps)
+		float radius = 1.5f;   // Radius of the disk (texels)
+	};
+
+	ShadowFilter() = default;
+	~ShadowFilter();
+	ShadowFilter(const ShadowFilter&) = delete;
+	ShadowFilter& operator=(const ShadowFilter&) = delete;
+
+	// ------------------------------------------------------------------------
+	// create the sampler objects
+	void create();
+	void release();
+
+	// ------------------------------------------------------------------------
+	// defines selecting the variant of triangles.frag
+	static std::string defines(const Settings& settings);
+	// number of taps of a kernel (4, 8, 16 or 32)
+	static int kernelSize(int kernel);
+	static int taps(const Settings& settings);
+	static const char* name(Mode mode);
+
+	// ------------------------------------------------------------------------
+	// bind the comparison sampler of the mode to a texture unit
+	void bind(GLuint unit, Mode mode) const;
+	// bind the sampler without comparison (to display the depth)
+	void bindDepth(GLuint unit) const;
+	static void unbind(GLuint unit);
+
+private:
+	GLuint m_comparePoint = 0;  // Nearest
+	GLuint m_compareLinear = 0; // Other modes (2x2 PCF)
+	GLuint m_depth = 0;
+};
@@ -0,0 +1,68 @@
+#include "ShadowPass.h"
+
+ShadowPass::~ShadowPass()
+{
+	release();
+}
+
+bool ShadowPass::create(int width, int height, int layers)
+{
+	release();
+	m_width = width;
+	m_height = height;
+
+	// 1) create depth texture array
+	glGenTextures(1, &m_texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, width, height, layers, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+	// (the main pass overrides this state with the samplers of ShadowFilter)
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	const GLfloat border[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+
+	// 2) attach each layer as the depth buffer of a FBO
+	// (no re-attachment, so no re-validation, during the frame)
+	bool complete = true;
+	m_framebuffers.resize(layers);
+	glGenFramebuffers(layers, m_framebuffers.data());
+	for (int layer = 0; layer < layers; ++layer) {
+		glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffers[layer]);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_texture, 0, layer);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		// Check while the framebuffer is still bound
+		complete &= glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return complete;
+}
+
+void ShadowPass::release()
+{
+	if (!m_framebuffers.empty()) {
+		glDeleteFramebuffers(GLsizei(m_framebuffers.size()), m_framebuffers.data());
+		m_framebuffers.clear();
+	}
+	if (m_texture != 0) {
+		glDeleteTextures(1, &m_texture);
+		m_texture = 0;
+	}
+}
+
+void ShadowPass::begin(int layer, bool clear) const
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffers[layer]);
+	glViewport(0, 0, m_width, m_height);
+	if (clear) {
+		glClear(GL_DEPTH_BUFFER_BIT);
+	}
+}
+
+void ShadowPass::end(const Target& next) const
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, next.framebuffer);
+	glViewport(0, 0, next.width, next.height);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <vector>
+
+// Render pass producing the shadow maps (depth only)
+//
+// The pass owns a depth texture array (one layer per shadow map, e.g.
+// per cascade) with one framebuffer per layer, and knows its own
+// viewport: begin(layer) binds them, end() rebinds the target given by
+// the caller with the viewport the caller tracks. Nothing is read back
+// from OpenGL (no glGet*, no glFinish): the main pass samples the depth
+// texture after the shadow draws in the same command stream, so the
+// driver orders them without stalling the CPU.
+class ShadowPass
+{
+public:
+	// Framebuffer and viewport of a render target
+	struct Target {
+		GLuint framebuffer = 0;
+		int width = 0;
+		int height = 0;
+	};
+
+	ShadowPass() = default;
+	~ShadowPass();
+	ShadowPass(const ShadowPass&) = delete;
+	ShadowPass& operator=(const ShadowPass&) = delete;
+
+	// ------------------------------------------------------------------------
+	// allocate the depth texture array (width x height x layers) and the
+	// framebuffers. return true if the framebuffers are complete
+	bool create(int width, int height, int layers = 1);
+	void release();
+
+	// ------------------------------------------------------------------------
+	// bind the framebuffer of a layer, set the viewport to the shadow map
+	// and clear it (not cleared to draw over a copy, see ShadowCache)
+	void begin(int layer = 0, bool clear = true) const;
+	// bind the next target (and its viewport)
+	void end(const Target& next) const;
+
+	// Depth texture array (to sample in the main pass)
+	GLuint texture() const { return m_texture; }
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+	int layers() const { return int(m_framebuffers.size()); }
+
+private:
+	std::vector<GLuint> m_framebuffers; // One per layer
+	int m_width = 0;
+	int m_height = 0;
+	GLuint m_texture = 0;
+};
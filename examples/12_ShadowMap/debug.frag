@@ -1,7 +1,8 @@
 #version 400 core
 
-uniform sampler2D tex;
+uniform sampler2DArray tex;
 uniform float scale;
+uniform int layer;
 
 in vec2 fUV;
 
@@ -9,5 +10,5 @@ out vec4 oColor;
 
 void main()
 {
-    oColor = texture(tex, fUV).rrrr * scale;
+    oColor = texture(tex, vec3(fUV, float(layer))).rrrr * scale;
 }
@@ -0,0 +1,32 @@
+#version 430 core
+
+// Single pass rendering of the 6 faces of the point light shadow
+// (layered framebuffer, see PointShadow.h)
+// VERTEX_LAYER: the face is selected here (one instance per face),
+// otherwise the vertices are sent in world space to shadow_cube.geom
+#ifdef VERTEX_LAYER
+#extension GL_ARB_shader_viewport_layer_array : require
+#endif
+
+uniform mat4 ModelMatrix;
+#ifdef VERTEX_LAYER
+// World to clip space of the faces
+uniform mat4 faceMatrices[6];
+// Face of each instance (the faces touched by the object)
+uniform int faces[6];
+#endif
+
+// input vertex position
+layout(location = 0) in vec4 vPosition;
+
+void main()
+{
+    vec4 worldPosition = ModelMatrix * vPosition;
+#ifdef VERTEX_LAYER
+    int face = faces[gl_InstanceID];
+    gl_Position = faceMatrices[face] * worldPosition;
+    gl_Layer = face;
+#else
+    gl_Position = worldPosition;
+#endif
+}
@@ -1,9 +1,40 @@
 #version 400 core
 
-uniform sampler2D texShadowMap;
+#define MAX_CASCADES 4
+
+// Variant (defines added by ShadowFilter::defines)
+// SHADOW_FILTER 0: nearest, 1: hardware 2x2 PCF,
+//               2: Poisson disk PCF, 3: rotated disk PCF
+#ifndef SHADOW_FILTER
+#define SHADOW_FILTER 1
+#endif
+#ifndef SHADOW_TAPS
+#define SHADOW_TAPS 16
+#endif
+
+// One shadow map per cascade (the sampler compares the depths)
+uniform sampler2DArrayShadow texShadowMap;
+uniform float filterRadius; // Radius of the PCF disk (texels)
+uniform mat4 cascadeMatrices[MAX_CASCADES]; // World to light clip space
+uniform float cascadeSplits[MAX_CASCADES];  // Far view depth of the cascades
+uniform int cascadeCount;
+uniform bool showCascades;
+
+// Point light: depth cube map (one face per major axis)
+uniform samplerCubeShadow texShadowCube;
+uniform float pointNear; // Planes of the perspectives of the faces
+uniform float pointFar;
+uniform float pointBiasScale; // The texels of the faces cover more than the cascade ones
+
 uniform vec4 uColor;
 
+// 0: directional light (cascades), 1: point light (cube map)
+uniform int lightType;
+// Directional light (direction towards the light)
+uniform vec3 lightDirectionCameraSpace;
+// Point light
 uniform vec3 lightPositionCameraSpace;
+uniform vec3 lightPositionWorld;
 
 uniform int biasType;
 uniform float biasValue;
@@ -11,40 +42,121 @@ uniform float biasValueMin;
 
 in vec3 fNormal;
 in vec3 fPosition;
-in vec4 fShadowCoord;
+in vec3 fWorldPosition;
 
 out vec4 oColor;
 
-void main()
-{
-    vec3 LightDirection = normalize(lightPositionCameraSpace-fPosition);
-    float diffuse = max(0.0, dot(fNormal, LightDirection));
+#if SHADOW_FILTER >= 2
+// Progressive Poisson disk: the first 4, 8, 16 taps are well distributed
+const vec2 poissonDisk[32] = vec2[](
+    vec2(-0.5000, -0.2500), vec2(0.2500, -0.5000), vec2(0.5000, 0.2500), vec2(-0.2500, 0.5000),
+    vec2(-0.0507, 0.0055), vec2(0.2326, 0.7000), vec2(-0.2384, -0.7115), vec2(0.7146, -0.2645),
+    vec2(-0.6868, 0.2504), vec2(0.3693, -0.0987), vec2(0.1463, 0.3329), vec2(-0.3855, 0.1090),
+    vec2(0.8289, 0.1040), vec2(-0.1454, -0.3581), vec2(-0.8296, -0.1245), vec2(-0.6257, -0.5634),
+    vec2(0.5925, 0.5793), vec2(-0.5740, 0.6107), vec2(-0.1347, 0.8335), vec2(0.0811, -0.8455),
+    vec2(0.5591, -0.5859), vec2(0.1308, -0.2336), vec2(-0.1606, 0.2527), vec2(0.7831, 0.3763),
+    vec2(0.3452, -0.7536), vec2(-0.3756, -0.4858), vec2(0.4482, -0.3286), vec2(0.3654, 0.4646),
+    vec2(0.2027, 0.0802), vec2(-0.0011, 0.5805), vec2(-0.6067, -0.0049), vec2(-0.3982, 0.7912)
+);
+#endif
 
-    vec4 materialColor = uColor;
+// Lit fraction of the fragment (1: lit, 0: in shadow)
+// coord: position in the shadow map of the cascade, depth: biased depth
+float shadowVisibility(vec2 coord, float cascade, float depth)
+{
+#if SHADOW_FILTER <= 1
+    // One lookup (2x2 PCF with the linear sampler)
+    return texture(texShadowMap, vec4(coord, cascade, depth));
+#else
+    vec2 texel = filterRadius / vec2(textureSize(texShadowMap, 0).xy);
+#if SHADOW_FILTER == 3
+    // Interleaved gradient noise: the rotation changes per pixel
+    float angle = 6.2831853 * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+    mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+#endif
+    float visibility = 0.0;
+    for (int i = 0; i < SHADOW_TAPS; ++i) {
+#if SHADOW_FILTER == 3
+        vec2 offset = rotation * poissonDisk[i];
+#else
+        vec2 offset = poissonDisk[i];
+#endif
+        visibility += texture(texShadowMap, vec4(coord + offset * texel, cascade, depth));
+    }
+    return visibility / float(SHADOW_TAPS);
+#endif
+}
 
-    // Project the shadow coordinate by dividing by parameter w.
-    //
-    // We also need to map uv coordinates from NDC to the range [0...1, 0...1]
-    //  and depth values (z) from NDC to the range [0...1]
-    //
-    vec3 coord = 0.5*(fShadowCoord.xyz / fShadowCoord.w)+0.5;
+// Lit fraction of the fragment for the point light
+float pointVisibility(float bias)
+{
+    // The face is selected by the major axis of the direction, its depth
+    // is the perspective depth of this axis (same as the shadow pass)
+    vec3 direction = fWorldPosition - lightPositionWorld;
+    // (the bias is relative to the distance: the perspective depth is not linear)
+    vec3 axis = abs(direction);
+    float distance = max(axis.x, max(axis.y, axis.z)) * (1.0 - pointBiasScale * bias);
+    float ndc = (pointFar + pointNear) / (pointFar - pointNear)
+        - 2.0 * pointFar * pointNear / ((pointFar - pointNear) * distance);
+    return texture(texShadowCube, vec4(direction, 0.5 * ndc + 0.5));
+}
 
-    // get closest depth value from light's perspective (using [0,1] range fragPosLight as coords)
-    float closestDepth = texture(texShadowMap, coord.xy).r; 
+void main()
+{
+    vec3 normal = normalize(fNormal);
+    vec3 LightDirection = lightType == 1 ? normalize(lightPositionCameraSpace - fPosition) : normalize(lightDirectionCameraSpace);
+    float diffuse = max(0.0, dot(normal, LightDirection));
 
-    // get depth of current fragment from light's perspective
-    float currentDepth = coord.z;
+    vec4 materialColor = uColor;
 
-    float bias = 0.0; 
+    float bias = 0.0;
     if(biasType == 1) {
         bias = biasValue;
     } else if(biasType == 2) {
-        bias = max(biasValue * (1.0 - dot(fNormal, LightDirection)), biasValueMin); 
+        bias = max(biasValue * (1.0 - dot(normal, LightDirection)), biasValueMin);
+    }
+
+    if (lightType == 1) {
+        float shadow = 1.0 - pointVisibility(bias);
+        vec4 ambient = vec4(vec3(0.1),1.0);
+        oColor = (1-shadow) * materialColor * diffuse + ambient;
+        return;
+    }
+
+    // Select the first cascade containing the fragment (view depth)
+    float viewDepth = -fPosition.z;
+    int cascade = cascadeCount;
+    for (int i = cascadeCount - 1; i >= 0; --i) {
+        if (viewDepth <= cascadeSplits[i]) {
+            cascade = i;
+        }
+    }
+
+    float shadow = 0.0;
+    if (cascade < cascadeCount) {
+        // Orthographic projection: no division by w
+        //
+        // We also need to map uv coordinates from NDC to the range [0...1, 0...1]
+        //  and depth values (z) from NDC to the range [0...1]
+        //
+        vec4 shadowCoord = cascadeMatrices[cascade] * vec4(fWorldPosition, 1.0);
+        vec3 coord = 0.5 * shadowCoord.xyz + 0.5;
+
+        // get depth of current fragment from light's perspective
+        float currentDepth = coord.z;
+
+        // check whether current frag pos is in shadow
+        // (compared with the closest depth from light's perspective by the sampler)
+        shadow = 1.0 - shadowVisibility(coord.xy, float(cascade), currentDepth - bias);
     }
-    
 
-    // check whether current frag pos is in shadow
-    float shadow = currentDepth - bias > closestDepth  ? 1.0 : 0.0;
+    if (showCascades) {
+        const vec4 colors[MAX_CASCADES + 1] = vec4[](
+            vec4(1.0, 0.4, 0.4, 1.0), vec4(0.4, 1.0, 0.4, 1.0),
+            vec4(0.4, 0.4, 1.0, 1.0), vec4(1.0, 1.0, 0.4, 1.0),
+            vec4(1.0));
+        materialColor *= colors[cascade];
+    }
 
     // Diffuse and ambient lighting.
     vec4 ambient = vec4(vec3(0.1),1.0);
@@ -2,7 +2,7 @@
 
 uniform mat4 MVMatrix;
 uniform mat4 ProjMatrix;
-uniform mat4 MLPMatrix;
+uniform mat4 ModelMatrix;
 uniform mat3 normalMatrix;
 uniform vec4 uColor;
 
@@ -11,7 +11,7 @@ layout(location = 1) in vec3 vNormal;
 
 out vec3 fNormal;
 out vec3 fPosition;
-out vec4 fShadowCoord;
+out vec3 fWorldPosition;
 
 void main()
 {
@@ -21,6 +21,6 @@ void main()
      fPosition = vEyeCoord.xyz;
      fNormal = normalMatrix * vNormal;
 
-     // Project inside shadow map
-     fShadowCoord = MLPMatrix * vPosition;
+     // Projected inside the shadow map of the cascade (fragment shader)
+     fWorldPosition = (ModelMatrix * vPosition).xyz;
 }
@@ -0,0 +1,184 @@
+#include "DepthSort.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace {
+	const int RadixBits = 8;
+	const int RadixSize = 1 << RadixBits;
+	const int NumPasses = 32 / RadixBits; // Only the key is sorted
+
+	// Number of particles per chunk for the parallel passes
+	const std::size_t ChunkSize = 65536;
+
+	// Insertion sort: only when less than 1 pair out of 32 is misplaced
+	// and give up after 4 moves per particle.
+	const std::size_t MaxDescentRatio = 32;
+	const std::size_t MaxMovesPerParticle = 4;
+	// Number of sorts without trying the insertion sort after a failure
+	const int CoherenceCooldown = 8;
+
+	// Execute f(chunk) for all the chunks (in parallel if possible)
+	template<typename F>
+	void forEachChunk(std::size_t numChunks, JobSystem* jobs, const F& f)
+	{
+		if (jobs != nullptr && numChunks > 1) {
+			jobs->parallelFor(0, numChunks, 1, [&](std::size_t begin, std::size_t end) {
+				for (std::size_t c = begin; c < end; ++c) f(c);
+			});
+		}
+		else {
+			for (std::size_t c = 0; c < numChunks; ++c) f(c);
+		}
+	}
+}
+
+uint32_t DepthSorter::sortableKey(float f)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &f, sizeof(float));
+	// Negative: reverse all the bits, positive: flip the sign
+	const uint32_t mask = uint32_t(-int32_t(bits >> 31)) | 0x80000000u;
+	return bits ^ mask;
+}
+
+void DepthSorter::sort(const ParticleSystem& system, const glm::vec3& eye, JobSystem* jobs)
+{
+	sort(system, nullptr, system.size(), eye, jobs);
+}
+
+void DepthSorter::sort(const ParticleSystem& system, const std::vector<uint32_t>& indices, const glm::vec3& eye, JobSystem* jobs)
+{
+	sort(system, indices.data(), indices.size(), eye, jobs);
+}
+
+void DepthSorter::sort(const ParticleSystem& system, const uint32_t* indices, std::size_t n, const glm::vec3& eye, JobSystem* jobs)
+{
+	const float* px = system.positionX();
+	const float* py = system.positionY();
+	const float* pz = system.positionZ();
+
+	// Previous order is still usable if the number of particles did not change
+	// (after a failed insertion sort, wait a few frames before trying again)
+	bool reuse = m_temporalCoherence && m_order.size() == n;
+	if (reuse && m_coherenceCooldown > 0) {
+		m_coherenceCooldown--;
+		reuse = false;
+	}
+	m_keys.resize(n);
+	m_pairs.resize(n);
+	m_temp.resize(n);
+
+	// Keys: squared distance, inverted (farthest first)
+	const std::size_t numChunks = (n + ChunkSize - 1) / ChunkSize;
+	forEachChunk(numChunks, jobs, [&](std::size_t c) {
+		const std::size_t end = std::min(n, (c + 1) * ChunkSize);
+		for (std::size_t i = c * ChunkSize; i < end; ++i) {
+			const std::size_t j = indices != nullptr ? indices[i] : i;
+			const float dx = eye.x - px[j];
+			const float dy = eye.y - py[j];
+			const float dz = eye.z - pz[j];
+			m_keys[i] = ~sortableKey(dx * dx + dy * dy + dz * dz);
+		}
+	});
+
+	// Pairs in the previous order (or in the particles order)
+	forEachChunk(numChunks, jobs, [&](std::size_t c) {
+		const std::size_t end = std::min(n, (c + 1) * ChunkSize);
+		for (std::size_t i = c * ChunkSize; i < end; ++i) {
+			const uint32_t index = reuse ? m_order[i] : uint32_t(i);
+			m_pairs[i] = (uint64_t(m_keys[index]) << 32) | index;
+		}
+	});
+
+	m_usedInsertionSort = reuse && insertionSort();
+	if (!m_usedInsertionSort) {
+		if (reuse) m_coherenceCooldown = CoherenceCooldown;
+		radixSort(jobs);
+	}
+
+	m_order.resize(n);
+	for (std::size_t i = 0; i < n; ++i) {
+		m_order[i] = uint32_t(m_pairs[i]);
+	}
+}
+
+bool DepthSorter::insertionSort()
+{
+	const std::size_t n = m_pairs.size();
+	std::size_t descents = 0;
+	for (std::size_t i = 1; i < n; ++i) {
+		descents += m_pairs[i - 1] > m_pairs[i];
+	}
+	if (descents == 0) return true;
+	if (descents * MaxDescentRatio > n) return false;
+
+	// If we give up, the pairs are still a permutation of the input
+	// (the radix sort can be used directly)
+	std::size_t budget = MaxMovesPerParticle * n;
+	for (std::size_t i = 1; i < n; ++i)
+	{
+		const uint64_t v = m_pairs[i];
+		std::size_t j = i;
+		while (j > 0 && m_pairs[j - 1] > v) {
+			m_pairs[j] = m_pairs[j - 1];
+			--j;
+		}
+		m_pairs[j] = v;
+		const std::size_t moves = i - j;
+		if (moves > budget) return false;
+		budget -= moves;
+	}
+	return true;
+}
+
+void DepthSorter::radixSort(JobSystem* jobs)
+{
+	const std::size_t n = m_pairs.size();
+	const std::size_t numChunks = jobs != nullptr ? (n + ChunkSize - 1) / ChunkSize : 1;
+	const std::size_t chunkSize = (n + numChunks - 1) / std::max<std::size_t>(numChunks, 1);
+	std::vector<std::array<uint32_t, RadixSize>> histograms(numChunks);
+
+	for (int pass = 0; pass < NumPasses; ++pass)
+	{
+		const int shift = 32 + pass * RadixBits;
+
+		// Histogram of each chunk
+		forEachChunk(numChunks, jobs, [&](std::size_t c) {
+			auto& h = histograms[c];
+			h.fill(0);
+			const std::size_t end = std::min(n, (c + 1) * chunkSize);
+			for (std::size_t i = c * chunkSize; i < end; ++i) {
+				h[(m_pairs[i] >> shift) & (RadixSize - 1)]++;
+			}
+		});
+
+		// Exclusive prefix sum (digit major, then chunk)
+		// skip the pass if all the keys have the same digit
+		bool skip = false;
+		uint32_t offset = 0;
+		for (int d = 0; d < RadixSize; ++d) {
+			uint32_t total = 0;
+			for (std::size_t c = 0; c < numChunks; ++c) {
+				const uint32_t count = histograms[c][d];
+				histograms[c][d] = offset;
+				offset += count;
+				total += count;
+			}
+			skip |= (total == n);
+		}
+		if (skip) continue;
+
+		// Scatter (stable)
+		forEachChunk(numChunks, jobs, [&](std::size_t c) {
+			auto& h = histograms[c];
+			const std::size_t end = std::min(n, (c + 1) * chunkSize);
+			for (std::size_t i = c * chunkSize; i < end; ++i) {
+				const uint64_t v = m_pairs[i];
+				m_temp[h[(v >> shift) & (RadixSize - 1)]++] = v;
+			}
+		});
+		m_pairs.swap(m_temp);
+	}
+}
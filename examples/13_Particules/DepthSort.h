@@ -0,0 +1,57 @@
+#pragma once
+
+#include "ParticleSystem.h"
+#include "JobSystem.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Back to front order of the particles (for alpha blending)
+//
+// Instead of moving the particles, a (depth key, index) pair is computed
+// once per particle and sorted with a LSD radix sort (4 passes of 8 bits).
+// The depth (squared distance) is converted to an uint32 that keeps the
+// float ordering, then inverted to sort from the farthest to the closest.
+//
+// The particles barely move between two frames: the keys are first
+// computed in the previous order and, if almost sorted, an insertion sort
+// finishes the job (linear time when the order is still valid).
+class DepthSorter
+{
+public:
+	// ------------------------------------------------------------------------
+	// compute the order of the particles seen from eye
+	// jobs: split the radix passes over the threads (optional)
+	void sort(const ParticleSystem& system, const glm::vec3& eye, JobSystem* jobs = nullptr);
+	// Same for a subset of the particles: order() contains positions in
+	// "indices" (the particle of order()[i] is indices[order()[i]])
+	void sort(const ParticleSystem& system, const std::vector<uint32_t>& indices, const glm::vec3& eye, JobSystem* jobs = nullptr);
+
+	// ------------------------------------------------------------------------
+	// indices of the particles from the farthest to the closest
+	const std::vector<uint32_t>& order() const { return m_order; }
+
+	// Reuse the previous order (insertion sort) when possible
+	void setTemporalCoherence(bool enabled) { m_temporalCoherence = enabled; }
+	// Last sort was done with the insertion sort?
+	bool usedInsertionSort() const { return m_usedInsertionSort; }
+
+	// Convert a float in an uint32 with the same ordering
+	static uint32_t sortableKey(float f);
+
+private:
+	void sort(const ParticleSystem& system, const uint32_t* indices, std::size_t n, const glm::vec3& eye, JobSystem* jobs);
+	bool insertionSort();
+	void radixSort(JobSystem* jobs);
+
+private:
+	std::vector<uint32_t> m_keys; // Key of each particle
+	std::vector<uint64_t> m_pairs; // (key << 32) | index
+	std::vector<uint64_t> m_temp;
+	std::vector<uint32_t> m_order;
+	bool m_temporalCoherence = true;
+	bool m_usedInsertionSort = false;
+	int m_coherenceCooldown = 0;
+};
@@ -0,0 +1,186 @@
+#include "Interactions.h"
+
+#include <chrono>
+
+namespace {
+	// Number of particles per job
+	const std::size_t ChunkSize = 4096;
+
+	template<typename F>
+	void forEachRange(std::size_t count, JobSystem* jobs, const F& f)
+	{
+		if (jobs != nullptr && count > ChunkSize) {
+			jobs->parallelFor(0, count, ChunkSize, f);
+		}
+		else {
+			f(0, count);
+		}
+	}
+
+	// Push the particle out of the sphere and reflect its velocity
+	inline void collide(const SphereProxy& sphere, float restitution, glm::vec3& p, glm::vec3& v)
+	{
+		const glm::vec3 d = p - sphere.center;
+		const float distance2 = glm::dot(d, d);
+		if (distance2 >= sphere.radius * sphere.radius || distance2 == 0.0f) return;
+		const glm::vec3 n = d / std::sqrt(distance2);
+		p = sphere.center + n * sphere.radius;
+		const float vn = glm::dot(v, n);
+		if (vn < 0.0f) v -= (1.0f + restitution) * vn * n;
+	}
+
+	// Push the particle out of the box by the closest face
+	inline void collide(const BoxProxy& box, float restitution, glm::vec3& p, glm::vec3& v)
+	{
+		if (glm::any(glm::lessThan(p, box.min)) || glm::any(glm::greaterThan(p, box.max))) return;
+		int axis = 0;
+		float side = -1.0f;
+		float depth = p.x - box.min.x;
+		for (int a = 0; a < 3; ++a) {
+			if (p[a] - box.min[a] < depth) { depth = p[a] - box.min[a]; axis = a; side = -1.0f; }
+			if (box.max[a] - p[a] < depth) { depth = box.max[a] - p[a]; axis = a; side = 1.0f; }
+		}
+		p[axis] = side < 0.0f ? box.min[axis] : box.max[axis];
+		if (v[axis] * side < 0.0f) v[axis] = -v[axis] * restitution;
+	}
+}
+
+void ParticleInteractions::apply(ParticleSystem& system, float dt, const InteractionSettings& settings, JobSystem* jobs)
+{
+	apply(system, nullptr, system.size(), dt, settings, jobs);
+}
+
+void ParticleInteractions::apply(ParticleSystem& system, const std::vector<uint32_t>& particles, float dt, const InteractionSettings& settings, JobSystem* jobs)
+{
+	apply(system, particles.data(), particles.size(), dt, settings, jobs);
+}
+
+void ParticleInteractions::apply(ParticleSystem& system, const uint32_t* particles, std::size_t n, float dt, const InteractionSettings& settings, JobSystem* jobs)
+{
+	float* px = system.stream(ParticleSystem::PX);
+	float* py = system.stream(ParticleSystem::PY);
+	float* pz = system.stream(ParticleSystem::PZ);
+	float* vx = system.stream(ParticleSystem::VX);
+	float* vy = system.stream(ParticleSystem::VY);
+	float* vz = system.stream(ParticleSystem::VZ);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	const float h = settings.radius;
+	const float h2 = h * h;
+	// Index of the particle k in the system
+	auto particle = [particles](std::size_t k) { return particles != nullptr ? particles[k] : uint32_t(k); };
+	if (particles != nullptr) {
+		// The grid is built on the positions of the indexed particles only
+		m_x.resize(n);
+		m_y.resize(n);
+		m_z.resize(n);
+		forEachRange(n, jobs, [&](std::size_t begin, std::size_t end) {
+			for (std::size_t k = begin; k < end; ++k) {
+				const uint32_t i = particles[k];
+				m_x[k] = px[i];
+				m_y[k] = py[i];
+				m_z[k] = pz[i];
+			}
+		});
+		m_grid.build(m_x.data(), m_y.data(), m_z.data(), n, h, jobs);
+	}
+	else {
+		m_grid.build(px, py, pz, n, h, jobs);
+	}
+	auto now = std::chrono::high_resolution_clock::now();
+	m_gridTime = std::chrono::duration<float, std::milli>(now - start).count();
+	start = now;
+
+	// The particles are processed in the order of the grid (slots):
+	// the neighbors of consecutive particles are in the same cells
+	const float* sx = m_grid.sortedX();
+	const float* sy = m_grid.sortedY();
+	const float* sz = m_grid.sortedZ();
+	const uint32_t* indices = m_grid.indices().data();
+
+	// Density: sum of (1 - r^2 / h^2)^3 over the neighbors (the particle included)
+	m_sortedDensity.resize(n);
+	m_density.resize(n);
+	if (settings.density) {
+		forEachRange(n, jobs, [&](std::size_t begin, std::size_t end) {
+			for (std::size_t slot = begin; slot < end; ++slot) {
+				const glm::vec3 pi(sx[slot], sy[slot], sz[slot]);
+				float density = 0.0f;
+				int neighbors = 0;
+				m_grid.forEachNeighbor(pi.x, pi.y, pi.z, [&](uint32_t other) {
+					const glm::vec3 d = pi - glm::vec3(sx[other], sy[other], sz[other]);
+					const float r2 = glm::dot(d, d);
+					if (r2 < h2) {
+						const float w = 1.0f - r2 / h2;
+						density += w * w * w;
+						neighbors++;
+					}
+					return neighbors < settings.maxNeighbors;
+				});
+				m_sortedDensity[slot] = density;
+				m_density[indices[slot]] = density;
+			}
+		});
+	}
+
+	// Separation and pressure (only the velocities are written)
+	forEachRange(n, jobs, [&](std::size_t begin, std::size_t end) {
+		for (std::size_t slot = begin; slot < end; ++slot)
+		{
+			const glm::vec3 pi(sx[slot], sy[slot], sz[slot]);
+			const float pressureI = settings.density ? settings.stiffness * (m_sortedDensity[slot] - settings.restDensity) : 0.0f;
+			glm::vec3 acceleration(0.0f);
+			int neighbors = 0;
+			m_grid.forEachNeighbor(pi.x, pi.y, pi.z, [&](uint32_t other) {
+				const glm::vec3 d = pi - glm::vec3(sx[other], sy[other], sz[other]);
+				const float r2 = glm::dot(d, d);
+				if (r2 >= h2) return true; // Too far
+				if (++neighbors > settings.maxNeighbors) return false;
+				if (r2 < 1e-12f) return true; // The particle itself (or at the same position)
+				const float r = std::sqrt(r2);
+				const glm::vec3 direction = d / r;
+				const float q = 1.0f - r / h;
+				float magnitude = settings.separation * q;
+				if (settings.density) {
+					const float pressureJ = settings.stiffness * (m_sortedDensity[other] - settings.restDensity);
+					magnitude += 0.5f * (pressureI + pressureJ) / m_sortedDensity[other] * q * q;
+				}
+				acceleration += magnitude * direction;
+				return true;
+			});
+			const float length = glm::length(acceleration);
+			if (length > settings.maxAcceleration) {
+				acceleration *= settings.maxAcceleration / length;
+			}
+			const uint32_t i = particle(indices[slot]);
+			vx[i] += acceleration.x * dt;
+			vy[i] += acceleration.y * dt;
+			vz[i] += acceleration.z * dt;
+		}
+	});
+
+	// Collisions
+	forEachRange(n, jobs, [&](std::size_t begin, std::size_t end) {
+		for (std::size_t k = begin; k < end; ++k)
+		{
+			const uint32_t i = particle(k);
+			glm::vec3 p(px[i], py[i], pz[i]);
+			glm::vec3 v(vx[i], vy[i], vz[i]);
+			if (settings.floor && p.y < settings.floorHeight) {
+				p.y = settings.floorHeight;
+				if (v.y < 0.0f) v.y = -v.y * settings.restitution;
+			}
+			for (const SphereProxy& sphere : settings.spheres) {
+				collide(sphere, settings.restitution, p, v);
+			}
+			for (const BoxProxy& box : settings.boxes) {
+				collide(box, settings.restitution, p, v);
+			}
+			px[i] = p.x; py[i] = p.y; pz[i] = p.z;
+			vx[i] = v.x; vy[i] = v.y; vz[i] = v.z;
+		}
+	});
+
+	now = std::chrono::high_resolution_clock::now();
+	m_interactionTime = std::chrono::duration<float, std::milli>(now - start).count();
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "ParticleSystem.h"
+#include "SpatialGrid.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Collision proxies of the meshes
+struct SphereProxy {
+	glm::vec3 center;
+	float radius;
+};
+
+struct BoxProxy {
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+struct InteractionSettings {
+	float radius = 0.05f;      // interaction distance (grid cell size)
+	float separation = 20.0f;  // repulsion between close particles
+	bool density = true;       // SPH density and pressure
+	float restDensity = 4.0f;  // target density (kernel sum, the particle included)
+	float stiffness = 2.0f;    // pressure = stiffness * (density - restDensity)
+	float maxAcceleration = 200.0f;
+	// Neighbors tested per particle: bounds the cost where the particles
+	// accumulate (e.g. all the particles respawned at the same point)
+	int maxNeighbors = 64;
+	bool floor = true;
+	float floorHeight = -1.0f;
+	float restitution = 0.4f;  // velocity kept after a collision
+	std::vector<SphereProxy> spheres;
+	std::vector<BoxProxy> boxes;
+
+	void sanitize() {
+		radius = std::max(radius, 0.001f);
+		separation = std::max(separation, 0.0f);
+		restDensity = std::max(restDensity, 1.0f);
+		stiffness = std::max(stiffness, 0.0f);
+		restitution = std::max(0.0f, std::min(1.0f, restitution));
+		maxNeighbors = std::max(maxNeighbors, 1);
+	}
+};
+
+// Particle-particle interactions and collisions (after ParticleSystem::step)
+//
+// The neighbors come from a spatial hash grid with cells of the size of
+// the interaction radius (27 cells per query): the cost is linear in the
+// number of particles instead of quadratic.
+// 1. density of each particle (poly6 kernel, not normalized)
+// 2. separation and pressure accelerations (velocities only, so the
+//    particles can be processed in parallel)
+// 3. collisions with the floor and the proxies (positions and velocities)
+class ParticleInteractions
+{
+public:
+	// ------------------------------------------------------------------------
+	// apply the interactions to the particles for a time step dt
+	// jobs: split the passes over the threads (optional)
+	void apply(ParticleSystem& system, float dt, const InteractionSettings& settings, JobSystem* jobs = nullptr);
+	// same for some particles of the system only (indices), the others are
+	// not read nor written (e.g. the free slots of a ParticleWorld)
+	void apply(ParticleSystem& system, const std::vector<uint32_t>& particles, float dt, const InteractionSettings& settings, JobSystem* jobs = nullptr);
+
+	// Density of each particle (last apply, in the order of the indices)
+	const std::vector<float>& density() const { return m_density; }
+	const SpatialHashGrid& grid() const { return m_grid; }
+
+	// Time of the last apply (ms)
+	float gridTime() const { return m_gridTime; }
+	float interactionTime() const { return m_interactionTime; }
+
+private:
+	// particles: indices of the particles (nullptr: all, count = size())
+	void apply(ParticleSystem& system, const uint32_t* particles, std::size_t count, float dt, const InteractionSettings& settings, JobSystem* jobs);
+
+private:
+	SpatialHashGrid m_grid;
+	std::vector<float> m_x;             // positions of the indexed particles
+	std::vector<float> m_y;
+	std::vector<float> m_z;
+	std::vector<float> m_density;       // per particle
+	std::vector<float> m_sortedDensity; // per slot of the grid
+	float m_gridTime = 0.0f;
+	float m_interactionTime = 0.0f;
+};
@@ -1,8 +1,16 @@
 #include "MainWindow.h"
 
-int main()
+#include <string>
+
+int main(int argc, char** argv)
 {
+	// --benchmark: compare the draw modes up to 2M particles, then quit
+	const bool benchmark = argc > 1 && std::string(argv[1]) == "--benchmark";
+
 	MainWindow MainWindow;
+	if (benchmark) {
+		MainWindow.setMaxParticles(2000000);
+	}
 	int init_value = MainWindow.Initialisation();
 	if (init_value != 0) {
 		// There was a problem during the initialization
@@ -10,5 +18,5 @@ int main()
 		return init_value;
 	}
 
-	return MainWindow.RenderLoop();
+	return benchmark ? MainWindow.RenderBenchmark() : MainWindow.RenderLoop();
 }
\ No newline at end of file
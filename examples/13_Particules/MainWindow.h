@@ -10,72 +10,12 @@
 
 #include "ShaderProgram.h"
 #include "Camera.h"
-
-inline float random(float min, float max)
-{
-	return (max - min) * ((float)rand() / (float)RAND_MAX) + min;
-}
-
-struct ParticleGPU {
-	glm::vec3 p;
-	float size;
-	glm::vec3 color;
-};
-
-// A simple particle object.
-struct Particle
-{
-	// Constructors
-	Particle() { }
-	ParticleGPU toGPU() {
-		return {
-			p,
-			size,
-			c
-		};
-	}
-
-	// Attributes
-	glm::vec3 p = glm::vec3(0.0); // position
-	glm::vec3 v = glm::vec3(0.0); // velocity
-	glm::vec3 c = glm::vec3(0.0); // RGB color
-	float life = 0.0f;			  // time to live
-	float size = 0.1f;			  // scaling factor
-};
-
-struct ParticleGeneratorSettings {
-	float size = 0.4f;
-	float velocityMin = 5.0f;
-	float velocityMax = 10.0f;
-	float lifeMin = 0.1f;
-	float lifeMax = 1.0f;
-
-	void sanitize() {
-		size = std::max(size, 0.0001f);
-		velocityMin = std::max(velocityMin, 0.0f);
-		velocityMax = std::max(velocityMax, velocityMin);
-		lifeMin = std::max(lifeMin, 0.0f);
-		lifeMax = std::max(lifeMax, lifeMin);
-	}
-
-	Particle createNewParticle()
-	{
-		Particle p;
-		p.p = glm::vec3(0, 0, 0);
-		const float vx = random(-size, size);
-		const float vz = random(-size, size);
-		p.v = glm::vec3(vx, random(velocityMin, velocityMax), vz);
-		p.life = random(lifeMin, lifeMax);
-		const float r = random(0.5, 1.0);
-		const float g = random(0.0, 0.5);
-		const float b = random(0.0, 0.5);
-		p.c = glm::vec3(r, g, b);
-		p.size = random(0.1f, 0.25f);
-		return p;
-	}
-
-
-};
+#include "ParticleSystem.h"
+#include "ParticleWorld.h"
+#include "DepthSort.h"
+#include "Interactions.h"
+#include "StreamingBuffer.h"
+#include "TextureLoader.h"
 
 class MainWindow
 {
@@ -85,6 +25,12 @@ public:
 	// Main functions (initialization, run)
 	int Initialisation();
 	int RenderLoop();
+	// Frame and draw times of the draw modes for 100k to 2M particles
+	// (instead of RenderLoop, after Initialisation)
+	int RenderBenchmark();
+
+	// Size of the particle pool (before Initialisation)
+	void setMaxParticles(std::size_t count) { m_maxParticles = count; }
 
 	// Callback to intersept GLFW calls
 	void FramebufferSizeCallback(int width, int height);
@@ -97,11 +43,19 @@ private:
 	// Intiialize OpenGL objects (shaders, ...)
 	int InitializeGL();
 	void initializeParticles();
+	void resizeMainEmitter();
+	void addEffects();
+	void removeEffects();
 
 	// Rendering scene (OpenGL)
 	void RenderScene(float t);
 	void RenderImgui();
 	void Step(float t);
+	void Tick(float dt);
+	void UploadParticles();
+	void DrawParticles();
+	void readDrawTime();
+	void cleanup();
 
 	glm::mat4 transform(float v) const;
 
@@ -119,29 +73,71 @@ private:
 	float m_time = 0.0;
 
 	// Geometries
-	enum VAO_IDs { Particules, NumVAOs };
-	enum Buffer_IDs { Particules_Position, NumBuffers };
+	enum VAO_IDs { Particules, ParticulesInstanced, ParticulesPulled, NumVAOs };
 	GLuint m_VAOs[NumVAOs];
-	GLuint m_Buffers[NumBuffers];
+	StreamingBuffer m_particlesBuffer; // Persistent mapped (3 regions)
+	GLuint m_indirectBuffer = 0; // Draw commands of the instanced mode
 	
 	// Texture
-	GLuint m_textureID;
+	TextureLoader m_textureLoader;
+	GLuint m_textureID = 0;
 	
 	// Particules
-	ParticleGeneratorSettings m_settings;
-	std::vector<Particle> m_particles;
-	std::vector<ParticleGPU> m_particlesGPU; // Temp buffer
+	// Fixed capacity pool: the emitters are allocated in it and the
+	// streaming buffer has the same size (never reallocated)
+	std::size_t m_maxParticles = 1 << 20;
+	ParticleWorld m_world;
+	ParticleWorld::EmitterId m_mainEmitter = ParticleWorld::InvalidEmitter;
+	std::vector<ParticleWorld::EmitterId> m_effects; // Small emitters around the main one
+	int m_numberEffects = 100;
+	int m_effectParticles = 500;
+	std::vector<GLint> m_drawFirsts; // Multi-draw (one range per group of emitters)
+	std::vector<GLsizei> m_drawCounts;
+	struct DrawArraysIndirectCommand {
+		GLuint count;
+		GLuint instanceCount;
+		GLuint first;
+		GLuint baseInstance;
+	};
+	std::vector<DrawArraysIndirectCommand> m_drawCommands; // Instanced mode
+	DepthSorter m_sorter;
 	bool m_useAdditiveBlending = true;
 	int m_numberParticles = 3000;
 	float m_speed = 1.0f;
+	// Fixed time step: the frame time is accumulated and consumed in
+	// ticks of m_tick seconds (same result whatever the frame rate), the
+	// positions are interpolated between the last two ticks
+	bool m_fixedTimestep = true;
+	bool m_interpolate = true;
+	float m_tick = 1.0f / 60.0f;
+	float m_accumulator = 0.0f;
+	int m_ticks = 0; // Ticks of the last frame
+	static const int MaxTicksPerFrame = 8; // After a long frame, the time is dropped
+	int m_integrator = int(ParticleSystem::Integrator::Euler);
 	float m_size = 0.05f;
 	float m_transparency = 1.0f;
 	bool m_useTexture = false;
 	bool m_sorting = true;
-
-	// Shader
-	std::unique_ptr<ShaderProgram> m_mainShader = nullptr;
-	struct {
+	bool m_multithreaded = true; // Use the job system for the update
+	float m_updateTime = 0.0f; // CPU time of Step (ms)
+	bool m_temporalCoherence = true; // Reuse the previous order when sorting
+	float m_sortTime = 0.0f; // CPU time of the sort (ms)
+	bool m_useInteractions = false; // Particle-particle interactions and collisions
+	InteractionSettings m_interactionSettings;
+	ParticleInteractions m_interactions;
+
+	// Billboards: the geometry shader expands each point in a quad,
+	// the other modes do it in the vertex shader (faster on most drivers)
+	enum DrawMode { GeometryShader, InstancedQuads, VertexPulling, NumDrawModes };
+	int m_drawMode = GeometryShader;
+	// GPU time of the particle draw (ms, a few frames late)
+	static const int NumDrawQueries = 3;
+	GLuint m_drawQueries[NumDrawQueries];
+	int m_drawQuery = 0;
+	float m_drawTime = 0.0f;
+
+	// Shader (one per draw mode)
+	struct ParticleUniforms {
 		GLint viewMatrix;
 		GLint projMatrix;
 		GLint globalSize;
@@ -149,5 +145,7 @@ private:
 		GLint texture;
 		GLint useTexture;
 		GLint time;
-	} m_mainUniforms;
+	};
+	std::unique_ptr<ShaderProgram> m_shaders[NumDrawModes];
+	ParticleUniforms m_uniforms[NumDrawModes];
 };
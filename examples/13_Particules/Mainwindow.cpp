@@ -7,10 +7,9 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <algorithm>
-
-// For images
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
+#include <chrono>
+#include <iomanip>
+#include <random>
 
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
@@ -25,6 +24,8 @@ MainWindow::MainWindow():
 		glm::vec3(2.0, 2.0, 2.0),
 		glm::vec3(0.0, 0.0, 0.0))
 {
+	// Obstacle above the fountain
+	m_interactionSettings.spheres.push_back({ glm::vec3(0.0f, 1.5f, 0.0f), 0.3f });
 }
 
 int MainWindow::Initialisation()
@@ -36,9 +37,9 @@ int MainWindow::Initialisation()
 	// ------------------------------
 	glfwInit();
 
-	// Request OpenGL 4.3
+	// Request OpenGL 4.4 (persistent mapped buffers)
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 #ifdef __APPLE__
@@ -99,72 +100,51 @@ void MainWindow::InitializeCallback() {
 
 int MainWindow::InitializeGL()
 {
-	// Load and create shaders
+	// Load and create shaders (one per draw mode, same fragment shader)
 	const std::string directory = SHADERS_DIR;
-	bool mainShaderSuccess = true;
-	m_mainShader = std::make_unique<ShaderProgram>();
-	mainShaderSuccess &= m_mainShader->addShaderFromSource(GL_VERTEX_SHADER, directory + "particules.vert");
-	mainShaderSuccess &= m_mainShader->addShaderFromSource(GL_FRAGMENT_SHADER, directory + "particules.frag");
-	mainShaderSuccess &= m_mainShader->addShaderFromSource(GL_GEOMETRY_SHADER, directory + "particules.geo");
-	mainShaderSuccess &= m_mainShader->link();
-	if (!mainShaderSuccess) {
-		std::cerr << "Error when loading main shader\n";
-		return 4;
-	}
+	const char* vertexShaders[NumDrawModes] = { "particules.vert", "particules_instanced.vert", "particules_pulled.vert" };
+	for (int mode = 0; mode < NumDrawModes; ++mode)
+	{
+		bool mainShaderSuccess = true;
+		m_shaders[mode] = std::make_unique<ShaderProgram>();
+		mainShaderSuccess &= m_shaders[mode]->addShaderFromSource(GL_VERTEX_SHADER, directory + vertexShaders[mode]);
+		mainShaderSuccess &= m_shaders[mode]->addShaderFromSource(GL_FRAGMENT_SHADER, directory + "particules.frag");
+		if (mode == GeometryShader) {
+			mainShaderSuccess &= m_shaders[mode]->addShaderFromSource(GL_GEOMETRY_SHADER, directory + "particules.geo");
+		}
+		mainShaderSuccess &= m_shaders[mode]->link();
+		if (!mainShaderSuccess) {
+			std::cerr << "Error when loading main shader (" << vertexShaders[mode] << ")\n";
+			return 4;
+		}
 
-	m_mainUniforms.projMatrix = m_mainShader->uniformLocation("projMatrix");
-	m_mainUniforms.viewMatrix = m_mainShader->uniformLocation("viewMatrix");
-	m_mainUniforms.globalSize = m_mainShader->uniformLocation("globalSize");
-	m_mainUniforms.globalTransparency = m_mainShader->uniformLocation("globalTransparency");
-	m_mainUniforms.texture = m_mainShader->uniformLocation("texture");
-	m_mainUniforms.useTexture = m_mainShader->uniformLocation("useTexture");
-	m_mainUniforms.time = m_mainShader->uniformLocation("time");	
-	if(m_mainUniforms.projMatrix == -1 || m_mainUniforms.viewMatrix == -1 || m_mainUniforms.globalSize == -1 || m_mainUniforms.globalTransparency == -1 || m_mainUniforms.texture == -1 || m_mainUniforms.useTexture == -1 || m_mainUniforms.time == -1) {
-		std::cerr << "Error when loading main shader uniforms\n";
-		return 5;
+		ParticleUniforms& uniforms = m_uniforms[mode];
+		uniforms.projMatrix = m_shaders[mode]->uniformLocation("projMatrix");
+		uniforms.viewMatrix = m_shaders[mode]->uniformLocation("viewMatrix");
+		uniforms.globalSize = m_shaders[mode]->uniformLocation("globalSize");
+		uniforms.globalTransparency = m_shaders[mode]->uniformLocation("globalTransparency");
+		uniforms.texture = m_shaders[mode]->uniformLocation("particleTexture");
+		uniforms.useTexture = m_shaders[mode]->uniformLocation("useTexture");
+		uniforms.time = m_shaders[mode]->uniformLocation("time");
+		if(uniforms.projMatrix == -1 || uniforms.viewMatrix == -1 || uniforms.globalSize == -1 || uniforms.globalTransparency == -1 || uniforms.texture == -1 || uniforms.useTexture == -1 || uniforms.time == -1) {
+			std::cerr << "Error when loading main shader uniforms\n";
+			return 5;
+		}
 	}
 
 	// Generate all buffers
 	glGenVertexArrays(NumVAOs, m_VAOs);
-	glGenBuffers(NumBuffers, m_Buffers);
+	glGenBuffers(1, &m_indirectBuffer);
+	glGenQueries(NumDrawQueries, m_drawQueries);
 
 	// Initialise and create the buffers
 	initializeParticles();
 
-	glGenTextures(1, &m_textureID);
-
-	// Ask the library to flip the image vertically
-	// This is necessary as TexImage2D assume "The first element corresponds to the lower left corner of the texture image"
-	// whereas stb_image load the image such "the first pixel pointed to is top-left-most in the image"
-	stbi_set_flip_vertically_on_load(true);
-
-	int width, height, nrComponents;
-	std::string img_path = directory + "Particle.png";
-	unsigned char* data = stbi_load(img_path.c_str(), &width, &height, &nrComponents, STBI_rgb_alpha);
-	if (data)
-	{
-		for (int i = 0; i < width * height; i++) {
-			std::cout << (int)data[i] << " ";
-		}
-		glBindTexture(GL_TEXTURE_2D, m_textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-	
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-
-		std::cout << "Texture loaded at path: " << img_path << std::endl;
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << img_path << std::endl;
-		stbi_image_free(data);
-		return false;
-	}
+	// Decoded in background: the texture is white until uploaded (RenderLoop)
+	TextureLoader::Settings settings;
+	settings.wrap = GL_CLAMP_TO_BORDER;
+	settings.placeholder = glm::u8vec4(255);
+	m_textureID = m_textureLoader.load(directory + "Particle.png", settings);
 
 	// Setup projection matrix (a bit hacky)
 	FramebufferSizeCallback(m_windowWidth, m_windowHeight);
@@ -174,47 +154,98 @@ int MainWindow::InitializeGL()
 
 void MainWindow::initializeParticles()
 {
-	std::cout << "Initialize the particules ... " << m_numberParticles << "\n";
-	m_particles.resize(m_numberParticles);
-	m_particlesGPU.resize(m_numberParticles);
-	for (int i = 0; i < m_numberParticles; ++i)
+	std::cout << "Initialize the particules ... " << m_maxParticles << "\n";
+	m_world.create(m_maxParticles);
+	resizeMainEmitter();
+
+	// Create buffer to get the particules (whole pool)
+	// The draw selects the region with the first vertex (see RenderScene)
+	m_particlesBuffer.create(m_maxParticles * sizeof(ParticleGPU));
+
+	// Points (geometry shader): one vertex per particle
+	// Instanced quads: same attributes, one value per instance
+	for (GLuint vao : { m_VAOs[Particules], m_VAOs[ParticulesInstanced] })
 	{
-		m_particles[i] = m_settings.createNewParticle();
-		m_particlesGPU[i] = m_particles[i].toGPU();
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, m_particlesBuffer.bufferId());
+
+		glEnableVertexAttribArray(0); // Position
+		glVertexAttribPointer(
+			0, // attribute: 0
+			3, // size
+			GL_FLOAT, // type
+			GL_FALSE, // normalized?
+			sizeof(ParticleGPU), // stride
+			(void*)0 // array buffer offset
+		);
+		glEnableVertexAttribArray(1); // Size
+		glVertexAttribPointer(
+			1, // attribute: 0
+			1, // size
+			GL_FLOAT, // type
+			GL_FALSE, // normalized?
+			sizeof(ParticleGPU), // stride
+			(void*)sizeof(glm::vec3) // array buffer offset
+		);
+		glEnableVertexAttribArray(2); // Size
+		glVertexAttribPointer(
+			2, // attribute: 0
+			3, // size
+			GL_FLOAT, // type
+			GL_FALSE, // normalized?
+			sizeof(ParticleGPU), // stride
+			(void*)(sizeof(glm::vec3)+sizeof(float)) // array buffer offset
+		);
+		const GLuint divisor = vao == m_VAOs[ParticulesInstanced] ? 1 : 0;
+		for (GLuint attribute = 0; attribute < 3; ++attribute) {
+			glVertexAttribDivisor(attribute, divisor);
+		}
 	}
+	// Vertex pulling: no attribute (the shader reads the buffer)
+	glBindVertexArray(0);
+}
 
-	// Create buffer to get the particules (and upload data)
-	glBindVertexArray(m_VAOs[Particules]);
-	glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[Particules_Position]);
-	glBufferData(GL_ARRAY_BUFFER, m_numberParticles * sizeof(ParticleGPU), m_particlesGPU.data(), GL_STREAM_DRAW);
-
-	glEnableVertexAttribArray(0); // Position
-	glVertexAttribPointer(
-		0, // attribute: 0
-		3, // size
-		GL_FLOAT, // type
-		GL_FALSE, // normalized?
-		sizeof(ParticleGPU), // stride
-		(void*)0 // array buffer offset
-	);
-	glEnableVertexAttribArray(1); // Size
-	glVertexAttribPointer(
-		1, // attribute: 0
-		1, // size
-		GL_FLOAT, // type
-		GL_FALSE, // normalized?
-		sizeof(ParticleGPU), // stride
-		(void*)sizeof(glm::vec3) // array buffer offset
-	);
-	glEnableVertexAttribArray(2); // Size
-	glVertexAttribPointer(
-		2, // attribute: 0
-		3, // size
-		GL_FLOAT, // type
-		GL_FALSE, // normalized?
-		sizeof(ParticleGPU), // stride
-		(void*)(sizeof(glm::vec3)+sizeof(float)) // array buffer offset
-	);
+void MainWindow::resizeMainEmitter()
+{
+	// The slots are reallocated in the pool (no GPU reallocation)
+	ParticleGeneratorSettings settings;
+	if (m_world.isAlive(m_mainEmitter)) {
+		settings = m_world.settings(m_mainEmitter);
+		m_world.removeEmitter(m_mainEmitter);
+	}
+	m_numberParticles = int(std::min<std::size_t>(m_numberParticles, m_world.largestFreeRange()));
+	m_mainEmitter = m_world.addEmitter(m_numberParticles, settings);
+}
+
+void MainWindow::addEffects()
+{
+	// Small fountains around the main one
+	std::mt19937 generator(uint32_t(m_effects.size()));
+	std::uniform_real_distribution<float> position(-3.0f, 3.0f);
+	std::uniform_real_distribution<float> velocity(1.0f, 4.0f);
+	for (int i = 0; i < m_numberEffects; ++i)
+	{
+		ParticleGeneratorSettings settings;
+		settings.origin = glm::vec3(position(generator), 0.0f, position(generator));
+		settings.size = 0.2f;
+		settings.velocityMin = velocity(generator);
+		settings.velocityMax = settings.velocityMin + 1.0f;
+		settings.lifeMax = 0.6f;
+		const ParticleWorld::EmitterId id = m_world.addEmitter(m_effectParticles, settings);
+		if (id == ParticleWorld::InvalidEmitter) {
+			std::cout << "Particle pool is full (" << m_effects.size() << " effects)\n";
+			break;
+		}
+		m_effects.push_back(id);
+	}
+}
+
+void MainWindow::removeEffects()
+{
+	for (ParticleWorld::EmitterId id : m_effects) {
+		m_world.removeEmitter(id);
+	}
+	m_effects.clear();
 }
 
 void MainWindow::RenderImgui()
@@ -231,29 +262,82 @@ void MainWindow::RenderImgui()
 		1000.0/double(ImGui::GetIO().Framerate), double(ImGui::GetIO().Framerate));
 		ImGui::Checkbox("Animate", &m_animate);
 		ImGui::Checkbox("Additive blend", &m_useAdditiveBlending);
+		ImGui::Combo("Draw mode", &m_drawMode, "Geometry shader\0Instanced quads\0Vertex pulling\0");
+		ImGui::Text("Draw (GPU): %.3f ms", m_drawTime);
 		if (ImGui::InputInt("Number particules", &m_numberParticles)) {
 			m_numberParticles = std::max(0, m_numberParticles);
-			initializeParticles();
+			resizeMainEmitter();
 		}
 		ImGui::InputFloat("Speed", &m_speed);
 		ImGui::InputFloat("Global Size", &m_size);
 		ImGui::InputFloat("Transparency", &m_transparency);
 		ImGui::Checkbox("Use Texture?", &m_useTexture);
 		ImGui::Checkbox("Sorting", &m_sorting);
+		if (m_sorting) {
+			ImGui::Checkbox("Temporal coherence", &m_temporalCoherence);
+			ImGui::Text("Sort: %.3f ms (%s)", m_sortTime, m_sorter.usedInsertionSort() ? "insertion" : "radix");
+		}
+		int kernel = int(m_world.system().kernel());
+		if (ImGui::Combo("Kernel", &kernel, "Scalar\0SSE\0AVX2\0")) {
+			m_world.system().setKernel(ParticleSystem::Kernel(kernel));
+		}
+		ImGui::Combo("Integrator", &m_integrator, "Euler\0Semi-implicit Euler\0Verlet\0");
+		ImGui::Checkbox("Fixed time step", &m_fixedTimestep);
+		if (m_fixedTimestep) {
+			ImGui::InputFloat("Tick (s)", &m_tick);
+			m_tick = std::max(0.001f, m_tick);
+			ImGui::Checkbox("Interpolate", &m_interpolate);
+			ImGui::Text("%d ticks this frame", m_ticks);
+		}
+		ImGui::Checkbox("Multithreaded", &m_multithreaded);
+		ImGui::Text("Update: %.3f ms (%u threads)", m_updateTime, m_multithreaded ? JobSystem::instance().numThreads() : 1u);
+		ImGui::Text("Fence wait: %.3f ms (%u stalls)", m_particlesBuffer.lastWaitTime(), m_particlesBuffer.stallCount());
 		m_speed = std::max(0.f, m_speed);
 		m_size = std::max(0.000001f, m_size);
 		m_transparency = std::max(0.f, std::min(1.f, m_transparency));
 
 		ImGui::Separator();
 		ImGui::Text("Generator:");
-		ImGui::InputFloat("Size", &m_settings.size);
+		ParticleGeneratorSettings& settings = m_world.settings(m_mainEmitter);
+		ImGui::InputFloat("Size", &settings.size);
 		ImGui::Text("Velocity:");
-		ImGui::InputFloat("v_min: ", &m_settings.velocityMin);
-		ImGui::InputFloat("v_max", &m_settings.velocityMax);
+		ImGui::InputFloat("v_min: ", &settings.velocityMin);
+		ImGui::InputFloat("v_max", &settings.velocityMax);
 		ImGui::Text("Life:");
-		ImGui::InputFloat("l_min", &m_settings.lifeMin);
-		ImGui::InputFloat("l_max", &m_settings.lifeMax);
-		m_settings.sanitize();
+		ImGui::InputFloat("l_min", &settings.lifeMin);
+		ImGui::InputFloat("l_max", &settings.lifeMax);
+		settings.sanitize();
+
+		ImGui::Separator();
+		ImGui::Text("Effects (small emitters):");
+		ImGui::InputInt("Effects", &m_numberEffects);
+		ImGui::InputInt("Particles/effect", &m_effectParticles);
+		m_numberEffects = std::max(0, m_numberEffects);
+		m_effectParticles = std::max(1, m_effectParticles);
+		if (ImGui::Button("Add effects")) {
+			addEffects();
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Remove effects")) {
+			removeEffects();
+		}
+		ImGui::Text("%zu emitters, %zu/%zu particles, %zu draw ranges",
+			m_world.numEmitters(), m_world.liveCount(), m_world.capacity(), m_world.drawRanges().size());
+
+		ImGui::Separator();
+		ImGui::Checkbox("Interactions", &m_useInteractions);
+		if (m_useInteractions) {
+			ImGui::InputFloat("Radius", &m_interactionSettings.radius);
+			ImGui::InputFloat("Separation", &m_interactionSettings.separation);
+			ImGui::Checkbox("Density (SPH)", &m_interactionSettings.density);
+			ImGui::InputFloat("Rest density", &m_interactionSettings.restDensity);
+			ImGui::InputFloat("Stiffness", &m_interactionSettings.stiffness);
+			ImGui::Checkbox("Floor", &m_interactionSettings.floor);
+			ImGui::InputFloat("Floor height", &m_interactionSettings.floorHeight);
+			ImGui::InputFloat("Restitution", &m_interactionSettings.restitution);
+			m_interactionSettings.sanitize();
+			ImGui::Text("Grid: %.3f ms, interactions: %.3f ms", m_interactions.gridTime(), m_interactions.interactionTime());
+		}
 
 		ImGui::End();
 	}
@@ -264,42 +348,76 @@ void MainWindow::RenderImgui()
 }
 
 void MainWindow::Step(float delta_time) {
-	const glm::vec3 gravity(0, -9.8, 0); // acceleration due to gravity
+	const auto start = std::chrono::high_resolution_clock::now();
 	const float dt = delta_time * m_speed;
-	for (auto p = m_particles.begin(); p != m_particles.end(); ++p)
+	ParticleSystem& system = m_world.system();
+	system.setIntegrator(ParticleSystem::Integrator(m_integrator));
+	if (!m_fixedTimestep)
 	{
-		p->life -= dt;
-		if (p->life <= 0.0f)
-		{
-			// particle is dead, so create a new one
-			*p = m_settings.createNewParticle();
-		}
-		else
-		{
-			// Euler integration
-			p->p += dt * p->v;
-			p->v += dt * gravity;
+		// Variable time step (depends on the frame rate)
+		Tick(dt);
+		m_ticks = 1;
+		system.setInterpolation(1.0f);
+	}
+	else
+	{
+		m_accumulator += dt;
+		m_ticks = 0;
+		while (m_accumulator >= m_tick && m_ticks < MaxTicksPerFrame) {
+			Tick(m_tick);
+			m_accumulator -= m_tick;
+			m_ticks++;
 		}
+		// Too slow to catch up: drop the time instead of spiraling
+		m_accumulator = std::min(m_accumulator, m_tick);
+		system.setInterpolation(m_interpolate ? m_accumulator / m_tick : 1.0f);
+	}
+	const std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+	m_updateTime = elapsed.count();
+}
+
+void MainWindow::Tick(float dt)
+{
+	JobSystem* jobs = m_multithreaded ? &JobSystem::instance() : nullptr;
+	m_world.step(dt, jobs);
+	if (m_useInteractions)
+	{
+		m_interactions.apply(m_world.system(), m_world.liveIndices(), dt, m_interactionSettings, jobs);
 	}
+}
+
+void MainWindow::UploadParticles() {
+	JobSystem* jobs = m_multithreaded ? &JobSystem::instance() : nullptr;
 
-	// Reupload on the GPU
-	for (int i = 0; i < m_numberParticles; ++i)
+	// Write directly in the mapped GPU memory
+	// (each emitter at its slots, or all the emitters sorted and packed)
+	ParticleGPU* region = static_cast<ParticleGPU*>(m_particlesBuffer.nextRegion());
+	if (!m_sorting)
 	{
-		m_particlesGPU[i] = m_particles[i].toGPU();
+		m_world.writeGPU(region, jobs);
+		return;
 	}
-	glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[Particules_Position]);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, m_numberParticles * sizeof(ParticleGPU), m_particlesGPU.data());
+
+	// Sort according to distance from the camera (before drawing, so
+	// the order is the one of this frame) and write in this order.
+	const auto start = std::chrono::high_resolution_clock::now();
+	m_sorter.setTemporalCoherence(m_temporalCoherence);
+	m_world.writeGPUSorted(region, m_sorter, m_camera.position(), jobs);
+	const std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+	m_sortTime = elapsed.count();
 }
 
 void MainWindow::RenderScene(float time)
 {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	m_mainShader->bind();
-	m_mainShader->setMat4(m_mainUniforms.projMatrix, m_camera.projectionMatrix());
-	m_mainShader->setMat4(m_mainUniforms.viewMatrix, m_camera.viewMatrix());
-	m_mainShader->setFloat(m_mainUniforms.globalSize, m_size);
-	m_mainShader->setFloat(m_mainUniforms.globalTransparency, m_transparency);
-	m_mainShader->setFloat(m_mainUniforms.time, glfwGetTime() * 2.f);
+	ShaderProgram& shader = *m_shaders[m_drawMode];
+	const ParticleUniforms& uniforms = m_uniforms[m_drawMode];
+	shader.bind();
+	shader.setMat4(uniforms.projMatrix, m_camera.projectionMatrix());
+	shader.setMat4(uniforms.viewMatrix, m_camera.viewMatrix());
+	shader.setFloat(uniforms.globalSize, m_size);
+	shader.setFloat(uniforms.globalTransparency, m_transparency);
+	shader.setFloat(uniforms.time, glfwGetTime() * 2.f);
 	glEnable(GL_BLEND);
 	// Choose the blending method
 	if (m_useAdditiveBlending)
@@ -314,25 +432,87 @@ void MainWindow::RenderScene(float time)
 	// Activate and use texture unit 0
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, m_textureID);
-	m_mainShader->setInt(m_mainUniforms.texture, 0); // Unit 0
-	m_mainShader->setBool(m_mainUniforms.useTexture, m_useTexture);
+	shader.setInt(uniforms.texture, 0); // Unit 0
+	shader.setBool(uniforms.useTexture, m_useTexture);
+
+	glBeginQuery(GL_TIME_ELAPSED, m_drawQueries[m_drawQuery]);
+	DrawParticles();
+	glEndQuery(GL_TIME_ELAPSED);
+	m_drawQuery = (m_drawQuery + 1) % NumDrawQueries;
+	readDrawTime();
+
+	glDisable(GL_BLEND);
 
+}
 
+void MainWindow::DrawParticles()
+{
 	// Draw the particles
-	glBindVertexArray(m_VAOs[Particules]);
-	glDrawArrays(GL_POINTS, 0, m_numberParticles);
-
-	// Note here we sort async to avoid locking the rendering system
-	// Sort according to distance from the camera.
-	const glm::vec3 eyePos = m_camera.position();
-	std::sort(m_particles.begin(), m_particles.end(),
-		[&eyePos](const Particle& a, const Particle& b)
-		{
-			return glm::dot(eyePos - a.p, eyePos - a.p) > glm::dot(eyePos - b.p, eyePos - b.p);
-		});
+	// (the current region of the streaming buffer, then fence it)
+	// All the emitters are drawn with one call: the sorted particles are
+	// packed, otherwise one range per group of adjacent emitters
+	const GLint first = GLint(m_particlesBuffer.currentOffset() / sizeof(ParticleGPU));
+	m_drawFirsts.clear();
+	m_drawCounts.clear();
+	if (m_sorting)
+	{
+		m_drawFirsts.push_back(first);
+		m_drawCounts.push_back(GLsizei(m_world.liveCount()));
+	}
+	else
+	{
+		for (const ParticleWorld::Range& range : m_world.drawRanges()) {
+			m_drawFirsts.push_back(first + GLint(range.first));
+			m_drawCounts.push_back(GLsizei(range.count));
+		}
+	}
+	const GLsizei numRanges = GLsizei(m_drawFirsts.size());
 
-	glDisable(GL_BLEND);
+	switch (m_drawMode)
+	{
+	case GeometryShader:
+		glBindVertexArray(m_VAOs[Particules]);
+		glMultiDrawArrays(GL_POINTS, m_drawFirsts.data(), m_drawCounts.data(), numRanges);
+		break;
+	case InstancedQuads:
+	{
+		// One instance per particle: the range is selected by the base
+		// instance (the per instance attributes start at this particle)
+		m_drawCommands.resize(numRanges);
+		for (GLsizei i = 0; i < numRanges; ++i) {
+			m_drawCommands[i] = { 4, GLuint(m_drawCounts[i]), 0, GLuint(m_drawFirsts[i]) };
+		}
+		glBindVertexArray(m_VAOs[ParticulesInstanced]);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirectBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, m_drawCommands.size() * sizeof(DrawArraysIndirectCommand), m_drawCommands.data(), GL_STREAM_DRAW);
+		glMultiDrawArraysIndirect(GL_TRIANGLE_STRIP, nullptr, numRanges, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		break;
+	}
+	case VertexPulling:
+		// 6 vertices per particle: gl_VertexID / 6 is the particle
+		for (GLsizei i = 0; i < numRanges; ++i) {
+			m_drawFirsts[i] *= 6;
+			m_drawCounts[i] *= 6;
+		}
+		glBindVertexArray(m_VAOs[ParticulesPulled]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_particlesBuffer.bufferId());
+		glMultiDrawArrays(GL_TRIANGLES, m_drawFirsts.data(), m_drawCounts.data(), numRanges);
+		break;
+	}
+	m_particlesBuffer.fence();
+}
 
+void MainWindow::readDrawTime()
+{
+	// Oldest query (NumDrawQueries - 1 frames ago), never wait for it
+	GLint available = 0;
+	glGetQueryObjectiv(m_drawQueries[m_drawQuery], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (available) {
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(m_drawQueries[m_drawQuery], GL_QUERY_RESULT, &elapsed);
+		m_drawTime = float(elapsed) * 1e-6f;
+	}
 }
 
 int MainWindow::RenderLoop()
@@ -355,6 +535,8 @@ int MainWindow::RenderLoop()
 		if (m_animate) {
 			Step(delta_time);
 		}
+		m_textureLoader.update();
+		UploadParticles();
 		RenderScene(time);
 		RenderImgui();
 
@@ -364,16 +546,74 @@ int MainWindow::RenderLoop()
 		m_imGuiActive = ImGui::IsAnyItemActive();
 	}
 
+	cleanup();
+	return 0;
+}
+
+int MainWindow::RenderBenchmark()
+{
+	// No vsync: the frame time is the time to simulate and draw
+	glfwSwapInterval(0);
+	m_sorting = false;
+	const int warmupFrames = 10;
+	const int measuredFrames = 60;
+	const float dt = 1.0f / 60.0f;
+	const char* modeNames[NumDrawModes] = { "geometry", "instanced", "pulling" };
+	m_textureLoader.finish();
+
+	std::cout << "\nFrame / draw (GPU) time (ms), " << m_windowWidth << "x" << m_windowHeight << "\n";
+	std::cout << std::setw(10) << "count";
+	for (int mode = 0; mode < NumDrawModes; ++mode) {
+		std::cout << std::setw(22) << modeNames[mode];
+	}
+	std::cout << "\n" << std::fixed << std::setprecision(3);
+	for (int count : { 100000, 250000, 500000, 1000000, 2000000 })
+	{
+		if (std::size_t(count) > m_world.capacity()) break;
+		m_numberParticles = count;
+		resizeMainEmitter();
+		std::cout << std::setw(10) << count;
+		for (int mode = 0; mode < NumDrawModes; ++mode)
+		{
+			m_drawMode = mode;
+			double frameTime = 0.0;
+			double drawTime = 0.0;
+			for (int frame = 0; frame < warmupFrames + measuredFrames && !glfwWindowShouldClose(m_window); ++frame)
+			{
+				const double start = glfwGetTime();
+				Step(dt);
+				UploadParticles();
+				RenderScene(float(start));
+				glfwSwapBuffers(m_window);
+				glfwPollEvents();
+				if (frame >= warmupFrames) {
+					frameTime += glfwGetTime() - start;
+					drawTime += m_drawTime;
+				}
+			}
+			std::cout << std::setw(11) << 1000.0 * frameTime / measuredFrames << " /" << std::setw(9) << drawTime / measuredFrames;
+		}
+		std::cout << std::endl;
+	}
+
+	cleanup();
+	return 0;
+}
+
+void MainWindow::cleanup()
+{
 	// Cleanup
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
 
-	// Cleanup
+	// Cleanup (OpenGL objects need the context)
+	m_particlesBuffer.destroy();
+	m_textureLoader.release();
+	glDeleteBuffers(1, &m_indirectBuffer);
+	glDeleteQueries(NumDrawQueries, m_drawQueries);
 	glfwDestroyWindow(m_window);
 	glfwTerminate();
-
-	return 0;
 }
 
 void MainWindow::FramebufferSizeCallback(int width, int height)
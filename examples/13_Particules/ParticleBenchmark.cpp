@@ -0,0 +1,464 @@
+// Benchmark of the particle simulation (no window or OpenGL needed)
+// Compare the original Array of Structures loop with the SoA kernels,
+// then the scaling of the best kernel with the number of threads,
+// then the back to front sorting (std::sort vs radix sort),
+// then the spawn rate with the different random generators,
+// then the particle interactions (spatial hash grid vs all the pairs),
+// then the cost of many small emitters in a ParticleWorld.
+//
+// Usage: 13_Particules_benchmark [max number of particles]
+//
+// Headless determinism check: step N fixed ticks from a seed with each
+// integrator, kernel and thread count, and compare the state hashes
+// (exit code 1 if they differ).
+// Usage: 13_Particules_benchmark --determinism [ticks] [count] [seed]
+
+#include "ParticleSystem.h"
+#include "ParticleWorld.h"
+#include "DepthSort.h"
+#include "Interactions.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <thread>
+
+namespace {
+	const float dt = 1.0f / 60.0f;
+	const glm::vec3 gravity(0, -9.8, 0);
+
+	// Number of steps so each measure simulates ~50M particles
+	int numberSteps(std::size_t count)
+	{
+		return int(std::max<std::size_t>(5, 50000000 / count));
+	}
+
+	template<typename F>
+	double particlesPerSecond(std::size_t count, F step)
+	{
+		step(); // Warm up
+		const int steps = numberSteps(count);
+		const auto start = std::chrono::high_resolution_clock::now();
+		for (int s = 0; s < steps; ++s) {
+			step();
+		}
+		const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+		return double(count) * steps / elapsed.count();
+	}
+
+	// Same loop as the original MainWindow::Step
+	double benchmarkAoS(std::size_t count, ParticleGeneratorSettings& settings)
+	{
+		std::vector<Particle> particles(count);
+		for (auto& p : particles) {
+			p = settings.createNewParticle();
+		}
+		return particlesPerSecond(count, [&]() {
+			for (auto p = particles.begin(); p != particles.end(); ++p)
+			{
+				p->life -= dt;
+				if (p->life <= 0.0f)
+				{
+					*p = settings.createNewParticle();
+				}
+				else
+				{
+					p->p += dt * p->v;
+					p->v += dt * gravity;
+				}
+			}
+		});
+	}
+
+	double benchmarkSoA(std::size_t count, ParticleGeneratorSettings& settings, ParticleSystem::Kernel kernel)
+	{
+		ParticleSystem system;
+		system.setKernel(kernel);
+		system.resize(count, settings);
+		return particlesPerSecond(count, [&]() {
+			system.step(dt, settings);
+		});
+	}
+
+	// Time of f() in ms (best of a few runs)
+	template<typename F>
+	double milliseconds(F f)
+	{
+		double best = 1e30;
+		for (int r = 0; r < 5; ++r) {
+			const auto start = std::chrono::high_resolution_clock::now();
+			f();
+			const std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+			best = std::min(best, elapsed.count());
+		}
+		return best;
+	}
+
+	void benchmarkSort(std::size_t count, ParticleGeneratorSettings& settings, JobSystem& jobs)
+	{
+		const glm::vec3 eyePos(2.0, 2.0, 2.0);
+		ParticleSystem system;
+		system.resize(count, settings);
+		for (int s = 0; s < 60; ++s) {
+			system.step(dt, settings, jobs); // Spread the particles
+		}
+		std::vector<ParticleGPU> particles(count);
+		system.writeGPU(particles.data());
+
+		// Original: sort the particles, distances recomputed at each comparison
+		std::vector<ParticleGPU> copy;
+		const double stdSort = milliseconds([&]() {
+			copy = particles;
+			std::sort(copy.begin(), copy.end(),
+				[&eyePos](const ParticleGPU& a, const ParticleGPU& b)
+				{
+					return glm::dot(eyePos - a.p, eyePos - a.p) > glm::dot(eyePos - b.p, eyePos - b.p);
+				});
+		});
+
+		DepthSorter sorter;
+		sorter.setTemporalCoherence(false);
+		const double radix = milliseconds([&]() { sorter.sort(system, eyePos); });
+		const double radixParallel = milliseconds([&]() { sorter.sort(system, eyePos, &jobs); });
+
+		// Sort, move the particles one frame, sort again
+		sorter.setTemporalCoherence(true);
+		double coherent = 0.0;
+		int insertions = 0;
+		const int frames = 5;
+		sorter.sort(system, eyePos, &jobs);
+		for (int f = 0; f < frames; ++f) {
+			system.step(dt, settings, jobs);
+			const auto start = std::chrono::high_resolution_clock::now();
+			sorter.sort(system, eyePos, &jobs);
+			const std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+			coherent += elapsed.count();
+			insertions += sorter.usedInsertionSort();
+		}
+
+		std::cout << std::setw(10) << count << std::setw(12) << stdSort << std::setw(12) << radix
+			<< std::setw(12) << radixParallel << std::setw(12) << coherent / frames
+			<< std::setw(6) << insertions << "/" << frames << std::endl;
+	}
+
+	// Original random(): rand() takes a lock in glibc
+	float randomLocked(float min, float max)
+	{
+		return (max - min) * ((float)rand() / (float)RAND_MAX) + min;
+	}
+
+	// Spawns/second (millions) of the different generators
+	void benchmarkSpawn(std::size_t count, ParticleGeneratorSettings& settings, JobSystem& jobs)
+	{
+		std::vector<Particle> particles(count);
+		const double locked = particlesPerSecond(count, [&]() {
+			for (auto& p : particles) {
+				p.v = glm::vec3(randomLocked(-settings.size, settings.size),
+					randomLocked(settings.velocityMin, settings.velocityMax),
+					randomLocked(-settings.size, settings.size));
+				p.life = randomLocked(settings.lifeMin, settings.lifeMax);
+				p.c = glm::vec3(randomLocked(0.5, 1.0), randomLocked(0.0, 0.5), randomLocked(0.0, 0.5));
+				p.size = randomLocked(0.1f, 0.25f);
+			}
+		});
+		const double pcg = particlesPerSecond(count, [&]() {
+			for (auto& p : particles) {
+				p = settings.createNewParticle();
+			}
+		});
+
+		// Philox: 8 numbers per particle, in parallel (no shared state)
+		std::vector<float> values(count * ParticleSystem::NumSpawned);
+		const Philox4x32 philox(1);
+		uint64_t frame = 0;
+		const double batch = particlesPerSecond(count, [&]() {
+			philox.uniform(0, values.data(), values.size(), frame++);
+		});
+		const double batchParallel = particlesPerSecond(count, [&]() {
+			jobs.parallelFor(0, count, 16384, [&](std::size_t begin, std::size_t end) {
+				philox.uniform(2 * begin, values.data() + begin * ParticleSystem::NumSpawned,
+					(end - begin) * ParticleSystem::NumSpawned, frame);
+			});
+			frame++;
+		});
+
+		// All the particles die at each step
+		ParticleGeneratorSettings respawn = settings;
+		respawn.lifeMin = respawn.lifeMax = dt * 0.5f;
+		ParticleSystem system;
+		system.resize(count, respawn);
+		const double respawnRate = particlesPerSecond(count, [&]() {
+			system.step(dt, respawn, jobs);
+		});
+
+		std::cout << std::setw(10) << count << std::setw(10) << locked * 1e-6 << std::setw(10) << pcg * 1e-6
+			<< std::setw(10) << batch * 1e-6 << std::setw(10) << batchParallel * 1e-6
+			<< std::setw(10) << respawnRate * 1e-6 << std::endl;
+	}
+
+	// Same number of particles split in "emitters" emitters
+	void benchmarkWorld(std::size_t count, std::size_t emitters, JobSystem& jobs)
+	{
+		ParticleWorld world;
+		world.create(count + emitters * ParticleSystem::BlockSize); // Padding of the last blocks
+		for (std::size_t e = 0; e < emitters; ++e) {
+			ParticleGeneratorSettings settings;
+			settings.origin = glm::vec3(float(e % 100), 0.0f, float(e / 100));
+			world.addEmitter(count / emitters, settings);
+		}
+		std::vector<ParticleGPU> gpu(world.capacity());
+		const int steps = std::max(5, numberSteps(count) / 10);
+		const double step = milliseconds([&]() { for (int s = 0; s < steps; ++s) world.step(dt); }) / steps;
+		const double stepMT = milliseconds([&]() { for (int s = 0; s < steps; ++s) world.step(dt, &jobs); }) / steps;
+		const double write = milliseconds([&]() { for (int s = 0; s < steps; ++s) world.writeGPU(gpu.data(), &jobs); }) / steps;
+		std::cout << std::setw(10) << count << std::setw(10) << world.numEmitters() << std::setw(10) << step
+			<< std::setw(10) << stepMT << std::setw(10) << write << std::setw(10) << world.drawRanges().size() << std::endl;
+	}
+
+	// Density of all the particles by testing all the pairs (reference)
+	std::vector<float> bruteForceDensity(const ParticleSystem& system, float h)
+	{
+		const std::size_t n = system.size();
+		const float* px = system.positionX();
+		const float* py = system.positionY();
+		const float* pz = system.positionZ();
+		std::vector<float> density(n, 0.0f);
+		for (std::size_t i = 0; i < n; ++i) {
+			for (std::size_t j = 0; j < n; ++j) {
+				const float dx = px[i] - px[j];
+				const float dy = py[i] - py[j];
+				const float dz = pz[i] - pz[j];
+				const float r2 = dx * dx + dy * dy + dz * dz;
+				if (r2 < h * h) {
+					const float w = 1.0f - r2 / (h * h);
+					density[i] += w * w * w;
+				}
+			}
+		}
+		return density;
+	}
+
+	void benchmarkInteractions(std::size_t count, ParticleGeneratorSettings& settings, JobSystem& jobs)
+	{
+		// Particles spread in a cube (about 20 neighbors each, the fountain
+		// concentrates the particles on the spawn point)
+		ParticleSystem system;
+		system.resize(count, settings);
+		const float side = std::cbrt(float(count) / 40000.0f);
+		std::vector<float> u(4 * count);
+		Philox4x32(7).uniform(0, u.data(), u.size());
+		for (std::size_t i = 0; i < count; ++i) {
+			system.stream(ParticleSystem::PX)[i] = (u[4 * i] - 0.5f) * side;
+			system.stream(ParticleSystem::PY)[i] = u[4 * i + 1] * side;
+			system.stream(ParticleSystem::PZ)[i] = (u[4 * i + 2] - 0.5f) * side;
+			system.stream(ParticleSystem::VX)[i] = 0.0f;
+			system.stream(ParticleSystem::VY)[i] = 0.0f;
+			system.stream(ParticleSystem::VZ)[i] = 0.0f;
+		}
+		InteractionSettings interactionSettings;
+		interactionSettings.floorHeight = 0.0f;
+		interactionSettings.spheres.push_back({ glm::vec3(0.0f, 0.5f * side, 0.0f), 0.1f * side });
+
+		// Best of a few applies (small time step: the particles barely move)
+		const float step = 1e-4f;
+		ParticleInteractions interactions;
+		float grid = 1e30f, interact = 1e30f, gridMT = 1e30f, interactMT = 1e30f;
+		for (int s = 0; s < 3; ++s) {
+			interactions.apply(system, step, interactionSettings);
+			grid = std::min(grid, interactions.gridTime());
+			interact = std::min(interact, interactions.interactionTime());
+			interactions.apply(system, step, interactionSettings, &jobs);
+			gridMT = std::min(gridMT, interactions.gridTime());
+			interactMT = std::min(interactMT, interactions.interactionTime());
+		}
+
+		// Average number of neighbors (kernel sum without the particle itself)
+		double neighbors = 0.0;
+		for (float d : interactions.density()) neighbors += d - 1.0f;
+		neighbors /= double(std::max<std::size_t>(count, 1));
+
+		std::cout << std::setw(10) << count << std::setw(10) << grid << std::setw(10) << interact
+			<< std::setw(10) << gridMT << std::setw(10) << interactMT << std::setw(10) << neighbors;
+
+		// All the pairs: quadratic, only for small counts
+		if (count <= 20000) {
+			std::vector<float> reference;
+			const double bruteForce = milliseconds([&]() { reference = bruteForceDensity(system, interactionSettings.radius); });
+			// Same densities with the grid (no neighbor limit)
+			interactionSettings.maxNeighbors = int(count);
+			interactions.apply(system, 0.0f, interactionSettings, &jobs);
+			float error = 0.0f;
+			for (std::size_t i = 0; i < count; ++i) {
+				error = std::max(error, std::abs(reference[i] - interactions.density()[i]));
+			}
+			std::cout << std::setw(12) << bruteForce << std::setw(12) << error;
+		}
+		std::cout << std::endl;
+	}
+
+	// Hash after "ticks" fixed steps of 1/60s
+	uint64_t simulate(std::size_t count, uint32_t seed, int ticks, ParticleSystem::Kernel kernel,
+		ParticleSystem::Integrator integrator, JobSystem* jobs)
+	{
+		ParticleGeneratorSettings settings;
+		ParticleSystem system;
+		system.setKernel(kernel);
+		system.setIntegrator(integrator);
+		system.resize(count, settings, seed);
+		for (int t = 0; t < ticks; ++t) {
+			if (jobs) system.step(dt, settings, *jobs);
+			else system.step(dt, settings);
+		}
+		return system.hash();
+	}
+
+	int checkDeterminism(int ticks, std::size_t count, uint32_t seed)
+	{
+		const ParticleSystem::Kernel kernels[] = { ParticleSystem::Kernel::Scalar, ParticleSystem::Kernel::SSE, ParticleSystem::Kernel::AVX2 };
+		const ParticleSystem::Integrator integrators[] = { ParticleSystem::Integrator::Euler, ParticleSystem::Integrator::SemiImplicitEuler, ParticleSystem::Integrator::Verlet };
+		const char* integratorNames[] = { "Euler", "Semi-implicit", "Verlet" };
+		JobSystem& jobs = JobSystem::instance();
+
+		std::cout << ticks << " ticks of " << count << " particles, seed " << seed << ", " << jobs.numThreads() << " threads for MT\n";
+		bool same = true;
+		for (int i = 0; i < 3; ++i)
+		{
+			uint64_t reference = 0;
+			bool first = true;
+			for (auto kernel : kernels) {
+				if (!ParticleSystem::isAvailable(kernel)) continue;
+				for (JobSystem* threads : { static_cast<JobSystem*>(nullptr), &jobs }) {
+					const uint64_t h = simulate(count, seed, ticks, kernel, integrators[i], threads);
+					if (first) reference = h;
+					first = false;
+					std::cout << std::setw(14) << integratorNames[i] << std::setw(8) << ParticleSystem::kernelName(kernel)
+						<< std::setw(4) << (threads ? "MT" : "") << "  " << std::hex << std::setw(16) << std::setfill('0') << h
+						<< std::dec << std::setfill(' ') << (h == reference ? "" : "  MISMATCH") << "\n";
+					same &= h == reference;
+				}
+			}
+		}
+		std::cout << (same ? "Deterministic" : "Not deterministic") << std::endl;
+		return same ? 0 : 1;
+	}
+
+	double benchmarkThreads(std::size_t count, ParticleGeneratorSettings& settings, JobSystem& jobs)
+	{
+		ParticleSystem system;
+		system.resize(count, settings);
+		return particlesPerSecond(count, [&]() {
+			system.step(dt, settings, jobs);
+		});
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1 && std::string(argv[1]) == "--determinism") {
+		const int ticks = argc > 2 ? std::stoi(argv[2]) : 600;
+		const std::size_t count = argc > 3 ? std::stoul(argv[3]) : 100000;
+		const uint32_t seed = argc > 4 ? uint32_t(std::stoul(argv[4])) : 1;
+		return checkDeterminism(ticks, count, seed);
+	}
+
+	std::size_t maxCount = 10000000;
+	if (argc > 1) {
+		maxCount = std::stoul(argv[1]);
+	}
+
+	ParticleGeneratorSettings settings;
+	const ParticleSystem::Kernel kernels[] = { ParticleSystem::Kernel::Scalar, ParticleSystem::Kernel::SSE, ParticleSystem::Kernel::AVX2 };
+
+	std::cout << "Particles/second (millions)\n";
+	std::cout << std::setw(10) << "count" << std::setw(10) << "AoS";
+	for (auto kernel : kernels) {
+		if (ParticleSystem::isAvailable(kernel)) {
+			std::cout << std::setw(10) << ParticleSystem::kernelName(kernel);
+		}
+	}
+	std::cout << "\n";
+
+	std::cout << std::fixed << std::setprecision(1);
+	for (std::size_t count = 10000; count <= maxCount; count *= 10)
+	{
+		std::cout << std::setw(10) << count;
+		std::cout << std::setw(10) << benchmarkAoS(count, settings) * 1e-6;
+		for (auto kernel : kernels) {
+			if (ParticleSystem::isAvailable(kernel)) {
+				std::cout << std::setw(10) << benchmarkSoA(count, settings, kernel) * 1e-6;
+			}
+		}
+		std::cout << std::endl;
+	}
+
+	// Scaling with the number of threads (best kernel)
+	const unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	std::cout << "\nUpdate time (ms) with " << ParticleSystem::kernelName(ParticleSystem::bestKernel()) << "\n";
+	std::cout << std::setw(10) << "threads";
+	for (std::size_t count = 1000000; count <= std::max<std::size_t>(maxCount, 1000000); count *= 10) {
+		std::cout << std::setw(12) << count << std::setw(10) << "speedup";
+	}
+	std::cout << "\n" << std::setprecision(3);
+	std::vector<unsigned int> threadCounts;
+	for (unsigned int threads = 1; threads < maxThreads; threads *= 2) {
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(maxThreads); // Last: all the threads
+	std::vector<double> reference;
+	for (unsigned int threads : threadCounts)
+	{
+		JobSystem jobs(threads);
+		std::cout << std::setw(10) << threads;
+		std::size_t c = 0;
+		for (std::size_t count = 1000000; count <= std::max<std::size_t>(maxCount, 1000000); count *= 10, ++c)
+		{
+			const double rate = benchmarkThreads(count, settings, jobs);
+			if (threads == 1) reference.push_back(rate);
+			std::cout << std::setw(12) << 1000.0 * count / rate << std::setw(10) << rate / reference[c];
+		}
+		std::cout << std::endl;
+	}
+
+	// Back to front sorting
+	JobSystem& jobs = JobSystem::instance();
+	std::cout << "\nSort time (ms), " << jobs.numThreads() << " threads for the parallel sorts\n";
+	std::cout << std::setw(10) << "count" << std::setw(12) << "std::sort" << std::setw(12) << "radix"
+		<< std::setw(12) << "radix MT" << std::setw(12) << "coherent" << std::setw(12) << "insertion" << "\n";
+	for (std::size_t count : { 100000, 500000, 1000000, 5000000 }) {
+		if (count <= maxCount) {
+			benchmarkSort(count, settings, jobs);
+		}
+	}
+
+	// Spawning (respawn heavy scenarios)
+	std::cout << "\nSpawns/second (millions), " << jobs.numThreads() << " threads for the parallel spawns\n";
+	std::cout << std::setw(10) << "count" << std::setw(10) << "rand()" << std::setw(10) << "PCG32"
+		<< std::setw(10) << "Philox" << std::setw(10) << "Philox MT" << std::setw(10) << "respawn" << "\n";
+	std::cout << std::setprecision(1);
+	for (std::size_t count = 10000; count <= std::min<std::size_t>(maxCount, 1000000); count *= 10) {
+		benchmarkSpawn(count, settings, jobs);
+	}
+
+	// Interactions (separation, SPH density, collisions)
+	std::cout << "\nInteractions time (ms), " << jobs.numThreads() << " threads for MT\n";
+	std::cout << std::setw(10) << "count" << std::setw(10) << "grid" << std::setw(10) << "interact"
+		<< std::setw(10) << "grid MT" << std::setw(10) << "inter. MT" << std::setw(10) << "neighbors"
+		<< std::setw(12) << "all pairs" << std::setw(12) << "max error" << "\n";
+	std::cout << std::setprecision(3);
+	for (std::size_t count = 10000; count <= std::min<std::size_t>(maxCount, 1000000); count *= 10) {
+		benchmarkInteractions(count, settings, jobs);
+	}
+
+	// Many emitters sharing one pool
+	std::cout << "\nWorld time (ms), " << jobs.numThreads() << " threads for MT\n";
+	std::cout << std::setw(10) << "count" << std::setw(10) << "emitters" << std::setw(10) << "step"
+		<< std::setw(10) << "step MT" << std::setw(10) << "write MT" << std::setw(10) << "ranges" << "\n";
+	const std::size_t worldCount = std::min<std::size_t>(maxCount, 1000000);
+	for (std::size_t emitters : { 1, 10, 100, 1000, 10000 }) {
+		benchmarkWorld(worldCount, emitters, jobs);
+	}
+	return 0;
+}
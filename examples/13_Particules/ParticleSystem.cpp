@@ -0,0 +1,439 @@
+#include "ParticleSystem.h"
+#include "CpuFeatures.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PARTICLES_X86 1
+#include <immintrin.h>
+#endif
+
+// GCC and Clang need to be told which instructions a function can use
+// (the rest of the file is compiled for the default architecture)
+#if defined(__GNUC__) || defined(__clang__)
+#define PARTICLES_TARGET(arch) __attribute__((target(arch)))
+#else
+#define PARTICLES_TARGET(arch)
+#endif
+
+namespace {
+	const float Gravity = -9.8f; // acceleration due to gravity (Y axis)
+	const std::size_t Alignment = 64; // Cache line
+	const std::size_t SpawnBatch = 256; // Particles spawned per batch of random numbers
+
+	// xorshift32 (the state must never be 0)
+	inline uint32_t nextRandom(uint32_t& state)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	// 24 bits random number converted in [0, 1)
+	inline float toUniform(uint32_t v)
+	{
+		return float(v >> 8) * (1.0f / 16777216.0f);
+	}
+
+	// Initial random state of a particle
+	uint32_t seedState(uint32_t seed, uint32_t index)
+	{
+		uint32_t h = index * 0x9E3779B9u + seed * 0x85EBCA6Bu;
+		h ^= h >> 16;
+		h *= 0x7FEB352Du;
+		h ^= h >> 15;
+		h *= 0x846CA68Bu;
+		h ^= h >> 16;
+		return h != 0 ? h : 0x6D2B79F5u;
+	}
+
+	ParticleSystem::SpawnRanges spawnRanges(const ParticleGeneratorSettings& settings)
+	{
+		// Same distribution as ParticleGeneratorSettings::createNewParticle()
+		return {
+			{ -settings.size, settings.velocityMin, -settings.size, settings.lifeMin, 0.5f, 0.0f, 0.0f, 0.1f },
+			{ settings.size, settings.velocityMax, settings.size, settings.lifeMax, 1.0f, 0.5f, 0.5f, 0.25f },
+			{ settings.origin.x, settings.origin.y, settings.origin.z }
+		};
+	}
+
+	// Spawn a new particle at the origin of the generator
+	inline void spawnScalar(float* const* s, uint32_t* rng, std::size_t i, const ParticleSystem::SpawnRanges& ranges)
+	{
+		uint32_t state = rng[i];
+		for (int k = 0; k < ParticleSystem::NumSpawned; ++k) {
+			const float u = toUniform(nextRandom(state));
+			s[k][i] = ranges.min[k] + (ranges.max[k] - ranges.min[k]) * u;
+		}
+		s[ParticleSystem::PX][i] = ranges.origin[0];
+		s[ParticleSystem::PY][i] = ranges.origin[1];
+		s[ParticleSystem::PZ][i] = ranges.origin[2];
+		s[ParticleSystem::PrevX][i] = ranges.origin[0];
+		s[ParticleSystem::PrevY][i] = ranges.origin[1];
+		s[ParticleSystem::PrevZ][i] = ranges.origin[2];
+		rng[i] = state;
+	}
+
+	// gravityOffset: dt^2 * Gravity term of the integrator (see ParticleSystem::Integrator)
+	// All the kernels compute ((p + dt * v) + gravityOffset): same result
+	void stepScalar(float* const* s, uint32_t* rng, std::size_t begin, std::size_t end, float dt, float gravityOffset, const ParticleSystem::SpawnRanges& ranges)
+	{
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			const float life = s[ParticleSystem::Life][i] - dt;
+			if (life <= 0.0f)
+			{
+				// particle is dead, so create a new one
+				spawnScalar(s, rng, i, ranges);
+			}
+			else
+			{
+				s[ParticleSystem::Life][i] = life;
+				s[ParticleSystem::PrevX][i] = s[ParticleSystem::PX][i];
+				s[ParticleSystem::PrevY][i] = s[ParticleSystem::PY][i];
+				s[ParticleSystem::PrevZ][i] = s[ParticleSystem::PZ][i];
+				s[ParticleSystem::PX][i] += dt * s[ParticleSystem::VX][i];
+				s[ParticleSystem::PY][i] += dt * s[ParticleSystem::VY][i];
+				s[ParticleSystem::PY][i] += gravityOffset;
+				s[ParticleSystem::PZ][i] += dt * s[ParticleSystem::VZ][i];
+				s[ParticleSystem::VY][i] += dt * Gravity;
+			}
+		}
+	}
+
+#ifdef PARTICLES_X86
+	// 4 particles per instruction (SSE2 has no blend: and/andnot/or)
+	PARTICLES_TARGET("sse2")
+	void stepSSE(float* const* s, uint32_t* rng, std::size_t begin, std::size_t end, float dt, float gravityOffset, const ParticleSystem::SpawnRanges& ranges)
+	{
+		const __m128 dtv = _mm_set1_ps(dt);
+		const __m128 offset = _mm_set1_ps(gravityOffset);
+		const __m128 gravity = _mm_set1_ps(dt * Gravity);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 toFloat = _mm_set1_ps(1.0f / 16777216.0f);
+		for (std::size_t i = begin; i < end; i += 4)
+		{
+			__m128 life = _mm_sub_ps(_mm_load_ps(s[ParticleSystem::Life] + i), dtv);
+			__m128 vx = _mm_load_ps(s[ParticleSystem::VX] + i);
+			__m128 vy = _mm_load_ps(s[ParticleSystem::VY] + i);
+			__m128 vz = _mm_load_ps(s[ParticleSystem::VZ] + i);
+			const __m128 oldx = _mm_load_ps(s[ParticleSystem::PX] + i);
+			const __m128 oldy = _mm_load_ps(s[ParticleSystem::PY] + i);
+			const __m128 oldz = _mm_load_ps(s[ParticleSystem::PZ] + i);
+			__m128 px = _mm_add_ps(oldx, _mm_mul_ps(dtv, vx));
+			__m128 py = _mm_add_ps(_mm_add_ps(oldy, _mm_mul_ps(dtv, vy)), offset);
+			__m128 pz = _mm_add_ps(oldz, _mm_mul_ps(dtv, vz));
+			vy = _mm_add_ps(vy, gravity);
+
+			const __m128 dead = _mm_cmple_ps(life, zero);
+			if (_mm_movemask_ps(dead) == 0)
+			{
+				_mm_store_ps(s[ParticleSystem::Life] + i, life);
+				_mm_store_ps(s[ParticleSystem::VY] + i, vy);
+				_mm_store_ps(s[ParticleSystem::PrevX] + i, oldx);
+				_mm_store_ps(s[ParticleSystem::PrevY] + i, oldy);
+				_mm_store_ps(s[ParticleSystem::PrevZ] + i, oldz);
+				_mm_store_ps(s[ParticleSystem::PX] + i, px);
+				_mm_store_ps(s[ParticleSystem::PY] + i, py);
+				_mm_store_ps(s[ParticleSystem::PZ] + i, pz);
+				continue;
+			}
+
+			// Respawn: the new values are computed for all the lanes
+			// and only kept for the dead particles
+			const __m128i oldState = _mm_load_si128((const __m128i*)(rng + i));
+			__m128i state = oldState;
+			__m128 spawned[ParticleSystem::NumSpawned];
+			for (int k = 0; k < ParticleSystem::NumSpawned; ++k) {
+				state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+				state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+				state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+				const __m128 u = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(state, 8)), toFloat);
+				const __m128 minv = _mm_set1_ps(ranges.min[k]);
+				const __m128 range = _mm_set1_ps(ranges.max[k] - ranges.min[k]);
+				spawned[k] = _mm_add_ps(minv, _mm_mul_ps(range, u));
+			}
+			auto select = [&dead](__m128 a, __m128 b) {
+				return _mm_or_ps(_mm_and_ps(dead, a), _mm_andnot_ps(dead, b));
+			};
+			_mm_store_ps(s[ParticleSystem::VX] + i, select(spawned[ParticleSystem::VX], vx));
+			_mm_store_ps(s[ParticleSystem::VY] + i, select(spawned[ParticleSystem::VY], vy));
+			_mm_store_ps(s[ParticleSystem::VZ] + i, select(spawned[ParticleSystem::VZ], vz));
+			_mm_store_ps(s[ParticleSystem::Life] + i, select(spawned[ParticleSystem::Life], life));
+			for (int k = ParticleSystem::R; k <= ParticleSystem::Size; ++k) {
+				_mm_store_ps(s[k] + i, select(spawned[k], _mm_load_ps(s[k] + i)));
+			}
+			_mm_store_ps(s[ParticleSystem::PX] + i, select(_mm_set1_ps(ranges.origin[0]), px));
+			_mm_store_ps(s[ParticleSystem::PY] + i, select(_mm_set1_ps(ranges.origin[1]), py));
+			_mm_store_ps(s[ParticleSystem::PZ] + i, select(_mm_set1_ps(ranges.origin[2]), pz));
+			_mm_store_ps(s[ParticleSystem::PrevX] + i, select(_mm_set1_ps(ranges.origin[0]), oldx));
+			_mm_store_ps(s[ParticleSystem::PrevY] + i, select(_mm_set1_ps(ranges.origin[1]), oldy));
+			_mm_store_ps(s[ParticleSystem::PrevZ] + i, select(_mm_set1_ps(ranges.origin[2]), oldz));
+			const __m128i deadi = _mm_castps_si128(dead);
+			_mm_store_si128((__m128i*)(rng + i),
+				_mm_or_si128(_mm_and_si128(deadi, state), _mm_andnot_si128(deadi, oldState)));
+		}
+	}
+
+	// 8 particles per instruction
+	PARTICLES_TARGET("avx2")
+	void stepAVX2(float* const* s, uint32_t* rng, std::size_t begin, std::size_t end, float dt, float gravityOffset, const ParticleSystem::SpawnRanges& ranges)
+	{
+		const __m256 dtv = _mm256_set1_ps(dt);
+		const __m256 offset = _mm256_set1_ps(gravityOffset);
+		const __m256 gravity = _mm256_set1_ps(dt * Gravity);
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 toFloat = _mm256_set1_ps(1.0f / 16777216.0f);
+		for (std::size_t i = begin; i < end; i += 8)
+		{
+			__m256 life = _mm256_sub_ps(_mm256_load_ps(s[ParticleSystem::Life] + i), dtv);
+			__m256 vx = _mm256_load_ps(s[ParticleSystem::VX] + i);
+			__m256 vy = _mm256_load_ps(s[ParticleSystem::VY] + i);
+			__m256 vz = _mm256_load_ps(s[ParticleSystem::VZ] + i);
+			const __m256 oldx = _mm256_load_ps(s[ParticleSystem::PX] + i);
+			const __m256 oldy = _mm256_load_ps(s[ParticleSystem::PY] + i);
+			const __m256 oldz = _mm256_load_ps(s[ParticleSystem::PZ] + i);
+			__m256 px = _mm256_add_ps(oldx, _mm256_mul_ps(dtv, vx));
+			__m256 py = _mm256_add_ps(_mm256_add_ps(oldy, _mm256_mul_ps(dtv, vy)), offset);
+			__m256 pz = _mm256_add_ps(oldz, _mm256_mul_ps(dtv, vz));
+			vy = _mm256_add_ps(vy, gravity);
+
+			const __m256 dead = _mm256_cmp_ps(life, zero, _CMP_LE_OQ);
+			if (_mm256_movemask_ps(dead) == 0)
+			{
+				_mm256_store_ps(s[ParticleSystem::Life] + i, life);
+				_mm256_store_ps(s[ParticleSystem::VY] + i, vy);
+				_mm256_store_ps(s[ParticleSystem::PrevX] + i, oldx);
+				_mm256_store_ps(s[ParticleSystem::PrevY] + i, oldy);
+				_mm256_store_ps(s[ParticleSystem::PrevZ] + i, oldz);
+				_mm256_store_ps(s[ParticleSystem::PX] + i, px);
+				_mm256_store_ps(s[ParticleSystem::PY] + i, py);
+				_mm256_store_ps(s[ParticleSystem::PZ] + i, pz);
+				continue;
+			}
+
+			// Respawn: the new values are computed for all the lanes
+			// and only kept for the dead particles
+			const __m256i oldState = _mm256_load_si256((const __m256i*)(rng + i));
+			__m256i state = oldState;
+			__m256 spawned[ParticleSystem::NumSpawned];
+			for (int k = 0; k < ParticleSystem::NumSpawned; ++k) {
+				state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 13));
+				state = _mm256_xor_si256(state, _mm256_srli_epi32(state, 17));
+				state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 5));
+				const __m256 u = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(state, 8)), toFloat);
+				const __m256 minv = _mm256_set1_ps(ranges.min[k]);
+				const __m256 range = _mm256_set1_ps(ranges.max[k] - ranges.min[k]);
+				spawned[k] = _mm256_add_ps(minv, _mm256_mul_ps(range, u));
+			}
+			_mm256_store_ps(s[ParticleSystem::VX] + i, _mm256_blendv_ps(vx, spawned[ParticleSystem::VX], dead));
+			_mm256_store_ps(s[ParticleSystem::VY] + i, _mm256_blendv_ps(vy, spawned[ParticleSystem::VY], dead));
+			_mm256_store_ps(s[ParticleSystem::VZ] + i, _mm256_blendv_ps(vz, spawned[ParticleSystem::VZ], dead));
+			_mm256_store_ps(s[ParticleSystem::Life] + i, _mm256_blendv_ps(life, spawned[ParticleSystem::Life], dead));
+			for (int k = ParticleSystem::R; k <= ParticleSystem::Size; ++k) {
+				_mm256_store_ps(s[k] + i, _mm256_blendv_ps(_mm256_load_ps(s[k] + i), spawned[k], dead));
+			}
+			_mm256_store_ps(s[ParticleSystem::PX] + i, _mm256_blendv_ps(px, _mm256_set1_ps(ranges.origin[0]), dead));
+			_mm256_store_ps(s[ParticleSystem::PY] + i, _mm256_blendv_ps(py, _mm256_set1_ps(ranges.origin[1]), dead));
+			_mm256_store_ps(s[ParticleSystem::PZ] + i, _mm256_blendv_ps(pz, _mm256_set1_ps(ranges.origin[2]), dead));
+			_mm256_store_ps(s[ParticleSystem::PrevX] + i, _mm256_blendv_ps(oldx, _mm256_set1_ps(ranges.origin[0]), dead));
+			_mm256_store_ps(s[ParticleSystem::PrevY] + i, _mm256_blendv_ps(oldy, _mm256_set1_ps(ranges.origin[1]), dead));
+			_mm256_store_ps(s[ParticleSystem::PrevZ] + i, _mm256_blendv_ps(oldz, _mm256_set1_ps(ranges.origin[2]), dead));
+			const __m256i blended = _mm256_blendv_epi8(oldState, state, _mm256_castps_si256(dead));
+			_mm256_store_si256((__m256i*)(rng + i), blended);
+		}
+	}
+#endif
+}
+
+ParticleSystem::ParticleSystem():
+	m_kernel(bestKernel())
+{
+	std::fill(m_streams, m_streams + NumStreams, nullptr);
+}
+
+void ParticleSystem::resize(std::size_t count, const ParticleGeneratorSettings& settings, uint32_t seed)
+{
+	m_count = count;
+	m_capacity = (count + BlockSize - 1) / BlockSize * BlockSize;
+
+	// One allocation: each array starts on a new cache line
+	const std::size_t streamBytes = (m_capacity * sizeof(float) + Alignment - 1) / Alignment * Alignment;
+	m_storage.assign(streamBytes * (NumStreams + 1) + Alignment, 0);
+	unsigned char* base = m_storage.data();
+	base += (Alignment - reinterpret_cast<std::uintptr_t>(base) % Alignment) % Alignment;
+	for (int k = 0; k < NumStreams; ++k) {
+		m_streams[k] = reinterpret_cast<float*>(base + k * streamBytes);
+	}
+	m_rng = reinterpret_cast<uint32_t*>(base + NumStreams * streamBytes);
+
+	// Spawn all the particles (padding included)
+	spawnBlocks(0, blockCount(), settings, seed);
+}
+
+void ParticleSystem::spawnBlocks(std::size_t firstBlock, std::size_t lastBlock, const ParticleGeneratorSettings& settings, uint32_t seed)
+{
+	// The attributes of the particle i come from the Philox blocks 2i and 2i + 1
+	// (same stream as the first frame of 13_Particules_compute/particules_emit.comp)
+	const SpawnRanges ranges = spawnRanges(settings);
+	const Philox4x32 philox(seed);
+	const std::size_t end = std::min(lastBlock * BlockSize, m_capacity);
+	float values[SpawnBatch * NumSpawned];
+	for (std::size_t first = firstBlock * BlockSize; first < end; first += SpawnBatch)
+	{
+		const std::size_t n = std::min(SpawnBatch, end - first);
+		philox.uniform(2 * first, values, n * NumSpawned);
+		for (std::size_t i = 0; i < n; ++i) {
+			const float* u = values + i * NumSpawned;
+			for (int k = 0; k < NumSpawned; ++k) {
+				m_streams[k][first + i] = ranges.min[k] + (ranges.max[k] - ranges.min[k]) * u[k];
+			}
+			m_streams[PX][first + i] = ranges.origin[0];
+			m_streams[PY][first + i] = ranges.origin[1];
+			m_streams[PZ][first + i] = ranges.origin[2];
+			m_streams[PrevX][first + i] = ranges.origin[0];
+			m_streams[PrevY][first + i] = ranges.origin[1];
+			m_streams[PrevZ][first + i] = ranges.origin[2];
+			m_rng[first + i] = seedState(seed, uint32_t(first + i));
+		}
+	}
+}
+
+void ParticleSystem::step(float dt, const ParticleGeneratorSettings& settings)
+{
+	stepBlocks(0, blockCount(), dt, settings);
+}
+
+void ParticleSystem::step(float dt, const ParticleGeneratorSettings& settings, JobSystem& jobs)
+{
+	jobs.parallelFor(0, blockCount(), BlocksPerJob, [&](std::size_t first, std::size_t last) {
+		stepBlocks(first, last, dt, settings);
+	});
+}
+
+void ParticleSystem::stepBlocks(std::size_t firstBlock, std::size_t lastBlock, float dt, const ParticleGeneratorSettings& settings)
+{
+	const SpawnRanges ranges = spawnRanges(settings);
+	const std::size_t begin = firstBlock * BlockSize;
+	const std::size_t end = std::min(lastBlock * BlockSize, m_capacity);
+	if (begin >= end) return;
+
+	// Position: p + dt * v + k * dt^2 * g, then v + dt * g
+	float k = 0.0f; // Explicit Euler: old velocity
+	if (m_integrator == Integrator::SemiImplicitEuler) k = 1.0f; // new velocity
+	if (m_integrator == Integrator::Verlet) k = 0.5f; // average (exact for a constant gravity)
+	const float gravityOffset = k * dt * dt * Gravity;
+
+	switch (m_kernel)
+	{
+#ifdef PARTICLES_X86
+	case Kernel::AVX2:
+		stepAVX2(m_streams, m_rng, begin, end, dt, gravityOffset, ranges);
+		break;
+	case Kernel::SSE:
+		stepSSE(m_streams, m_rng, begin, end, dt, gravityOffset, ranges);
+		break;
+#endif
+	default:
+		stepScalar(m_streams, m_rng, begin, end, dt, gravityOffset, ranges);
+		break;
+	}
+}
+
+void ParticleSystem::writeGPU(ParticleGPU* out) const
+{
+	writeGPU(out, 0, m_count);
+}
+
+void ParticleSystem::writeGPU(ParticleGPU* out, JobSystem& jobs) const
+{
+	jobs.parallelFor(0, m_count, BlocksPerJob * BlockSize, [&](std::size_t begin, std::size_t end) {
+		writeGPU(out, begin, end);
+	});
+}
+
+void ParticleSystem::writeGPU(ParticleGPU* out, std::size_t begin, std::size_t end) const
+{
+	for (std::size_t i = begin; i < end; ++i)
+	{
+		out[i].p = position(i);
+		out[i].size = m_streams[Size][i];
+		out[i].color = glm::vec3(m_streams[R][i], m_streams[G][i], m_streams[B][i]);
+	}
+}
+
+void ParticleSystem::setKernel(Kernel kernel)
+{
+	while (!isAvailable(kernel)) {
+		kernel = Kernel(int(kernel) - 1);
+	}
+	m_kernel = kernel;
+}
+
+bool ParticleSystem::isAvailable(Kernel kernel)
+{
+	switch (kernel)
+	{
+	case Kernel::Scalar:
+		return true;
+#ifdef PARTICLES_X86
+	case Kernel::SSE:
+		return true; // Always present on x86-64
+	case Kernel::AVX2:
+		return cpuSupportsAVX2();
+#endif
+	default:
+		return false;
+	}
+}
+
+ParticleSystem::Kernel ParticleSystem::bestKernel()
+{
+	if (isAvailable(Kernel::AVX2)) return Kernel::AVX2;
+	if (isAvailable(Kernel::SSE)) return Kernel::SSE;
+	return Kernel::Scalar;
+}
+
+const char* ParticleSystem::kernelName(Kernel kernel)
+{
+	switch (kernel)
+	{
+	case Kernel::AVX2: return "AVX2";
+	case Kernel::SSE: return "SSE";
+	default: return "Scalar";
+	}
+}
+
+void ParticleSystem::writeGPU(ParticleGPU* out, const uint32_t* order, JobSystem& jobs) const
+{
+	jobs.parallelFor(0, m_count, BlocksPerJob * BlockSize, [&](std::size_t begin, std::size_t end) {
+		writeGPU(out, order, begin, end);
+	});
+}
+
+void ParticleSystem::writeGPU(ParticleGPU* out, const uint32_t* order, std::size_t begin, std::size_t end) const
+{
+	for (std::size_t i = begin; i < end; ++i)
+	{
+		const uint32_t j = order[i];
+		out[i].p = position(j);
+		out[i].size = m_streams[Size][j];
+		out[i].color = glm::vec3(m_streams[R][j], m_streams[G][j], m_streams[B][j]);
+	}
+}
+
+uint64_t ParticleSystem::hash() const
+{
+	// FNV-1a over the particles (padding excluded) and their random states
+	uint64_t h = 0xCBF29CE484222325ull;
+	auto add = [&h](const void* data, std::size_t bytes) {
+		const unsigned char* c = static_cast<const unsigned char*>(data);
+		for (std::size_t i = 0; i < bytes; ++i) {
+			h = (h ^ c[i]) * 0x100000001B3ull;
+		}
+	};
+	for (int k = 0; k < NumStreams; ++k) {
+		add(m_streams[k], m_count * sizeof(float));
+	}
+	add(m_rng, m_count * sizeof(uint32_t));
+	return h;
+}
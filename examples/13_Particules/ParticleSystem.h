@@ -0,0 +1,200 @@
+#pragma once
+
+// Particle data and simulation (no OpenGL dependency, can be used
+// by the application and by the benchmark).
+
+#include <glm/glm.hpp>
+
+#include "JobSystem.h"
+#include "Random.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Random number in [min, max) (generator of the calling thread, no lock)
+inline float random(float min, float max)
+{
+	return threadRandom().nextFloat(min, max);
+}
+
+// Data sent to the GPU (one per particle)
+struct ParticleGPU {
+	glm::vec3 p;
+	float size;
+	glm::vec3 color;
+};
+
+// A simple particle object.
+// Only used as a reference (Array of Structures) implementation,
+// the application uses ParticleSystem.
+struct Particle
+{
+	// Constructors
+	Particle() { }
+	ParticleGPU toGPU() {
+		return {
+			p,
+			size,
+			c
+		};
+	}
+
+	// Attributes
+	glm::vec3 p = glm::vec3(0.0); // position
+	glm::vec3 v = glm::vec3(0.0); // velocity
+	glm::vec3 c = glm::vec3(0.0); // RGB color
+	float life = 0.0f;			  // time to live
+	float size = 0.1f;			  // scaling factor
+};
+
+struct ParticleGeneratorSettings {
+	glm::vec3 origin = glm::vec3(0.0f); // spawn position
+	float size = 0.4f;
+	float velocityMin = 5.0f;
+	float velocityMax = 10.0f;
+	float lifeMin = 0.1f;
+	float lifeMax = 1.0f;
+
+	void sanitize() {
+		size = std::max(size, 0.0001f);
+		velocityMin = std::max(velocityMin, 0.0f);
+		velocityMax = std::max(velocityMax, velocityMin);
+		lifeMin = std::max(lifeMin, 0.0f);
+		lifeMax = std::max(lifeMax, lifeMin);
+	}
+
+	Particle createNewParticle()
+	{
+		Particle p;
+		p.p = origin;
+		const float vx = random(-size, size);
+		const float vz = random(-size, size);
+		p.v = glm::vec3(vx, random(velocityMin, velocityMax), vz);
+		p.life = random(lifeMin, lifeMax);
+		const float r = random(0.5, 1.0);
+		const float g = random(0.0, 0.5);
+		const float b = random(0.0, 0.5);
+		p.c = glm::vec3(r, g, b);
+		p.size = random(0.1f, 0.25f);
+		return p;
+	}
+
+
+};
+
+// Particle system stored as a Structure of Arrays (SoA):
+// each attribute is a separate float array aligned on a cache line,
+// so the integration can load 8 particles with one SIMD instruction.
+//
+// The particles are spawned from a counter based generator (Philox),
+// then each particle owns its random state (xorshift32): dead particles
+// are respawned with a mask (no branch per particle). The result is
+// the same whatever the kernel used (Scalar, SSE or AVX2) and however
+// the particles are split between the threads.
+class ParticleSystem
+{
+public:
+	enum class Kernel { Scalar, SSE, AVX2 };
+	// Position update (the velocity is always v + dt * g)
+	// Euler: p + dt * v (original), semi-implicit Euler: p + dt * v(t + dt),
+	// Verlet: p + dt * v + dt^2 * g / 2 (exact for a constant acceleration)
+	enum class Integrator { Euler, SemiImplicitEuler, Verlet };
+
+	// Number of particles processed together (one AVX2 register).
+	// All the arrays are padded to a multiple of this value.
+	static const std::size_t BlockSize = 8;
+	// Number of blocks per job (16k particles)
+	static const std::size_t BlocksPerJob = 2048;
+
+	ParticleSystem();
+	// The arrays point inside the storage: no copy
+	ParticleSystem(const ParticleSystem&) = delete;
+	ParticleSystem& operator=(const ParticleSystem&) = delete;
+
+	// Reallocate and spawn "count" new particles
+	void resize(std::size_t count, const ParticleGeneratorSettings& settings, uint32_t seed = 1);
+	// Spawn new particles in the blocks [firstBlock, lastBlock) (no allocation)
+	void spawnBlocks(std::size_t firstBlock, std::size_t lastBlock, const ParticleGeneratorSettings& settings, uint32_t seed = 1);
+
+	// Integrate all the particles (respawn dead ones)
+	void step(float dt, const ParticleGeneratorSettings& settings);
+	// Same but the blocks are split over the threads of the job system
+	void step(float dt, const ParticleGeneratorSettings& settings, JobSystem& jobs);
+	// Integrate the particles of the blocks [firstBlock, lastBlock)
+	void stepBlocks(std::size_t firstBlock, std::size_t lastBlock, float dt, const ParticleGeneratorSettings& settings);
+
+	// Convert the particles to the GPU format (out needs size() elements)
+	void writeGPU(ParticleGPU* out) const;
+	void writeGPU(ParticleGPU* out, JobSystem& jobs) const;
+	// Convert the particles [begin, end)
+	void writeGPU(ParticleGPU* out, std::size_t begin, std::size_t end) const;
+	// Convert the particles in the given order (out[i] is particle order[i])
+	void writeGPU(ParticleGPU* out, const uint32_t* order, JobSystem& jobs) const;
+	void writeGPU(ParticleGPU* out, const uint32_t* order, std::size_t begin, std::size_t end) const;
+
+	std::size_t size() const { return m_count; }
+	std::size_t blockCount() const { return m_capacity / BlockSize; }
+
+	Integrator integrator() const { return m_integrator; }
+	void setIntegrator(Integrator integrator) { m_integrator = integrator; }
+
+	// Position written by writeGPU: previous + alpha * (current - previous)
+	// (render between two fixed time steps, alpha = 1: current position)
+	float interpolation() const { return m_alpha; }
+	void setInterpolation(float alpha) { m_alpha = alpha; }
+
+	// Hash of the state (all the attributes and the random states):
+	// same steps from the same seed give the same hash, whatever the kernel
+	// and the number of threads
+	uint64_t hash() const;
+
+	// Kernel selection (fallback to the best available one)
+	Kernel kernel() const { return m_kernel; }
+	void setKernel(Kernel kernel);
+	static bool isAvailable(Kernel kernel);
+	static Kernel bestKernel();
+	static const char* kernelName(Kernel kernel);
+
+	// Direct access to the arrays
+	const float* positionX() const { return m_streams[PX]; }
+	const float* positionY() const { return m_streams[PY]; }
+	const float* positionZ() const { return m_streams[PZ]; }
+	const float* life() const { return m_streams[Life]; }
+
+	// Arrays (one per attribute) and spawn ranges share the same order
+	// (Prev: position before the last step, for the interpolation)
+	enum Stream { VX, VY, VZ, Life, R, G, B, Size, PX, PY, PZ, PrevX, PrevY, PrevZ, NumStreams };
+	static const int NumSpawned = PX; // Attributes set randomly at spawn
+
+	// Array of an attribute (size() particles)
+	float* stream(Stream s) { return m_streams[s]; }
+	const float* stream(Stream s) const { return m_streams[s]; }
+
+	// Min/Max of the random attributes when spawning (see Stream)
+	struct SpawnRanges {
+		float min[NumSpawned];
+		float max[NumSpawned];
+		float origin[3]; // spawn position
+	};
+
+private:
+	glm::vec3 position(std::size_t i) const
+	{
+		const glm::vec3 p(m_streams[PX][i], m_streams[PY][i], m_streams[PZ][i]);
+		if (m_alpha >= 1.0f) return p;
+		const glm::vec3 previous(m_streams[PrevX][i], m_streams[PrevY][i], m_streams[PrevZ][i]);
+		return previous + m_alpha * (p - previous);
+	}
+
+private:
+	std::vector<unsigned char> m_storage; // One allocation for all the arrays
+	float* m_streams[NumStreams];
+	uint32_t* m_rng = nullptr; // Random state per particle
+	std::size_t m_count = 0;
+	std::size_t m_capacity = 0;
+	Kernel m_kernel;
+	Integrator m_integrator = Integrator::Euler;
+	float m_alpha = 1.0f;
+};
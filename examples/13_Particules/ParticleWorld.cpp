@@ -0,0 +1,257 @@
+#include "ParticleWorld.h"
+
+#include <algorithm>
+
+namespace {
+	// Blocks per chunk (2048 particles): large emitters are split so
+	// the threads stay busy, small ones are a single chunk
+	const std::size_t BlocksPerChunk = 256;
+	// Position of the free slots (far from the emitters)
+	const float ParkedPosition = -1.0e6f;
+}
+
+void ParticleWorld::create(std::size_t capacity, uint32_t seed)
+{
+	m_seed = seed;
+	m_spawned = 0;
+	ParticleGeneratorSettings settings;
+	m_system.resize(capacity, settings, seed);
+	m_emitters.clear();
+	m_freeEmitters.clear();
+	m_freeRanges.clear();
+	if (m_system.blockCount() > 0) {
+		m_freeRanges.push_back({ 0, m_system.blockCount() });
+	}
+	park(0, m_system.blockCount());
+	m_liveCount = 0;
+	m_layoutDirty = true;
+}
+
+ParticleWorld::EmitterId ParticleWorld::addEmitter(std::size_t count, const ParticleGeneratorSettings& settings)
+{
+	const std::size_t numBlocks = std::max<std::size_t>(1, (count + ParticleSystem::BlockSize - 1) / ParticleSystem::BlockSize);
+	std::size_t firstBlock = 0;
+	if (!allocate(numBlocks, firstBlock)) {
+		return InvalidEmitter;
+	}
+
+	EmitterId id;
+	if (!m_freeEmitters.empty()) {
+		id = m_freeEmitters.back();
+		m_freeEmitters.pop_back();
+	}
+	else {
+		id = EmitterId(m_emitters.size());
+		m_emitters.emplace_back();
+	}
+	Emitter& e = m_emitters[id];
+	e.settings = settings;
+	e.count = count;
+	e.firstBlock = firstBlock;
+	e.numBlocks = numBlocks;
+	e.alive = true;
+
+	// Each emitter has its own random stream
+	m_spawned++;
+	m_system.spawnBlocks(firstBlock, firstBlock + numBlocks, settings, m_seed + m_spawned * 0x9E3779B9u);
+	m_liveCount += count;
+	m_layoutDirty = true;
+	return id;
+}
+
+void ParticleWorld::removeEmitter(EmitterId id)
+{
+	if (!isAlive(id)) return;
+	Emitter& e = m_emitters[id];
+	park(e.firstBlock, e.numBlocks);
+	release(e.firstBlock, e.numBlocks);
+	m_liveCount -= e.count;
+	e = Emitter();
+	m_freeEmitters.push_back(id);
+	m_layoutDirty = true;
+}
+
+void ParticleWorld::clear()
+{
+	for (EmitterId id = 0; id < m_emitters.size(); ++id) {
+		if (m_emitters[id].alive) {
+			park(m_emitters[id].firstBlock, m_emitters[id].numBlocks);
+		}
+	}
+	m_emitters.clear();
+	m_freeEmitters.clear();
+	m_freeRanges.clear();
+	if (m_system.blockCount() > 0) {
+		m_freeRanges.push_back({ 0, m_system.blockCount() });
+	}
+	m_liveCount = 0;
+	m_layoutDirty = true;
+}
+
+std::size_t ParticleWorld::largestFreeRange() const
+{
+	std::size_t blocks = 0;
+	for (const FreeRange& r : m_freeRanges) {
+		blocks = std::max(blocks, r.numBlocks);
+	}
+	return blocks * ParticleSystem::BlockSize;
+}
+
+bool ParticleWorld::allocate(std::size_t numBlocks, std::size_t& firstBlock)
+{
+	// First fit: the beginning of the pool stays dense
+	for (std::size_t i = 0; i < m_freeRanges.size(); ++i)
+	{
+		FreeRange& r = m_freeRanges[i];
+		if (r.numBlocks < numBlocks) continue;
+		firstBlock = r.firstBlock;
+		r.firstBlock += numBlocks;
+		r.numBlocks -= numBlocks;
+		if (r.numBlocks == 0) {
+			m_freeRanges.erase(m_freeRanges.begin() + i);
+		}
+		return true;
+	}
+	return false;
+}
+
+void ParticleWorld::release(std::size_t firstBlock, std::size_t numBlocks)
+{
+	// Insert in order, then merge with the previous and the next ranges
+	auto it = std::lower_bound(m_freeRanges.begin(), m_freeRanges.end(), firstBlock,
+		[](const FreeRange& r, std::size_t block) { return r.firstBlock < block; });
+	it = m_freeRanges.insert(it, { firstBlock, numBlocks });
+	auto next = it + 1;
+	if (next != m_freeRanges.end() && it->firstBlock + it->numBlocks == next->firstBlock) {
+		it->numBlocks += next->numBlocks;
+		m_freeRanges.erase(next);
+	}
+	if (it != m_freeRanges.begin()) {
+		auto previous = it - 1;
+		if (previous->firstBlock + previous->numBlocks == it->firstBlock) {
+			previous->numBlocks += it->numBlocks;
+			m_freeRanges.erase(it);
+		}
+	}
+}
+
+void ParticleWorld::park(std::size_t firstBlock, std::size_t numBlocks)
+{
+	const std::size_t begin = firstBlock * ParticleSystem::BlockSize;
+	const std::size_t end = (firstBlock + numBlocks) * ParticleSystem::BlockSize;
+	std::fill(m_system.stream(ParticleSystem::PX) + begin, m_system.stream(ParticleSystem::PX) + end, ParkedPosition);
+	std::fill(m_system.stream(ParticleSystem::PY) + begin, m_system.stream(ParticleSystem::PY) + end, ParkedPosition);
+	std::fill(m_system.stream(ParticleSystem::PZ) + begin, m_system.stream(ParticleSystem::PZ) + end, ParkedPosition);
+	std::fill(m_system.stream(ParticleSystem::PrevX) + begin, m_system.stream(ParticleSystem::PrevX) + end, ParkedPosition);
+	std::fill(m_system.stream(ParticleSystem::PrevY) + begin, m_system.stream(ParticleSystem::PrevY) + end, ParkedPosition);
+	std::fill(m_system.stream(ParticleSystem::PrevZ) + begin, m_system.stream(ParticleSystem::PrevZ) + end, ParkedPosition);
+	std::fill(m_system.stream(ParticleSystem::VX) + begin, m_system.stream(ParticleSystem::VX) + end, 0.0f);
+	std::fill(m_system.stream(ParticleSystem::VY) + begin, m_system.stream(ParticleSystem::VY) + end, 0.0f);
+	std::fill(m_system.stream(ParticleSystem::VZ) + begin, m_system.stream(ParticleSystem::VZ) + end, 0.0f);
+	std::fill(m_system.stream(ParticleSystem::Size) + begin, m_system.stream(ParticleSystem::Size) + end, 0.0f);
+}
+
+void ParticleWorld::updateLayout() const
+{
+	if (!m_layoutDirty) return;
+	m_layoutDirty = false;
+
+	// Emitters in the pool order: adjacent ranges can be merged
+	std::vector<EmitterId> ids;
+	for (EmitterId id = 0; id < m_emitters.size(); ++id) {
+		if (m_emitters[id].alive) ids.push_back(id);
+	}
+	std::sort(ids.begin(), ids.end(), [this](EmitterId a, EmitterId b) {
+		return m_emitters[a].firstBlock < m_emitters[b].firstBlock;
+	});
+
+	m_chunks.clear();
+	m_drawRanges.clear();
+	m_liveIndices.clear();
+	std::size_t totalBlocks = 0;
+	for (EmitterId id : ids)
+	{
+		const Emitter& e = m_emitters[id];
+		for (std::size_t b = 0; b < e.numBlocks; b += BlocksPerChunk) {
+			m_chunks.push_back({ id, uint32_t(e.firstBlock + b), uint32_t(e.firstBlock + std::min(e.numBlocks, b + BlocksPerChunk)) });
+		}
+		totalBlocks += e.numBlocks;
+
+		const uint32_t first = uint32_t(e.firstBlock * ParticleSystem::BlockSize);
+		if (!m_drawRanges.empty() && m_drawRanges.back().first + m_drawRanges.back().count == first) {
+			m_drawRanges.back().count += uint32_t(e.count);
+		}
+		else if (e.count > 0) {
+			m_drawRanges.push_back({ first, uint32_t(e.count) });
+		}
+		for (uint32_t i = 0; i < e.count; ++i) {
+			m_liveIndices.push_back(first + i);
+		}
+	}
+
+	// About ParticleSystem::BlocksPerJob blocks per task
+	m_chunksPerJob = 1;
+	if (totalBlocks > 0) {
+		m_chunksPerJob = std::max<std::size_t>(1, ParticleSystem::BlocksPerJob * m_chunks.size() / totalBlocks);
+	}
+}
+
+void ParticleWorld::step(float dt, JobSystem* jobs)
+{
+	updateLayout();
+	auto stepChunks = [&](std::size_t begin, std::size_t end) {
+		for (std::size_t c = begin; c < end; ++c) {
+			const Chunk& chunk = m_chunks[c];
+			m_system.stepBlocks(chunk.firstBlock, chunk.lastBlock, dt, m_emitters[chunk.emitter].settings);
+		}
+	};
+	if (jobs != nullptr && m_chunks.size() > m_chunksPerJob) {
+		jobs->parallelFor(0, m_chunks.size(), m_chunksPerJob, stepChunks);
+	}
+	else {
+		stepChunks(0, m_chunks.size());
+	}
+}
+
+void ParticleWorld::writeGPU(ParticleGPU* out, JobSystem* jobs) const
+{
+	updateLayout();
+	// Same chunks as the update (without the padding of the last block)
+	auto writeChunks = [&](std::size_t begin, std::size_t end) {
+		for (std::size_t c = begin; c < end; ++c) {
+			const Chunk& chunk = m_chunks[c];
+			const Emitter& e = m_emitters[chunk.emitter];
+			const std::size_t last = e.firstBlock * ParticleSystem::BlockSize + e.count;
+			m_system.writeGPU(out, chunk.firstBlock * ParticleSystem::BlockSize,
+				std::min<std::size_t>(chunk.lastBlock * ParticleSystem::BlockSize, last));
+		}
+	};
+	if (jobs != nullptr && m_chunks.size() > m_chunksPerJob) {
+		jobs->parallelFor(0, m_chunks.size(), m_chunksPerJob, writeChunks);
+	}
+	else {
+		writeChunks(0, m_chunks.size());
+	}
+}
+
+void ParticleWorld::writeGPUSorted(ParticleGPU* out, DepthSorter& sorter, const glm::vec3& eye, JobSystem* jobs)
+{
+	updateLayout();
+	sorter.sort(m_system, m_liveIndices, eye, jobs);
+	const std::vector<uint32_t>& order = sorter.order();
+	const std::size_t n = m_liveIndices.size();
+	m_order.resize(n);
+	for (std::size_t i = 0; i < n; ++i) {
+		m_order[i] = m_liveIndices[order[i]];
+	}
+
+	const std::size_t grain = ParticleSystem::BlocksPerJob * ParticleSystem::BlockSize;
+	if (jobs != nullptr && n > grain) {
+		jobs->parallelFor(0, n, grain, [&](std::size_t begin, std::size_t end) {
+			m_system.writeGPU(out, m_order.data(), begin, end);
+		});
+	}
+	else {
+		m_system.writeGPU(out, m_order.data(), 0, n);
+	}
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "ParticleSystem.h"
+#include "DepthSort.h"
+#include "JobSystem.h"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Many emitters (effects) sharing one particle pool
+//
+// The pool is a ParticleSystem of fixed capacity, allocated once: each
+// emitter owns a contiguous range of blocks, given by a free-list
+// allocator (first fit, the free ranges are merged when released).
+// Adding or removing an emitter never reallocates the pool, so the GPU
+// buffer can have the same layout: the particles of an emitter are
+// written at the same slots and each emitter is one range of a
+// multi-draw (see drawRanges()).
+//
+// The update splits the emitters in chunks of blocks and runs all the
+// chunks in one parallel loop: hundreds of small emitters cost about
+// the same as one large emitter with the same number of particles.
+//
+// The free slots are not updated, not drawn and are parked far away.
+// Code that works on the particles of the pool (e.g. ParticleInteractions)
+// takes liveIndices() instead of the whole pool.
+class ParticleWorld
+{
+public:
+	using EmitterId = uint32_t;
+	static const EmitterId InvalidEmitter = 0xFFFFFFFFu;
+
+	struct Emitter {
+		ParticleGeneratorSettings settings;
+		std::size_t count = 0;      // number of particles
+		std::size_t firstBlock = 0; // range of blocks in the pool
+		std::size_t numBlocks = 0;
+		bool alive = false;
+	};
+
+	// Particles [first, first + count) of the pool
+	struct Range {
+		uint32_t first;
+		uint32_t count;
+	};
+
+	// ------------------------------------------------------------------------
+	// allocate the pool (capacity particles) and remove all the emitters
+	void create(std::size_t capacity, uint32_t seed = 1);
+
+	// ------------------------------------------------------------------------
+	// add an emitter of "count" particles (spawned immediately)
+	// return InvalidEmitter if the pool has no free range large enough
+	EmitterId addEmitter(std::size_t count, const ParticleGeneratorSettings& settings);
+	void removeEmitter(EmitterId id);
+	void clear();
+
+	// ------------------------------------------------------------------------
+	// integrate the particles of all the emitters (respawn dead ones)
+	// jobs: split the chunks over the threads (optional)
+	void step(float dt, JobSystem* jobs = nullptr);
+
+	// ------------------------------------------------------------------------
+	// write the particles of the emitters at their slot
+	// (out has capacity() elements, the free slots are not written)
+	void writeGPU(ParticleGPU* out, JobSystem* jobs = nullptr) const;
+	// Ranges of particles to draw after writeGPU (one per group of
+	// adjacent emitters, sorted by first)
+	const std::vector<Range>& drawRanges() const { updateLayout(); return m_drawRanges; }
+
+	// ------------------------------------------------------------------------
+	// sort the particles of all the emitters from back to front and write
+	// them packed at the start of out (liveCount() particles)
+	void writeGPUSorted(ParticleGPU* out, DepthSorter& sorter, const glm::vec3& eye, JobSystem* jobs = nullptr);
+
+	// Emitters (the id is an index, the slots of removed emitters are reused)
+	const Emitter& emitter(EmitterId id) const { return m_emitters[id]; }
+	ParticleGeneratorSettings& settings(EmitterId id) { return m_emitters[id].settings; }
+	bool isAlive(EmitterId id) const { return id < m_emitters.size() && m_emitters[id].alive; }
+	std::size_t emitterSlots() const { return m_emitters.size(); }
+	std::size_t numEmitters() const { return m_emitters.size() - m_freeEmitters.size(); }
+
+	std::size_t capacity() const { return m_system.blockCount() * ParticleSystem::BlockSize; }
+	std::size_t liveCount() const { return m_liveCount; }
+	// Particles of the emitters (pool indices, sorted)
+	const std::vector<uint32_t>& liveIndices() const { updateLayout(); return m_liveIndices; }
+	// Largest emitter that can still be added (particles)
+	std::size_t largestFreeRange() const;
+
+	ParticleSystem& system() { return m_system; }
+	const ParticleSystem& system() const { return m_system; }
+
+private:
+	// Free-list allocator (in blocks)
+	bool allocate(std::size_t numBlocks, std::size_t& firstBlock);
+	void release(std::size_t firstBlock, std::size_t numBlocks);
+	void park(std::size_t firstBlock, std::size_t numBlocks);
+	// Rebuild the chunks, draw ranges and live indices if the emitters
+	// changed: once for all the changes between two frames, not per change
+	void updateLayout() const;
+
+	// Part of an emitter updated by one task
+	struct Chunk {
+		uint32_t emitter;
+		uint32_t firstBlock;
+		uint32_t lastBlock;
+	};
+
+private:
+	ParticleSystem m_system;
+	uint32_t m_seed = 1;
+	uint32_t m_spawned = 0; // Number of emitters added (seed of the next one)
+
+	std::vector<Emitter> m_emitters;
+	std::vector<EmitterId> m_freeEmitters;
+	struct FreeRange {
+		std::size_t firstBlock;
+		std::size_t numBlocks;
+	};
+	std::vector<FreeRange> m_freeRanges; // Sorted by firstBlock, never adjacent
+
+	std::size_t m_liveCount = 0;
+
+	// Layout of the emitters (rebuilt on use after a change)
+	mutable bool m_layoutDirty = true;
+	mutable std::vector<Chunk> m_chunks;
+	mutable std::size_t m_chunksPerJob = 1;
+	mutable std::vector<Range> m_drawRanges;
+	mutable std::vector<uint32_t> m_liveIndices; // Particles of the emitters (sort, interactions)
+	std::vector<uint32_t> m_order;       // Back to front order (pool indices)
+};
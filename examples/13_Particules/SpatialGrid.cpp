@@ -0,0 +1,78 @@
+#include "SpatialGrid.h"
+
+#include <algorithm>
+
+namespace {
+	// Number of particles per job
+	const std::size_t ChunkSize = 16384;
+
+	template<typename F>
+	void forEachRange(std::size_t count, JobSystem* jobs, const F& f)
+	{
+		if (jobs != nullptr && count > ChunkSize) {
+			jobs->parallelFor(0, count, ChunkSize, f);
+		}
+		else {
+			f(0, count);
+		}
+	}
+}
+
+void SpatialHashGrid::build(const float* px, const float* py, const float* pz, std::size_t count, float cellSize, JobSystem* jobs)
+{
+	m_cellSize = cellSize;
+	m_inverseCellSize = 1.0f / cellSize;
+
+	// Table: power of 2, about 2 entries per particle (few collisions)
+	std::size_t tableSize = 1024;
+	while (tableSize < 2 * count) tableSize <<= 1;
+	if (m_cellEnd.size() != tableSize) {
+		m_cellEnd = std::vector<std::atomic<uint32_t>>(tableSize);
+	}
+	m_mask = uint32_t(tableSize - 1);
+	m_cellOfParticle.resize(count);
+	m_indices.resize(count);
+	m_sortedX.resize(count);
+	m_sortedY.resize(count);
+	m_sortedZ.resize(count);
+
+	forEachRange(tableSize, jobs, [&](std::size_t begin, std::size_t end) {
+		for (std::size_t h = begin; h < end; ++h) {
+			m_cellEnd[h].store(0, std::memory_order_relaxed);
+		}
+	});
+
+	// Count
+	forEachRange(count, jobs, [&](std::size_t begin, std::size_t end) {
+		for (std::size_t i = begin; i < end; ++i) {
+			const uint32_t h = cellHash(cellCoordinate(px[i]), cellCoordinate(py[i]), cellCoordinate(pz[i]));
+			m_cellOfParticle[i] = h;
+			m_cellEnd[h].fetch_add(1, std::memory_order_relaxed);
+		}
+	});
+
+	// Exclusive prefix sum: first slot of each cell
+	uint32_t offset = 0;
+	for (std::size_t h = 0; h < tableSize; ++h) {
+		const uint32_t c = m_cellEnd[h].load(std::memory_order_relaxed);
+		m_cellEnd[h].store(offset, std::memory_order_relaxed);
+		offset += c;
+	}
+
+	// Scatter: each cell start is incremented until it reaches the cell end
+	forEachRange(count, jobs, [&](std::size_t begin, std::size_t end) {
+		for (std::size_t i = begin; i < end; ++i) {
+			m_indices[m_cellEnd[m_cellOfParticle[i]].fetch_add(1, std::memory_order_relaxed)] = uint32_t(i);
+		}
+	});
+
+	// Positions in the cell order
+	forEachRange(count, jobs, [&](std::size_t begin, std::size_t end) {
+		for (std::size_t slot = begin; slot < end; ++slot) {
+			const uint32_t i = m_indices[slot];
+			m_sortedX[slot] = px[i];
+			m_sortedY[slot] = py[i];
+			m_sortedZ[slot] = pz[i];
+		}
+	});
+}
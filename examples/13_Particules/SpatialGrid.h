@@ -0,0 +1,102 @@
+#pragma once
+
+#include "JobSystem.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Uniform grid stored in a hash table (unbounded domain, memory
+// proportional to the number of particles)
+//
+// Built each frame with a counting sort on the cell hash:
+// 1. count the particles of each cell
+// 2. exclusive prefix sum: first slot of each cell
+// 3. scatter the particle indices in their cell
+// The counts and the scatter use atomics so the particles can be split
+// over the threads of the job system (the order of the particles inside
+// a cell then depends on the threads).
+//
+// The positions are copied in the cell order: the particles of a cell
+// are contiguous in memory, the queries return slots in these arrays
+// (indices()[slot] is the index of the particle).
+//
+// Different cells can share a hash: the neighbor queries return a
+// superset of the particles, the distance must still be tested.
+class SpatialHashGrid
+{
+public:
+	// ------------------------------------------------------------------------
+	// sort the particles in the cells of size cellSize
+	// jobs: split the passes over the threads (optional)
+	void build(const float* px, const float* py, const float* pz, std::size_t count, float cellSize, JobSystem* jobs = nullptr);
+
+	// ------------------------------------------------------------------------
+	// call f(slot) for the particles of the 27 cells around (x, y, z)
+	// (all the particles closer than cellSize are visited)
+	// f returns false to stop the query
+	template<typename F>
+	void forEachNeighbor(float x, float y, float z, const F& f) const;
+
+	float cellSize() const { return m_cellSize; }
+	std::size_t tableSize() const { return m_cellEnd.size(); }
+	// Particle indices and positions sorted by cell (one per slot)
+	const std::vector<uint32_t>& indices() const { return m_indices; }
+	const float* sortedX() const { return m_sortedX.data(); }
+	const float* sortedY() const { return m_sortedY.data(); }
+	const float* sortedZ() const { return m_sortedZ.data(); }
+
+	uint32_t cellHash(int x, int y, int z) const
+	{
+		return (uint32_t(x) * 73856093u ^ uint32_t(y) * 19349663u ^ uint32_t(z) * 83492791u) & m_mask;
+	}
+
+	int cellCoordinate(float v) const { return int(std::floor(v * m_inverseCellSize)); }
+
+private:
+	float m_cellSize = 1.0f;
+	float m_inverseCellSize = 1.0f;
+	uint32_t m_mask = 0;
+	std::vector<uint32_t> m_cellOfParticle;
+	// After the build: end of each cell (cell h is [end[h - 1], end[h]))
+	std::vector<std::atomic<uint32_t>> m_cellEnd;
+	std::vector<uint32_t> m_indices;
+	std::vector<float> m_sortedX;
+	std::vector<float> m_sortedY;
+	std::vector<float> m_sortedZ;
+};
+
+template<typename F>
+void SpatialHashGrid::forEachNeighbor(float x, float y, float z, const F& f) const
+{
+	if (m_indices.empty()) return;
+	const int cx = cellCoordinate(x);
+	const int cy = cellCoordinate(y);
+	const int cz = cellCoordinate(z);
+
+	// Two of the 27 cells can share a hash: visit each hash once
+	uint32_t visited[27];
+	int numVisited = 0;
+	for (int dz = -1; dz <= 1; ++dz) {
+		for (int dy = -1; dy <= 1; ++dy) {
+			for (int dx = -1; dx <= 1; ++dx)
+			{
+				const uint32_t h = cellHash(cx + dx, cy + dy, cz + dz);
+				bool seen = false;
+				for (int v = 0; v < numVisited; ++v) {
+					seen |= visited[v] == h;
+				}
+				if (seen) continue;
+				visited[numVisited++] = h;
+
+				const uint32_t begin = h > 0 ? m_cellEnd[h - 1].load(std::memory_order_relaxed) : 0u;
+				const uint32_t end = m_cellEnd[h].load(std::memory_order_relaxed);
+				for (uint32_t slot = begin; slot < end; ++slot) {
+					if (!f(slot)) return;
+				}
+			}
+		}
+	}
+}
@@ -6,14 +6,14 @@ out vec4 color;
 
 uniform float globalTransparency;
 
-uniform sampler2D texture;
+uniform sampler2D particleTexture;
 uniform bool useTexture;
 uniform float time; // Temps de la simulation
 
 void main(void){
     vec4 outputColor = vec4(ex_color, globalTransparency);
     if(useTexture) {
-        outputColor = texture2D(texture, ex_TexCoor);
+        outputColor = texture(particleTexture, ex_TexCoor);
         
         // Play around with the values to change color of particles over time
         // https://github.com/StanEpp/OpenGL_ParticleSystem
@@ -0,0 +1,36 @@
+#version 430
+
+// Instanced quads: one instance per particle, 4 vertices (triangle strip)
+// Same billboard as particules.geo without the geometry shader
+
+// Per particle attributes (divisor 1)
+layout(location=0) in vec4 pPos;
+layout(location=1) in float pSize;
+layout(location=2) in vec3 pColor;
+
+uniform float globalSize;
+uniform mat4  viewMatrix;
+uniform mat4  projMatrix;
+
+out vec2 ex_TexCoor;
+out vec3 ex_color;
+
+void main(void){
+    // Corner of the quad: (0,0), (1,0), (0,1), (1,1)
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    float quadLength = pSize * globalSize;
+
+    // Same computation as particules.geo
+    vec4 normal = normalize(viewMatrix * pPos);
+    vec3 rightAxis  = cross(normal.xyz, vec3(0,1,0));
+    vec3 upAxis   = cross(rightAxis, normal.xyz);
+    vec4 rightVector  = projMatrix * vec4(rightAxis.xyz, 1.0f) * (quadLength*0.5f);
+    vec4 upVector     = projMatrix * vec4(upAxis.xyz, 1.0f) * (quadLength*0.5f);
+    vec4 particlePos  = projMatrix * viewMatrix * pPos;
+
+    vec2 side = corner * 2.0 - 1.0;
+    gl_Position = particlePos + side.x * rightVector + side.y * upVector;
+    gl_Position.xy += corner * 0.5 * quadLength;
+    ex_TexCoor = corner;
+    ex_color = pColor;
+}
@@ -0,0 +1,46 @@
+#version 430
+
+// Vertex pulling: no vertex attributes, 6 vertices (2 triangles) per
+// particle read from the particle buffer with gl_VertexID
+// Same billboard as particules.geo without the geometry shader
+
+// ParticleGPU (7 floats: position, size, color), a struct would be
+// padded to 32 bytes by std430
+layout(std430, binding = 0) readonly buffer Particles {
+    float data[];
+};
+
+uniform float globalSize;
+uniform mat4  viewMatrix;
+uniform mat4  projMatrix;
+
+out vec2 ex_TexCoor;
+out vec3 ex_color;
+
+// Corners of the two triangles: (0,0), (1,0), (0,1) and (0,1), (1,0), (1,1)
+const int corners[6] = int[6](0, 1, 2, 2, 1, 3);
+
+void main(void){
+    int particle = gl_VertexID / 6;
+    int c = corners[gl_VertexID % 6];
+    vec2 corner = vec2(c & 1, c >> 1);
+
+    int base = particle * 7;
+    vec4 pPos = vec4(data[base], data[base + 1], data[base + 2], 1.0);
+    float quadLength = data[base + 3] * globalSize;
+    vec3 pColor = vec3(data[base + 4], data[base + 5], data[base + 6]);
+
+    // Same computation as particules.geo
+    vec4 normal = normalize(viewMatrix * pPos);
+    vec3 rightAxis  = cross(normal.xyz, vec3(0,1,0));
+    vec3 upAxis   = cross(rightAxis, normal.xyz);
+    vec4 rightVector  = projMatrix * vec4(rightAxis.xyz, 1.0f) * (quadLength*0.5f);
+    vec4 upVector     = projMatrix * vec4(upAxis.xyz, 1.0f) * (quadLength*0.5f);
+    vec4 particlePos  = projMatrix * viewMatrix * pPos;
+
+    vec2 side = corner * 2.0 - 1.0;
+    gl_Position = particlePos + side.x * rightVector + side.y * upVector;
+    gl_Position.xy += corner * 0.5 * quadLength;
+    ex_TexCoor = corner;
+    ex_color = pColor;
+}
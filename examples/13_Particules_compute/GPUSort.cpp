@@ -0,0 +1,173 @@
+#include "GPUSort.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+	const GLuint GroupSize = 256; // local_size_x of the sort shaders
+	const GLuint RadixBits = 4;
+	const GLuint RadixSize = 1 << RadixBits;
+	const GLuint NumRadixPasses = 32 / RadixBits;
+
+	// SSBO bindings (see the .comp files)
+	const GLuint PairsBinding = 2;
+	const GLuint SortedBinding = 3;
+	const GLuint HistogramBinding = 4;
+
+	GLuint numGroups(GLuint count)
+	{
+		return (count + GroupSize - 1) / GroupSize;
+	}
+
+	unsigned int nextPowerOfTwo(unsigned int v)
+	{
+		unsigned int p = 1;
+		while (p < v) p <<= 1;
+		return p;
+	}
+}
+
+GPUSorter::~GPUSorter()
+{
+	release();
+}
+
+bool GPUSorter::loadProgram(Program& program, const std::string& path, const std::vector<const char*>& uniforms)
+{
+	bool success = true;
+	program.shader = std::make_unique<ShaderProgram>();
+	success &= program.shader->addShaderFromSource(GL_COMPUTE_SHADER, path);
+	success &= program.shader->link();
+	if (!success) {
+		std::cerr << "Error when loading sort shader: " << path << "\n";
+		return false;
+	}
+	program.uniforms.clear();
+	for (const char* name : uniforms) {
+		const GLint location = program.shader->uniformLocation(name);
+		if (location == -1) {
+			std::cerr << "Error when loading sort shader uniform: " << name << " (" << path << ")\n";
+			return false;
+		}
+		program.uniforms.push_back(location);
+	}
+	return true;
+}
+
+bool GPUSorter::initialize(const std::string& directory)
+{
+	bool success = true;
+	success &= loadProgram(m_keys, directory + "sort_keys.comp", { "eyePos", "count", "paddedCount" });
+	success &= loadProgram(m_bitonic, directory + "sort_bitonic.comp", { "k", "j", "paddedCount" });
+	success &= loadProgram(m_histogram, directory + "radix_histogram.comp", { "count", "shift" });
+	success &= loadProgram(m_scan, directory + "radix_scan.comp", { "size" });
+	success &= loadProgram(m_scatter, directory + "radix_scatter.comp", { "count", "shift" });
+	if (!success) return false;
+
+	m_timer.create();
+	return true;
+}
+
+void GPUSorter::release()
+{
+	if (m_pairs[0] != 0) {
+		glDeleteBuffers(2, m_pairs);
+		glDeleteBuffers(1, &m_histogramBuffer);
+		m_pairs[0] = m_pairs[1] = 0;
+		m_histogramBuffer = 0;
+	}
+	m_timer.release();
+}
+
+void GPUSorter::resize(unsigned int count)
+{
+	if (m_pairs[0] != 0) {
+		glDeleteBuffers(2, m_pairs);
+		glDeleteBuffers(1, &m_histogramBuffer);
+	}
+	m_count = count;
+	m_paddedCount = nextPowerOfTwo(std::max(count, 1u));
+
+	// Pairs: padded for the bitonic sort (uvec2 per pair)
+	glCreateBuffers(2, m_pairs);
+	glNamedBufferStorage(m_pairs[0], m_paddedCount * sizeof(glm::uvec2), nullptr, 0);
+	glNamedBufferStorage(m_pairs[1], m_paddedCount * sizeof(glm::uvec2), nullptr, 0);
+	// Histogram: one counter per digit and workgroup
+	glCreateBuffers(1, &m_histogramBuffer);
+	glNamedBufferStorage(m_histogramBuffer, std::max(numGroups(count), 1u) * RadixSize * sizeof(GLuint), nullptr, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PairsBinding, m_pairs[0]);
+}
+
+void GPUSorter::sort(const glm::vec3& eyePos)
+{
+	if (m_count == 0) return;
+	m_timer.beginFrame();
+
+	// Keys (and padding for the bitonic sort)
+	const bool bitonic = usesBitonic();
+	const GLuint keysCount = bitonic ? m_paddedCount : m_count;
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PairsBinding, m_pairs[0]);
+	m_timer.mark("keys");
+	m_keys.shader->bind();
+	m_keys.shader->setVec3(m_keys.uniforms[0], eyePos);
+	glProgramUniform1ui(m_keys.shader->programId(), m_keys.uniforms[1], m_count);
+	glProgramUniform1ui(m_keys.shader->programId(), m_keys.uniforms[2], keysCount);
+	glDispatchCompute(numGroups(keysCount), 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	if (bitonic) sortBitonic();
+	else sortRadix();
+
+	// The draw reads the sorted pairs
+	m_timer.endFrame();
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PairsBinding, m_pairs[0]);
+}
+
+void GPUSorter::sortBitonic()
+{
+	m_timer.mark("bitonic");
+	const GLuint program = m_bitonic.shader->programId();
+	m_bitonic.shader->bind();
+	glProgramUniform1ui(program, m_bitonic.uniforms[2], m_paddedCount);
+	for (GLuint k = 2; k <= m_paddedCount; k <<= 1) {
+		for (GLuint j = k >> 1; j > 0; j >>= 1) {
+			glProgramUniform1ui(program, m_bitonic.uniforms[0], k);
+			glProgramUniform1ui(program, m_bitonic.uniforms[1], j);
+			glDispatchCompute(numGroups(m_paddedCount), 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		}
+	}
+}
+
+void GPUSorter::sortRadix()
+{
+	const GLuint groups = numGroups(m_count);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, HistogramBinding, m_histogramBuffer);
+	glProgramUniform1ui(m_histogram.shader->programId(), m_histogram.uniforms[0], m_count);
+	glProgramUniform1ui(m_scan.shader->programId(), m_scan.uniforms[0], groups * RadixSize);
+	glProgramUniform1ui(m_scatter.shader->programId(), m_scatter.uniforms[0], m_count);
+
+	for (GLuint pass = 0; pass < NumRadixPasses; ++pass)
+	{
+		m_timer.mark("radix " + std::to_string(pass));
+		const GLuint shift = pass * RadixBits;
+		// Input: binding 2, output: binding 3
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PairsBinding, m_pairs[pass % 2]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SortedBinding, m_pairs[(pass + 1) % 2]);
+
+		m_histogram.shader->bind();
+		glProgramUniform1ui(m_histogram.shader->programId(), m_histogram.uniforms[1], shift);
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		m_scan.shader->bind();
+		glDispatchCompute(1, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		m_scatter.shader->bind();
+		glProgramUniform1ui(m_scatter.shader->programId(), m_scatter.uniforms[1], shift);
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+	// Even number of passes: the result is in m_pairs[0]
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "FrameTimer.h"
+#include "ShaderProgram.h"
+
+// Back to front sorting of the particles on the GPU (compute shaders)
+//
+// A (depth key, index) pair is computed for each particle (sort_keys.comp)
+// then sorted:
+// - bitonic sort for small counts (log2(n)^2 / 2 dispatches)
+// - radix sort for large counts (8 passes of 4 bits, each pass is
+//   histogram + scan + scatter)
+// The sorted pairs are bound to the SSBO binding 2, the vertex shader
+// reads the index of the particle to draw from it.
+//
+// The time of each pass is measured with timer queries (FrameTimer),
+// read a few frames later to avoid waiting on the GPU.
+class GPUSorter
+{
+public:
+	GPUSorter() = default;
+	~GPUSorter();
+
+	// ------------------------------------------------------------------------
+	// load the compute shaders (directory with the .comp files)
+	// return true if sucessfull
+	bool initialize(const std::string& directory);
+
+	// ------------------------------------------------------------------------
+	// allocate the pairs for a pool of "count" particles
+	void resize(unsigned int count);
+
+	// ------------------------------------------------------------------------
+	// sort the alive particles (SSBO binding 0, alive list and counters
+	// at the bindings 5 and 7) from the farthest to the closest to eyePos.
+	// The result is bound to the SSBO binding 2.
+	void sort(const glm::vec3& eyePos);
+
+	void release();
+
+	// Bitonic sort is used up to this number of particles
+	void setBitonicThreshold(unsigned int threshold) { m_bitonicThreshold = threshold; }
+	unsigned int bitonicThreshold() const { return m_bitonicThreshold; }
+	bool usesBitonic() const { return m_count <= m_bitonicThreshold; }
+
+	// Time of the passes of the last measured sort (Timing::gpu)
+	const std::vector<FrameTimer::Timing>& timings() const { return m_timer.timings(); }
+
+private:
+	struct Program {
+		std::unique_ptr<ShaderProgram> shader;
+		std::vector<GLint> uniforms;
+	};
+	bool loadProgram(Program& program, const std::string& path, const std::vector<const char*>& uniforms);
+
+	void sortBitonic();
+	void sortRadix();
+
+private:
+	Program m_keys;     // eyePos, count, paddedCount
+	Program m_bitonic;  // k, j, paddedCount
+	Program m_histogram; // count, shift
+	Program m_scan;     // size
+	Program m_scatter;  // count, shift
+
+	unsigned int m_count = 0;
+	unsigned int m_paddedCount = 0; // Power of 2 (bitonic)
+	unsigned int m_bitonicThreshold = 1 << 16;
+	GLuint m_pairs[2] = { 0, 0 }; // Ping-pong for the radix sort
+	GLuint m_histogramBuffer = 0;
+
+	FrameTimer m_timer; // One frame per sort
+};
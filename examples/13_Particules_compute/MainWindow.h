@@ -10,14 +10,10 @@
 
 #include "ShaderProgram.h"
 #include "Camera.h"
+#include "GPUSort.h"
+#include "TextureLoader.h"
 
-inline float random(float min, float max)
-{
-	return (max - min) * ((float)rand() / (float)RAND_MAX) + min;
-}
-
-
-// A simple particle object.
+// A simple particle object (same layout as in the shaders)
 struct Particle
 {
 	// Attributes
@@ -29,6 +25,7 @@ struct Particle
 	float padd = 0.0f;			  // padding
 };
 
+// Uploaded as an uniform buffer (std140, binding 0) used by particules_emit.comp
 struct ParticleGeneratorSettings {
 	float size = 0.4f;
 	float velocityMin = 5.0f;
@@ -43,24 +40,38 @@ struct ParticleGeneratorSettings {
 		lifeMin = std::max(lifeMin, 0.0f);
 		lifeMax = std::max(lifeMax, lifeMin);
 	}
+};
 
-	Particle createNewParticle()
-	{
-		Particle p;
-		p.p = glm::vec3(0, 0, 0);
-		const float vx = random(-size, size);
-		const float vz = random(-size, size);
-		p.v = glm::vec3(vx, random(velocityMin, velocityMax), vz);
-		p.life = random(lifeMin, lifeMax);
-		const float r = random(0.5, 1.0);
-		const float g = random(0.0, 0.5);
-		const float b = random(0.0, 0.5);
-		p.c = glm::vec3(r, g, b);
-		p.size = random(0.1f, 0.25f);
-		return p;
-	}
-
+// Counters of the particle pool (SSBO binding 7, see particules_prepare.comp)
+// also used as the indirect dispatch and draw arguments
+struct ParticleCounters {
+	GLuint deadCount;
+	GLuint aliveCount;     // alive at the beginning of the simulation
+	GLuint aliveCountNext; // alive after the simulation
+	GLuint emitCount;
+	GLuint emitGroups[3];     // glDispatchComputeIndirect
+	GLuint simulateGroups[3]; // glDispatchComputeIndirect
+	GLuint drawCount;         // glDrawArraysIndirect
+	GLuint drawInstanceCount;
+	GLuint drawFirst;
+	GLuint drawBaseInstance;
+};
 
+// Particle interactions (std140, binding 1, see grid_count.comp)
+// Same parameters as InteractionSettings in 13_Particules
+struct InteractionSettingsGPU {
+	glm::vec4 sphere = glm::vec4(0.0f, 1.5f, 0.0f, 0.3f); // center, radius (collision proxy)
+	float radius = 0.05f; // interaction distance (grid cell size)
+	float separation = 20.0f;
+	float restDensity = 4.0f;
+	float stiffness = 2.0f;
+	float maxAcceleration = 200.0f;
+	float floorHeight = -1.0f;
+	float restitution = 0.4f;
+	GLuint tableMask = 0; // hash table size - 1 (set by the application)
+	GLint useDensity = 1;
+	GLint useFloor = 1;
+	GLint maxNeighbors = 64; // neighbors tested per particle
 };
 
 class MainWindow
@@ -83,11 +94,13 @@ private:
 	// Intiialize OpenGL objects (shaders, ...)
 	int InitializeGL();
 	void initializeParticles();
+	void updateSettings();
 
 	// Rendering scene (OpenGL)
 	void RenderScene(float t);
 	void RenderImgui();
 	void Step(float t);
+	void Interact(float dt);
 
 	glm::mat4 transform(float v) const;
 
@@ -105,31 +118,66 @@ private:
 	float m_time = 0.0;
 	
 	// Texture
-	GLuint m_textureID;
+	TextureLoader m_textureLoader;
+	GLuint m_textureID = 0;
 
-	// Storage buffer
+	// Storage buffers
+	// The particles live in a pool: the free slots are in the dead list,
+	// the used ones in the alive list (two lists swapped each frame)
 	enum VAO_IDs { Particules, NumVAOs };
 	GLuint m_VAOs[NumVAOs];
-	GLuint m_particleBuffer;
-	GLuint m_spawnBuffer;
-	bool m_particleBufferCreated = true;
-
-	// Compute shader
+	GLuint m_particleBuffer = 0;
+	GLuint m_deadListBuffer = 0;
+	GLuint m_aliveListBuffers[2] = { 0, 0 };
+	GLuint m_countersBuffer = 0;
+	GLuint m_settingsBuffer = 0;
+	int m_currentAliveList = 0;
+
+	// Compute shaders (prepare, emit, simulate, finalize)
+	std::unique_ptr<ShaderProgram> m_prepareShader = nullptr;
+	std::unique_ptr<ShaderProgram> m_emitShader = nullptr;
 	std::unique_ptr<ShaderProgram> m_computeShader = nullptr;
+	std::unique_ptr<ShaderProgram> m_finalizeShader = nullptr;
 	struct {
 		GLint dt;
 		GLint gravity;
+		GLint requestedEmitCount;
+		GLint seed;
+		GLint frame;
 	} m_computeUniforms;
 	
+	// Spatial hash grid and interactions (see grid_count.comp)
+	bool m_useInteractions = false;
+	InteractionSettingsGPU m_interaction;
+	GLuint m_gridTableSize = 0;
+	GLuint m_gridCellsBuffer = 0;     // end of each cell
+	GLuint m_gridParticlesBuffer = 0; // particle indices sorted by cell
+	GLuint m_densityBuffer = 0;
+	GLuint m_interactionBuffer = 0;   // uniform buffer (InteractionSettingsGPU)
+	std::unique_ptr<ShaderProgram> m_gridCountShader = nullptr;
+	std::unique_ptr<ShaderProgram> m_gridScanShader = nullptr;
+	std::unique_ptr<ShaderProgram> m_gridScatterShader = nullptr;
+	std::unique_ptr<ShaderProgram> m_densityShader = nullptr;
+	std::unique_ptr<ShaderProgram> m_interactShader = nullptr;
+	std::unique_ptr<ShaderProgram> m_collideShader = nullptr;
+	struct {
+		GLint scanSize;
+		GLint dt;
+	} m_gridUniforms;
+
 	// Particules
 	ParticleGeneratorSettings m_settings;
-	std::vector<Particle> m_particles;
 	bool m_useAdditiveBlending = true;
-	int m_numberParticles = 3000;
+	int m_numberParticles = 3000; // Size of the pool
+	float m_emissionRate = 6000.0f; // Particles per second
+	float m_emissionAccumulator = 0.0f;
+	unsigned int m_frame = 0;
 	float m_speed = 1.0f;
 	float m_size = 0.05f;
 	float m_transparency = 1.0f;
 	bool m_useTexture = false;
+	bool m_sorting = true;
+	GPUSorter m_sorter;
 
 	// Shader
 	std::unique_ptr<ShaderProgram> m_mainShader = nullptr;
@@ -141,5 +189,6 @@ private:
 		GLint texture;
 		GLint useTexture;
 		GLint time;
+		GLint useSorting;
 	} m_mainUniforms;
 };
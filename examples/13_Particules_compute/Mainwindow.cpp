@@ -7,10 +7,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <algorithm>
-
-// For images
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
+#include <cstddef>
 
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
@@ -119,28 +116,68 @@ int MainWindow::InitializeGL()
 	m_mainUniforms.texture = m_mainShader->uniformLocation("texture");
 	m_mainUniforms.useTexture = m_mainShader->uniformLocation("useTexture");
 	m_mainUniforms.time = m_mainShader->uniformLocation("time");	
-	if(m_mainUniforms.projMatrix == -1 || m_mainUniforms.viewMatrix == -1 || m_mainUniforms.globalSize == -1 || m_mainUniforms.globalTransparency == -1 || m_mainUniforms.texture == -1 || m_mainUniforms.useTexture == -1 || m_mainUniforms.time == -1) {
+	m_mainUniforms.useSorting = m_mainShader->uniformLocation("useSorting");
+	if(m_mainUniforms.projMatrix == -1 || m_mainUniforms.viewMatrix == -1 || m_mainUniforms.globalSize == -1 || m_mainUniforms.globalTransparency == -1 || m_mainUniforms.texture == -1 || m_mainUniforms.useTexture == -1 || m_mainUniforms.time == -1 || m_mainUniforms.useSorting == -1) {
 		std::cerr << "Error when loading main shader uniforms\n";
 		return 5;
 	}
 
-	// Create compute 
+	// Create compute shaders (particle pipeline)
+	auto loadCompute = [&](std::unique_ptr<ShaderProgram>& shader, const std::string& file) {
+		shader = std::make_unique<ShaderProgram>();
+		bool success = shader->addShaderFromSource(GL_COMPUTE_SHADER, directory + file);
+		success &= shader->link();
+		if (!success) {
+			std::cerr << "Error when loading compute shader: " << file << "\n";
+		}
+		return success;
+	};
 	bool computeShaderSuccess = true;
-	m_computeShader = std::make_unique<ShaderProgram>();
-	computeShaderSuccess &= m_computeShader->addShaderFromSource(GL_COMPUTE_SHADER, directory + "particules.comp");
-	computeShaderSuccess &= m_computeShader->link();
+	computeShaderSuccess &= loadCompute(m_prepareShader, "particules_prepare.comp");
+	computeShaderSuccess &= loadCompute(m_emitShader, "particules_emit.comp");
+	computeShaderSuccess &= loadCompute(m_computeShader, "particules.comp");
+	computeShaderSuccess &= loadCompute(m_finalizeShader, "particules_finalize.comp");
 	if (!computeShaderSuccess) {
-		std::cerr << "Error when loading compute shader\n";
 		return 6;
 	}
 	m_computeUniforms.dt = m_computeShader->uniformLocation("dt");
 	m_computeUniforms.gravity = m_computeShader->uniformLocation("gravity");
-	if(m_computeUniforms.dt == -1 || m_computeUniforms.gravity == -1) {
+	m_computeUniforms.requestedEmitCount = m_prepareShader->uniformLocation("requestedEmitCount");
+	m_computeUniforms.seed = m_emitShader->uniformLocation("seed");
+	m_computeUniforms.frame = m_emitShader->uniformLocation("frame");
+	if(m_computeUniforms.dt == -1 || m_computeUniforms.gravity == -1 || m_computeUniforms.requestedEmitCount == -1 || m_computeUniforms.seed == -1 || m_computeUniforms.frame == -1) {
 		std::cerr << "Error when loading compute shader uniforms\n";
-		std::cerr << "dt: " << m_computeUniforms.dt << " gravity: " << m_computeUniforms.gravity << std::endl;
+		std::cerr << "dt: " << m_computeUniforms.dt << " gravity: " << m_computeUniforms.gravity
+			<< " requestedEmitCount: " << m_computeUniforms.requestedEmitCount << " seed: " << m_computeUniforms.seed
+			<< " frame: " << m_computeUniforms.frame << std::endl;
 		return 7;
 	}
+	glProgramUniform1ui(m_emitShader->programId(), m_computeUniforms.seed, 1);
+
+	// Spatial hash grid and interactions
+	// the prefix sum of the cells is the one of the radix sort (binding 4)
+	bool gridShaderSuccess = true;
+	gridShaderSuccess &= loadCompute(m_gridCountShader, "grid_count.comp");
+	gridShaderSuccess &= loadCompute(m_gridScanShader, "radix_scan.comp");
+	gridShaderSuccess &= loadCompute(m_gridScatterShader, "grid_scatter.comp");
+	gridShaderSuccess &= loadCompute(m_densityShader, "grid_density.comp");
+	gridShaderSuccess &= loadCompute(m_interactShader, "particules_interact.comp");
+	gridShaderSuccess &= loadCompute(m_collideShader, "particules_collide.comp");
+	if (!gridShaderSuccess) {
+		return 9;
+	}
+	m_gridUniforms.scanSize = m_gridScanShader->uniformLocation("size");
+	m_gridUniforms.dt = m_interactShader->uniformLocation("dt");
+	if (m_gridUniforms.scanSize == -1 || m_gridUniforms.dt == -1) {
+		std::cerr << "Error when loading grid shader uniforms\n";
+		return 10;
+	}
 
+	// Sorting (compute shaders)
+	if (!m_sorter.initialize(directory)) {
+		std::cerr << "Error when loading sort shaders\n";
+		return 8;
+	}
 
 	// Create the VAO
 	glCreateVertexArrays(1, m_VAOs);
@@ -149,40 +186,11 @@ int MainWindow::InitializeGL()
 	// Initialise and create the buffers
 	initializeParticles();
 
-	glGenTextures(1, &m_textureID);
-
-	// Ask the library to flip the image vertically
-	// This is necessary as TexImage2D assume "The first element corresponds to the lower left corner of the texture image"
-	// whereas stb_image load the image such "the first pixel pointed to is top-left-most in the image"
-	stbi_set_flip_vertically_on_load(true);
-
-	int width, height, nrComponents;
-	std::string img_path = directory + "Particle.png";
-	unsigned char* data = stbi_load(img_path.c_str(), &width, &height, &nrComponents, STBI_rgb_alpha);
-	if (data)
-	{
-		for (int i = 0; i < width * height; i++) {
-			std::cout << (int)data[i] << " ";
-		}
-		glBindTexture(GL_TEXTURE_2D, m_textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-	
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-
-		std::cout << "Texture loaded at path: " << img_path << std::endl;
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << img_path << std::endl;
-		stbi_image_free(data);
-		return false;
-	}
+	// Decoded in background: the texture is white until uploaded (RenderLoop)
+	TextureLoader::Settings settings;
+	settings.wrap = GL_CLAMP_TO_BORDER;
+	settings.placeholder = glm::u8vec4(255);
+	m_textureID = m_textureLoader.load(directory + "Particle.png", settings);
 
 	// Setup projection matrix (a bit hacky)
 	FramebufferSizeCallback(m_windowWidth, m_windowHeight);
@@ -193,24 +201,176 @@ int MainWindow::InitializeGL()
 void MainWindow::initializeParticles()
 {
 	std::cout << "Initialize the particules ... " << m_numberParticles << "\n";
-	m_particles.resize(m_numberParticles);
-	for (int i = 0; i < m_numberParticles; ++i)
-	{
-		m_particles[i] = m_settings.createNewParticle();
-	}
+	const GLuint count = GLuint(m_numberParticles);
 
-	if(m_particleBufferCreated) {
+	if (m_particleBuffer != 0) {
 		glDeleteBuffers(1, &m_particleBuffer);
-		glDeleteBuffers(1, &m_spawnBuffer);
+		glDeleteBuffers(1, &m_deadListBuffer);
+		glDeleteBuffers(2, m_aliveListBuffers);
+		glDeleteBuffers(1, &m_countersBuffer);
+		glDeleteBuffers(1, &m_gridCellsBuffer);
+		glDeleteBuffers(1, &m_gridParticlesBuffer);
+		glDeleteBuffers(1, &m_densityBuffer);
 	}
+	// Avoid empty buffers (count can be 0)
+	const GLsizeiptr poolSize = std::max(count, 1u);
+
+	// Particles: only written by the emit pass
 	glCreateBuffers(1, &m_particleBuffer);
-	glCreateBuffers(1, &m_spawnBuffer);
-	std::cout << " - Create buffer of size: " << m_numberParticles * sizeof(Particle) << "\n";
-	glNamedBufferStorage(m_particleBuffer, m_numberParticles * sizeof(Particle), (const void*)m_particles.data(), GL_DYNAMIC_STORAGE_BIT);
-	glNamedBufferStorage(m_spawnBuffer, m_numberParticles * sizeof(Particle), (const void*)m_particles.data(), GL_DYNAMIC_STORAGE_BIT);
+	std::cout << " - Create buffer of size: " << poolSize * sizeof(Particle) << "\n";
+	glNamedBufferStorage(m_particleBuffer, poolSize * sizeof(Particle), nullptr, 0);
+
+	// All the particles are dead at the beginning
+	std::vector<GLuint> deadList(poolSize);
+	for (GLuint i = 0; i < count; ++i) {
+		deadList[i] = i;
+	}
+	glCreateBuffers(1, &m_deadListBuffer);
+	glNamedBufferStorage(m_deadListBuffer, poolSize * sizeof(GLuint), deadList.data(), 0);
+	glCreateBuffers(2, m_aliveListBuffers);
+	glNamedBufferStorage(m_aliveListBuffers[0], poolSize * sizeof(GLuint), nullptr, 0);
+	glNamedBufferStorage(m_aliveListBuffers[1], poolSize * sizeof(GLuint), nullptr, 0);
+	m_currentAliveList = 0;
+
+	ParticleCounters counters = {};
+	counters.deadCount = count;
+	counters.emitGroups[1] = counters.emitGroups[2] = 1;
+	counters.simulateGroups[1] = counters.simulateGroups[2] = 1;
+	counters.drawInstanceCount = 1;
+	glCreateBuffers(1, &m_countersBuffer);
+	glNamedBufferStorage(m_countersBuffer, sizeof(ParticleCounters), &counters, 0);
+
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_particleBuffer);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_spawnBuffer);
-	m_particleBufferCreated = true;
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_deadListBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_aliveListBuffers[0]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, m_aliveListBuffers[1]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, m_countersBuffer);
+	// Spatial hash grid: power of 2, about 2 cells per particle
+	m_gridTableSize = 1024;
+	while (m_gridTableSize < 2 * count) m_gridTableSize <<= 1;
+	m_interaction.tableMask = m_gridTableSize - 1;
+	glCreateBuffers(1, &m_gridCellsBuffer);
+	glNamedBufferStorage(m_gridCellsBuffer, m_gridTableSize * sizeof(GLuint), nullptr, 0);
+	glCreateBuffers(1, &m_gridParticlesBuffer);
+	glNamedBufferStorage(m_gridParticlesBuffer, poolSize * sizeof(GLuint), nullptr, 0);
+	glCreateBuffers(1, &m_densityBuffer);
+	glNamedBufferStorage(m_densityBuffer, poolSize * sizeof(float), nullptr, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, m_gridCellsBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, m_gridParticlesBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, m_densityBuffer);
+
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_countersBuffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_countersBuffer);
+	m_emissionAccumulator = 0.0f;
+
+	// Pairs used to sort the particles
+	m_sorter.resize(count);
+
+	// Generator and interaction settings (size of the hash table)
+	updateSettings();
+}
+
+void MainWindow::updateSettings()
+{
+	// Only the settings are uploaded (the particles stay on the GPU)
+	if (m_settingsBuffer == 0) {
+		glCreateBuffers(1, &m_settingsBuffer);
+		glNamedBufferStorage(m_settingsBuffer, sizeof(ParticleGeneratorSettings), &m_settings, GL_DYNAMIC_STORAGE_BIT);
+	}
+	else {
+		glNamedBufferSubData(m_settingsBuffer, 0, sizeof(ParticleGeneratorSettings), &m_settings);
+	}
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, m_settingsBuffer);
+
+	if (m_interactionBuffer == 0) {
+		glCreateBuffers(1, &m_interactionBuffer);
+		glNamedBufferStorage(m_interactionBuffer, sizeof(InteractionSettingsGPU), &m_interaction, GL_DYNAMIC_STORAGE_BIT);
+	}
+	else {
+		glNamedBufferSubData(m_interactionBuffer, 0, sizeof(InteractionSettingsGPU), &m_interaction);
+	}
+	glBindBufferBase(GL_UNIFORM_BUFFER, 1, m_interactionBuffer);
+}
+
+void MainWindow::Interact(float dt)
+{
+	// The alive particles are in the current alive list (binding 5),
+	// simulateGroups is an upper bound of their number of groups
+	const GLintptr groups = offsetof(ParticleCounters, simulateGroups);
+
+	// Build the grid: count, prefix sum, scatter
+	const GLuint zero = 0;
+	glClearNamedBufferData(m_gridCellsBuffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	m_gridCountShader->bind();
+	glDispatchComputeIndirect(groups);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_gridCellsBuffer);
+	m_gridScanShader->bind();
+	glProgramUniform1ui(m_gridScanShader->programId(), m_gridUniforms.scanSize, m_gridTableSize);
+	glDispatchCompute(1, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	m_gridScatterShader->bind();
+	glDispatchComputeIndirect(groups);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	// Density, then separation and pressure, then collisions
+	m_densityShader->bind();
+	glDispatchComputeIndirect(groups);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	m_interactShader->bind();
+	m_interactShader->setFloat(m_gridUniforms.dt, dt);
+	glDispatchComputeIndirect(groups);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	m_collideShader->bind();
+	glDispatchComputeIndirect(groups);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void MainWindow::Step(float dt)
+{
+	// Number of particles to emit (the fractional part is kept for the next frame)
+	m_emissionAccumulator += m_emissionRate * dt;
+	const GLuint requested = GLuint(std::min(m_emissionAccumulator, float(m_numberParticles)));
+	m_emissionAccumulator = std::min(m_emissionAccumulator - float(requested), 1.0f);
+
+	// Prepare: clamp the emission to the free slots, indirect arguments
+	m_prepareShader->bind();
+	glProgramUniform1ui(m_prepareShader->programId(), m_computeUniforms.requestedEmitCount, requested);
+	glDispatchCompute(1, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+	// Emit: dead list -> current alive list
+	m_emitShader->bind();
+	glProgramUniform1ui(m_emitShader->programId(), m_computeUniforms.frame, m_frame++);
+	glDispatchComputeIndirect(offsetof(ParticleCounters, emitGroups));
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	// Simulate: current alive list -> next alive list (or dead list)
+	const glm::vec3 gravity(0, -9.8, 0); // acceleration due to gravity
+	m_computeShader->bind();
+	m_computeShader->setFloat(m_computeUniforms.dt, dt);
+	m_computeShader->setVec3(m_computeUniforms.gravity, gravity);
+	glDispatchComputeIndirect(offsetof(ParticleCounters, simulateGroups));
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	// Finalize: alive count for the draw
+	m_finalizeShader->bind();
+	glDispatchCompute(1, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+	// The next alive list becomes the current one (binding 5)
+	m_currentAliveList = 1 - m_currentAliveList;
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_aliveListBuffers[m_currentAliveList]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, m_aliveListBuffers[1 - m_currentAliveList]);
+
+	if (m_useInteractions) {
+		Interact(dt);
+	}
 }
 
 void MainWindow::RenderImgui()
@@ -232,10 +392,19 @@ void MainWindow::RenderImgui()
 			m_numberParticles = std::max(0, m_numberParticles);
 			initializeParticles();
 		}
+		ImGui::InputFloat("Emission rate (/s)", &m_emissionRate);
+		m_emissionRate = std::max(0.f, m_emissionRate);
 		ImGui::InputFloat("Speed", &m_speed);
 		ImGui::InputFloat("Global Size", &m_size);
 		ImGui::InputFloat("Transparency", &m_transparency);
 		ImGui::Checkbox("Use Texture?", &m_useTexture);
+		ImGui::Checkbox("Sorting", &m_sorting);
+		if (m_sorting) {
+			ImGui::Text("GPU sort (%s):", m_sorter.usesBitonic() ? "bitonic" : "radix");
+			for (const auto& timing : m_sorter.timings()) {
+				ImGui::Text(" - %s: %.3f ms", timing.name.c_str(), timing.gpu);
+			}
+		}
 		m_speed = std::max(0.f, m_speed);
 		m_size = std::max(0.000001f, m_size);
 		m_transparency = std::max(0.f, std::min(1.f, m_transparency));
@@ -251,8 +420,27 @@ void MainWindow::RenderImgui()
 		changed |= ImGui::InputFloat("l_min", &m_settings.lifeMin);
 		changed |= ImGui::InputFloat("l_max", &m_settings.lifeMax);
 		m_settings.sanitize();
+		ImGui::Separator();
+		ImGui::Checkbox("Interactions", &m_useInteractions);
+		if (m_useInteractions) {
+			changed |= ImGui::InputFloat("Radius", &m_interaction.radius);
+			changed |= ImGui::InputFloat("Separation", &m_interaction.separation);
+			bool density = m_interaction.useDensity != 0;
+			changed |= ImGui::Checkbox("Density (SPH)", &density);
+			changed |= ImGui::InputFloat("Rest density", &m_interaction.restDensity);
+			changed |= ImGui::InputFloat("Stiffness", &m_interaction.stiffness);
+			bool floor = m_interaction.useFloor != 0;
+			changed |= ImGui::Checkbox("Floor", &floor);
+			changed |= ImGui::InputFloat("Floor height", &m_interaction.floorHeight);
+			changed |= ImGui::InputFloat("Restitution", &m_interaction.restitution);
+			m_interaction.useDensity = density;
+			m_interaction.useFloor = floor;
+			m_interaction.radius = std::max(m_interaction.radius, 0.001f);
+			m_interaction.restDensity = std::max(m_interaction.restDensity, 1.0f);
+			m_interaction.restitution = std::max(0.f, std::min(1.f, m_interaction.restitution));
+		}
 		if(changed) {
-			initializeParticles();
+			updateSettings();
 		}
 
 		ImGui::End();
@@ -290,17 +478,16 @@ void MainWindow::RenderScene(float time)
 	m_mainShader->setBool(m_mainUniforms.useTexture, m_useTexture);
 
 
-	// Draw the particles
-	glDrawArrays(GL_POINTS, 0, m_numberParticles);
+	// Sort according to distance from the camera (on the GPU)
+	// the vertex shader reads the particles in the sorted order
+	if (m_sorting) {
+		m_sorter.sort(m_camera.position());
+	}
+	m_mainShader->bind();
+	m_mainShader->setBool(m_mainUniforms.useSorting, m_sorting);
 
-	// Note here we sort async to avoid locking the rendering system
-	// Sort according to distance from the camera.
-	const glm::vec3 eyePos = m_camera.position();
-	std::sort(m_particles.begin(), m_particles.end(),
-		[&eyePos](const Particle& a, const Particle& b)
-		{
-			return glm::dot(eyePos - a.p, eyePos - a.p) > glm::dot(eyePos - b.p, eyePos - b.p);
-		});
+	// Draw the alive particles (count written by particules_finalize.comp)
+	glDrawArraysIndirect(GL_POINTS, BUFFER_OFFSET(offsetof(ParticleCounters, drawCount)));
 
 	glDisable(GL_BLEND);
 
@@ -324,13 +511,9 @@ int MainWindow::RenderLoop()
 		}
 
 		if (m_animate) {
-			const glm::vec3 gravity(0, -9.8, 0); // acceleration due to gravity
-			m_computeShader->bind();
-			m_computeShader->setFloat(m_computeUniforms.dt, delta_time * m_speed);
-			m_computeShader->setVec3(m_computeUniforms.gravity, gravity);
-			glDispatchCompute(m_numberParticles / 256, 1, 1);
-			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			Step(delta_time * m_speed);
 		}
+		m_textureLoader.update();
 		RenderScene(time);
 		RenderImgui();
 
@@ -345,7 +528,18 @@ int MainWindow::RenderLoop()
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
 
-	// Cleanup
+	// Cleanup (OpenGL objects need the context)
+	m_sorter.release();
+	m_textureLoader.release();
+	glDeleteBuffers(1, &m_particleBuffer);
+	glDeleteBuffers(1, &m_deadListBuffer);
+	glDeleteBuffers(2, m_aliveListBuffers);
+	glDeleteBuffers(1, &m_countersBuffer);
+	glDeleteBuffers(1, &m_settingsBuffer);
+	glDeleteBuffers(1, &m_gridCellsBuffer);
+	glDeleteBuffers(1, &m_gridParticlesBuffer);
+	glDeleteBuffers(1, &m_densityBuffer);
+	glDeleteBuffers(1, &m_interactionBuffer);
 	glfwDestroyWindow(m_window);
 	glfwTerminate();
 
@@ -13,15 +13,27 @@ layout(binding = 0, std430) readonly buffer ssbo1 {
     Particle data[];
 };
 
+// Alive particles (see particules.comp)
+layout(binding = 5, std430) readonly buffer ssbo6 {
+    uint aliveList[];
+};
+
+// Sorted (depth key, index) pairs (see GPUSort.h)
+layout(binding = 2, std430) readonly buffer ssbo3 {
+    uvec2 sorted[];
+};
+
 uniform float globalSize;
+uniform bool useSorting;
 
 out float quadLength;
 out vec3 quadColor;
 
 void main(void){
-    vec4 pPos = vec4(data[gl_VertexID].position, 1.0);
-    float pSize = data[gl_VertexID].size;
-    vec3 pColor = data[gl_VertexID].color;
+    uint index = useSorting ? sorted[gl_VertexID].y : aliveList[gl_VertexID];
+    vec4 pPos = vec4(data[index].position, 1.0);
+    float pSize = data[index].size;
+    vec3 pColor = data[index].color;
 
     gl_Position = pPos;
     quadLength = pSize * globalSize;
@@ -6,23 +6,10 @@
 
 #include <iostream>
 #include <memory>
+#include <vector>
 
 #include "ShaderProgram.h"
-
-// Conversion functions uvec4 <-> uint32_t
-inline glm::uvec4 GetRGBA(uint32_t PackedUint) {
-	unsigned int blue = PackedUint & 255;
-	unsigned int green = (PackedUint >> 8) & 255;
-	unsigned int red = (PackedUint >> 16) & 255;
-	unsigned int alpha = (PackedUint >> 24) & 255;
-
-	return glm::uvec4(red, green, blue, alpha);
-}
-// Fonction inverse
-inline uint32_t GetIntFromRGBA(glm::uvec4& RGBA)
-{
-	return (RGBA.a << 24) + (RGBA.r << 16) + (RGBA.g << 8) + RGBA.b;
-}
+#include "PickingService.h"
 
 class MainWindow
 {
@@ -50,8 +37,12 @@ private:
 	// Rendering interface ImGUI
 	void RenderImgui();
 	
-	// Perform selection on the object
+	// Draw the IDs of the spirals in the picking framebuffer
+	void RenderPicking();
+	// Perform selection on the object (the result arrives in a later frame)
 	void PerformSelection(int x, int y);
+	// Select all the spirals visible in the rectangle (window corners)
+	void PerformRegionSelection(int x0, int y0, int x1, int y1);
 
 private:
 	// settings
@@ -82,7 +73,7 @@ private:
 	std::unique_ptr<ShaderProgram> m_pickingShader = nullptr;
 	struct {
 		GLint uProjMatrix;
-		GLint uColor;
+		GLint uId;
 		GLint uMatrix;
 	} m_pickingShaderLocations;
 
@@ -92,7 +83,13 @@ private:
 	const GLint SHADER_COLOR_LOCATION = 2;
 
 	// Picking parameters
-	int m_selectedSpiral = -1;
+	// - ID framebuffer and asynchronous readbacks
+	PickingService m_picking;
+	std::vector<bool> m_selectedSpirals;
+	//  - marquee: shift + drag from the press position
+	bool m_dragging = false;
+	int m_dragStartX = 0;
+	int m_dragStartY = 0;
 	//  - ray drawing from the picking point
 	glm::vec3 SelectedPoint;
 	glm::vec3 SelectRayOrigin;
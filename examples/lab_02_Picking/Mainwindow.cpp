@@ -4,10 +4,11 @@
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 
-#include <map>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/matrix_inverse.hpp>
 
+#include <cstdlib>
+
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 #ifndef M_PI
 #define M_PI (3.14159)
@@ -121,7 +122,7 @@ int MainWindow::InitializeGL()
 	bool pickingSuccess = true;
 	m_pickingShader = std::make_unique<ShaderProgram>();
 	pickingSuccess &= m_pickingShader->addShaderFromSource(GL_VERTEX_SHADER, directory + "constantColor.vert");
-	pickingSuccess &= m_pickingShader->addShaderFromSource(GL_FRAGMENT_SHADER, directory + "constantColor.frag");
+	pickingSuccess &= m_pickingShader->addShaderFromSource(GL_FRAGMENT_SHADER, directory + "pickingId.frag");
 	pickingSuccess &= m_pickingShader->link();
 	if (!pickingSuccess) {
 		std::cerr << "Error when loading pikcing shader\n";
@@ -130,13 +131,20 @@ int MainWindow::InitializeGL()
 
 	// Get locations of the uniform variables
 	m_pickingShaderLocations.uProjMatrix = m_pickingShader->uniformLocation("uProjMatrix");
-	m_pickingShaderLocations.uColor = m_pickingShader->uniformLocation("uColor");
+	m_pickingShaderLocations.uId = m_pickingShader->uniformLocation("uId");
 	m_pickingShaderLocations.uMatrix = m_pickingShader->uniformLocation("uMatrix");
-	if (m_pickingShaderLocations.uProjMatrix < 0 || m_pickingShaderLocations.uColor < 0 || m_pickingShaderLocations.uMatrix < 0) {
-		std::cerr << "Unable to find shader location for uProjMatrix, uColor or uMatrix" << std::endl;
+	if (m_pickingShaderLocations.uProjMatrix < 0 || m_pickingShaderLocations.uId < 0 || m_pickingShaderLocations.uMatrix < 0) {
+		std::cerr << "Unable to find shader location for uProjMatrix, uId or uMatrix" << std::endl;
 		return 3;
 	}
 
+	// Offscreen framebuffer of the IDs (same size as the window)
+	m_selectedSpirals.assign(NbSpirals, false);
+	if (!m_picking.create(m_windowWidth, m_windowHeight, 3, NbSpirals)) {
+		std::cerr << "Error during picking framebuffer creation\n";
+		return 5;
+	}
+
 	// Create our VertexArrays Objects and VertexBuffer Objects
 	int resInitGeometry = InitGeometrySpiral();
 	if (resInitGeometry != 0) {
@@ -176,7 +184,7 @@ void MainWindow::RenderScene()
 		);
 
 		// Draw selected spiral differently
-		bool isSelected = (m_selectedSpiral == i);
+		bool isSelected = m_selectedSpirals[i];
 		if (isSelected)
 			glBindVertexArray(m_VAOs[VAO_SpiralSelected]);
 
@@ -212,13 +220,10 @@ int MainWindow::RenderLoop()
 		if (glfwGetKey(m_window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 			glfwSetWindowShouldClose(m_window, true);
 
-		RenderScene();
+		// Selections read back by the GPU since the last frame
+		m_picking.poll();
 
-		// If we press D, we show the debug view
-		if (glfwGetKey(m_window, GLFW_KEY_D) == GLFW_PRESS)
-		{
-			PerformSelection(0,0);
-		}
+		RenderScene();
 
 		// Show rendering and get events
 		glfwSwapBuffers(m_window);
@@ -226,6 +231,7 @@ int MainWindow::RenderLoop()
 	}
 
 	// Cleanup
+	m_picking.destroy();
 	glfwDestroyWindow(m_window);
 	glfwTerminate();
 
@@ -342,35 +348,12 @@ int MainWindow::InitGeometrySpiral()
 	return 0;
 }
 
-void MainWindow::PerformSelection(int x, int y)
+void MainWindow::RenderPicking()
 {
-	// Map (dictionnary) used to store the correspondences between colors and spiral number.
-	// This to found easily the object associated to a given color
-	struct compUVec4 {
-		bool operator()(const glm::uvec4& a, const glm::uvec4& b) const {
-			auto ia = (a.a << 24) + (a.r << 16) + (a.g << 8) + a.b;
-			auto ib = (b.a << 24) + (b.r << 16) + (b.g << 8) + b.b;
-			return ia < ib;
-		}
-	};
-	std::map<glm::uvec4, uint32_t, compUVec4> myMap;
-	// Identificator ID used as a color for rendering and as a key for the map.
-	std::cout << "Viewer::performSelection(" << x << ", " << y << ")" << std::endl;
+	// Selection is performed by drawing the spirals with their ID (uint)
+	// in the picking framebuffer: the back buffer is not touched.
+	m_picking.begin();
 
-	// Selection is performed by drawing the spirals with a color that matches their ID
-	// Note: Because we are drawing outside the draw() function, the back buffer is not
-	//       swapped after this function is called.
-
-	// Clear back buffer. Since we set a differet clear color, we save the
-	// previous value and restore it after the backbuffer has been cleared.
-	{
-		float clearColor[4];
-		glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
-		glClearColor(1, 1, 1, 1);	// This value should not match any existing index
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
-	}
-	
 	// Bind our vertex/fragment shaders
 	m_pickingShader->bind();
 
@@ -387,40 +370,64 @@ void MainWindow::PerformSelection(int x, int y)
 		currentTransformation = glm::translate(currentTransformation,
 			glm::vec3(cos(2.0f * id * float(M_PI) / static_cast<float>(NbSpirals)),sin(2.0f * id * float(M_PI) / static_cast<float>(NbSpirals)),0.0));
 
-		// For convenience, convert the ID to a color object.
-		glm::uvec4 color = GetRGBA(id);
-		myMap.insert({color, id}); 
-
-
-		// Set the color value for the shader.
-		// Need to send color where each channel is between [0, 1]
-		glm::vec4 color_float = glm::vec4(color.r / 255.0, color.g / 255.0, color.b / 255.0, color.a / 255.0) ;
-		m_pickingShader->setVec4(m_pickingShaderLocations.uColor, color_float);
+		// The ID is written as is (no conversion to a color),
+		// the fragment shader adds the triangle (gl_PrimitiveID)
+		glProgramUniform1ui(m_pickingShader->programId(), m_pickingShaderLocations.uId, id);
 
 		// Draw the spiral
 		m_pickingShader->setMat4(m_pickingShaderLocations.uMatrix, currentTransformation);
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, NbVerticesSpiral);
 	}
+}
+
+void MainWindow::PerformSelection(int x, int y)
+{
+	std::cout << "Viewer::performSelection(" << x << ", " << y << ")" << std::endl;
+
+	RenderPicking();
 
-	// Wait until all drawing commands are done
-	glFinish();
-
-	// Read the pixel under the cursor
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	unsigned char pixelData[4];
-	glReadPixels(x, m_windowHeight - 1 - y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixelData);
-
-	std::cout << "Selected pixelData: " << int(pixelData[0]) << ", "
-		<< int(pixelData[1]) << ", "
-		<< int(pixelData[2]) << ", "
-		<< int(pixelData[3]) << std::endl;
-
-	// For convenience, construct a color object matching what was read in the frame buffer.
-	glm::uvec4 pickedColor(pixelData[0], pixelData[1], pixelData[2], pixelData[3]);
-	// Get the value matching the key.
-	auto iteratorToPair = myMap.find(pickedColor);
-	m_selectedSpiral = (iteratorToPair != myMap.end()) ? iteratorToPair->second : -1;
-	std::cout << "m_selectedSpiral: " << m_selectedSpiral << std::endl;
+	// Read the pixel under the cursor without waiting for the GPU:
+	// the callback is called by m_picking.poll() once the copy is done
+	const bool queued = m_picking.request(x, m_windowHeight - 1 - y, [this](const PickingService::Result& result) {
+		m_selectedSpirals.assign(NbSpirals, false);
+		if (result.id != PickingService::NoObject) {
+			m_selectedSpirals[result.id] = true;
+			std::cout << "Selected spiral: " << result.id << ", triangle " << result.primitive;
+		}
+		else {
+			std::cout << "No spiral selected";
+		}
+		std::cout << " (" << result.frames << " frame(s) later)" << std::endl;
+	});
+	if (!queued) {
+		std::cout << "Selection ignored (outside the window or too many selections in flight)" << std::endl;
+	}
+
+	// Back to the window
+	m_picking.end();
+}
+
+void MainWindow::PerformRegionSelection(int x0, int y0, int x1, int y1)
+{
+	std::cout << "Viewer::performRegionSelection(" << x0 << ", " << y0 << ") - (" << x1 << ", " << y1 << ")" << std::endl;
+
+	RenderPicking();
+
+	// Read the rectangle: the service returns the unique IDs found
+	const bool queued = m_picking.requestRegion(x0, m_windowHeight - 1 - y0, x1, m_windowHeight - 1 - y1, [this](const PickingService::RegionResult& result) {
+		m_selectedSpirals.assign(NbSpirals, false);
+		std::cout << "Selected spirals:";
+		for (std::size_t i = 0; i < result.count; ++i) {
+			m_selectedSpirals[result.ids[i]] = true;
+			std::cout << " " << result.ids[i];
+		}
+		std::cout << " (" << result.width << "x" << result.height << " pixels, " << result.frames << " frame(s) later)" << std::endl;
+	});
+	if (!queued) {
+		std::cout << "Selection ignored (outside the window or too many selections in flight)" << std::endl;
+	}
+
+	m_picking.end();
 }
 
 
@@ -428,6 +435,7 @@ void MainWindow::FramebufferSizeCallback(int width, int height) {
 	m_windowWidth = width;
 	m_windowHeight = height;
 	glViewport(0, 0, width, height);
+	m_picking.resize(width, height);
 }
 
 void MainWindow::MouseButtonCallback(int button, int action, int mods)
@@ -436,13 +444,33 @@ void MainWindow::MouseButtonCallback(int button, int action, int mods)
 	// std::cout << " - Left? " << (button == GLFW_MOUSE_BUTTON_LEFT ? "true" : "false") << "\n";
 	// std::cout << " - Pressed? " << (action == GLFW_PRESS ? "true" : "false") << "\n";
 	// std::cout << " - Shift? " << (mods == GLFW_MOD_SHIFT ? "true" : "false") << "\n";
-	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && mods == GLFW_MOD_SHIFT)
+	if (button != GLFW_MOUSE_BUTTON_LEFT) {
+		return;
+	}
+
+	double xpos, ypos;
+	//getting cursor position
+	glfwGetCursorPos(m_window, &xpos, &ypos);
+
+	// Shift + click: select the spiral under the cursor
+	// Shift + drag: select the spirals inside the rectangle
+	if (action == GLFW_PRESS && mods == GLFW_MOD_SHIFT)
 	{
-		double xpos, ypos;
-		//getting cursor position
-		glfwGetCursorPos(m_window, &xpos, &ypos);
 		std::cout << "Cursor Position at (" << xpos << " : " << ypos << ")" << std::endl;
-
-		PerformSelection((int)xpos, (int)ypos);
+		m_dragging = true;
+		m_dragStartX = (int)xpos;
+		m_dragStartY = (int)ypos;
+	}
+	else if (action == GLFW_RELEASE && m_dragging)
+	{
+		m_dragging = false;
+		const int x = (int)xpos;
+		const int y = (int)ypos;
+		if (std::abs(x - m_dragStartX) <= 2 && std::abs(y - m_dragStartY) <= 2) {
+			PerformSelection(m_dragStartX, m_dragStartY);
+		}
+		else {
+			PerformRegionSelection(m_dragStartX, m_dragStartY, x, y);
+		}
 	}
 }
\ No newline at end of file
@@ -1,10 +0,0 @@
-#version 400 core
-
-uniform vec4 uColor;
-
-out vec4 fColor;
-
-void main()
-{
-  fColor = uColor;
-}
@@ -0,0 +1,1209 @@
+#include "BVH.h"
+#include "CpuFeatures.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BVH_X86 1
+#include <immintrin.h>
+#endif
+
+// GCC and Clang need to be told which instructions a function can use
+// (the rest of the file is compiled for the default architecture)
+#if defined(__GNUC__) || defined(__clang__)
+#define BVH_TARGET(arch) __attribute__((target(arch)))
+#else
+#define BVH_TARGET(arch)
+#endif
+
+namespace {
+	const int NumBins = 16;               // SAH bins per axis
+	const uint32_t MaxLeafSize = 4;       // Triangles per leaf (one SoA block)
+	const uint32_t NoParent = 0xFFFFFFFFu;
+	const uint32_t ParallelGrain = 4096;  // Items per job (large nodes only)
+	const float TraversalCost = 1.0f;     // Relative to the test of a leaf
+	const std::size_t BatchGrain = 256;   // Rays per job (multiple of the packet sizes)
+
+	struct Box {
+		glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+		void grow(const glm::vec3& p) { min = glm::min(min, p); max = glm::max(max, p); }
+		void grow(const Box& b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+		float area() const {
+			const glm::vec3 e = max - min;
+			return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+		}
+	};
+
+	// Box of the items of a node and box of their centroids
+	struct NodeBounds {
+		Box box;
+		Box centroids;
+		void merge(const NodeBounds& other) { box.grow(other.box); centroids.grow(other.centroids); }
+	};
+
+	// Bins of the three axes
+	struct Bins {
+		Box boxes[3][NumBins];
+		uint32_t counts[3][NumBins] = {};
+		void merge(const Bins& other) {
+			for (int axis = 0; axis < 3; ++axis) {
+				for (int b = 0; b < NumBins; ++b) {
+					boxes[axis][b].grow(other.boxes[axis][b]);
+					counts[axis][b] += other.counts[axis][b];
+				}
+			}
+		}
+	};
+
+	// Range of items to turn into a node
+	struct Task {
+		uint32_t begin;
+		uint32_t end;
+		uint32_t parent; // Parent to link (right child), NoParent otherwise
+		int depth;
+	};
+
+	inline int binIndex(float centroid, float minimum, float scale)
+	{
+		return std::min(int((centroid - minimum) * scale), NumBins - 1);
+	}
+
+	// accumulate(result, begin, end) over [begin, end): in parallel
+	// (one partial result per chunk, then merged) if the range is large
+	template<typename Result, typename Accumulate>
+	Result reduce(uint32_t begin, uint32_t end, const Accumulate& accumulate)
+	{
+		Result result;
+		const uint32_t count = end - begin;
+		if (count < 4 * ParallelGrain) {
+			accumulate(result, begin, end);
+			return result;
+		}
+		const uint32_t numChunks = (count + ParallelGrain - 1) / ParallelGrain;
+		std::vector<Result> partial(numChunks);
+		JobSystem::instance().parallelFor(0, numChunks, 1, [&](std::size_t first, std::size_t last) {
+			for (std::size_t c = first; c < last; ++c) {
+				const uint32_t chunkBegin = begin + uint32_t(c) * ParallelGrain;
+				accumulate(partial[c], chunkBegin, std::min(chunkBegin + ParallelGrain, end));
+			}
+		});
+		for (const Result& p : partial) {
+			result.merge(p);
+		}
+		return result;
+	}
+
+	// Binned SAH build over the boxes of the items (triangles or instances)
+	// The items are reordered in "order", makeLeaf(node, first, count)
+	// fills a leaf with order[first, first + count). Return the depth
+	template<typename MakeLeaf>
+	int buildTree(const std::vector<Box>& bounds, const std::vector<glm::vec3>& centroids, uint32_t maxLeafSize,
+		std::vector<BVH::Node>& nodes, std::vector<uint32_t>& order, const MakeLeaf& makeLeaf)
+	{
+		const uint32_t numItems = uint32_t(bounds.size());
+		order.resize(numItems);
+		for (uint32_t i = 0; i < numItems; ++i) {
+			order[i] = i;
+		}
+		nodes.clear();
+		if (numItems == 0) {
+			return 0;
+		}
+		nodes.reserve(2 * ((numItems + maxLeafSize - 1) / maxLeafSize));
+
+		// Depth first: the left child is processed right after its parent,
+		// so it is stored next to it
+		int depth = 0;
+		std::vector<Task> tasks;
+		tasks.push_back({ 0, numItems, NoParent, 1 });
+		while (!tasks.empty())
+		{
+			const Task task = tasks.back();
+			tasks.pop_back();
+			const uint32_t index = uint32_t(nodes.size());
+			nodes.emplace_back();
+			if (task.parent != NoParent) {
+				nodes[task.parent].index = index;
+			}
+			depth = std::max(depth, task.depth);
+
+			const NodeBounds nodeBounds = reduce<NodeBounds>(task.begin, task.end, [&](NodeBounds& r, uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; ++i) {
+					r.box.grow(bounds[order[i]]);
+					r.centroids.grow(centroids[order[i]]);
+				}
+			});
+			const Box& centroidBox = nodeBounds.centroids;
+			for (int k = 0; k < 3; ++k) {
+				nodes[index].min[k] = nodeBounds.box.min[k];
+				nodes[index].max[k] = nodeBounds.box.max[k];
+			}
+			const uint32_t count = task.end - task.begin;
+
+			// 1) Leaf: a BVH tests its triangles at once (SIMD), so splitting
+			// a range of maxLeafSize items or less never pays off
+			if (count <= maxLeafSize) {
+				makeLeaf(nodes[index], task.begin, count);
+				continue;
+			}
+
+			// 2) Best split among the bins boundaries (SAH: minimize the areas
+			// of the children weighted by their number of items)
+			// Past half the maximum depth, split at the median (balanced)
+			int bestAxis = -1;
+			int bestBin = 0;
+			float bestCost = std::numeric_limits<float>::max();
+			float scale[3];
+			for (int axis = 0; axis < 3; ++axis) {
+				const float extent = centroidBox.max[axis] - centroidBox.min[axis];
+				scale[axis] = extent > 0.0f ? NumBins / extent : 0.0f;
+			}
+			if (task.depth < BVH::MaxDepth / 2)
+			{
+				const Bins bins = reduce<Bins>(task.begin, task.end, [&](Bins& r, uint32_t begin, uint32_t end) {
+					for (uint32_t i = begin; i < end; ++i) {
+						const uint32_t item = order[i];
+						for (int axis = 0; axis < 3; ++axis) {
+							const int b = binIndex(centroids[item][axis], centroidBox.min[axis], scale[axis]);
+							r.boxes[axis][b].grow(bounds[item]);
+							r.counts[axis][b]++;
+						}
+					}
+				});
+
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					if (scale[axis] == 0.0f) {
+						continue;
+					}
+					// Left sweep, then right sweep evaluating each boundary
+					float leftArea[NumBins - 1];
+					uint32_t leftCount[NumBins - 1];
+					Box left;
+					uint32_t numLeft = 0;
+					for (int b = 0; b < NumBins - 1; ++b) {
+						left.grow(bins.boxes[axis][b]);
+						numLeft += bins.counts[axis][b];
+						leftArea[b] = numLeft > 0 ? left.area() : 0.0f;
+						leftCount[b] = numLeft;
+					}
+					Box right;
+					uint32_t numRight = 0;
+					for (int b = NumBins - 1; b > 0; --b) {
+						right.grow(bins.boxes[axis][b]);
+						numRight += bins.counts[axis][b];
+						if (leftCount[b - 1] == 0 || numRight == 0) {
+							continue;
+						}
+						const float cost = leftCount[b - 1] * leftArea[b - 1] + numRight * right.area();
+						if (cost < bestCost) {
+							bestCost = cost;
+							bestAxis = axis;
+							bestBin = b;
+						}
+					}
+				}
+			}
+
+			// 3) Inner node: partition the items
+			uint32_t* first = order.data() + task.begin;
+			uint32_t* last = order.data() + task.end;
+			uint32_t* middle;
+			if (bestAxis >= 0) {
+				const int axis = bestAxis;
+				middle = std::partition(first, last, [&](uint32_t item) {
+					return binIndex(centroids[item][axis], centroidBox.min[axis], scale[axis]) < bestBin;
+				});
+			}
+			else {
+				// Median of the centroids along the largest axis
+				const glm::vec3 extent = centroidBox.max - centroidBox.min;
+				const int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+				middle = first + count / 2;
+				std::nth_element(first, middle, last, [&](uint32_t a, uint32_t b) {
+					return centroids[a][axis] < centroids[b][axis];
+				});
+			}
+			const uint32_t split = uint32_t(middle - order.data());
+			nodes[index].count = 0;
+			tasks.push_back({ split, task.end, index, task.depth + 1 });
+			tasks.push_back({ task.begin, split, NoParent, task.depth + 1 });
+		}
+		return depth;
+	}
+
+	// SAH cost of a tree: areas of the nodes relative to the root
+	float treeCost(const std::vector<BVH::Node>& nodes)
+	{
+		if (nodes.empty()) {
+			return 0.0f;
+		}
+		auto area = [](const BVH::Node& node) {
+			const glm::vec3 e(node.max[0] - node.min[0], node.max[1] - node.min[1], node.max[2] - node.min[2]);
+			return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+		};
+		float cost = 0.0f;
+		for (const BVH::Node& node : nodes) {
+			cost += area(node) * (node.count > 0 ? float(node.count) : TraversalCost);
+		}
+		const float rootArea = area(nodes[0]);
+		return rootArea > 0.0f ? cost / rootArea : 0.0f;
+	}
+
+	// Ray with the values used by the box test
+	// (null direction components replaced by a tiny value: no 0 * inf)
+	struct RayData {
+		glm::vec3 invDirection;
+		RayData(const BVH::Ray& ray) {
+			for (int i = 0; i < 3; ++i) {
+				const float d = ray.direction[i];
+				invDirection[i] = 1.0f / (std::abs(d) > 1e-20f ? d : std::copysign(1e-20f, d));
+			}
+		}
+	};
+
+	// Distance to the box of the node (slab test), false if it is missed
+	// or farther than tMax
+	inline bool intersectBox(const float* boxMin, const float* boxMax, const BVH::Ray& ray, const RayData& data, float tMax, float& tEntry)
+	{
+#ifdef BVH_X86
+		// The 4th lane (index or count of the node) is replaced by the 3rd one
+		const __m128 origin = _mm_setr_ps(ray.origin.x, ray.origin.y, ray.origin.z, ray.origin.z);
+		const __m128 invDirection = _mm_setr_ps(data.invDirection.x, data.invDirection.y, data.invDirection.z, data.invDirection.z);
+		const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(boxMin), origin), invDirection);
+		const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(boxMax), origin), invDirection);
+		__m128 tNear = _mm_min_ps(t0, t1);
+		__m128 tFar = _mm_max_ps(t0, t1);
+		tNear = _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(2, 2, 1, 0));
+		tFar = _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(2, 2, 1, 0));
+		tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(1, 0, 3, 2)));
+		tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(2, 3, 0, 1)));
+		tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(1, 0, 3, 2)));
+		tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(2, 3, 0, 1)));
+		const float tMin = std::max(_mm_cvtss_f32(tNear), 0.0f);
+		const float tMaxBox = std::min(_mm_cvtss_f32(tFar), tMax);
+#else
+		float tMin = 0.0f;
+		float tMaxBox = tMax;
+		for (int i = 0; i < 3; ++i) {
+			const float t0 = (boxMin[i] - ray.origin[i]) * data.invDirection[i];
+			const float t1 = (boxMax[i] - ray.origin[i]) * data.invDirection[i];
+			tMin = std::max(tMin, std::min(t0, t1));
+			tMaxBox = std::min(tMaxBox, std::max(t0, t1));
+		}
+#endif
+		tEntry = tMin;
+		return tMin <= tMaxBox;
+	}
+
+	// Traversal shared by the two levels: testLeaf(node) returns true if
+	// it found a hit closer than tMax (and updated tMax). AnyHit: stop at
+	// the first hit. root: subtree to traverse
+	template<bool AnyHit, typename TestLeaf>
+	bool traverse(const std::vector<BVH::Node>& nodes, const BVH::Ray& ray, const float& tMax, const TestLeaf& testLeaf, uint32_t root = 0)
+	{
+		float tEntry;
+		const RayData data(ray);
+		if (nodes.empty() || !intersectBox(nodes[root].min, nodes[root].max, ray, data, tMax, tEntry)) {
+			return false;
+		}
+
+		// Nodes still to visit, with the distance where the ray enters them
+		uint32_t stack[BVH::MaxDepth];
+		float stackEntry[BVH::MaxDepth];
+		int size = 0;
+		uint32_t current = root;
+		bool found = false;
+		for (;;)
+		{
+			const BVH::Node& node = nodes[current];
+			if (node.count > 0) {
+				if (testLeaf(node)) {
+					found = true;
+					if (AnyHit) {
+						return true;
+					}
+				}
+			}
+			else {
+				// Both children: the nearest is visited first
+				uint32_t nearChild = current + 1;
+				uint32_t farChild = node.index;
+				float tNear, tFar;
+				const bool hitNear = intersectBox(nodes[nearChild].min, nodes[nearChild].max, ray, data, tMax, tNear);
+				const bool hitFar = intersectBox(nodes[farChild].min, nodes[farChild].max, ray, data, tMax, tFar);
+				if (hitNear && hitFar) {
+					if (tFar < tNear) {
+						std::swap(nearChild, farChild);
+						std::swap(tNear, tFar);
+					}
+					stack[size] = farChild;
+					stackEntry[size] = tFar;
+					size++;
+					current = nearChild;
+					continue;
+				}
+				if (hitNear || hitFar) {
+					current = hitNear ? nearChild : farChild;
+					continue;
+				}
+			}
+
+			// Next node on the stack, skipped if the hit found is closer
+			do {
+				if (size == 0) {
+					return found;
+				}
+				size--;
+			} while (stackEntry[size] > tMax);
+			current = stack[size];
+		}
+	}
+
+	// ------------------------------------------------------------------------
+	// Batches
+
+	// Indices of the rays sorted by direction octant (sign of x, y, z).
+	// Counting sort: stable, the order of the caller is kept in an octant
+	std::vector<uint32_t> sortByOctant(const BVH::Ray* rays, std::size_t count)
+	{
+		auto octant = [](const BVH::Ray& ray) {
+			return (ray.direction.x < 0.0f ? 1 : 0) | (ray.direction.y < 0.0f ? 2 : 0) | (ray.direction.z < 0.0f ? 4 : 0);
+		};
+		std::size_t offsets[9] = {};
+		for (std::size_t i = 0; i < count; ++i) {
+			offsets[octant(rays[i]) + 1]++;
+		}
+		for (int o = 0; o < 8; ++o) {
+			offsets[o + 1] += offsets[o];
+		}
+		std::vector<uint32_t> order(count);
+		for (std::size_t i = 0; i < count; ++i) {
+			order[offsets[octant(rays[i])]++] = uint32_t(i);
+		}
+		return order;
+	}
+
+	// Rays of a packet in SoA. The unused lanes have a null direction
+	// (never hit a triangle) and a negative tMax (never hit a box)
+	template<int N>
+	struct alignas(32) Packet {
+		float ox[N], oy[N], oz[N];
+		float dx[N], dy[N], dz[N];
+		float ix[N], iy[N], iz[N];   // 1 / direction (see RayData)
+		float tMax[N];               // Closest hit so far, < 0: lane done
+		float u[N], v[N];            // Barycentric coordinates of the hit
+		uint32_t triangle[N];        // Index of the triangle hit (in a Block)
+		uint32_t lanes = 0;          // Mask of the lanes used
+
+		void load(const BVH::Ray* rays, const uint32_t* order, std::size_t count) {
+			lanes = 0;
+			for (int k = 0; k < N; ++k) {
+				if (std::size_t(k) < count) {
+					const BVH::Ray& ray = rays[order[k]];
+					const RayData data(ray);
+					ox[k] = ray.origin.x; oy[k] = ray.origin.y; oz[k] = ray.origin.z;
+					dx[k] = ray.direction.x; dy[k] = ray.direction.y; dz[k] = ray.direction.z;
+					ix[k] = data.invDirection.x; iy[k] = data.invDirection.y; iz[k] = data.invDirection.z;
+					tMax[k] = ray.tMax;
+					lanes |= 1u << k;
+				}
+				else {
+					ox[k] = oy[k] = oz[k] = 0.0f;
+					dx[k] = dy[k] = dz[k] = 0.0f;
+					ix[k] = iy[k] = iz[k] = 1.0f;
+					tMax[k] = -1.0f;
+				}
+				u[k] = v[k] = 0.0f;
+				triangle[k] = 0;
+			}
+		}
+	};
+
+	inline int bitCount(uint32_t mask)
+	{
+		int count = 0;
+		for (; mask != 0; mask &= mask - 1) {
+			count++;
+		}
+		return count;
+	}
+
+#ifdef BVH_X86
+	// Kernels of a packet (same operations as the single ray versions, so
+	// the same hits):
+	// - box: mask of the rays hitting the box of the node in [0, tMax],
+	//   entry: smallest distance where they enter it
+	// - triangles: test the triangles of a leaf (SoA, 4 per block), keep
+	//   the closest hit of each ray. return the mask of the rays hit
+	struct LanesSSE {
+		static const int Width = 4;
+		typedef Packet<4> Rays;
+
+		static uint32_t box(const BVH::Node& node, const Rays& p, float& entry)
+		{
+			const __m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min[0]), _mm_load_ps(p.ox)), _mm_load_ps(p.ix));
+			const __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max[0]), _mm_load_ps(p.ox)), _mm_load_ps(p.ix));
+			const __m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min[1]), _mm_load_ps(p.oy)), _mm_load_ps(p.iy));
+			const __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max[1]), _mm_load_ps(p.oy)), _mm_load_ps(p.iy));
+			const __m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min[2]), _mm_load_ps(p.oz)), _mm_load_ps(p.iz));
+			const __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max[2]), _mm_load_ps(p.oz)), _mm_load_ps(p.iz));
+			const __m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)), _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_setzero_ps()));
+			const __m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)), _mm_min_ps(_mm_max_ps(tz0, tz1), _mm_load_ps(p.tMax)));
+			const __m128 hit = _mm_cmple_ps(tNear, tFar);
+			const uint32_t mask = uint32_t(_mm_movemask_ps(hit));
+			if (mask != 0) {
+				// Smallest entry among the rays hitting the box
+				__m128 t = _mm_or_ps(_mm_and_ps(hit, tNear), _mm_andnot_ps(hit, _mm_set1_ps(std::numeric_limits<float>::infinity())));
+				t = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2)));
+				t = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+				entry = _mm_cvtss_f32(t);
+			}
+			return mask;
+		}
+
+		static uint32_t triangles(const float* v0, const float* e1, const float* e2, const uint32_t* ids, uint32_t count, Rays& p)
+		{
+			const __m128 ox = _mm_load_ps(p.ox), oy = _mm_load_ps(p.oy), oz = _mm_load_ps(p.oz);
+			const __m128 dx = _mm_load_ps(p.dx), dy = _mm_load_ps(p.dy), dz = _mm_load_ps(p.dz);
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 one = _mm_set1_ps(1.0f);
+			__m128 tMax = _mm_load_ps(p.tMax);
+			__m128 u = _mm_load_ps(p.u), v = _mm_load_ps(p.v);
+			__m128 triangle = _mm_load_ps(reinterpret_cast<const float*>(p.triangle));
+			__m128 any = zero;
+			for (uint32_t k = 0; k < count; ++k)
+			{
+				const __m128 e1x = _mm_set1_ps(e1[k]), e1y = _mm_set1_ps(e1[4 + k]), e1z = _mm_set1_ps(e1[8 + k]);
+				const __m128 e2x = _mm_set1_ps(e2[k]), e2y = _mm_set1_ps(e2[4 + k]), e2z = _mm_set1_ps(e2[8 + k]);
+				const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+				const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+				const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+				const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+				const __m128 invDet = _mm_div_ps(one, det);
+				const __m128 sx = _mm_sub_ps(ox, _mm_set1_ps(v0[k]));
+				const __m128 sy = _mm_sub_ps(oy, _mm_set1_ps(v0[4 + k]));
+				const __m128 sz = _mm_sub_ps(oz, _mm_set1_ps(v0[8 + k]));
+				const __m128 lu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+				const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+				const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+				const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+				const __m128 lv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+				const __m128 lt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+				__m128 valid = _mm_cmpneq_ps(det, zero);
+				valid = _mm_and_ps(valid, _mm_cmpge_ps(lu, zero));
+				valid = _mm_and_ps(valid, _mm_cmpge_ps(lv, zero));
+				valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(lu, lv), one));
+				valid = _mm_and_ps(valid, _mm_cmpge_ps(lt, zero));
+				valid = _mm_and_ps(valid, _mm_cmplt_ps(lt, tMax));
+				// SSE2 has no blend: and/andnot/or
+				tMax = _mm_or_ps(_mm_and_ps(valid, lt), _mm_andnot_ps(valid, tMax));
+				u = _mm_or_ps(_mm_and_ps(valid, lu), _mm_andnot_ps(valid, u));
+				v = _mm_or_ps(_mm_and_ps(valid, lv), _mm_andnot_ps(valid, v));
+				const __m128 id = _mm_castsi128_ps(_mm_set1_epi32(int(ids[k])));
+				triangle = _mm_or_ps(_mm_and_ps(valid, id), _mm_andnot_ps(valid, triangle));
+				any = _mm_or_ps(any, valid);
+			}
+			_mm_store_ps(p.tMax, tMax);
+			_mm_store_ps(p.u, u);
+			_mm_store_ps(p.v, v);
+			_mm_store_ps(reinterpret_cast<float*>(p.triangle), triangle);
+			return uint32_t(_mm_movemask_ps(any));
+		}
+	};
+
+	// Same with 8 rays (not inlined in the traversal, compiled for the
+	// default architecture: the packet is passed in memory)
+	struct LanesAVX2 {
+		static const int Width = 8;
+		typedef Packet<8> Rays;
+
+		BVH_TARGET("avx2")
+		static uint32_t box(const BVH::Node& node, const Rays& p, float& entry)
+		{
+			const __m256 tx0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.min[0]), _mm256_load_ps(p.ox)), _mm256_load_ps(p.ix));
+			const __m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.max[0]), _mm256_load_ps(p.ox)), _mm256_load_ps(p.ix));
+			const __m256 ty0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.min[1]), _mm256_load_ps(p.oy)), _mm256_load_ps(p.iy));
+			const __m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.max[1]), _mm256_load_ps(p.oy)), _mm256_load_ps(p.iy));
+			const __m256 tz0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.min[2]), _mm256_load_ps(p.oz)), _mm256_load_ps(p.iz));
+			const __m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.max[2]), _mm256_load_ps(p.oz)), _mm256_load_ps(p.iz));
+			const __m256 tNear = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)), _mm256_max_ps(_mm256_min_ps(tz0, tz1), _mm256_setzero_ps()));
+			const __m256 tFar = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)), _mm256_min_ps(_mm256_max_ps(tz0, tz1), _mm256_load_ps(p.tMax)));
+			const __m256 hit = _mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ);
+			const uint32_t mask = uint32_t(_mm256_movemask_ps(hit));
+			if (mask != 0) {
+				const __m256 t8 = _mm256_blendv_ps(_mm256_set1_ps(std::numeric_limits<float>::infinity()), tNear, hit);
+				__m128 t = _mm_min_ps(_mm256_castps256_ps128(t8), _mm256_extractf128_ps(t8, 1));
+				t = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 0, 3, 2)));
+				t = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+				entry = _mm_cvtss_f32(t);
+			}
+			return mask;
+		}
+
+		BVH_TARGET("avx2")
+		static uint32_t triangles(const float* v0, const float* e1, const float* e2, const uint32_t* ids, uint32_t count, Rays& p)
+		{
+			const __m256 ox = _mm256_load_ps(p.ox), oy = _mm256_load_ps(p.oy), oz = _mm256_load_ps(p.oz);
+			const __m256 dx = _mm256_load_ps(p.dx), dy = _mm256_load_ps(p.dy), dz = _mm256_load_ps(p.dz);
+			const __m256 zero = _mm256_setzero_ps();
+			const __m256 one = _mm256_set1_ps(1.0f);
+			__m256 tMax = _mm256_load_ps(p.tMax);
+			__m256 u = _mm256_load_ps(p.u), v = _mm256_load_ps(p.v);
+			__m256 triangle = _mm256_load_ps(reinterpret_cast<const float*>(p.triangle));
+			__m256 any = zero;
+			for (uint32_t k = 0; k < count; ++k)
+			{
+				const __m256 e1x = _mm256_set1_ps(e1[k]), e1y = _mm256_set1_ps(e1[4 + k]), e1z = _mm256_set1_ps(e1[8 + k]);
+				const __m256 e2x = _mm256_set1_ps(e2[k]), e2y = _mm256_set1_ps(e2[4 + k]), e2z = _mm256_set1_ps(e2[8 + k]);
+				const __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+				const __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+				const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+				const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+				const __m256 invDet = _mm256_div_ps(one, det);
+				const __m256 sx = _mm256_sub_ps(ox, _mm256_set1_ps(v0[k]));
+				const __m256 sy = _mm256_sub_ps(oy, _mm256_set1_ps(v0[4 + k]));
+				const __m256 sz = _mm256_sub_ps(oz, _mm256_set1_ps(v0[8 + k]));
+				const __m256 lu = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), invDet);
+				const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+				const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+				const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+				const __m256 lv = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+				const __m256 lt = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+				__m256 valid = _mm256_cmp_ps(det, zero, _CMP_NEQ_UQ);
+				valid = _mm256_and_ps(valid, _mm256_cmp_ps(lu, zero, _CMP_GE_OQ));
+				valid = _mm256_and_ps(valid, _mm256_cmp_ps(lv, zero, _CMP_GE_OQ));
+				valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(lu, lv), one, _CMP_LE_OQ));
+				valid = _mm256_and_ps(valid, _mm256_cmp_ps(lt, zero, _CMP_GE_OQ));
+				valid = _mm256_and_ps(valid, _mm256_cmp_ps(lt, tMax, _CMP_LT_OQ));
+				tMax = _mm256_blendv_ps(tMax, lt, valid);
+				u = _mm256_blendv_ps(u, lu, valid);
+				v = _mm256_blendv_ps(v, lv, valid);
+				triangle = _mm256_blendv_ps(triangle, _mm256_castsi256_ps(_mm256_set1_epi32(int(ids[k]))), valid);
+				any = _mm256_or_ps(any, valid);
+			}
+			_mm256_store_ps(p.tMax, tMax);
+			_mm256_store_ps(p.u, u);
+			_mm256_store_ps(p.v, v);
+			_mm256_store_ps(reinterpret_cast<float*>(p.triangle), triangle);
+			return uint32_t(_mm256_movemask_ps(any));
+		}
+	};
+#endif
+
+	// Traversal of a packet: a node is visited if any ray hits its box,
+	// the child entered first by the rays is visited first. When the rays
+	// hitting a node are Width / 4 or less, they finish its subtree one
+	// by one: traceSingle(lane, node) returns true if the ray found a hit.
+	// testLeaf(node) returns the mask of the rays with a closer hit.
+	// AnyHit: a ray stops at its first hit (its tMax becomes negative).
+	// Return the mask of the rays hit
+	template<bool AnyHit, typename Lanes, typename TestLeaf, typename TraceSingle>
+	uint32_t traversePacket(const std::vector<BVH::Node>& nodes, typename Lanes::Rays& packet, const TestLeaf& testLeaf, const TraceSingle& traceSingle)
+	{
+		float entry;
+		uint32_t mask = nodes.empty() ? 0 : Lanes::box(nodes[0], packet, entry);
+		uint32_t stack[BVH::MaxDepth];
+		int size = 0;
+		uint32_t current = 0;
+		uint32_t found = 0;
+		while (mask != 0)
+		{
+			const BVH::Node& node = nodes[current];
+			uint32_t hits = 0;
+			bool next = true;
+			if (bitCount(mask) <= Lanes::Width / 4) {
+				for (int lane = 0; lane < Lanes::Width; ++lane) {
+					if ((mask & (1u << lane)) && traceSingle(lane, current)) {
+						hits |= 1u << lane;
+					}
+				}
+			}
+			else if (node.count > 0) {
+				hits = testLeaf(node);
+			}
+			else {
+				// Both children: the nearest (for the rays) is visited first
+				uint32_t nearChild = current + 1;
+				uint32_t farChild = node.index;
+				float tNear, tFar;
+				uint32_t nearMask = Lanes::box(nodes[nearChild], packet, tNear);
+				uint32_t farMask = Lanes::box(nodes[farChild], packet, tFar);
+				if (nearMask != 0 && farMask != 0) {
+					if (tFar < tNear) {
+						std::swap(nearChild, farChild);
+						std::swap(nearMask, farMask);
+					}
+					stack[size++] = farChild;
+				}
+				if (nearMask != 0 || farMask != 0) {
+					current = nearMask != 0 ? nearChild : farChild;
+					mask = nearMask != 0 ? nearMask : farMask;
+					next = false;
+				}
+			}
+
+			found |= hits;
+			if (AnyHit && hits != 0) {
+				for (int lane = 0; lane < Lanes::Width; ++lane) {
+					if (hits & (1u << lane)) {
+						packet.tMax[lane] = -1.0f;
+					}
+				}
+				if (found == packet.lanes) {
+					return found;
+				}
+			}
+
+			// Next node on the stack: its box is tested again (the rays
+			// which found a closer hit are culled)
+			if (next) {
+				mask = 0;
+				while (mask == 0 && size > 0) {
+					current = stack[--size];
+					mask = Lanes::box(nodes[current], packet, entry);
+				}
+			}
+		}
+		return found;
+	}
+
+	// Rays [0, count) of order: in parallel, by chunks of BatchGrain
+	template<typename F>
+	void forEachBatch(std::size_t count, const F& f)
+	{
+		JobSystem::instance().parallelFor(0, count, BatchGrain, [&](std::size_t begin, std::size_t end) {
+			f(begin, end);
+		});
+	}
+}
+
+// ----------------------------------------------------------------------------
+// BVH: geometry
+
+void BVH::addTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, uint32_t object, uint32_t primitive)
+{
+	m_vertices.push_back(a);
+	m_vertices.push_back(b);
+	m_vertices.push_back(c);
+	m_objects.push_back(object);
+	m_primitives.push_back(primitive);
+}
+
+void BVH::addTriangles(const float* positions, std::size_t stride, std::size_t numVertices, const glm::mat4& transform, uint32_t object)
+{
+	auto vertex = [&](std::size_t i) {
+		const float* p = positions + i * stride;
+		return glm::vec3(transform * glm::vec4(p[0], p[1], p[2], 1.0f));
+	};
+	for (std::size_t i = 0; i + 2 < numVertices; i += 3) {
+		addTriangle(vertex(i), vertex(i + 1), vertex(i + 2), object, uint32_t(i / 3));
+	}
+}
+
+void BVH::addTriangleStrip(const float* positions, std::size_t stride, std::size_t numVertices, const glm::mat4& transform, uint32_t object)
+{
+	auto vertex = [&](std::size_t i) {
+		const float* p = positions + i * stride;
+		return glm::vec3(transform * glm::vec4(p[0], p[1], p[2], 1.0f));
+	};
+	// Triangle i: vertices i, i + 1, i + 2 (the winding does not matter)
+	for (std::size_t i = 0; i + 2 < numVertices; ++i) {
+		addTriangle(vertex(i), vertex(i + 1), vertex(i + 2), object, uint32_t(i));
+	}
+}
+
+void BVH::addMesh(const OBJLoader::Mesh& mesh, const glm::mat4& transform, uint32_t object)
+{
+	if (mesh.vertices.empty()) {
+		return;
+	}
+	addTriangles(mesh.vertices[0].position, sizeof(OBJLoader::Vertex) / sizeof(float), mesh.vertices.size(), transform, object);
+}
+
+void BVH::clear()
+{
+	m_vertices.clear();
+	m_objects.clear();
+	m_primitives.clear();
+	m_nodes.clear();
+	m_blocks.clear();
+	m_depth = 0;
+}
+
+glm::vec3 BVH::boundsMin() const
+{
+	return m_nodes.empty() ? glm::vec3(0.0f) : glm::vec3(m_nodes[0].min[0], m_nodes[0].min[1], m_nodes[0].min[2]);
+}
+
+glm::vec3 BVH::boundsMax() const
+{
+	return m_nodes.empty() ? glm::vec3(0.0f) : glm::vec3(m_nodes[0].max[0], m_nodes[0].max[1], m_nodes[0].max[2]);
+}
+
+// ----------------------------------------------------------------------------
+// BVH: build and traversal
+
+void BVH::build()
+{
+	// Bounds and centroids of the triangles
+	const uint32_t numTriangles = uint32_t(m_objects.size());
+	std::vector<Box> bounds(numTriangles);
+	std::vector<glm::vec3> centroids(numTriangles);
+	JobSystem::instance().parallelFor(0, numTriangles, ParallelGrain, [&](std::size_t begin, std::size_t end) {
+		for (std::size_t t = begin; t < end; ++t) {
+			for (int k = 0; k < 3; ++k) {
+				bounds[t].grow(m_vertices[3 * t + k]);
+			}
+			centroids[t] = 0.5f * (bounds[t].min + bounds[t].max);
+		}
+	});
+
+	// Leaf: one block with its triangles (vertex 0 and edges)
+	std::vector<uint32_t> order;
+	m_blocks.clear();
+	m_blocks.reserve(numTriangles / 2 + 1);
+	m_depth = buildTree(bounds, centroids, MaxLeafSize, m_nodes, order, [&](Node& node, uint32_t first, uint32_t count) {
+		node.index = uint32_t(m_blocks.size());
+		node.count = count;
+		Block block = {};
+		for (uint32_t k = 0; k < count; ++k) {
+			const uint32_t t = order[first + k];
+			const glm::vec3& a = m_vertices[3 * t];
+			const glm::vec3 e1 = m_vertices[3 * t + 1] - a;
+			const glm::vec3 e2 = m_vertices[3 * t + 2] - a;
+			for (int c = 0; c < 3; ++c) {
+				block.v0[c][k] = a[c];
+				block.e1[c][k] = e1[c];
+				block.e2[c][k] = e2[c];
+			}
+			block.triangle[k] = t;
+		}
+		m_blocks.push_back(block);
+	});
+}
+
+bool BVH::intersectBlock(const Block& block, uint32_t count, const Ray& ray, Hit& hit) const
+{
+	// Moller-Trumbore on the 4 lanes (no culling of the back faces)
+	float t[4], u[4], v[4];
+	int mask = 0;
+#ifdef BVH_X86
+	const __m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+	const __m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y), dz = _mm_set1_ps(ray.direction.z);
+	const __m128 e1x = _mm_load_ps(block.e1[0]), e1y = _mm_load_ps(block.e1[1]), e1z = _mm_load_ps(block.e1[2]);
+	const __m128 e2x = _mm_load_ps(block.e2[0]), e2y = _mm_load_ps(block.e2[1]), e2z = _mm_load_ps(block.e2[2]);
+
+	// p = d x e2, det = e1 . p
+	const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+	const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+	// s = o - v0, u = (s . p) / det
+	const __m128 sx = _mm_sub_ps(ox, _mm_load_ps(block.v0[0]));
+	const __m128 sy = _mm_sub_ps(oy, _mm_load_ps(block.v0[1]));
+	const __m128 sz = _mm_sub_ps(oz, _mm_load_ps(block.v0[2]));
+	const __m128 lu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+	// q = s x e1, v = (d . q) / det, t = (e2 . q) / det
+	const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+	const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+	const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+	const __m128 lv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+	const __m128 lt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+	// Degenerate triangles (and unused lanes) have det = 0
+	const __m128 zero = _mm_setzero_ps();
+	__m128 valid = _mm_cmpneq_ps(det, zero);
+	valid = _mm_and_ps(valid, _mm_cmpge_ps(lu, zero));
+	valid = _mm_and_ps(valid, _mm_cmpge_ps(lv, zero));
+	valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(lu, lv), _mm_set1_ps(1.0f)));
+	valid = _mm_and_ps(valid, _mm_cmpge_ps(lt, zero));
+	valid = _mm_and_ps(valid, _mm_cmplt_ps(lt, _mm_set1_ps(hit.t)));
+	mask = _mm_movemask_ps(valid) & ((1 << count) - 1);
+	if (mask == 0) {
+		return false;
+	}
+	_mm_storeu_ps(t, lt);
+	_mm_storeu_ps(u, lu);
+	_mm_storeu_ps(v, lv);
+#else
+	for (uint32_t k = 0; k < count; ++k)
+	{
+		const glm::vec3 e1(block.e1[0][k], block.e1[1][k], block.e1[2][k]);
+		const glm::vec3 e2(block.e2[0][k], block.e2[1][k], block.e2[2][k]);
+		const glm::vec3 p = glm::cross(ray.direction, e2);
+		const float det = glm::dot(e1, p);
+		if (det == 0.0f) {
+			continue;
+		}
+		const float invDet = 1.0f / det;
+		const glm::vec3 s = ray.origin - glm::vec3(block.v0[0][k], block.v0[1][k], block.v0[2][k]);
+		const glm::vec3 q = glm::cross(s, e1);
+		u[k] = glm::dot(s, p) * invDet;
+		v[k] = glm::dot(ray.direction, q) * invDet;
+		t[k] = glm::dot(e2, q) * invDet;
+		if (u[k] >= 0.0f && v[k] >= 0.0f && u[k] + v[k] <= 1.0f && t[k] >= 0.0f && t[k] < hit.t) {
+			mask |= 1 << k;
+		}
+	}
+#endif
+
+	// Closest of the triangles hit
+	for (uint32_t k = 0; k < count; ++k) {
+		if ((mask & (1 << k)) && t[k] < hit.t) {
+			const uint32_t triangle = block.triangle[k];
+			hit.t = t[k];
+			hit.u = u[k];
+			hit.v = v[k];
+			hit.object = m_objects[triangle];
+			hit.primitive = m_primitives[triangle];
+		}
+	}
+	return mask != 0;
+}
+
+bool BVH::intersect(const Ray& ray, Hit& hit) const
+{
+	hit = Hit();
+	hit.t = ray.tMax;
+	return traverse<false>(m_nodes, ray, hit.t, [&](const Node& node) {
+		return intersectBlock(m_blocks[node.index], node.count, ray, hit);
+	});
+}
+
+bool BVH::occluded(const Ray& ray) const
+{
+	Hit hit;
+	hit.t = ray.tMax;
+	return traverse<true>(m_nodes, ray, hit.t, [&](const Node& node) {
+		return intersectBlock(m_blocks[node.index], node.count, ray, hit);
+	});
+}
+
+// ----------------------------------------------------------------------------
+// BVH: batches
+
+template<bool AnyHit, typename Lanes>
+void BVH::tracePackets(const Ray* rays, const uint32_t* order, std::size_t count, Hit* hits, bool* occluded) const
+{
+	typename Lanes::Rays packet;
+	for (std::size_t first = 0; first < count; first += Lanes::Width)
+	{
+		const uint32_t* packetRays = order + first;
+		packet.load(rays, packetRays, count - first);
+		if (!AnyHit) {
+			for (int lane = 0; lane < Lanes::Width; ++lane) {
+				if (packet.lanes & (1u << lane)) {
+					hits[packetRays[lane]] = Hit();
+					hits[packetRays[lane]].t = packet.tMax[lane];
+				}
+			}
+		}
+
+		auto testLeaf = [&](const Node& node) {
+			const Block& block = m_blocks[node.index];
+			const uint32_t hitMask = Lanes::triangles(&block.v0[0][0], &block.e1[0][0], &block.e2[0][0], block.triangle, node.count, packet);
+			if (!AnyHit) {
+				for (int lane = 0; lane < Lanes::Width; ++lane) {
+					if (hitMask & (1u << lane)) {
+						Hit& hit = hits[packetRays[lane]];
+						hit.t = packet.tMax[lane];
+						hit.u = packet.u[lane];
+						hit.v = packet.v[lane];
+						hit.object = m_objects[packet.triangle[lane]];
+						hit.primitive = m_primitives[packet.triangle[lane]];
+					}
+				}
+			}
+			return hitMask;
+		};
+		auto traceSingle = [&](int lane, uint32_t root) {
+			const Ray& ray = rays[packetRays[lane]];
+			if (AnyHit) {
+				Hit hit;
+				hit.t = ray.tMax;
+				return traverse<true>(m_nodes, ray, hit.t, [&](const Node& node) {
+					return intersectBlock(m_blocks[node.index], node.count, ray, hit);
+				}, root);
+			}
+			Hit& hit = hits[packetRays[lane]];
+			const bool found = traverse<false>(m_nodes, ray, hit.t, [&](const Node& node) {
+				return intersectBlock(m_blocks[node.index], node.count, ray, hit);
+			}, root);
+			packet.tMax[lane] = hit.t;
+			return found;
+		};
+
+		const uint32_t found = traversePacket<AnyHit, Lanes>(m_nodes, packet, testLeaf, traceSingle);
+		if (AnyHit) {
+			for (int lane = 0; lane < Lanes::Width; ++lane) {
+				if (packet.lanes & (1u << lane)) {
+					occluded[packetRays[lane]] = (found & (1u << lane)) != 0;
+				}
+			}
+		}
+	}
+}
+
+void BVH::intersect(const Ray* rays, Hit* hits, std::size_t count, Kernel kernel) const
+{
+	while (!isAvailable(kernel)) {
+		kernel = Kernel(int(kernel) - 1);
+	}
+	const std::vector<uint32_t> order = sortByOctant(rays, count);
+	forEachBatch(count, [&](std::size_t begin, std::size_t end) {
+		switch (kernel)
+		{
+#ifdef BVH_X86
+		case Kernel::AVX2:
+			tracePackets<false, LanesAVX2>(rays, order.data() + begin, end - begin, hits, nullptr);
+			break;
+		case Kernel::SSE:
+			tracePackets<false, LanesSSE>(rays, order.data() + begin, end - begin, hits, nullptr);
+			break;
+#endif
+		default:
+			for (std::size_t i = begin; i < end; ++i) {
+				intersect(rays[order[i]], hits[order[i]]);
+			}
+			break;
+		}
+	});
+}
+
+void BVH::occluded(const Ray* rays, bool* occluded, std::size_t count, Kernel kernel) const
+{
+	while (!isAvailable(kernel)) {
+		kernel = Kernel(int(kernel) - 1);
+	}
+	const std::vector<uint32_t> order = sortByOctant(rays, count);
+	forEachBatch(count, [&](std::size_t begin, std::size_t end) {
+		switch (kernel)
+		{
+#ifdef BVH_X86
+		case Kernel::AVX2:
+			tracePackets<true, LanesAVX2>(rays, order.data() + begin, end - begin, nullptr, occluded);
+			break;
+		case Kernel::SSE:
+			tracePackets<true, LanesSSE>(rays, order.data() + begin, end - begin, nullptr, occluded);
+			break;
+#endif
+		default:
+			for (std::size_t i = begin; i < end; ++i) {
+				occluded[order[i]] = this->occluded(rays[order[i]]);
+			}
+			break;
+		}
+	});
+}
+
+bool BVH::isAvailable(Kernel kernel)
+{
+	switch (kernel)
+	{
+	case Kernel::Single:
+		return true;
+#ifdef BVH_X86
+	case Kernel::SSE:
+		return true; // Always present on x86-64
+	case Kernel::AVX2:
+		return cpuSupportsAVX2();
+#endif
+	default:
+		return false;
+	}
+}
+
+BVH::Kernel BVH::bestKernel()
+{
+	if (isAvailable(Kernel::AVX2)) return Kernel::AVX2;
+	if (isAvailable(Kernel::SSE)) return Kernel::SSE;
+	return Kernel::Single;
+}
+
+const char* BVH::kernelName(Kernel kernel)
+{
+	switch (kernel)
+	{
+	case Kernel::AVX2: return "AVX2";
+	case Kernel::SSE: return "SSE";
+	default: return "Single";
+	}
+}
+
+// ----------------------------------------------------------------------------
+// TopLevelBVH
+
+uint32_t TopLevelBVH::addInstance(const BVH& mesh, const glm::mat4& transform, uint32_t id)
+{
+	Instance instance;
+	instance.mesh = &mesh;
+	instance.localMin = mesh.boundsMin();
+	instance.localMax = mesh.boundsMax();
+	instance.id = id;
+	m_instances.push_back(instance);
+	setTransform(uint32_t(m_instances.size() - 1), transform);
+	m_needsBuild = true;
+	return uint32_t(m_instances.size() - 1);
+}
+
+void TopLevelBVH::setTransform(uint32_t instance, const glm::mat4& transform)
+{
+	m_instances[instance].transform = transform;
+	m_instances[instance].inverse = glm::inverse(transform);
+}
+
+void TopLevelBVH::clear()
+{
+	m_instances.clear();
+	m_nodes.clear();
+	m_depth = 0;
+	m_cost = m_builtCost = 0.0f;
+	m_needsBuild = true;
+}
+
+void TopLevelBVH::updateBounds()
+{
+	// Box of the transformed box: center transformed, extent by |M|
+	JobSystem::instance().parallelFor(0, m_instances.size(), ParallelGrain, [this](std::size_t begin, std::size_t end) {
+		for (std::size_t i = begin; i < end; ++i) {
+			Instance& instance = m_instances[i];
+			const glm::vec3 center = 0.5f * (instance.localMin + instance.localMax);
+			const glm::vec3 extent = 0.5f * (instance.localMax - instance.localMin);
+			const glm::mat3 m(instance.transform);
+			const glm::mat3 absolute(glm::abs(m[0]), glm::abs(m[1]), glm::abs(m[2]));
+			const glm::vec3 worldCenter = glm::vec3(instance.transform * glm::vec4(center, 1.0f));
+			const glm::vec3 worldExtent = absolute * extent;
+			instance.worldMin = worldCenter - worldExtent;
+			instance.worldMax = worldCenter + worldExtent;
+		}
+	});
+}
+
+void TopLevelBVH::build()
+{
+	updateBounds();
+	const std::size_t numInstances = m_instances.size();
+	std::vector<Box> bounds(numInstances);
+	std::vector<glm::vec3> centroids(numInstances);
+	for (std::size_t i = 0; i < numInstances; ++i) {
+		bounds[i].min = m_instances[i].worldMin;
+		bounds[i].max = m_instances[i].worldMax;
+		centroids[i] = 0.5f * (bounds[i].min + bounds[i].max);
+	}
+
+	// One instance per leaf (its BVH is the rest of the tree)
+	std::vector<uint32_t> order;
+	m_depth = buildTree(bounds, centroids, 1, m_nodes, order, [&](BVH::Node& node, uint32_t first, uint32_t) {
+		node.index = order[first];
+		node.count = 1;
+	});
+	m_cost = m_builtCost = treeCost(m_nodes);
+	m_needsBuild = false;
+}
+
+void TopLevelBVH::refit()
+{
+	if (m_needsBuild) {
+		build();
+		return;
+	}
+	updateBounds();
+
+	// The children are stored after their parent: backward, each node
+	// is updated after its children
+	for (std::size_t i = m_nodes.size(); i-- > 0;)
+	{
+		BVH::Node& node = m_nodes[i];
+		if (node.count > 0) {
+			const Instance& instance = m_instances[node.index];
+			for (int k = 0; k < 3; ++k) {
+				node.min[k] = instance.worldMin[k];
+				node.max[k] = instance.worldMax[k];
+			}
+		}
+		else {
+			const BVH::Node& left = m_nodes[i + 1];
+			const BVH::Node& right = m_nodes[node.index];
+			for (int k = 0; k < 3; ++k) {
+				node.min[k] = std::min(left.min[k], right.min[k]);
+				node.max[k] = std::max(left.max[k], right.max[k]);
+			}
+		}
+	}
+	m_cost = treeCost(m_nodes);
+}
+
+bool TopLevelBVH::update(float maxCostRatio)
+{
+	if (!m_needsBuild) {
+		refit();
+		if (m_cost <= maxCostRatio * m_builtCost) {
+			return false;
+		}
+	}
+	build();
+	return true;
+}
+
+BVH::Ray TopLevelBVH::toInstance(const Instance& instance, const BVH::Ray& ray, float tMax)
+{
+	BVH::Ray local;
+	local.origin = glm::vec3(instance.inverse * glm::vec4(ray.origin, 1.0f));
+	local.direction = glm::mat3(instance.inverse) * ray.direction;
+	local.tMax = tMax;
+	return local;
+}
+
+bool TopLevelBVH::intersect(const BVH::Ray& ray, BVH::Hit& hit) const
+{
+	hit = BVH::Hit();
+	hit.t = ray.tMax;
+	return traverse<false>(m_nodes, ray, hit.t, [&](const BVH::Node& node) {
+		const Instance& instance = m_instances[node.index];
+		BVH::Hit local;
+		if (!instance.mesh->intersect(toInstance(instance, ray, hit.t), local)) {
+			return false;
+		}
+		hit = local;
+		hit.instance = instance.id;
+		return true;
+	});
+}
+
+bool TopLevelBVH::occluded(const BVH::Ray& ray) const
+{
+	return traverse<true>(m_nodes, ray, ray.tMax, [&](const BVH::Node& node) {
+		const Instance& instance = m_instances[node.index];
+		return instance.mesh->occluded(toInstance(instance, ray, ray.tMax));
+	});
+}
+
+void TopLevelBVH::intersect(const BVH::Ray* rays, BVH::Hit* hits, std::size_t count) const
+{
+	const std::vector<uint32_t> order = sortByOctant(rays, count);
+	forEachBatch(count, [&](std::size_t begin, std::size_t end) {
+		for (std::size_t i = begin; i < end; ++i) {
+			intersect(rays[order[i]], hits[order[i]]);
+		}
+	});
+}
+
+void TopLevelBVH::occluded(const BVH::Ray* rays, bool* occluded, std::size_t count) const
+{
+	const std::vector<uint32_t> order = sortByOctant(rays, count);
+	forEachBatch(count, [&](std::size_t begin, std::size_t end) {
+		for (std::size_t i = begin; i < end; ++i) {
+			occluded[order[i]] = this->occluded(rays[order[i]]);
+		}
+	});
+}
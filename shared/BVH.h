@@ -0,0 +1,229 @@
+#pragma once
+
+// Bounding volume hierarchies for ray casting on the CPU (picking,
+// unprojection, occlusion queries, ...). No OpenGL dependency: a
+// selection is answered without rendering or reading back anything.
+//
+// Two levels:
+// - BVH (bottom level): triangles of a mesh, built once
+// - TopLevelBVH: instances of meshes (a BVH and a matrix each). Moving
+//   an instance only changes its matrix: refit() updates the boxes of
+//   the tree in O(instances), build() rebuilds it (in parallel)
+//
+// Both use the same tree:
+// - build: binned surface area heuristic (SAH), top-down; the bins of
+//   the large nodes are filled in parallel (JobSystem)
+// - nodes: flattened depth first in a single array (32 bytes per node),
+//   the left child directly follows its parent
+// - ray-box: slab test of a node with SSE, nearest child visited first
+// The leaves of a BVH hold up to 4 triangles stored in SoA (one block
+// per leaf), tested together against the ray (Moller-Trumbore with SSE,
+// scalar fallback). The leaves of a TopLevelBVH hold one instance: the
+// ray is transformed in the space of the instance and traverses its BVH.
+//
+// Batches of rays (visibility probes, line of sight, ambient occlusion):
+// the rays are sorted by direction octant (same signs: they visit the
+// tree in the same order), then traced by packets of 4 (SSE) or 8 (AVX2)
+// rays: a node is visited if any ray of the packet hits its box, and
+// when only a few rays of the packet remain (divergence) they finish the
+// subtree one by one. The packets are split between the threads of the
+// JobSystem.
+//
+// Usage:
+// BVH spiral;
+// spiral.addTriangleStrip(&vertices[0][0], 3, numVertices, glm::mat4(1.0f), 0);
+// spiral.build();
+// TopLevelBVH scene;
+// scene.addInstance(spiral, modelMatrix, objectID);
+// scene.build();
+// ...
+// scene.setTransform(instance, newModelMatrix); // Each frame
+// scene.update();                               // Refit (or rebuild)
+// BVH::Hit hit;
+// if (scene.intersect(BVH::Ray{ origin, direction }, hit)) { ... hit.instance ... }
+// std::vector<BVH::Hit> hits(rays.size());
+// spiral.intersect(rays.data(), hits.data(), rays.size()); // Batch
+
+#include <glm/glm.hpp>
+
+#include "OBJLoader.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+class BVH
+{
+public:
+	static const uint32_t NoObject = 0xFFFFFFFFu;
+	// Maximum depth of the tree (size of the traversal stack)
+	static const int MaxDepth = 64;
+	// Traversal of the batches: one ray at a time, packets of 4 or 8 rays
+	enum class Kernel { Single, SSE, AVX2 };
+
+	struct Ray {
+		glm::vec3 origin = glm::vec3(0.0f);
+		glm::vec3 direction = glm::vec3(0.0f, 0.0f, -1.0f); // Not necessarily normalized
+		float tMax = std::numeric_limits<float>::infinity();
+	};
+
+	struct Hit {
+		float t = std::numeric_limits<float>::infinity(); // origin + t * direction
+		uint32_t instance = NoObject; // ID of the instance (TopLevelBVH only)
+		uint32_t object = NoObject;   // ID given when the triangles were added
+		uint32_t primitive = 0;       // Triangle in the object (as gl_PrimitiveID)
+		float u = 0.0f;               // Barycentric coordinates (v1, v2)
+		float v = 0.0f;
+
+		bool valid() const { return object != NoObject; }
+	};
+
+	// Flattened node (32 bytes):
+	// - inner node: count = 0, left child = this + 1, right child = index
+	// - leaf: count items (triangles or instance) from "index"
+	struct alignas(32) Node {
+		float min[3];
+		uint32_t index;
+		float max[3];
+		uint32_t count;
+	};
+
+	BVH() = default;
+
+	// ------------------------------------------------------------------------
+	// Geometry (world space, or object space for a TopLevelBVH).
+	// positions: x, y, z of each vertex, stride: floats between two vertices
+	// - each triplet of vertices forms a triangle (GL_TRIANGLES)
+	void addTriangles(const float* positions, std::size_t stride, std::size_t numVertices, const glm::mat4& transform, uint32_t object);
+	// - GL_TRIANGLE_STRIP
+	void addTriangleStrip(const float* positions, std::size_t stride, std::size_t numVertices, const glm::mat4& transform, uint32_t object);
+	// - mesh loaded by OBJLoader
+	void addMesh(const OBJLoader::Mesh& mesh, const glm::mat4& transform, uint32_t object);
+	// remove the geometry and the tree
+	void clear();
+
+	// ------------------------------------------------------------------------
+	// build the tree over the triangles added (they can be added again after)
+	void build();
+
+	// closest hit along the ray (t in [0, ray.tMax]), both faces
+	bool intersect(const Ray& ray, Hit& hit) const;
+	// true if anything is hit in [0, ray.tMax] (stops at the first hit)
+	bool occluded(const Ray& ray) const;
+
+	// ------------------------------------------------------------------------
+	// Batches (in parallel): hits[i] / occluded[i] of rays[i]
+	void intersect(const Ray* rays, Hit* hits, std::size_t count, Kernel kernel = bestKernel()) const;
+	void occluded(const Ray* rays, bool* occluded, std::size_t count, Kernel kernel = bestKernel()) const;
+
+	// Kernel selection (fallback to the best available one)
+	static bool isAvailable(Kernel kernel);
+	static Kernel bestKernel();
+	static const char* kernelName(Kernel kernel);
+
+	// Statistics
+	std::size_t numTriangles() const { return m_objects.size(); }
+	std::size_t numNodes() const { return m_nodes.size(); }
+	int depth() const { return m_depth; }
+	// Bounding box of the whole scene
+	glm::vec3 boundsMin() const;
+	glm::vec3 boundsMax() const;
+
+private:
+	// Up to 4 triangles of a leaf in SoA (vertex 0 and the two edges)
+	// Unused lanes are degenerate (null edges): never hit
+	struct alignas(16) Block {
+		float v0[3][4];
+		float e1[3][4];
+		float e2[3][4];
+		uint32_t triangle[4]; // Index in m_objects / m_primitives
+	};
+
+	void addTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, uint32_t object, uint32_t primitive);
+	// closest hit among the triangles of the block (closer than hit.t)
+	bool intersectBlock(const Block& block, uint32_t count, const Ray& ray, Hit& hit) const;
+	// batch of rays (order: rays sorted by octant) traced by packets
+	// of Lanes::Width rays. AnyHit: occlusion, results in "occluded"
+	template<bool AnyHit, typename Lanes>
+	void tracePackets(const Ray* rays, const uint32_t* order, std::size_t count, Hit* hits, bool* occluded) const;
+
+private:
+	// Triangles added (3 vertices each) and their IDs
+	std::vector<glm::vec3> m_vertices;
+	std::vector<uint32_t> m_objects;
+	std::vector<uint32_t> m_primitives;
+
+	// Tree
+	std::vector<Node> m_nodes;
+	std::vector<Block> m_blocks;
+	int m_depth = 0;
+};
+
+// ----------------------------------------------------------------------------
+
+class TopLevelBVH
+{
+public:
+	TopLevelBVH() = default;
+
+	// ------------------------------------------------------------------------
+	// add an instance of a mesh (built, must live as long as this scene)
+	// placed by transform (object to world). id: reported in Hit::instance.
+	// return the index of the instance (to move it)
+	uint32_t addInstance(const BVH& mesh, const glm::mat4& transform, uint32_t id);
+	// move an instance (taken into account by the next refit/build/update)
+	void setTransform(uint32_t instance, const glm::mat4& transform);
+	void clear();
+
+	// ------------------------------------------------------------------------
+	// build the tree over the instances (boxes and bins in parallel)
+	void build();
+	// keep the tree, only update its boxes from the instances: O(n)
+	void refit();
+	// refit, and rebuild if the quality of the tree has degraded too much
+	// (SAH cost > maxCostRatio * cost after the last build) or if
+	// instances were added. return true if rebuilt
+	bool update(float maxCostRatio = 1.5f);
+
+	// closest hit along the ray (t in [0, ray.tMax]) among the instances
+	bool intersect(const BVH::Ray& ray, BVH::Hit& hit) const;
+	// true if any instance is hit in [0, ray.tMax]
+	bool occluded(const BVH::Ray& ray) const;
+	// Batches (in parallel, sorted by octant, one ray at a time: the rays
+	// of a packet would not share the space of the instances)
+	void intersect(const BVH::Ray* rays, BVH::Hit* hits, std::size_t count) const;
+	void occluded(const BVH::Ray* rays, bool* occluded, std::size_t count) const;
+
+	// Statistics
+	std::size_t numInstances() const { return m_instances.size(); }
+	std::size_t numNodes() const { return m_nodes.size(); }
+	int depth() const { return m_depth; }
+	// SAH cost of the tree (relative to its root box)
+	float cost() const { return m_cost; }
+
+private:
+	struct Instance {
+		const BVH* mesh;
+		glm::mat4 transform;
+		glm::mat4 inverse;    // World to object (rays)
+		glm::vec3 localMin;   // Bounds of the mesh (object space)
+		glm::vec3 localMax;
+		glm::vec3 worldMin;   // Bounds of the instance (world space)
+		glm::vec3 worldMax;
+		uint32_t id;
+	};
+
+	// world boxes of the instances (in parallel)
+	void updateBounds();
+	// ray in the space of an instance: same t as the world ray (affine)
+	static BVH::Ray toInstance(const Instance& instance, const BVH::Ray& ray, float tMax);
+
+private:
+	std::vector<Instance> m_instances;
+	std::vector<BVH::Node> m_nodes;
+	int m_depth = 0;
+	float m_cost = 0.0f;
+	float m_builtCost = 0.0f;
+	bool m_needsBuild = true;
+};
@@ -86,6 +86,15 @@ void Camera::viewportEvents(int width, int height) {
     if (m_image_ratio > 1e-6) updateProjectionMatrix();
 }
 
+glm::vec3 Camera::rayDirection(const glm::vec2& windowPos, int width, int height) const {
+    // Normalized device coordinates (y up)
+    const float x = 2.0f * windowPos.x / float(width) - 1.0f;
+    const float y = 1.0f - 2.0f * windowPos.y / float(height);
+    // Point on the far plane, back in world space
+    const glm::vec4 p = glm::inverse(m_proj_matrix * viewMatrix()) * glm::vec4(x, y, 1.0f, 1.0f);
+    return glm::normalize(glm::vec3(p) / p.w - m_position);
+}
+
 void Camera::computeAngles() {
     // Horizontal direction
     glm::vec3 h_dir = glm::vec3(m_direction.x, 0.0, -m_direction.z);
@@ -46,6 +46,10 @@ public:
         m_near = near;
         updateProjectionMatrix();
     }
+    // Direction (world space, normalized) of the ray from the camera
+    // through a window position (pixels, origin top left as GLFW)
+    glm::vec3 rayDirection(const glm::vec2& windowPos, int width, int height) const;
+
     const glm::vec3& position() const { return m_position;  }
     float fieldOfView() const { return m_fov;  }
 private:
@@ -0,0 +1,38 @@
+#include "CpuFeatures.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+namespace {
+	bool detectAVX2()
+	{
+#if !defined(CPU_X86)
+		return false;
+#elif defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) return false;
+		__cpuid(info, 1);
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool avx = (info[2] & (1 << 28)) != 0;
+		if (!osxsave || !avx) return false;
+		// The OS must save the YMM registers
+		if ((_xgetbv(0) & 0x6) != 0x6) return false;
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+}
+
+bool cpuSupportsAVX2()
+{
+	static const bool avx2 = detectAVX2();
+	return avx2;
+}
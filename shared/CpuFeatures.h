@@ -0,0 +1,10 @@
+#pragma once
+
+// Instruction sets of the CPU (runtime dispatch of the SIMD kernels)
+//
+// The kernels using them are compiled for their instruction set only
+// (target attribute): they must not run if the CPU does not have it.
+
+// AVX2 usable: supported by the CPU and its registers saved by the OS
+// (checked once, false if not x86)
+bool cpuSupportsAVX2();
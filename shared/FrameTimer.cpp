@@ -0,0 +1,104 @@
+#include "FrameTimer.h"
+
+namespace {
+	float milliseconds(std::chrono::high_resolution_clock::duration d)
+	{
+		return std::chrono::duration<float, std::milli>(d).count();
+	}
+}
+
+FrameTimer::~FrameTimer()
+{
+	release();
+}
+
+void FrameTimer::create()
+{
+	release();
+	for (QuerySet& set : m_querySets) {
+		glGenQueries(MaxQueries, set.queries);
+	}
+	m_queriesCreated = true;
+}
+
+void FrameTimer::release()
+{
+	if (m_queriesCreated) {
+		for (QuerySet& set : m_querySets) {
+			glDeleteQueries(MaxQueries, set.queries);
+			set.names.clear();
+			set.cpu.clear();
+			set.pending = false;
+		}
+		m_queriesCreated = false;
+	}
+}
+
+void FrameTimer::beginFrame()
+{
+	const Clock::time_point now = Clock::now();
+	if (m_started) {
+		m_frameTime = milliseconds(now - m_frameStart);
+	}
+	m_frameStart = now;
+	m_sectionStart = now;
+	m_started = true;
+
+	if (!m_queriesCreated) return;
+	readTimings();
+	QuerySet& set = m_querySets[m_currentSet];
+	set.names.clear();
+	set.cpu.clear();
+}
+
+void FrameTimer::mark(const std::string& name)
+{
+	if (!m_queriesCreated) return;
+	QuerySet& set = m_querySets[m_currentSet];
+	if (set.names.size() >= MaxQueries) return;
+
+	const Clock::time_point now = Clock::now();
+	if (!set.names.empty()) {
+		set.cpu.push_back(milliseconds(now - m_sectionStart));
+	}
+	m_sectionStart = now;
+
+	glQueryCounter(set.queries[set.names.size()], GL_TIMESTAMP);
+	set.names.push_back(name);
+}
+
+void FrameTimer::endFrame()
+{
+	if (!m_queriesCreated) return;
+	mark("");
+	QuerySet& set = m_querySets[m_currentSet];
+	set.pending = true;
+	m_currentSet = (m_currentSet + 1) % NumQuerySets;
+}
+
+void FrameTimer::readTimings()
+{
+	// Oldest set (written NumQuerySets - 1 frames ago)
+	QuerySet& set = m_querySets[m_currentSet];
+	if (!set.pending || set.names.size() < 2) return;
+	GLint available = 0;
+	glGetQueryObjectiv(set.queries[set.names.size() - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available) return; // Still not done: keep the old timings
+
+	m_timings.clear();
+	GLuint64 first = 0;
+	glGetQueryObjectui64v(set.queries[0], GL_QUERY_RESULT, &first);
+	GLuint64 previous = first;
+	for (std::size_t i = 1; i < set.names.size(); ++i) {
+		GLuint64 current = 0;
+		glGetQueryObjectui64v(set.queries[i], GL_QUERY_RESULT, &current);
+		Timing timing;
+		timing.name = set.names[i - 1];
+		timing.cpu = set.cpu[i - 1];
+		timing.gpu = float(current - previous) * 1e-6f;
+		m_timings.push_back(timing);
+		previous = current;
+	}
+	m_gpuFrameTime = float(previous - first) * 1e-6f;
+	set.pending = false;
+}
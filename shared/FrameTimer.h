@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// CPU and GPU time of the passes of a frame
+//
+// mark(name) starts a section: it records the CPU time and a GPU
+// timestamp (glQueryCounter). The GPU results are read NumQuerySets - 1
+// frames later and only if they are available, so measuring never
+// waits on the GPU. A "frame" is any sequence of sections measured
+// repeatedly (e.g. the passes of the GPU sort in 13_Particules_compute).
+//
+// The CPU time of a section is the time spent submitting its commands;
+// it includes any wait on the GPU inside the section (glFinish, a
+// read back...), which is how a stall shows up.
+class FrameTimer
+{
+public:
+	// Name and time (ms) of a section
+	struct Timing {
+		std::string name;
+		float cpu = 0.0f;
+		float gpu = 0.0f;
+	};
+
+	FrameTimer() = default;
+	~FrameTimer();
+	FrameTimer(const FrameTimer&) = delete;
+	FrameTimer& operator=(const FrameTimer&) = delete;
+
+	void create();
+	void release();
+
+	// ------------------------------------------------------------------------
+	// start a frame (read the timings of the oldest frame in flight)
+	void beginFrame();
+	// start a section (ends the previous one)
+	void mark(const std::string& name);
+	// end the last section and the frame
+	void endFrame();
+
+	// Sections of the last measured frame
+	const std::vector<Timing>& timings() const { return m_timings; }
+	// CPU time between the last two beginFrame (ms)
+	float frameTime() const { return m_frameTime; }
+	// GPU time of the last measured frame (first to last mark, ms)
+	float gpuFrameTime() const { return m_gpuFrameTime; }
+
+private:
+	using Clock = std::chrono::high_resolution_clock;
+	void readTimings();
+
+	// Query sets (one per frame in flight)
+	static const int NumQuerySets = 3;
+	static const int MaxQueries = 16;
+	struct QuerySet {
+		GLuint queries[MaxQueries];
+		std::vector<std::string> names; // names[i]: section between i and i+1
+		std::vector<float> cpu;         // CPU time of the sections (ms)
+		bool pending = false;
+	};
+	QuerySet m_querySets[NumQuerySets];
+	int m_currentSet = 0;
+	bool m_queriesCreated = false;
+
+	Clock::time_point m_frameStart;
+	Clock::time_point m_sectionStart;
+	bool m_started = false;
+
+	std::vector<Timing> m_timings;
+	float m_frameTime = 0.0f;
+	float m_gpuFrameTime = 0.0f;
+};
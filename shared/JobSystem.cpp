@@ -0,0 +1,138 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+
+namespace {
+	// Queue index of the current thread (workers only)
+	thread_local int t_queueIndex = -1;
+	thread_local const void* t_owner = nullptr;
+}
+
+JobSystem::JobSystem(unsigned int numThreads)
+{
+	if (numThreads == 0) {
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	const unsigned int numWorkers = numThreads - 1;
+	for (unsigned int i = 0; i < numWorkers + 1; ++i) {
+		m_queues.emplace_back(std::make_unique<WorkQueue>());
+	}
+	for (unsigned int i = 0; i < numWorkers; ++i) {
+		m_workers.emplace_back(&JobSystem::workerLoop, this, i);
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_stop = true;
+	}
+	m_wakeUp.notify_all();
+	for (auto& worker : m_workers) {
+		worker.join();
+	}
+}
+
+JobSystem& JobSystem::instance()
+{
+	static JobSystem jobs;
+	return jobs;
+}
+
+void JobSystem::parallelFor(std::size_t begin, std::size_t end, std::size_t grain, const RangeFunction& f)
+{
+	if (begin >= end) return;
+	grain = std::max<std::size_t>(grain, 1);
+	const std::size_t numChunks = (end - begin + grain - 1) / grain;
+	if (numChunks == 1 || m_workers.empty()) {
+		f(begin, end);
+		return;
+	}
+
+	// Distribute the chunks over all the queues (round robin),
+	// the idle workers will steal the rest.
+	std::atomic<std::size_t> pending{ numChunks };
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_queuedJobs += numChunks;
+	}
+	const std::size_t numQueues = m_queues.size();
+	for (std::size_t q = 0; q < numQueues; ++q)
+	{
+		WorkQueue& queue = *m_queues[q];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		for (std::size_t c = q; c < numChunks; c += numQueues) {
+			const std::size_t chunkBegin = begin + c * grain;
+			queue.jobs.push_back({ &f, chunkBegin, std::min(chunkBegin + grain, end), &pending });
+		}
+	}
+	m_wakeUp.notify_all();
+
+	// Help until all the chunks are done
+	const unsigned int index = (t_owner == this && t_queueIndex >= 0) ? unsigned(t_queueIndex) : unsigned(m_workers.size());
+	Job job;
+	while (pending.load(std::memory_order_acquire) != 0)
+	{
+		if (popOrSteal(index, job)) {
+			execute(job);
+		}
+		else {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void JobSystem::workerLoop(unsigned int index)
+{
+	t_queueIndex = int(index);
+	t_owner = this;
+	Job job;
+	while (true)
+	{
+		if (popOrSteal(index, job)) {
+			execute(job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		m_wakeUp.wait(lock, [this]() { return m_stop || m_queuedJobs.load() != 0; });
+		if (m_stop) return;
+	}
+}
+
+bool JobSystem::popOrSteal(unsigned int index, Job& job)
+{
+	// Own queue first (back: most recent, still in cache)
+	{
+		WorkQueue& queue = *m_queues[index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.jobs.empty()) {
+			job = queue.jobs.back();
+			queue.jobs.pop_back();
+			--m_queuedJobs;
+			return true;
+		}
+	}
+
+	// Steal from the others (front: oldest)
+	const std::size_t numQueues = m_queues.size();
+	for (std::size_t i = 1; i < numQueues; ++i)
+	{
+		WorkQueue& queue = *m_queues[(index + i) % numQueues];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.jobs.empty()) {
+			job = queue.jobs.front();
+			queue.jobs.pop_front();
+			--m_queuedJobs;
+			return true;
+		}
+	}
+	return false;
+}
+
+void JobSystem::execute(const Job& job)
+{
+	(*job.f)(job.begin, job.end);
+	job.pending->fetch_sub(1, std::memory_order_release);
+}
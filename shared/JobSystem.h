@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed pool of worker threads with one work-stealing deque per worker.
+//
+// Usage:
+// JobSystem jobs; // One thread per core
+// jobs.parallelFor(0, n, 1024, [&](std::size_t begin, std::size_t end) {
+//     for (std::size_t i = begin; i < end; ++i) { ... }
+// });
+//
+// The calling thread also executes chunks while waiting, so parallelFor
+// can be called from inside a job.
+class JobSystem
+{
+public:
+	// Range function: process the elements [begin, end)
+	using RangeFunction = std::function<void(std::size_t, std::size_t)>;
+
+	// ------------------------------------------------------------------------
+	// numThreads: total number of threads working on a parallelFor
+	// (calling thread included). 0 means one per hardware thread.
+	explicit JobSystem(unsigned int numThreads = 0);
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// ------------------------------------------------------------------------
+	// Split [begin, end) in chunks of "grain" elements and execute them
+	// on all the threads. Return when all the chunks are done.
+	void parallelFor(std::size_t begin, std::size_t end, std::size_t grain, const RangeFunction& f);
+
+	// Number of threads (calling thread included)
+	unsigned int numThreads() const { return unsigned(m_workers.size()) + 1; }
+
+	// Shared instance (one thread per core)
+	static JobSystem& instance();
+
+private:
+	// A chunk of a parallelFor (no allocation)
+	struct Job {
+		const RangeFunction* f;
+		std::size_t begin;
+		std::size_t end;
+		std::atomic<std::size_t>* pending;
+	};
+
+	// Deque of a thread: the owner works at the back, thieves steal at the front
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	void workerLoop(unsigned int index);
+	bool popOrSteal(unsigned int index, Job& job);
+	static void execute(const Job& job);
+
+private:
+	std::vector<std::thread> m_workers;
+	// One queue per worker + one for the external threads (last one)
+	std::vector<std::unique_ptr<WorkQueue>> m_queues;
+
+	// Sleeping workers
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wakeUp;
+	std::atomic<std::size_t> m_queuedJobs{ 0 };
+	bool m_stop = false;
+};
@@ -0,0 +1,321 @@
+#include "PickingService.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace {
+	// Pixel readback: (object ID, primitive ID) then depth
+	const GLintptr IdsOffset = 0;
+	const GLintptr DepthOffset = 2 * sizeof(uint32_t);
+	const GLsizeiptr PixelSize = 2 * sizeof(uint32_t) + sizeof(float);
+	// Region readback: (object ID, primitive ID) per pixel
+	const GLsizeiptr RegionPixelSize = 2 * sizeof(uint32_t);
+	// Pixels per job of the region scan (small regions stay on this thread)
+	const std::size_t ScanGrain = 16 * 1024;
+}
+
+PickingService::~PickingService()
+{
+	destroy();
+}
+
+bool PickingService::create(int width, int height, unsigned int slots, uint32_t maxObjects)
+{
+	destroy();
+
+	// Readback buffers (GPU -> CPU: GL_STREAM_READ)
+	m_slots.resize(slots > 0 ? slots : 1);
+	for (Slot& slot : m_slots) {
+		glGenBuffers(1, &slot.buffer);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+		glBufferData(GL_PIXEL_PACK_BUFFER, PixelSize, nullptr, GL_STREAM_READ);
+		slot.capacity = PixelSize;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	m_oldest = 0;
+	m_inFlight = 0;
+
+	// Region selections: allocated once
+	m_maxObjects = maxObjects;
+	m_bits.reset(new std::atomic<uint64_t>[(maxObjects + 63) / 64]);
+	m_regionIds.clear();
+	m_regionIds.reserve(maxObjects);
+
+	glGenFramebuffers(1, &m_framebuffer);
+	return resize(width, height);
+}
+
+void PickingService::destroy()
+{
+	for (Slot& slot : m_slots) {
+		if (slot.fence != nullptr) {
+			glDeleteSync(slot.fence);
+		}
+		glDeleteBuffers(1, &slot.buffer);
+	}
+	m_slots.clear();
+	m_oldest = 0;
+	m_inFlight = 0;
+	if (m_framebuffer != 0) {
+		glDeleteFramebuffers(1, &m_framebuffer);
+		glDeleteTextures(1, &m_ids);
+		glDeleteTextures(1, &m_depth);
+	}
+	m_framebuffer = m_ids = m_depth = 0;
+	m_bits.reset();
+	m_regionIds = std::vector<uint32_t>();
+	m_maxObjects = 0;
+}
+
+bool PickingService::resize(int width, int height)
+{
+	// Minimized window: keep the previous attachments
+	if (width <= 0 || height <= 0) {
+		return true;
+	}
+	m_width = width;
+	m_height = height;
+
+	// New textures (immutable storage cannot be resized)
+	if (m_ids != 0) {
+		glDeleteTextures(1, &m_ids);
+		glDeleteTextures(1, &m_depth);
+	}
+	glGenTextures(1, &m_ids);
+	glBindTexture(GL_TEXTURE_2D, m_ids);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32UI, width, height);
+	glGenTextures(1, &m_depth);
+	glBindTexture(GL_TEXTURE_2D, m_depth);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, width, height);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_ids, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depth, 0);
+	const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (!complete) {
+		std::cerr << "Picking framebuffer is not complete\n";
+	}
+	return complete;
+}
+
+void PickingService::begin()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+	glViewport(0, 0, m_width, m_height);
+	// Integer attachment: glClearColor does not apply
+	const GLuint noObject[4] = { NoObject, 0, 0, 0 };
+	const GLfloat farDepth = 1.0f;
+	glClearBufferuiv(GL_COLOR, 0, noObject);
+	glClearBufferfv(GL_DEPTH, 0, &farDepth);
+}
+
+void PickingService::end()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, m_width, m_height);
+}
+
+PickingService::Slot* PickingService::acquireSlot()
+{
+	if (m_inFlight == m_slots.size()) {
+		return nullptr;
+	}
+	Slot& slot = m_slots[(m_oldest + m_inFlight) % m_slots.size()];
+	m_inFlight++;
+	return &slot;
+}
+
+bool PickingService::request(int x, int y, Callback callback)
+{
+	if (x < 0 || y < 0 || x >= m_width || y >= m_height) {
+		return false;
+	}
+	Slot* slot = acquireSlot();
+	if (slot == nullptr) {
+		return false;
+	}
+
+	// Copies into the buffer (the pointer is an offset): queued, no wait.
+	// The read framebuffer and the pack alignment of the caller are restored
+	GLint readFramebuffer = 0;
+	GLint packAlignment = 4;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+	glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glReadPixels(x, y, 1, 1, GL_RG_INTEGER, GL_UNSIGNED_INT, reinterpret_cast<void*>(IdsOffset));
+	glReadPixels(x, y, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, reinterpret_cast<void*>(DepthOffset));
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, GLuint(readFramebuffer));
+
+	slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot->region = false;
+	slot->callback = std::move(callback);
+	slot->result = Result();
+	slot->result.x = x;
+	slot->result.y = y;
+	return true;
+}
+
+bool PickingService::requestRegion(int x0, int y0, int x1, int y1, RegionCallback callback)
+{
+	const int xMin = std::max(std::min(x0, x1), 0);
+	const int yMin = std::max(std::min(y0, y1), 0);
+	const int xMax = std::min(std::max(x0, x1), m_width - 1);
+	const int yMax = std::min(std::max(y0, y1), m_height - 1);
+	if (xMin > xMax || yMin > yMax) {
+		return false;
+	}
+	Slot* slot = acquireSlot();
+	if (slot == nullptr) {
+		return false;
+	}
+	const int width = xMax - xMin + 1;
+	const int height = yMax - yMin + 1;
+
+	// Grow the buffer if needed (the slot is not in flight)
+	const GLsizeiptr size = GLsizeiptr(width) * height * RegionPixelSize;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+	if (slot->capacity < size) {
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+		slot->capacity = size;
+	}
+	GLint readFramebuffer = 0;
+	GLint packAlignment = 4;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+	glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glReadPixels(xMin, yMin, width, height, GL_RG_INTEGER, GL_UNSIGNED_INT, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, GLuint(readFramebuffer));
+
+	slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot->region = true;
+	slot->regionCallback = std::move(callback);
+	slot->regionResult = RegionResult();
+	slot->regionResult.x = xMin;
+	slot->regionResult.y = yMin;
+	slot->regionResult.width = width;
+	slot->regionResult.height = height;
+	return true;
+}
+
+void PickingService::poll()
+{
+	for (std::size_t i = 0; i < m_inFlight; ++i) {
+		Slot& slot = m_slots[(m_oldest + i) % m_slots.size()];
+		slot.result.frames++;
+		slot.regionResult.frames++;
+	}
+
+	// Deliver in order of submission, stop at the first one still in flight
+	while (m_inFlight > 0)
+	{
+		Slot& slot = m_slots[m_oldest];
+		// Timeout 0: only check (the flush makes sure the fence is submitted)
+		const GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+			return;
+		}
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+
+		// The copy is done: mapping does not stall
+		const GLsizeiptr size = slot.region ? GLsizeiptr(slot.regionResult.width) * slot.regionResult.height * RegionPixelSize : PixelSize;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+		const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+		if (data != nullptr) {
+			read(slot, data);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		// Free the slot before the callback (it may request again)
+		m_oldest = (m_oldest + 1) % m_slots.size();
+		m_inFlight--;
+		if (slot.region) {
+			const RegionResult result = slot.regionResult;
+			RegionCallback callback = std::move(slot.regionCallback);
+			slot.regionCallback = nullptr;
+			if (callback) {
+				callback(result);
+			}
+		}
+		else {
+			const Result result = slot.result;
+			Callback callback = std::move(slot.callback);
+			slot.callback = nullptr;
+			if (callback) {
+				callback(result);
+			}
+		}
+	}
+}
+
+void PickingService::read(Slot& slot, const void* data)
+{
+	if (slot.region) {
+		RegionResult& result = slot.regionResult;
+		result.count = collectIds(static_cast<const uint32_t*>(data), std::size_t(result.width) * result.height);
+		result.ids = m_regionIds.data();
+	}
+	else {
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		std::memcpy(&slot.result.id, bytes + IdsOffset, sizeof(uint32_t));
+		std::memcpy(&slot.result.primitive, bytes + IdsOffset + sizeof(uint32_t), sizeof(uint32_t));
+		std::memcpy(&slot.result.depth, bytes + DepthOffset, sizeof(float));
+	}
+}
+
+std::size_t PickingService::collectIds(const uint32_t* pixels, std::size_t count)
+{
+	const std::size_t numWords = (std::size_t(m_maxObjects) + 63) / 64;
+	for (std::size_t w = 0; w < numWords; ++w) {
+		m_bits[w].store(0, std::memory_order_relaxed);
+	}
+
+	// 1) Set the bit of each ID (NoObject and the IDs >= maxObjects are
+	// skipped). Neighbour pixels mostly have the same ID: the bit is only
+	// written (atomic OR) the first time, the other pixels only read it.
+	std::atomic<uint64_t>* bits = m_bits.get();
+	const uint32_t maxObjects = m_maxObjects;
+	JobSystem::instance().parallelFor(0, count, ScanGrain, [bits, pixels, maxObjects](std::size_t begin, std::size_t end) {
+		uint32_t previous = NoObject;
+		for (std::size_t i = begin; i < end; ++i)
+		{
+			const uint32_t id = pixels[2 * i];
+			if (id == previous || id >= maxObjects) {
+				continue;
+			}
+			previous = id;
+			const uint64_t mask = uint64_t(1) << (id & 63);
+			std::atomic<uint64_t>& word = bits[id >> 6];
+			if ((word.load(std::memory_order_relaxed) & mask) == 0) {
+				word.fetch_or(mask, std::memory_order_relaxed);
+			}
+		}
+	});
+
+	// 2) List the bits set (parallelFor has joined: all the writes are visible)
+	m_regionIds.clear();
+	for (std::size_t w = 0; w < numWords; ++w)
+	{
+		uint64_t word = m_bits[w].load(std::memory_order_relaxed);
+		for (uint32_t bit = 0; word != 0; ++bit, word >>= 1) {
+			if (word & 1) {
+				m_regionIds.push_back(uint32_t(w * 64 + bit));
+			}
+		}
+	}
+	return m_regionIds.size();
+}
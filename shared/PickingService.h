@@ -0,0 +1,140 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Asynchronous picking (OpenGL 4.3)
+//
+// The objects are drawn with their ID in an offscreen framebuffer
+// (GL_RG32UI color + depth), never in the back buffer: the fragment
+// shader writes uvec2(object ID, gl_PrimitiveID), so the IDs are read
+// as is (no color encoding, no lookup table). request() reads the pixel
+// under the cursor with glReadPixels into a pixel buffer object: the copy
+// is queued on the GPU and a fence is inserted after it, so the call
+// returns immediately. poll(), called once per frame, checks the fences
+// without waiting and calls the callback of the finished readbacks
+// (usually one or two frames later).
+//
+// requestRegion() reads a rectangle (marquee selection) the same way.
+// When it arrives, the pixels are scanned in parallel (JobSystem) to set
+// one bit per object ID, then the bitset gives the unique IDs in order:
+// O(pixels + maxObjects / 64), and no allocation once the buffers have
+// reached the size of the largest rectangle.
+//
+// Usage:
+// picking.begin();                    // Bind and clear the ID framebuffer
+// ... draw the objects, the fragment shader writes the IDs (uvec2) ...
+// picking.request(x, y, callback);    // Queue the readback
+// picking.end();                      // Back to the default framebuffer
+// ...
+// picking.poll();                     // Each frame: deliver the results
+class PickingService
+{
+public:
+	// Value of the pixels without object
+	static const uint32_t NoObject = 0xFFFFFFFFu;
+
+	struct Result {
+		uint32_t id = NoObject;  // Object ID written by the fragment shader
+		uint32_t primitive = 0;  // gl_PrimitiveID in the draw of the object
+		float depth = 1.0f;      // Window depth [0, 1] (1: no object)
+		int x = 0;               // Pixel read (origin bottom left)
+		int y = 0;
+		unsigned int frames = 0; // Number of poll() before the delivery
+	};
+	using Callback = std::function<void(const Result&)>;
+
+	// Objects inside a rectangle (only valid during the callback)
+	struct RegionResult {
+		const uint32_t* ids = nullptr; // Unique object IDs (increasing)
+		std::size_t count = 0;
+		int x = 0;                     // Rectangle read (origin bottom left)
+		int y = 0;
+		int width = 0;
+		int height = 0;
+		unsigned int frames = 0;
+	};
+	using RegionCallback = std::function<void(const RegionResult&)>;
+
+	PickingService() = default;
+	~PickingService();
+
+	PickingService(const PickingService&) = delete;
+	PickingService& operator=(const PickingService&) = delete;
+
+	// ------------------------------------------------------------------------
+	// create the ID framebuffer (width x height) and slots readbacks
+	// in flight. The region selections report the IDs < maxObjects.
+	// return true if the framebuffer is complete
+	bool create(int width, int height, unsigned int slots = 3, uint32_t maxObjects = 1u << 16);
+	void destroy();
+	// reallocate the attachments (the readbacks in flight are kept)
+	bool resize(int width, int height);
+
+	// ------------------------------------------------------------------------
+	// bind the ID framebuffer, set its viewport, clear it (NoObject, depth 1)
+	void begin();
+	// rebind the default framebuffer with the viewport of the window
+	void end();
+
+	// ------------------------------------------------------------------------
+	// queue the readback of the pixel (x, y) (origin bottom left) after
+	// the draws issued since begin(). return false if the pixel is outside
+	// the framebuffer or if all the slots are in flight (never waits)
+	bool request(int x, int y, Callback callback);
+	// queue the readback of a rectangle (corners in any order, clamped to
+	// the framebuffer). Same rules as request()
+	bool requestRegion(int x0, int y0, int x1, int y1, RegionCallback callback);
+	// deliver the readbacks done by the GPU (never waits)
+	void poll();
+
+	// Number of readbacks in flight
+	std::size_t pending() const { return m_inFlight; }
+	uint32_t maxObjects() const { return m_maxObjects; }
+	GLuint framebuffer() const { return m_framebuffer; }
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+
+private:
+	// One readback in flight:
+	// - pixel: object ID, primitive ID then depth (12 bytes)
+	// - region: width x height (object ID, primitive ID)
+	struct Slot {
+		GLuint buffer = 0;
+		GLsizeiptr capacity = 0; // Size of the buffer (grows with the regions)
+		GLsync fence = nullptr;
+		bool region = false;
+		Callback callback;
+		RegionCallback regionCallback;
+		Result result;
+		RegionResult regionResult;
+	};
+
+	Slot* acquireSlot();
+	// Copy the readback (mapped) into the result of the slot
+	void read(Slot& slot, const void* data);
+	// Unique IDs of the pixels (object, primitive) into m_regionIds
+	std::size_t collectIds(const uint32_t* pixels, std::size_t count);
+
+	GLuint m_framebuffer = 0;
+	GLuint m_ids = 0;
+	GLuint m_depth = 0;
+	int m_width = 0;
+	int m_height = 0;
+
+	// Ring of slots: m_inFlight readbacks from m_oldest
+	std::vector<Slot> m_slots;
+	std::size_t m_oldest = 0;
+	std::size_t m_inFlight = 0;
+
+	// Region selections: one bit per object ID (set from several threads)
+	// and the list of the IDs found
+	uint32_t m_maxObjects = 0;
+	std::unique_ptr<std::atomic<uint64_t>[]> m_bits;
+	std::vector<uint32_t> m_regionIds;
+};
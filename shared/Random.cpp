@@ -0,0 +1,176 @@
+#include "Random.h"
+#include "CpuFeatures.h"
+
+#include <atomic>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RANDOM_X86 1
+#include <immintrin.h>
+#endif
+
+// GCC and Clang need to be told which instructions a function can use
+// (the rest of the file is compiled for the default architecture)
+#if defined(__GNUC__) || defined(__clang__)
+#define RANDOM_TARGET(arch) __attribute__((target(arch)))
+#else
+#define RANDOM_TARGET(arch)
+#endif
+
+namespace {
+	const float ToUniform = 1.0f / 16777216.0f;
+
+	void philoxScalar(const Philox4x32& philox, uint64_t counter, uint64_t high, float* out, std::size_t count)
+	{
+		for (std::size_t i = 0; i < count; i += 4, ++counter) {
+			const Philox4x32::Block b = philox.block(counter, high);
+			for (std::size_t w = 0; w < 4 && i + w < count; ++w) {
+				out[i + w] = uniformFloat(b.v[w]);
+			}
+		}
+	}
+
+#if defined(RANDOM_X86)
+	// Low and high 32 bits of a * b (4 lanes, SSE2 only has even lanes products)
+	inline void mulhilo(__m128i a, __m128i b, __m128i& lo, __m128i& hi)
+	{
+		const __m128i even = _mm_mul_epu32(a, b);
+		const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), b);
+		const __m128i lowMask = _mm_set1_epi64x(0xFFFFFFFF);
+		lo = _mm_or_si128(_mm_and_si128(even, lowMask), _mm_slli_epi64(odd, 32));
+		hi = _mm_or_si128(_mm_srli_epi64(even, 32), _mm_andnot_si128(lowMask, odd));
+	}
+
+	// 4 blocks (one per lane), written in the block order
+	void philoxSSE(const Philox4x32& philox, uint64_t counter, uint64_t high, float* out, std::size_t count)
+	{
+		const __m128i m0 = _mm_set1_epi32(int(Philox4x32::M0));
+		const __m128i m1 = _mm_set1_epi32(int(Philox4x32::M1));
+		const __m128 scale = _mm_set1_ps(ToUniform);
+		std::size_t i = 0;
+		for (; i + 16 <= count; i += 16, counter += 4)
+		{
+			// Counters of the 4 blocks (SoA)
+			__m128i c0 = _mm_set_epi32(int(uint32_t(counter + 3)), int(uint32_t(counter + 2)), int(uint32_t(counter + 1)), int(uint32_t(counter)));
+			__m128i c1 = _mm_set_epi32(int(uint32_t((counter + 3) >> 32)), int(uint32_t((counter + 2) >> 32)), int(uint32_t((counter + 1) >> 32)), int(uint32_t(counter >> 32)));
+			__m128i c2 = _mm_set1_epi32(int(uint32_t(high)));
+			__m128i c3 = _mm_set1_epi32(int(uint32_t(high >> 32)));
+			uint32_t k0 = uint32_t(philox.key());
+			uint32_t k1 = uint32_t(philox.key() >> 32);
+			for (int round = 0; round < Philox4x32::Rounds; ++round) {
+				__m128i lo0, hi0, lo1, hi1;
+				mulhilo(c0, m0, lo0, hi0);
+				mulhilo(c2, m1, lo1, hi1);
+				c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), _mm_set1_epi32(int(k0)));
+				c1 = lo1;
+				c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), _mm_set1_epi32(int(k1)));
+				c3 = lo0;
+				k0 += Philox4x32::W0;
+				k1 += Philox4x32::W1;
+			}
+			// 24 bits in [0, 1), then back to the block order
+			__m128 f0 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(c0, 8)), scale);
+			__m128 f1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(c1, 8)), scale);
+			__m128 f2 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(c2, 8)), scale);
+			__m128 f3 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(c3, 8)), scale);
+			_MM_TRANSPOSE4_PS(f0, f1, f2, f3);
+			_mm_storeu_ps(out + i, f0);
+			_mm_storeu_ps(out + i + 4, f1);
+			_mm_storeu_ps(out + i + 8, f2);
+			_mm_storeu_ps(out + i + 12, f3);
+		}
+		philoxScalar(philox, counter, high, out + i, count - i);
+	}
+
+	RANDOM_TARGET("avx2")
+	inline void mulhilo(__m256i a, __m256i b, __m256i& lo, __m256i& hi)
+	{
+		const __m256i even = _mm256_mul_epu32(a, b);
+		const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b);
+		lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+		hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+	}
+
+	// 8 blocks (one per lane), written in the block order
+	RANDOM_TARGET("avx2")
+	void philoxAVX2(const Philox4x32& philox, uint64_t counter, uint64_t high, float* out, std::size_t count)
+	{
+		const __m256i m0 = _mm256_set1_epi32(int(Philox4x32::M0));
+		const __m256i m1 = _mm256_set1_epi32(int(Philox4x32::M1));
+		const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256 scale = _mm256_set1_ps(ToUniform);
+		std::size_t i = 0;
+		for (; i + 32 <= count; i += 32, counter += 8)
+		{
+			// Counters of the 8 blocks (SoA), the upper word only changes
+			// if the lower one wraps
+			const __m256i low = _mm256_add_epi32(_mm256_set1_epi32(int(uint32_t(counter))), lanes);
+			const __m256i wrapped = _mm256_cmpgt_epi32(
+				_mm256_xor_si256(_mm256_set1_epi32(int(uint32_t(counter))), _mm256_set1_epi32(INT32_MIN)),
+				_mm256_xor_si256(low, _mm256_set1_epi32(INT32_MIN)));
+			__m256i c0 = low;
+			__m256i c1 = _mm256_sub_epi32(_mm256_set1_epi32(int(uint32_t(counter >> 32))), wrapped);
+			__m256i c2 = _mm256_set1_epi32(int(uint32_t(high)));
+			__m256i c3 = _mm256_set1_epi32(int(uint32_t(high >> 32)));
+			uint32_t k0 = uint32_t(philox.key());
+			uint32_t k1 = uint32_t(philox.key() >> 32);
+			for (int round = 0; round < Philox4x32::Rounds; ++round) {
+				__m256i lo0, hi0, lo1, hi1;
+				mulhilo(c0, m0, lo0, hi0);
+				mulhilo(c2, m1, lo1, hi1);
+				c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32(int(k0)));
+				c1 = lo1;
+				c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32(int(k1)));
+				c3 = lo0;
+				k0 += Philox4x32::W0;
+				k1 += Philox4x32::W1;
+			}
+			__m256 f0 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(c0, 8)), scale);
+			__m256 f1 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(c1, 8)), scale);
+			__m256 f2 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(c2, 8)), scale);
+			__m256 f3 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(c3, 8)), scale);
+			// 4x4 transpose in each 128 bits half: blocks 0-3 (low), 4-7 (high)
+			const __m256 t0 = _mm256_unpacklo_ps(f0, f1);
+			const __m256 t1 = _mm256_unpackhi_ps(f0, f1);
+			const __m256 t2 = _mm256_unpacklo_ps(f2, f3);
+			const __m256 t3 = _mm256_unpackhi_ps(f2, f3);
+			const __m256 b0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+			const __m256 b1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+			const __m256 b2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+			const __m256 b3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+			_mm256_storeu_ps(out + i, _mm256_permute2f128_ps(b0, b1, 0x20));      // blocks 0, 1
+			_mm256_storeu_ps(out + i + 8, _mm256_permute2f128_ps(b2, b3, 0x20));  // blocks 2, 3
+			_mm256_storeu_ps(out + i + 16, _mm256_permute2f128_ps(b0, b1, 0x31)); // blocks 4, 5
+			_mm256_storeu_ps(out + i + 24, _mm256_permute2f128_ps(b2, b3, 0x31)); // blocks 6, 7
+		}
+		philoxSSE(philox, counter, high, out + i, count - i);
+	}
+#endif
+
+	// Thread generators: one stream per thread (in the order of the first use)
+	std::atomic<uint64_t> s_nextStream{ 0 };
+}
+
+void Philox4x32::uniform(uint64_t counter, float* out, std::size_t count, uint64_t high) const
+{
+#if defined(RANDOM_X86)
+	if (cpuSupportsAVX2()) {
+		philoxAVX2(*this, counter, high, out, count);
+	}
+	else {
+		philoxSSE(*this, counter, high, out, count);
+	}
+#else
+	philoxScalar(*this, counter, high, out, count);
+#endif
+}
+
+PCG32& threadRandom()
+{
+	thread_local PCG32 generator(0x853C49E6748FEA9Bull, s_nextStream++);
+	return generator;
+}
+
+void seedThreadRandom(uint64_t seed)
+{
+	threadRandom().seed(seed);
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+// Random number generators (no OpenGL dependency)
+//
+// - PCG32: small state (128 bits), fast, one stream per object.
+// - Xoshiro256StarStar: 256 bits state, very fast 64 bits outputs.
+// - Philox4x32: counter based (Salmon et al., "Parallel Random Numbers:
+//   As Easy as 1, 2, 3"). The output is a function of (key, counter):
+//   no state to share between threads, any value can be computed
+//   directly and the same stream can be reproduced on the GPU
+//   (see 13_Particules_compute/particules_emit.comp).
+//   The batch functions use SSE2/AVX2 when available.
+//
+// None of them are thread safe: use one generator per thread
+// (or Philox with a different counter range per thread).
+
+#include <cstddef>
+#include <cstdint>
+
+// 24 bits random number converted in [0, 1)
+inline float uniformFloat(uint32_t v)
+{
+	return float(v >> 8) * (1.0f / 16777216.0f);
+}
+
+// PCG-XSH-RR 64/32 (O'Neill, pcg-random.org)
+class PCG32
+{
+public:
+	explicit PCG32(uint64_t seed = 0x853C49E6748FEA9Bull, uint64_t stream = 0xDA3E39CB94B95BDBull)
+	{
+		this->seed(seed, stream);
+	}
+
+	void seed(uint64_t seed, uint64_t stream = 0xDA3E39CB94B95BDBull)
+	{
+		m_state = 0;
+		m_increment = (stream << 1) | 1;
+		next();
+		m_state += seed;
+		next();
+	}
+
+	uint32_t next()
+	{
+		const uint64_t old = m_state;
+		m_state = old * 6364136223846793005ull + m_increment;
+		const uint32_t xorShifted = uint32_t(((old >> 18) ^ old) >> 27);
+		const uint32_t rotation = uint32_t(old >> 59);
+		return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+	}
+
+	// [0, 1) and [min, max)
+	float nextFloat() { return uniformFloat(next()); }
+	float nextFloat(float min, float max) { return min + (max - min) * nextFloat(); }
+
+private:
+	uint64_t m_state;
+	uint64_t m_increment;
+};
+
+// xoshiro256** (Blackman and Vigna), seeded with splitmix64
+class Xoshiro256StarStar
+{
+public:
+	explicit Xoshiro256StarStar(uint64_t seed = 1) { this->seed(seed); }
+
+	void seed(uint64_t seed)
+	{
+		for (uint64_t& s : m_state) {
+			seed += 0x9E3779B97F4A7C15ull;
+			uint64_t z = seed;
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			s = z ^ (z >> 31);
+		}
+	}
+
+	uint64_t next()
+	{
+		const uint64_t result = rotl(m_state[1] * 5, 7) * 9;
+		const uint64_t t = m_state[1] << 17;
+		m_state[2] ^= m_state[0];
+		m_state[3] ^= m_state[1];
+		m_state[1] ^= m_state[2];
+		m_state[0] ^= m_state[3];
+		m_state[2] ^= t;
+		m_state[3] = rotl(m_state[3], 45);
+		return result;
+	}
+
+	// [0, 1) and [min, max) (upper 24 bits)
+	float nextFloat() { return float(next() >> 40) * (1.0f / 16777216.0f); }
+	float nextFloat(float min, float max) { return min + (max - min) * nextFloat(); }
+
+private:
+	static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+	uint64_t m_state[4];
+};
+
+// Philox4x32-10: 4 random uint32 (a block) per 128 bits counter
+class Philox4x32
+{
+public:
+	struct Block {
+		uint32_t v[4];
+	};
+
+	// key: selects the stream (seed)
+	explicit Philox4x32(uint64_t key = 0) : m_key(key) {}
+
+	uint64_t key() const { return m_key; }
+
+	// ------------------------------------------------------------------------
+	// block number "counter" (high: upper 64 bits of the counter, optional)
+	Block block(uint64_t counter, uint64_t high = 0) const
+	{
+		uint32_t c[4] = { uint32_t(counter), uint32_t(counter >> 32), uint32_t(high), uint32_t(high >> 32) };
+		uint32_t k0 = uint32_t(m_key);
+		uint32_t k1 = uint32_t(m_key >> 32);
+		for (int round = 0; round < Rounds; ++round) {
+			const uint64_t p0 = uint64_t(M0) * c[0];
+			const uint64_t p1 = uint64_t(M1) * c[2];
+			const uint32_t next[4] = {
+				uint32_t(p1 >> 32) ^ c[1] ^ k0,
+				uint32_t(p1),
+				uint32_t(p0 >> 32) ^ c[3] ^ k1,
+				uint32_t(p0)
+			};
+			c[0] = next[0]; c[1] = next[1]; c[2] = next[2]; c[3] = next[3];
+			k0 += W0;
+			k1 += W1;
+		}
+		return { { c[0], c[1], c[2], c[3] } };
+	}
+
+	// ------------------------------------------------------------------------
+	// Batch: out[i] = word (i % 4) of the block (counter + i / 4), in [0, 1)
+	// The blocks are computed 8 (AVX2) or 4 (SSE2) at a time.
+	void uniform(uint64_t counter, float* out, std::size_t count, uint64_t high = 0) const;
+	// 8 and 16 floats (2 and 4 blocks)
+	void uniform8(uint64_t counter, float* out, uint64_t high = 0) const { uniform(counter, out, 8, high); }
+	void uniform16(uint64_t counter, float* out, uint64_t high = 0) const { uniform(counter, out, 16, high); }
+
+	// Constants of the reference implementation (Random123)
+	static const uint32_t M0 = 0xD2511F53u;
+	static const uint32_t M1 = 0xCD9E8D57u;
+	static const uint32_t W0 = 0x9E3779B9u;
+	static const uint32_t W1 = 0xBB67AE85u;
+	static const int Rounds = 10;
+
+private:
+	uint64_t m_key;
+};
+
+// ----------------------------------------------------------------------------
+// Generator of the calling thread (seeded from the thread id unless seedThreadRandom is called)
+PCG32& threadRandom();
+void seedThreadRandom(uint64_t seed);
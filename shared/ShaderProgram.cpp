@@ -101,7 +101,7 @@ ShaderProgram::ShaderProgram()
 	m_ID = glCreateProgram();
 }
 
-bool ShaderProgram::addShaderFromSource(GLenum shader_type, const std::string& path) {
+bool ShaderProgram::addShaderFromSource(GLenum shader_type, const std::string& path, const std::string& defines) {
 	std::string shader_type_str = [&]() -> std::string {
 		if (shader_type == GL_VERTEX_SHADER) {
 			return "VERTEX";
@@ -148,6 +148,20 @@ bool ShaderProgram::addShaderFromSource(GLenum shader_type, const std::string& p
 		std::cerr << e.what() << std::endl;
 		return false;
 	}
+	if (!defines.empty()) {
+		// The #version directive must stay first
+		std::size_t position = 0;
+		const std::size_t version = code.find("#version");
+		if (version != std::string::npos) {
+			position = code.find('\n', version);
+			if (position == std::string::npos) {
+				code += '\n';
+				position = code.size() - 1;
+			}
+			position++;
+		}
+		code.insert(position, defines);
+	}
 	GLuint shader_id = glCreateShader(shader_type);
 	const char* code_c_str = code.c_str();
 	glShaderSource(shader_id, 1, &code_c_str, NULL);
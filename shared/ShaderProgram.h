@@ -69,8 +69,10 @@ public:
    
    // ------------------------------------------------------------------------
    // attach shader from sources 
+   // defines: inserted after the #version line (e.g. "#define TAPS 8\n"),
+   // to compile variants of the same source
    // return true if sucessfull
-   bool addShaderFromSource(GLenum type, const std::string& path);
+   bool addShaderFromSource(GLenum type, const std::string& path, const std::string& defines = "");
    
    // ------------------------------------------------------------------------
    // link the different shaders to make a full program 
@@ -0,0 +1,98 @@
+#include "StreamingBuffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+StreamingBuffer::~StreamingBuffer()
+{
+	destroy();
+}
+
+bool StreamingBuffer::create(std::size_t regionSize, unsigned int regions)
+{
+	destroy();
+	m_regionSize = regionSize;
+	m_fences.assign(std::max(regions, 1u), nullptr);
+	// The first call to nextRegion() returns the region 0
+	m_current = numRegions() - 1;
+	m_lastWait = 0.0f;
+	m_totalWait = 0.0f;
+	m_stalls = 0;
+
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	// Storage of size 0 is not allowed
+	const GLsizeiptr size = GLsizeiptr(std::max<std::size_t>(m_regionSize * numRegions(), 1));
+	glGenBuffers(1, &m_buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+	glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+	m_mapped = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	if (m_mapped == nullptr) {
+		std::cerr << "Impossible to map the streaming buffer\n";
+		destroy();
+		return false;
+	}
+	return true;
+}
+
+void StreamingBuffer::destroy()
+{
+	for (GLsync& sync : m_fences) {
+		if (sync != nullptr) {
+			glDeleteSync(sync);
+			sync = nullptr;
+		}
+	}
+	if (m_buffer != 0) {
+		if (m_mapped != nullptr) {
+			glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &m_buffer);
+	}
+	m_buffer = 0;
+	m_mapped = nullptr;
+}
+
+void* StreamingBuffer::nextRegion()
+{
+	m_current = (m_current + 1) % numRegions();
+	m_lastWait = 0.0f;
+
+	GLsync& sync = m_fences[m_current];
+	if (sync != nullptr)
+	{
+		// Check without waiting first (usual case: the GPU is done)
+		GLenum status = glClientWaitSync(sync, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED)
+		{
+			const auto start = std::chrono::high_resolution_clock::now();
+			GLbitfield waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+			do {
+				status = glClientWaitSync(sync, waitFlags, 1000000); // 1 ms
+				waitFlags = 0;
+			} while (status == GL_TIMEOUT_EXPIRED);
+			const std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+			m_lastWait = elapsed.count();
+			m_totalWait += m_lastWait;
+			m_stalls++;
+		}
+		if (status == GL_WAIT_FAILED) {
+			std::cerr << "glClientWaitSync failed on the streaming buffer\n";
+		}
+		glDeleteSync(sync);
+		sync = nullptr;
+	}
+	return currentPointer();
+}
+
+void StreamingBuffer::fence()
+{
+	GLsync& sync = m_fences[m_current];
+	if (sync != nullptr) {
+		glDeleteSync(sync);
+	}
+	sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <vector>
+
+// Buffer to stream data to the GPU every frame (OpenGL 4.4)
+//
+// The buffer is split in N regions (3 by default) and stays mapped
+// (GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT): the CPU writes directly
+// in GPU memory while the GPU reads the regions written the frames before.
+// A fence per region guarantees that a region is not overwritten
+// while the GPU still uses it.
+//
+// Usage (each frame):
+// void* ptr = buffer.nextRegion(); // Wait (if needed) and get the next region
+// ... write the data in ptr ...
+// glDrawArrays(..., buffer.currentOffset() / stride, count);
+// buffer.fence(); // After the commands that read the current region
+class StreamingBuffer
+{
+public:
+	StreamingBuffer() = default;
+	~StreamingBuffer();
+
+	StreamingBuffer(const StreamingBuffer&) = delete;
+	StreamingBuffer& operator=(const StreamingBuffer&) = delete;
+
+	// ------------------------------------------------------------------------
+	// create the buffer (regions * regionSize bytes) and map it
+	// return true if sucessfull
+	bool create(std::size_t regionSize, unsigned int regions = 3);
+	void destroy();
+
+	// ------------------------------------------------------------------------
+	// wait until the next region is not used anymore by the GPU,
+	// make it the current region and return its address
+	void* nextRegion();
+
+	// ------------------------------------------------------------------------
+	// insert a fence for the current region
+	// (after all the commands that read the current region)
+	void fence();
+
+	// Current region
+	void* currentPointer() const { return m_mapped + m_current * m_regionSize; }
+	std::size_t currentOffset() const { return m_current * m_regionSize; }
+	unsigned int currentRegion() const { return m_current; }
+
+	GLuint bufferId() const { return m_buffer; }
+	std::size_t regionSize() const { return m_regionSize; }
+	unsigned int numRegions() const { return unsigned(m_fences.size()); }
+
+	// Instrumentation: time spent waiting on fences
+	float lastWaitTime() const { return m_lastWait; } // ms (last nextRegion)
+	float totalWaitTime() const { return m_totalWait; } // ms (since create)
+	unsigned int stallCount() const { return m_stalls; } // number of nextRegion that waited
+
+private:
+	GLuint m_buffer = 0;
+	unsigned char* m_mapped = nullptr;
+	std::size_t m_regionSize = 0;
+	unsigned int m_current = 0;
+	std::vector<GLsync> m_fences;
+
+	float m_lastWait = 0.0f;
+	float m_totalWait = 0.0f;
+	unsigned int m_stalls = 0;
+};
@@ -0,0 +1,378 @@
+#include "TextureCache.h"
+
+#include <algorithm>
+#include <iostream>
+
+TextureCache::TextureCache(std::size_t pixelBudget, std::size_t textureBudget) :
+	m_textureBudget(textureBudget),
+	m_pixelBudget(pixelBudget)
+{
+	m_loader.setDecodedCallback([this](GLuint texture, const TextureLoader::DecodedImage& image) {
+		onDecoded(texture, image);
+	});
+	m_loader.setKnownCallback([this](GLuint texture, std::uint64_t hash, TextureLoader::KnownContent& content) {
+		return onKnown(texture, hash, content);
+	});
+}
+
+int TextureCache::variantOf(const TextureSettings& settings)
+{
+	const bool mipmaps = settings.minFilter != GL_NEAREST && settings.minFilter != GL_LINEAR;
+	return (settings.flipVertically ? Flipped : 0) | (mipmaps ? Mipmapped : 0) | (settings.immutable ? Immutable : 0);
+}
+
+GLuint TextureCache::acquire(const std::string& path, const TextureSettings& settings, TextureLoader::Callback callback)
+{
+	const PathKey key(path, variantOf(settings));
+
+	// Same path, or same content under another path (file already hashed)
+	auto found = m_byPath.find(key);
+	auto hash = m_contentOfPath.find(path);
+	if (found == m_byPath.end() && hash != m_contentOfPath.end())
+	{
+		auto shared = m_byContent.find(ContentKey(hash->second, key.second));
+		if (shared != m_byContent.end()) {
+			addPath(*shared->second, key);
+			found = m_byPath.find(key);
+		}
+	}
+
+	if (found != m_byPath.end())
+	{
+		Entry& entry = *found->second;
+		entry.refs++;
+		reuse(entry);
+		m_stats.textureHits++;
+		if (callback) {
+			if (entry.loading) {
+				entry.waiting.push_back(std::move(callback));
+			} else {
+				callback(entry.texture, !entry.failed);
+			}
+		}
+		return entry.texture;
+	}
+
+	// First request: read in background, then decoded or shared (onKnown).
+	// A file already hashed is not read again: uploaded from the cached
+	// pixels if they are still there
+	auto loaded = [this](GLuint texture, bool loaded) {
+		onLoaded(texture, loaded);
+	};
+	const GLuint texture = hash != m_contentOfPath.end()
+		? m_loader.loadKnown(path, hash->second, settings, loaded)
+		: m_loader.load(path, settings, loaded);
+	Entry& entry = addEntry(texture, key);
+	entry.refs = 1;
+	entry.loading = true;
+	if (callback) {
+		entry.waiting.push_back(std::move(callback));
+	}
+	return texture;
+}
+
+void TextureCache::release(GLuint texture)
+{
+	auto found = m_entries.find(texture);
+	if (found == m_entries.end()) {
+		std::cerr << "TextureCache: release of an unknown texture " << texture << std::endl;
+		return;
+	}
+	Entry& entry = *found->second;
+	if (entry.unused) {
+		std::cerr << "TextureCache: release of an unreferenced texture " << texture << std::endl;
+		return;
+	}
+	entry.refs--;
+	// A texture still loading is retired once uploaded (onLoaded)
+	if (entry.refs <= 0 && !entry.loading) {
+		retire(entry);
+	}
+}
+
+void TextureCache::destroy()
+{
+	m_loader.finish();
+	for (auto& entry : m_entries) {
+		glDeleteTextures(1, &entry.second->texture);
+	}
+	std::map<ContentKey, Entry*> loaded;
+	loaded.swap(m_byContent);
+	m_entries.clear();
+	m_byPath.clear();
+	m_unused.clear();
+	m_unusedBytes = 0;
+	// The decoded pixels stay cached
+	for (const auto& content : loaded) {
+		updateKnown(content.first.first, content.first.second & Flipped);
+	}
+	m_loader.release();
+}
+
+TextureCache::Entry& TextureCache::addEntry(GLuint texture, const PathKey& key)
+{
+	std::unique_ptr<Entry>& entry = m_entries[texture];
+	entry = std::make_unique<Entry>();
+	entry->texture = texture;
+	entry->variant = key.second;
+	addPath(*entry, key);
+	return *entry;
+}
+
+void TextureCache::addPath(Entry& entry, const PathKey& key)
+{
+	entry.paths.push_back(key);
+	m_byPath[key] = &entry;
+}
+
+void TextureCache::erase(Entry& entry)
+{
+	reuse(entry);
+	for (const PathKey& key : entry.paths) {
+		m_byPath.erase(key);
+	}
+	auto content = m_byContent.find(ContentKey(entry.hash, entry.variant));
+	if (content != m_byContent.end() && content->second == &entry) {
+		// A copy of the same image takes over, if any
+		m_byContent.erase(content);
+		for (auto& other : m_entries) {
+			const Entry& copy = *other.second;
+			if (&copy != &entry && !copy.loading && !copy.failed && copy.hash == entry.hash && copy.variant == entry.variant) {
+				m_byContent[ContentKey(entry.hash, entry.variant)] = other.second.get();
+				break;
+			}
+		}
+		updateKnown(entry.hash, entry.variant & Flipped);
+	}
+	GLuint texture = entry.texture;
+	glDeleteTextures(1, &texture);
+	m_entries.erase(texture);
+}
+
+void TextureCache::retire(Entry& entry)
+{
+	// A failed load is tried again at the next request. An entry merged
+	// in another one has no paths anymore
+	const std::size_t bytes = bytesOf(entry);
+	if (entry.failed || entry.paths.empty() || bytes > m_textureBudget) {
+		erase(entry);
+		return;
+	}
+	if (entry.unused) {
+		return;
+	}
+	entry.unused = true;
+	m_unused.push_front(&entry);
+	entry.unusedPosition = m_unused.begin();
+	m_unusedBytes += bytes;
+	// Delete the least recently released textures
+	while (m_unusedBytes > m_textureBudget) {
+		erase(*m_unused.back());
+	}
+}
+
+void TextureCache::reuse(Entry& entry)
+{
+	if (entry.unused) {
+		m_unused.erase(entry.unusedPosition);
+		m_unusedBytes -= bytesOf(entry);
+		entry.unused = false;
+	}
+}
+
+std::size_t TextureCache::bytesOf(const Entry& entry)
+{
+	const std::size_t bytes = std::size_t(entry.width) * entry.height * 4;
+	return (entry.variant & Mipmapped) ? bytes * 4 / 3 : bytes;
+}
+
+void TextureCache::merge(Entry& entry, Entry& shared)
+{
+	for (const PathKey& key : entry.paths) {
+		shared.paths.push_back(key);
+		m_byPath[key] = &shared;
+	}
+	entry.paths.clear();
+	shared.refs += entry.refs;
+	entry.refs = 0;
+	if (shared.refs > 0) {
+		reuse(shared);
+	}
+	m_stats.textureHits++;
+
+	std::vector<TextureLoader::Callback> waiting;
+	waiting.swap(entry.waiting);
+	for (TextureLoader::Callback& callback : waiting) {
+		callback(shared.texture, !shared.failed);
+	}
+}
+
+void TextureCache::onDecoded(GLuint texture, const TextureLoader::DecodedImage& image)
+{
+	auto found = m_entries.find(texture);
+	if (found == m_entries.end()) {
+		return;
+	}
+	if (image.texture != texture)
+	{
+		// Immutable storage: the entry follows the new texture
+		std::unique_ptr<Entry> moved = std::move(found->second);
+		m_entries.erase(found);
+		moved->texture = image.texture;
+		found = m_entries.emplace(image.texture, std::move(moved)).first;
+	}
+	Entry& entry = *found->second;
+	entry.hash = image.hash;
+	entry.width = image.width;
+	entry.height = image.height;
+	for (const PathKey& key : entry.paths) {
+		m_contentOfPath[key.first] = image.hash;
+	}
+	if (image.known) {
+		m_stats.pixelHits++;
+	} else {
+		m_stats.decodes++;
+	}
+
+	// The first texture of a content is the one shared with the next paths.
+	// Same content loaded at the same time under another path: an immutable
+	// texture is dropped once uploaded (onLoaded), a mutable one is kept
+	const ContentKey content(image.hash, entry.variant);
+	auto shared = m_byContent.find(content);
+	if (shared == m_byContent.end()) {
+		m_byContent.emplace(content, &entry);
+		updateKnown(image.hash, entry.variant & Flipped);
+	} else if (entry.variant & Immutable) {
+		merge(entry, *shared->second);
+	}
+	insertPixels(ContentKey(image.hash, entry.variant & Flipped), image);
+}
+
+bool TextureCache::onKnown(GLuint texture, std::uint64_t hash, TextureLoader::KnownContent& content)
+{
+	auto found = m_entries.find(texture);
+	if (found == m_entries.end()) {
+		return false;
+	}
+	Entry& entry = *found->second;
+	for (const PathKey& key : entry.paths) {
+		m_contentOfPath[key.first] = hash;
+	}
+
+	// Loaded texture of the same image
+	auto shared = m_byContent.find(ContentKey(hash, entry.variant));
+	if (shared != m_byContent.end())
+	{
+		Entry& source = *shared->second;
+		if (entry.variant & Immutable)
+		{
+			// Replaced by the texture loaded (the loader deletes the placeholder)
+			merge(entry, source);
+			m_entries.erase(found);
+			content.texture = source.texture;
+			return true;
+		}
+		// The caller keeps the texture returned by acquire: copy on the GPU,
+		// mipmaps included (both textures must be complete)
+		int levels = 1;
+		if (entry.variant & Mipmapped) {
+			while ((std::max(source.width, source.height) >> levels) > 0) {
+				levels++;
+			}
+		}
+		glBindTexture(GL_TEXTURE_2D, entry.texture);
+		for (int level = 0; level < levels; ++level) {
+			glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, std::max(source.width >> level, 1), std::max(source.height >> level, 1), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		for (int level = 0; level < levels; ++level) {
+			glCopyImageSubData(source.texture, GL_TEXTURE_2D, level, 0, 0, 0, entry.texture, GL_TEXTURE_2D, level, 0, 0, 0,
+				std::max(source.width >> level, 1), std::max(source.height >> level, 1), 1);
+		}
+		entry.hash = hash;
+		entry.width = source.width;
+		entry.height = source.height;
+		m_stats.textureHits++;
+		content.texture = entry.texture;
+		return true;
+	}
+
+	// Cached pixels (other mipmaps or storage): uploaded by the loader
+	if (const Pixels* pixels = findPixels(ContentKey(hash, entry.variant & Flipped))) {
+		content.width = pixels->width;
+		content.height = pixels->height;
+		content.pixels = pixels->data.data();
+		return true;
+	}
+	return false;
+}
+
+void TextureCache::updateKnown(std::uint64_t hash, int flipped)
+{
+	// Known: pixels cached, or a texture loaded with this orientation
+	// (variants: flipped + any combination of Mipmapped and Immutable)
+	bool known = m_pixelsByContent.count(ContentKey(hash, flipped)) != 0;
+	for (int variant = flipped; variant <= (Flipped | Mipmapped | Immutable) && !known; variant += 2) {
+		known = m_byContent.count(ContentKey(hash, variant)) != 0;
+	}
+	m_loader.setKnownContent(hash, flipped != 0, known);
+}
+
+void TextureCache::onLoaded(GLuint texture, bool loaded)
+{
+	auto found = m_entries.find(texture);
+	if (found == m_entries.end()) {
+		return;
+	}
+	Entry& entry = *found->second;
+	if (!entry.loading) {
+		return; // Request shared with a loaded texture (onKnown)
+	}
+	entry.loading = false;
+	entry.failed = !loaded;
+	std::vector<TextureLoader::Callback> waiting;
+	waiting.swap(entry.waiting);
+	for (TextureLoader::Callback& callback : waiting) {
+		callback(texture, loaded);
+	}
+	// Released while loading
+	if (entry.refs <= 0) {
+		retire(entry);
+	}
+}
+
+const TextureCache::Pixels* TextureCache::findPixels(const ContentKey& key)
+{
+	auto found = m_pixelsByContent.find(key);
+	if (found == m_pixelsByContent.end()) {
+		return nullptr;
+	}
+	m_pixels.splice(m_pixels.begin(), m_pixels, found->second);
+	return &*found->second;
+}
+
+void TextureCache::insertPixels(const ContentKey& key, const TextureLoader::DecodedImage& image)
+{
+	const std::size_t bytes = std::size_t(image.width) * image.height * 4;
+	if (bytes > m_pixelBudget || m_pixelsByContent.count(key) != 0) {
+		return;
+	}
+	// Evict the least recently used images
+	while (m_cachedBytes + bytes > m_pixelBudget) {
+		const ContentKey last = m_pixels.back().key;
+		m_cachedBytes -= m_pixels.back().data.size();
+		m_pixelsByContent.erase(last);
+		m_pixels.pop_back();
+		updateKnown(last.first, last.second);
+	}
+
+	m_pixels.emplace_front();
+	Pixels& pixels = m_pixels.front();
+	pixels.key = key;
+	pixels.width = image.width;
+	pixels.height = image.height;
+	pixels.data.assign(image.pixels, image.pixels + bytes);
+	m_pixelsByContent[key] = m_pixels.begin();
+	m_cachedBytes += bytes;
+	updateKnown(key.first, key.second);
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "TextureLoader.h"
+
+// Shared textures (reference counted), loaded with a TextureLoader
+//
+// acquire() returns the texture already created for the same image when
+// there is one: same path, or same file content under another path.
+// release() drops a reference. A texture without references is kept
+// (textureBudget, the least recently released deleted first): acquired
+// again, it costs nothing.
+// The decoded pixels are kept in a LRU cache (pixelBudget, keyed by the
+// content of the file): an image acquired again after its texture was
+// deleted is uploaded by the loader (staging, upload budget) without
+// reading nor decoding the file.
+//
+// The content of a new path is only known once its file is read: the
+// loading threads hash it and skip the decode of a content already
+// loaded or cached (TextureLoader::setKnownContent). The request then
+// gets the existing texture if it is immutable (see below), otherwise its
+// own texture copied from it (glCopyImageSubData) or uploaded from the
+// cached pixels.
+//
+// An image is shared whatever the wrap mode and the filters: the texture
+// keeps the parameters of its first request (a sampler object can sample
+// it differently). Only the orientation, the mipmaps and the immutable
+// storage split it. An immutable texture is replaced once loaded: the
+// callbacks get the new one, to use and release instead.
+//
+// Usage:
+// TextureCache textures;
+// GLuint texture = textures.acquire(path); // Placeholder until loaded
+// textures.update(); // Each frame
+// textures.release(texture);
+// textures.destroy(); // Before destroying the context
+class TextureCache
+{
+public:
+	static const std::size_t DefaultPixelBudget = 64 << 20;   // 16 1k RGBA images
+	static const std::size_t DefaultTextureBudget = 32 << 20; // 6 1k RGBA textures with mipmaps
+
+	// Instrumentation (since the creation)
+	struct Stats {
+		unsigned int textureHits = 0; // Existing texture returned (same path or content)
+		unsigned int pixelHits = 0;   // Texture uploaded from the cached pixels (through the loader)
+		unsigned int decodes = 0;     // Images read and decoded
+	};
+
+	// ------------------------------------------------------------------------
+	// pixelBudget: bytes of decoded pixels kept (least recently used evicted)
+	// textureBudget: bytes of textures kept without references
+	explicit TextureCache(std::size_t pixelBudget = DefaultPixelBudget, std::size_t textureBudget = DefaultTextureBudget);
+	~TextureCache() = default;
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// ------------------------------------------------------------------------
+	// texture of the image (one more reference). callback: as TextureLoader,
+	// called right away if the texture is already loaded
+	GLuint acquire(const std::string& path, const TextureSettings& settings = TextureSettings(), TextureLoader::Callback callback = nullptr);
+	// drop a reference (the texture is kept unused after the last one)
+	void release(GLuint texture);
+
+	// ------------------------------------------------------------------------
+	// upload the images decoded (TextureLoader::update)
+	int update() { return m_loader.update(); }
+	// wait for the loads in progress
+	void finish() { m_loader.finish(); }
+
+	// ------------------------------------------------------------------------
+	// delete all the textures (waits for the loads in progress)
+	void destroy();
+
+	const Stats& stats() const { return m_stats; }
+	std::size_t numTextures() const { return m_entries.size(); }
+	std::size_t cachedBytes() const { return m_cachedBytes; }
+	std::size_t unusedBytes() const { return m_unusedBytes; }
+	TextureLoader& loader() { return m_loader; }
+
+private:
+	// Image: file (path or content hash) and variant (orientation, mipmaps)
+	enum Variant { Flipped = 1, Mipmapped = 2, Immutable = 4 };
+	using PathKey = std::pair<std::string, int>;
+	using ContentKey = std::pair<std::uint64_t, int>;
+
+	struct Entry {
+		GLuint texture = 0;
+		int refs = 0;
+		bool loading = false;
+		bool failed = false; // Placeholder kept
+		int variant = 0;
+		std::uint64_t hash = 0; // Known once decoded
+		int width = 0;
+		int height = 0;
+		std::vector<PathKey> paths; // Paths of the image
+		std::vector<TextureLoader::Callback> waiting; // Requests before the end of the load
+		bool unused = false; // No references (in m_unused)
+		std::list<Entry*>::iterator unusedPosition;
+	};
+
+	// Decoded pixels (RGBA, key: content and orientation)
+	struct Pixels {
+		ContentKey key;
+		int width = 0;
+		int height = 0;
+		std::vector<unsigned char> data;
+	};
+
+	static int variantOf(const TextureSettings& settings);
+	Entry& addEntry(GLuint texture, const PathKey& key);
+	void addPath(Entry& entry, const PathKey& key);
+	void erase(Entry& entry);
+	// Last reference dropped: kept unused (within the budget) or erased
+	void retire(Entry& entry);
+	// Referenced again: out of the unused textures
+	void reuse(Entry& entry);
+	// Memory of the texture (mipmaps included)
+	static std::size_t bytesOf(const Entry& entry);
+	// Move the paths, references and waiting requests of entry (being
+	// loaded) to shared (loaded, same image)
+	void merge(Entry& entry, Entry& shared);
+	// Loader callbacks (OpenGL thread)
+	void onDecoded(GLuint texture, const TextureLoader::DecodedImage& image);
+	void onLoaded(GLuint texture, bool loaded);
+	bool onKnown(GLuint texture, std::uint64_t hash, TextureLoader::KnownContent& content);
+	// Tell the loader if the content is loaded or cached (per orientation)
+	void updateKnown(std::uint64_t hash, int flipped);
+	// Cached pixels (moved to the front of the LRU list), nullptr if evicted
+	const Pixels* findPixels(const ContentKey& key);
+	void insertPixels(const ContentKey& key, const TextureLoader::DecodedImage& image);
+
+private:
+	TextureLoader m_loader;
+
+	// Entries (by texture), and the lookups of an image
+	std::unordered_map<GLuint, std::unique_ptr<Entry>> m_entries;
+	std::map<PathKey, Entry*> m_byPath;
+	std::map<ContentKey, Entry*> m_byContent; // Loaded entries
+	std::unordered_map<std::string, std::uint64_t> m_contentOfPath; // Hashes already computed
+
+	// Textures without references, most recently released first
+	std::list<Entry*> m_unused;
+	std::size_t m_textureBudget;
+	std::size_t m_unusedBytes = 0;
+
+	// Decoded pixels, most recently used first
+	std::list<Pixels> m_pixels;
+	std::map<ContentKey, std::list<Pixels>::iterator> m_pixelsByContent;
+	std::size_t m_pixelBudget;
+	std::size_t m_cachedBytes = 0;
+
+	Stats m_stats;
+};
@@ -0,0 +1,392 @@
+#include "TextureLoader.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+	bool usesMipmaps(GLint minFilter)
+	{
+		return minFilter != GL_NEAREST && minFilter != GL_LINEAR;
+	}
+
+	// FNV-1a (64 bits)
+	std::uint64_t hashBytes(const std::vector<unsigned char>& bytes)
+	{
+		std::uint64_t hash = 14695981039346656037ull;
+		for (unsigned char byte : bytes) {
+			hash = (hash ^ byte) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	bool readFile(const std::string& path, std::vector<unsigned char>& bytes)
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file) {
+			return false;
+		}
+		bytes.resize(std::size_t(file.tellg()));
+		file.seekg(0);
+		return bool(file.read(reinterpret_cast<char*>(bytes.data()), std::streamsize(bytes.size())));
+	}
+
+	// Levels of the immutable storage (full chain with mipmaps)
+	GLsizei numLevels(int width, int height, GLint minFilter)
+	{
+		GLsizei levels = 1;
+		if (usesMipmaps(minFilter)) {
+			while ((std::max(width, height) >> levels) > 0) {
+				levels++;
+			}
+		}
+		return levels;
+	}
+
+	void setParameters(const TextureLoader::Settings& settings)
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, settings.wrap);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, settings.wrap);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, settings.minFilter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, settings.magFilter);
+	}
+
+	void setParameters(GLuint texture, const TextureLoader::Settings& settings)
+	{
+		glTextureParameteri(texture, GL_TEXTURE_WRAP_S, settings.wrap);
+		glTextureParameteri(texture, GL_TEXTURE_WRAP_T, settings.wrap);
+		glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, settings.minFilter);
+		glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, settings.magFilter);
+	}
+}
+
+TextureLoader::Image::~Image()
+{
+	if (pixels != nullptr) {
+		stbi_image_free(pixels);
+	}
+}
+
+TextureLoader::TextureLoader(unsigned int numThreads, std::size_t uploadBudget) :
+	m_uploadBudget(std::max<std::size_t>(uploadBudget, 4))
+{
+	if (numThreads == 0) {
+		const unsigned int cores = std::thread::hardware_concurrency();
+		numThreads = std::min(cores > 1 ? cores - 1 : 1u, 4u);
+	}
+	for (unsigned int i = 0; i < numThreads; ++i) {
+		m_threads.emplace_back(&TextureLoader::workerLoop, this);
+	}
+}
+
+TextureLoader::~TextureLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wakeUp.notify_all();
+	for (std::thread& thread : m_threads) {
+		thread.join();
+	}
+	for (Image* image : m_requests) {
+		delete image;
+	}
+	Image* image = m_decoded.exchange(nullptr, std::memory_order_acquire);
+	while (image != nullptr) {
+		Image* next = image->next;
+		delete image;
+		image = next;
+	}
+	release();
+}
+
+GLuint TextureLoader::createTexture(const unsigned char* pixels, int width, int height, const Settings& settings)
+{
+	GLuint texture = 0;
+	if (settings.immutable)
+	{
+		glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+		glTextureStorage2D(texture, numLevels(width, height, settings.minFilter), GL_RGBA8, width, height);
+		glTextureSubImage2D(texture, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		if (usesMipmaps(settings.minFilter)) {
+			glGenerateTextureMipmap(texture);
+		}
+		setParameters(texture, settings);
+		return texture;
+	}
+
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	if (usesMipmaps(settings.minFilter)) {
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+	setParameters(settings);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
+
+GLuint TextureLoader::createPlaceholder(const glm::u8vec4& color, const Settings& settings)
+{
+	return createTexture(&color[0], 1, 1, settings);
+}
+
+std::unique_ptr<TextureLoader::Image> TextureLoader::createRequest(const std::string& path, const Settings& settings, Callback callback)
+{
+	// Same texture object once loaded (respecified by glTexImage2D), except
+	// with immutable storage
+	std::unique_ptr<Image> image = std::make_unique<Image>();
+	image->texture = createPlaceholder(settings.placeholder, settings);
+	image->path = path;
+	image->settings = settings;
+	image->callback = std::move(callback);
+	return image;
+}
+
+GLuint TextureLoader::load(const std::string& path, const Settings& settings, Callback callback)
+{
+	std::unique_ptr<Image> image = createRequest(path, settings, std::move(callback));
+	const GLuint texture = image->texture;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_requests.push_back(image.release());
+	}
+	m_wakeUp.notify_one();
+	m_pending++;
+	return texture;
+}
+
+GLuint TextureLoader::loadKnown(const std::string& path, std::uint64_t hash, const Settings& settings, Callback callback)
+{
+	// Straight to the uploads (staging and budget of update())
+	std::unique_ptr<Image> image = createRequest(path, settings, std::move(callback));
+	image->hash = hash;
+	image->known = true;
+	const GLuint texture = image->texture;
+	m_ready.push_back(std::move(image));
+	m_pending++;
+	return texture;
+}
+
+void TextureLoader::setKnownContent(std::uint64_t hash, bool flipVertically, bool known)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (known) {
+		m_knownContents.emplace(hash, flipVertically);
+	} else {
+		m_knownContents.erase(std::make_pair(hash, flipVertically));
+	}
+}
+
+void TextureLoader::workerLoop()
+{
+	for (;;)
+	{
+		Image* image = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wakeUp.wait(lock, [this]() { return m_stop || !m_requests.empty(); });
+			if (m_stop) {
+				return;
+			}
+			image = m_requests.front();
+			m_requests.pop_front();
+		}
+
+		// The file is hashed (content of the image) then decoded from memory,
+		// unless the content is known. The flip setting of stb_image is per
+		// thread here
+		std::vector<unsigned char> bytes;
+		if (readFile(image->path, bytes) && !bytes.empty()) {
+			image->hash = hashBytes(bytes);
+			if (!image->decode) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				image->known = m_knownContents.count(std::make_pair(image->hash, image->settings.flipVertically)) != 0;
+			}
+			if (!image->known) {
+				int components = 0;
+				stbi_set_flip_vertically_on_load_thread(image->settings.flipVertically ? 1 : 0);
+				image->pixels = stbi_load_from_memory(bytes.data(), int(bytes.size()), &image->width, &image->height, &components, STBI_rgb_alpha);
+			}
+		}
+
+		// Push on the decoded list (compare_exchange updates image->next on failure)
+		image->next = m_decoded.load(std::memory_order_relaxed);
+		while (!m_decoded.compare_exchange_weak(image->next, image, std::memory_order_release, std::memory_order_relaxed)) {
+		}
+	}
+}
+
+int TextureLoader::update()
+{
+	const auto start = std::chrono::high_resolution_clock::now();
+
+	// Take all the decoded images, back in decoding order
+	Image* image = m_decoded.exchange(nullptr, std::memory_order_acquire);
+	Image* reversed = nullptr;
+	while (image != nullptr) {
+		Image* next = image->next;
+		image->next = reversed;
+		reversed = image;
+		image = next;
+	}
+	while (reversed != nullptr) {
+		Image* next = reversed->next;
+		m_ready.emplace_back(reversed);
+		reversed = next;
+	}
+
+	int finished = 0;
+	std::size_t used = 0; // Bytes uploaded by this call
+	while (!m_ready.empty())
+	{
+		Image& ready = *m_ready.front();
+		GLuint texture = ready.texture;
+		const unsigned char* pixels = ready.pixels;
+		if (ready.known)
+		{
+			KnownContent content;
+			if (!m_knownCallback || !m_knownCallback(ready.texture, ready.hash, content))
+			{
+				// No longer available: back to the loading threads
+				ready.known = false;
+				ready.decode = true;
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_requests.push_back(m_ready.front().release());
+				}
+				m_wakeUp.notify_one();
+				m_ready.pop_front();
+				continue;
+			}
+			if (content.texture != 0) {
+				// Already holding the image: nothing to upload
+				if (content.texture != ready.texture) {
+					glDeleteTextures(1, &ready.texture);
+				}
+				texture = content.texture;
+			} else {
+				ready.width = content.width;
+				ready.height = content.height;
+				pixels = content.pixels;
+			}
+		}
+
+		if (pixels != nullptr)
+		{
+			const std::size_t bytes = std::size_t(ready.width) * ready.height * 4;
+			if (used > 0 && used + bytes > m_uploadBudget) {
+				break; // Next frame
+			}
+			texture = upload(ready, pixels, used);
+			used += bytes;
+			std::cout << "Texture loaded at path: " << ready.path << std::endl;
+			if (m_decodedCallback) {
+				m_decodedCallback(ready.texture, DecodedImage{ ready.width, ready.height, pixels, ready.hash, texture, ready.known });
+			}
+		}
+		else if (!ready.known)
+		{
+			std::cout << "Texture failed to load at path: " << ready.path << std::endl;
+		}
+		if (ready.callback) {
+			ready.callback(texture, pixels != nullptr || ready.known);
+		}
+		m_ready.pop_front();
+		m_pending--;
+		finished++;
+	}
+	if (used > 0 && m_staging.bufferId() != 0) {
+		m_staging.fence(); // The region is read by the uploads of this call
+	}
+	// No request left: the staging is freed (created again by the next upload).
+	// The uploads queued keep reading it, OpenGL deletes it after them
+	if (m_pending == 0) {
+		release();
+	}
+
+	const std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+	m_lastUpdateTime = elapsed.count();
+	return finished;
+}
+
+GLuint TextureLoader::upload(const Image& image, const unsigned char* pixels, std::size_t offset)
+{
+	const std::size_t bytes = std::size_t(image.width) * image.height * 4;
+	if (m_staging.bufferId() == 0 && m_pbo == 0)
+	{
+		// Persistent mapped staging (one region per update) when available
+		if (!GLAD_GL_VERSION_4_4 || !m_staging.create(m_uploadBudget)) {
+			glGenBuffers(1, &m_pbo);
+		}
+	}
+
+	const void* source = pixels;
+	if (m_staging.bufferId() != 0 && bytes <= m_staging.regionSize())
+	{
+		// offset + bytes fits: only the first image of an update can exceed the budget
+		if (offset == 0) {
+			m_staging.nextRegion();
+		}
+		std::memcpy(static_cast<unsigned char*>(m_staging.currentPointer()) + offset, pixels, bytes);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_staging.bufferId());
+		source = reinterpret_cast<const void*>(m_staging.currentOffset() + offset);
+	}
+	else if (m_pbo != 0)
+	{
+		// New storage for each upload (orphaning): no wait on the previous one
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, GLsizeiptr(bytes), nullptr, GL_STREAM_DRAW);
+		void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, GLsizeiptr(bytes), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (mapped != nullptr) {
+			std::memcpy(mapped, pixels, bytes);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			source = nullptr;
+		} else {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+	}
+	// else: larger than a staging region, from the client memory
+
+	if (image.settings.immutable)
+	{
+		// The storage of the placeholder cannot change: new texture
+		const GLuint texture = createTexture(static_cast<const unsigned char*>(source), image.width, image.height, image.settings);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glDeleteTextures(1, &image.texture);
+		return texture;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, image.texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, source);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (usesMipmaps(image.settings.minFilter)) {
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return image.texture;
+}
+
+void TextureLoader::finish()
+{
+	while (m_pending > 0) {
+		if (update() == 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+}
+
+void TextureLoader::release()
+{
+	m_staging.destroy();
+	if (m_pbo != 0) {
+		glDeleteBuffers(1, &m_pbo);
+		m_pbo = 0;
+	}
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "StreamingBuffer.h"
+
+// Parameters of a texture loaded by TextureLoader
+struct TextureSettings {
+	GLint wrap = GL_REPEAT;
+	GLint minFilter = GL_LINEAR_MIPMAP_LINEAR; // Mipmaps generated when used
+	GLint magFilter = GL_LINEAR;
+	// glTexImage2D starts with the bottom row, stb_image with the top one
+	bool flipVertically = true;
+	// Immutable storage (glTextureStorage2D, OpenGL 4.5): the image is
+	// uploaded in a new texture that replaces the placeholder (deleted),
+	// given to the callbacks
+	bool immutable = false;
+	// Color of the texture until it is loaded (and if it fails)
+	glm::u8vec4 placeholder = glm::u8vec4(128, 128, 128, 255);
+};
+
+// Asynchronous texture loading
+//
+// load() returns a texture immediately: a 1x1 placeholder until its image
+// is decoded (stb_image) by the loading threads. The decoded images are
+// handed to the OpenGL thread through a lock-free list, then update()
+// (once per frame) uploads them through a pixel unpack buffer: persistent
+// mapped (StreamingBuffer, OpenGL 4.4) or orphaned at each upload, freed
+// once all the requests are finished.
+// Each update() uploads at most uploadBudget bytes (at least one image),
+// so the first frame does not wait for the textures and a burst of
+// images is spread over a few frames.
+// The loading threads hash each file before decoding it: a content marked
+// as known (setKnownContent, e.g. already cached by the caller) is not
+// decoded, update() asks the known callback for its texture or pixels.
+//
+// Usage:
+// TextureLoader loader;
+// GLuint texture = loader.load(path); // Placeholder, usable right away
+// loader.update(); // Each frame
+// loader.release(); // Before destroying the context
+//
+// Except the loading threads, everything happens on the OpenGL thread
+// (load, update, finish, release and the callbacks).
+class TextureLoader
+{
+public:
+	using Settings = TextureSettings;
+	// Called by update() once the image is uploaded (loaded) or could not
+	// be decoded (the placeholder stays). texture: the one returned by
+	// load(), or the new texture of an immutable image
+	using Callback = std::function<void(GLuint texture, bool loaded)>;
+	// Image given to the decoded callback (before its pixels are freed)
+	struct DecodedImage {
+		int width;
+		int height;
+		const unsigned char* pixels; // RGBA
+		std::uint64_t hash;          // Content of the file (FNV-1a)
+		GLuint texture;              // Texture of the image (new one if immutable)
+		bool known;                  // Pixels given by the known callback (not decoded)
+	};
+	using DecodedCallback = std::function<void(GLuint texture, const DecodedImage& image)>;
+	// Image of a known content, given by the known callback: a texture
+	// already holding it (nothing uploaded: the placeholder filled by the
+	// callback, or another texture that replaces it), or its pixels
+	// (uploaded right after the call)
+	struct KnownContent {
+		GLuint texture = 0;
+		int width = 0;
+		int height = 0;
+		const unsigned char* pixels = nullptr; // RGBA
+	};
+	// texture: the one returned by load(). false if the content is not
+	// available anymore: the file is decoded
+	using KnownCallback = std::function<bool(GLuint texture, std::uint64_t hash, KnownContent& content)>;
+
+	static const std::size_t DefaultUploadBudget = 8 << 20; // Two 1k RGBA images per frame
+
+	// ------------------------------------------------------------------------
+	// numThreads: loading threads (0: one per core minus the OpenGL thread,
+	// at most 4). uploadBudget: bytes uploaded per update()
+	explicit TextureLoader(unsigned int numThreads = 0, std::size_t uploadBudget = DefaultUploadBudget);
+	~TextureLoader();
+
+	TextureLoader(const TextureLoader&) = delete;
+	TextureLoader& operator=(const TextureLoader&) = delete;
+
+	// ------------------------------------------------------------------------
+	// new texture (placeholder) whose image is loaded in background
+	GLuint load(const std::string& path, const Settings& settings = Settings(), Callback callback = nullptr);
+	// same for a file whose content is known (hash): not read, the known
+	// callback gives its image at the next update() (decoded if it cannot)
+	GLuint loadKnown(const std::string& path, std::uint64_t hash, const Settings& settings = Settings(), Callback callback = nullptr);
+
+	// ------------------------------------------------------------------------
+	// upload the images decoded since the last call (within the budget)
+	// return the number of requests finished
+	int update();
+	// update until all the requests are finished (blocking)
+	void finish();
+
+	// ------------------------------------------------------------------------
+	// free the staging buffer (the requests in progress are kept)
+	void release();
+
+	// Called by update() for each image uploaded (before its callback),
+	// with the texture returned by load()
+	void setDecodedCallback(DecodedCallback callback) { m_decodedCallback = std::move(callback); }
+	// Called by update() for each image of a known content (decode skipped)
+	void setKnownCallback(KnownCallback callback) { m_knownCallback = std::move(callback); }
+	// Content (hash of the file, orientation) the known callback can give,
+	// checked by the loading threads (thread safe)
+	void setKnownContent(std::uint64_t hash, bool flipVertically, bool known);
+
+	// Texture of RGBA pixels (uploaded now, mipmaps if the settings use them)
+	// pixels: offset in the pixel unpack buffer if one is bound
+	static GLuint createTexture(const unsigned char* pixels, int width, int height, const Settings& settings = Settings());
+	// 1x1 texture of a color (with the parameters of settings)
+	static GLuint createPlaceholder(const glm::u8vec4& color, const Settings& settings = Settings());
+
+	// Requests not finished yet
+	std::size_t pending() const { return m_pending; }
+	unsigned int numThreads() const { return unsigned(m_threads.size()); }
+	// Instrumentation: time spent in the last update (ms, uploads and mipmaps)
+	float lastUpdateTime() const { return m_lastUpdateTime; }
+
+private:
+	// A request: decoded by a loading thread, then uploaded by update()
+	struct Image {
+		GLuint texture = 0;
+		std::string path;
+		Settings settings;
+		Callback callback;
+		int width = 0;
+		int height = 0;
+		unsigned char* pixels = nullptr; // RGBA (stb_image), nullptr if it failed
+		std::uint64_t hash = 0;
+		bool known = false;  // Decode skipped (known content)
+		bool decode = false; // Decoded even if known (no longer available)
+		Image* next = nullptr; // Lock-free list of the decoded images
+
+		~Image();
+	};
+
+	// Request with its placeholder texture
+	static std::unique_ptr<Image> createRequest(const std::string& path, const Settings& settings, Callback callback);
+	void workerLoop();
+	// glTexImage2D of the pixels of the image (width x height, RGBA)
+	// offset: bytes already used in the staging region
+	// return the texture of the image (a new one if immutable)
+	GLuint upload(const Image& image, const unsigned char* pixels, std::size_t offset);
+
+private:
+	// Requests waiting for a loading thread
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::condition_variable m_wakeUp;
+	std::deque<Image*> m_requests;
+	std::set<std::pair<std::uint64_t, bool>> m_knownContents; // Hash and orientation
+	bool m_stop = false;
+
+	// Decoded images: pushed by the loading threads, taken all at once by
+	// update() (no lock, last pushed first)
+	std::atomic<Image*> m_decoded{ nullptr };
+	// Decoded images waiting for their upload (decoding order)
+	std::deque<std::unique_ptr<Image>> m_ready;
+	std::size_t m_pending = 0;
+	DecodedCallback m_decodedCallback;
+	KnownCallback m_knownCallback;
+
+	// Staging of the uploads (created at the first upload, freed when no
+	// request is left)
+	std::size_t m_uploadBudget;
+	StreamingBuffer m_staging; // OpenGL 4.4
+	GLuint m_pbo = 0;          // Otherwise
+	float m_lastUpdateTime = 0.0f;
+};